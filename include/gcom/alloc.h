@@ -59,6 +59,63 @@ BEGIN_INTERFACE( IMalloc )
    void		(*HeapMinimize)( IMalloc * );
 END_INTERFACE( IMalloc )
 
+/************************************************************************/
+/* IMallocSpy definitions						*/
+/************************************************************************/
+
+/*
+DECLARE_IID(
+	    IMallocSpy,
+	    0x0000001D,
+	    0x0000, 0x0000, 0xC000,
+	    0x00, 0x00, 0x00, 0x00, 0x00, 0x46
+	   )
+*/
+
+extern REFIID IID_IMallocSpy;
+
+BEGIN_INTERFACE( IMallocSpy )
+   uint32	(*PreAlloc)( IMallocSpy *, uint32 );
+   void *	(*PostAlloc)( IMallocSpy *, void * );
+   void *	(*PreFree)( IMallocSpy *, void *, Bool );
+   void		(*PostFree)( IMallocSpy *, Bool );
+   uint32	(*PreRealloc)( IMallocSpy *, void *, uint32, void **, Bool );
+   void *	(*PostRealloc)( IMallocSpy *, void *, Bool );
+   void *	(*PreGetSize)( IMallocSpy *, void *, Bool );
+   uint32	(*PostGetSize)( IMallocSpy *, uint32, Bool );
+   void *	(*PreDidAlloc)( IMallocSpy *, void *, Bool );
+   int		(*PostDidAlloc)( IMallocSpy *, void *, Bool, int );
+   void		(*PreHeapMinimize)( IMallocSpy * );
+   void		(*PostHeapMinimize)( IMallocSpy * );
+END_INTERFACE( IMallocSpy )
+
+/************************************************************************/
+/* IMemoryPressure definitions -- GCOM specific				*/
+/************************************************************************/
+
+/*
+DECLARE_IID(
+	    IMemoryPressure,
+	    0x5B0E7C21,
+	    0x3A4D, 0x4F86, 0x9C1B,
+	    0x2E, 0x60, 0xD8, 0x47, 0xA3, 0x15
+	   )
+*/
+
+extern REFIID IID_IMemoryPressure;
+
+enum MEMPRESSURE
+{
+   MEMPRESSURE_LOW		= 1,	/* Trim caches if convenient */
+   MEMPRESSURE_MODERATE		= 2,	/* Release whatever can be rebuilt */
+   MEMPRESSURE_CRITICAL		= 3,	/* Release everything possible */
+};
+typedef enum MEMPRESSURE MEMPRESSURE;
+
+BEGIN_INTERFACE( IMemoryPressure )
+   void		(*OnMemoryPressure)( IMemoryPressure *, MEMPRESSURE );
+END_INTERFACE( IMemoryPressure )
+
 enum MEMCTX
 {
    MEMCTX_TASK 		= 1,
@@ -69,9 +126,57 @@ enum MEMCTX
 };
 typedef enum MEMCTX MEMCTX;
 
+/* Per-NUMA node statistics, as reported by gCoTaskMemGetNodeStats() */
+
+struct TASKMEMNODESTATS
+{
+   uint64	cbMapped;
+   uint64	cbCached;
+   uint64	cNodeAllocs;
+};
+typedef struct TASKMEMNODESTATS TASKMEMNODESTATS;
+
+/* Per-component statistics, as reported by gCoDLLGetMemoryStats() */
+
+struct TASKMEMCOMPONENTSTATS
+{
+   uint64	cbLive;
+   uint64	cbPeak;
+   uint64	cbBudget;
+};
+typedef struct TASKMEMCOMPONENTSTATS TASKMEMCOMPONENTSTATS;
+
+/* Handles to MEMCTX_SHARED blocks, valid in every process sharing them */
+
+typedef uint64 HSHAREDMEM;
+
 HRESULT	CoGetMalloc( MEMCTX, IMalloc ** );
 void *	CoTaskMemAlloc( uint32 );
+void *	CoTaskMemAllocAligned( uint32, uint32 );
+void *	CoTaskMemAllocOnNode( uint32, uint32 );
 void *	CoTaskMemRealloc( void *, uint32 );
 void	CoTaskMemFree( void * );
+HRESULT	gCoCreateArenaMalloc( IMalloc ** );
+HRESULT	CoRegisterMalloc( IMalloc * );
+Bool	gCoTaskMemIsBuiltin( void );
+HRESULT	CoRegisterMallocSpy( IMallocSpy * );
+HRESULT	CoRevokeMallocSpy( void );
+uint64	gCoTaskMemMinimize( void );
+HRESULT	gCoTaskMemSetTrimInterval( uint32 );
+HRESULT	gCoHeapProfileStart( uint32 );
+void	gCoHeapProfileStop( void );
+HRESULT	gCoHeapProfileDump( int );
+uint32	gCoTaskMemGetNodeCount( void );
+HRESULT	gCoTaskMemGetNodeStats( uint32, TASKMEMNODESTATS * );
+HRESULT	gCoRegisterMemoryPressure( IUnknown *, uint32f * );
+HRESULT	gCoRevokeMemoryPressure( uint32 );
+HRESULT	gCoMemoryPressureStart( void );
+void	gCoMemoryPressureStop( void );
+uint64	gCoMemoryPressureNotify( MEMPRESSURE );
+
+int		gCoSharedMemGetFD( void );
+HRESULT		gCoSharedMemAttach( int );
+HSHAREDMEM	gCoSharedMemToHandle( void * );
+void *		gCoSharedMemFromHandle( HSHAREDMEM );
 
 #endif
@@ -127,7 +127,7 @@ struct MULTI_QI
  * the most efficient way of returning the results of CoRegisterClassObject().
  * So we define a new return type, just for those functions.
  */
-typedef uint32 GCOMREGTOKEN;
+typedef uint32f GCOMREGTOKEN;
 
 /**** PROTOTYPES ****/
 
@@ -32,23 +32,32 @@ freely, subject to the following restrictions:
  */
 
 #include <gcom/types.h>
+#include <gcom/alloc.h>
 #include <dlfcn.h>
 
 /************************************************************************/
 /* Dynamic Link Library Definitions					*/
 /************************************************************************/
 
-typedef uint32 HDLL;	
+typedef uintptr HDLL;	/* Really a pointer to the loader's record */
 
 HRESULT	gCoLoadDLL( wchar *, HDLL * );
+HRESULT	gCoLoadDLLUTF8( const char *, HDLL * );
 HRESULT gCoUnloadDLL( HDLL );
 HRESULT gCoGCOMDLLInit( HDLL );
 void	gCoGCOMDLLExpunge( HDLL );
 
 HRESULT gCoGetDLLSymbol( HDLL, wchar *, void ** );
+HRESULT gCoGetDLLSymbolUTF8( HDLL, const char *, void ** );
 HRESULT gCoDLLGetClassObject( HDLL, REFCLSID, REFIID, void ** );
 HRESULT gCoDLLCanUnloadNow( HDLL );
 
+HDLL	gCoDLLFromAddress( void * );
+uint32	gCoDLLEnter( HDLL );
+void	gCoDLLLeave( uint32 );
+HRESULT	gCoDLLGetMemoryStats( HDLL, TASKMEMCOMPONENTSTATS * );
+HRESULT	gCoDLLSetMemoryBudget( HDLL, uint64, IMemoryPressure * );
+
 void CoFreeUnusedLibraries( void );
 
 #endif
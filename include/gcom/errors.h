@@ -37,7 +37,7 @@ freely, subject to the following restrictions:
 /* Error Definitions							*/
 /************************************************************************/
 
-typedef uint32 HRESULT;
+typedef uint32f HRESULT;
 
 #define FACILITY_NULL		(0)
 #define FACILITY_RPC		(1)
@@ -77,11 +77,13 @@ typedef uint32 HRESULT;
 #define E_WRITEREGDB	MAKE_HRESULT( SEVERITY_ERROR, FACILITY_NULL, 0x04 )
 #define E_DLLNOTFOUND	MAKE_HRESULT( SEVERITY_ERROR, FACILITY_NULL, 0x05 )
 #define E_SYMBOLNOTFOUND MAKE_HRESULT( SEVERITY_ERROR, FACILITY_NULL, 0x06 )
+#define E_NOTSUPPORTED	MAKE_HRESULT( SEVERITY_ERROR, FACILITY_NULL, 0x07 )
 
 #define E_NOAGGREGATION	MAKE_HRESULT( SEVERITY_ERROR, FACILITY_NULL, 0x10 )
 #define E_CLASSNOTREG	MAKE_HRESULT( SEVERITY_ERROR, FACILITY_NULL, 0x11 )
 #define E_OBJISREG	MAKE_HRESULT( SEVERITY_ERROR, FACILITY_NULL, 0x12 )
 #define E_NOINTERFACE	MAKE_HRESULT( SEVERITY_ERROR, FACILITY_NULL, 0x13 )
+#define E_OBJNOTREG	MAKE_HRESULT( SEVERITY_ERROR, FACILITY_NULL, 0x14 )
 
 /* Amiga Specific Errors */
 
@@ -99,6 +101,7 @@ typedef uint32 HRESULT;
 #define CO_S_NOTALLINTERFACES		S_NOTALLINTERFACES
 #define REGDB_E_CLASSNOTREG		E_CLASSNOTREG
 #define CO_E_OBJISREG			E_OBJISREG
+#define CO_E_OBJNOTREG			E_OBJNOTREG
 #define CO_E_CLASSNOTREG		E_CLASSNOTREG
 #define CO_E_READREGDB			E_READREGDB
 #define CO_E_WRITEREGDB			E_WRITEREGDB
@@ -54,7 +54,7 @@ typedef uint32		GCOMVERSION;
 #define MAKE_GCOMVERSION(v,r)	((uint32)((uint16)(v)<<16)|((uint16)(r)))
 
 #define GCOM_CURRENT_VERSION	(0)
-#define GCOM_CURRENT_REVISION	(3)
+#define GCOM_CURRENT_REVISION	(4)
 
 GCOMVERSION	CoBuildVersion( void );
 
@@ -64,5 +64,6 @@ GCOMVERSION	CoBuildVersion( void );
 
 HRESULT		CoInitialize( void * );
 void		CoUninitialize( void );
+void		gCoUninitializeForExit( void );
 
 #endif
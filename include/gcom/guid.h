@@ -31,6 +31,7 @@ freely, subject to the following restrictions:
  * GCOM Release 0.1
  */
 
+#include <string.h>
 #include <gcom/types.h>
 #include <gcom/unicode.h>
 
@@ -44,14 +45,28 @@ freely, subject to the following restrictions:
    typedef struct GUID id;			\
    typedef const id * REF##id ;
 
+/*
+ * A GUID is exactly 16 bytes, with no padding, so it can be compared,
+ * hashed and copied as two 64-bit words.  The ones DECLARE_GUID() makes
+ * are 16-byte aligned as well, for SIMD code.
+ */
+
 struct GUID
 {
-   uint32	Data1;
+   uint32f	Data1;
    uint16	Data2;
    uint16	Data3;
    uint8	Data4[8];
 };
 
+typedef char GCOM_GUID_SIZE_CHECK[ ( sizeof( struct GUID ) == 16 ) ? 1 : -1 ];
+
+#if defined( __GNUC__ )
+#define GCOM_GUID_ALIGN		__attribute__(( aligned( 16 ) ))
+#else
+#define GCOM_GUID_ALIGN
+#endif
+
 GCOM_DECLARE_ID_TYPE( GUID );
 GCOM_DECLARE_ID_TYPE( UUID );
 GCOM_DECLARE_ID_TYPE( IID );
@@ -60,7 +75,7 @@ GCOM_DECLARE_ID_TYPE( CLSID );
 /* This butt-ugly macro allows us to easily create UUIDs in C source. */
 
 #define DECLARE_GUID(name, a,b,c,d,e,f,g,h,i,j)		\
-   static struct GUID ___##name = {			\
+   static struct GUID ___##name GCOM_GUID_ALIGN = {	\
       a, b, c,						\
       {							\
 	 ((d)>>8),					\
@@ -87,8 +102,72 @@ GCOM_DECLARE_ID_TYPE( CLSID );
 #define DECLARE_CLSID(name, a,b,c,d,e,f,g,h,i,j)	\
    DECLARE_GUID( CLSID_##name , a,b,c,d,e,f,g,h,i,j)
 
-Bool IsEqualIID( REFIID, REFIID );
+/*
+ * IsEqualIID() is inline, and checks pointer identity before comparing
+ * contents.  Most IIDs are passed around as the pointers DECLARE_IID()
+ * creates, so when both sides got theirs from the same place, a single
+ * compare settles it.  gCoInternIID() maps any IID to a canonical pointer
+ * to make that the common case:
+ *
+ *	IID_IFoo = gCoInternIID( IID_IFoo );
+ *
+ * The runtime's own IIDs (IID_IUnknown and friends) are already canonical.
+ */
+
+static GCOM_INLINE Bool IsEqualIID( REFIID riid1, REFIID riid2 )
+{
+   uint64 a[2], b[2];
+
+   if( riid1 == riid2 )
+      return TRUE;
+
+   memcpy( a, riid1, sizeof( GUID ) );
+   memcpy( b, riid2, sizeof( GUID ) );
+
+   return ( ( a[0] ^ b[0] ) | ( a[1] ^ b[1] ) ) == 0;
+}
+
+/* GUID versions gCoCreateGuids() and gCoCreateNameGuids() can make */
+
+enum GUIDVERSION
+{
+   GUIDVERSION_TIME		= 1,	/* Timestamp and node ID */
+   GUIDVERSION_MD5		= 3,	/* MD5 hash of namespace and name */
+   GUIDVERSION_RANDOM		= 4,	/* Random */
+   GUIDVERSION_SHA1		= 5,	/* SHA-1 hash of namespace and name */
+   GUIDVERSION_SORTABLE		= 7,	/* Unix time in ms, then random */
+};
+typedef enum GUIDVERSION GUIDVERSION;
+
+/* Well-known namespaces for name-based GUIDs */
+
+extern REFGUID GUID_NAMESPACE_DNS;	/* Fully-qualified domain names */
+extern REFGUID GUID_NAMESPACE_URL;	/* URLs */
+extern REFGUID GUID_NAMESPACE_OID;	/* ISO object identifiers */
+extern REFGUID GUID_NAMESPACE_X500;	/* X.500 distinguished names */
+
+REFIID gCoInternIID( REFIID );
+HRESULT gCoCreateGuid( GUID * );
+HRESULT gCoCreateGuids( GUIDVERSION, GUID *, uint32 );
+HRESULT gCoCreateNameGuid( GUIDVERSION, REFGUID, const void *, uint32, GUID * );
+HRESULT gCoCreateNameGuids( GUIDVERSION, REFGUID, const char **, uint32, GUID * );
 void gCoGUIDToString( REFGUID, wchar * );
 HRESULT gCoStringToGUID( wchar *, GUID * );
+void gCoGUIDToAsciiString( REFGUID, char * );
+HRESULT gCoAsciiStringToGUID( const char *, GUID * );
+void gCoGUIDsToStrings( const GUID *, uint32, wchar * );
+void gCoGUIDsToAsciiStrings( const GUID *, uint32, char * );
+HRESULT gCoStringsToGUIDs( wchar *, uint32, GUID * );
+HRESULT gCoAsciiStringsToGUIDs( const char *, uint32, GUID * );
+
+/*
+ * GUID text is pure ASCII, so it reads the same in UTF-8; these are the
+ * names to use alongside the other UTF-8 interfaces.
+ */
+
+#define gCoGUIDToStringUTF8	gCoGUIDToAsciiString
+#define gCoStringToGUIDUTF8	gCoAsciiStringToGUID
+#define gCoGUIDsToStringsUTF8	gCoGUIDsToAsciiStrings
+#define gCoStringsToGUIDsUTF8	gCoAsciiStringsToGUIDs
 
 #endif
@@ -0,0 +1,314 @@
+/*
+
+Copyright (c) 1999, 2000 Samuel A. Falvo II
+
+This software is provided 'as-is', without any implied or express warranty.
+In no event shall the authors be held liable for damages arising from the
+use this software.
+
+Permission is granted for anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software in a
+   product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+3. This notice may not be removed or altered from any source
+   distribution.
+
+*/
+
+#ifndef GCOM_GUID_HPP
+#define GCOM_GUID_HPP
+
+/*
+ * gcom/guid.hpp
+ * GCOM Release 0.4
+ *
+ * C++17 only.  GUIDs known when the component is compiled, rather than
+ * the run-time globals DECLARE_GUID() makes:
+ *
+ *	constexpr GUID CLSID_Foo = "{2ED6657D-E927-568B-95E1-2665A8AEA6A2}"_guid;
+ *
+ *	GCOM_DECLARE_UUIDOF( IFoo, "{5DF41881-3AED-3515-88A7-2F4A814CF09E}" )
+ *
+ * A malformed literal fails to compile.  Once an interface has its IID
+ * declared, gcom::uuidof<IFoo>() names it, gcom::is_iid<IFoo>( riid )
+ * checks a requested IID against it with two immediate-operand compares,
+ * and gcom::interfaces<> writes QueryInterface() from a list of the
+ * interfaces an object implements, refusing to compile if any two of
+ * them share an IID:
+ *
+ *	class Foo : public IFoo, public IBar
+ *	{
+ *	   ...
+ *	   HRESULT QueryInterface( REFIID riid, void **ppv )
+ *	   {
+ *	      return gcom::interfaces< IFoo, IBar >::query( this, riid, ppv );
+ *	   }
+ *	};
+ */
+
+#if !defined( __cplusplus ) || ( __cplusplus < 201703L )
+#error gcom/guid.hpp requires C++17.
+#endif
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+extern "C"
+{
+#include <gcom/gcom.h>
+}
+
+namespace gcom
+{
+
+/************************************************************************/
+/* GUID literals							*/
+/************************************************************************/
+
+namespace detail
+{
+
+constexpr int HexValue( char c )
+{
+   return ( c >= '0' && c <= '9' ) ? c - '0' :
+	  ( c >= 'A' && c <= 'F' ) ? c - 'A' + 10 :
+	  ( c >= 'a' && c <= 'f' ) ? c - 'a' + 10 :
+	  throw std::invalid_argument( "GUID literal has a bad hex digit" );
+}
+
+constexpr std::uint32_t HexField( const char *psz, std::size_t cDigits )
+{
+   std::uint32_t v = 0;
+
+   for( std::size_t i = 0; i < cDigits; i++ )
+      v = ( v << 4 ) | (std::uint32_t)HexValue( psz[i] );
+
+   return v;
+}
+
+}
+
+/*
+ * Parses a GUID from its usual text form, with or without the braces.
+ * Evaluated in a constant expression, as _guid literals are, a malformed
+ * GUID is a compile-time error; anywhere else it throws
+ * std::invalid_argument.
+ */
+
+constexpr GUID make_guid( const char *psz, std::size_t cb )
+{
+   GUID guid = {};
+
+   if( cb == 38 )
+   {
+      if( psz[0] != '{' || psz[37] != '}' )
+	 throw std::invalid_argument( "GUID literal has mismatched braces" );
+
+      psz++;
+      cb -= 2;
+   }
+
+   if( cb != 36 )
+      throw std::invalid_argument( "GUID literal is the wrong length" );
+
+   if( psz[8] != '-' || psz[13] != '-' || psz[18] != '-' || psz[23] != '-' )
+      throw std::invalid_argument( "GUID literal is missing a dash" );
+
+   guid.Data1 = detail::HexField( &psz[0], 8 );
+   guid.Data2 = (uint16)detail::HexField( &psz[9], 4 );
+   guid.Data3 = (uint16)detail::HexField( &psz[14], 4 );
+   guid.Data4[0] = (uint8)detail::HexField( &psz[19], 2 );
+   guid.Data4[1] = (uint8)detail::HexField( &psz[21], 2 );
+
+   for( std::size_t i = 0; i < 6; i++ )
+      guid.Data4[ 2 + i ] = (uint8)detail::HexField( &psz[ 24 + ( i * 2 ) ], 2 );
+
+   return guid;
+}
+
+template< std::size_t N >
+constexpr GUID make_guid( const char ( &sz )[N] )
+{
+   return make_guid( sz, N - 1 );
+}
+
+inline namespace literals
+{
+
+constexpr GUID operator ""_guid( const char *psz, std::size_t cb )
+{
+   return make_guid( psz, cb );
+}
+
+}
+
+constexpr bool equal_guids( const GUID &a, const GUID &b ) noexcept
+{
+   if( a.Data1 != b.Data1 || a.Data2 != b.Data2 || a.Data3 != b.Data3 )
+      return false;
+
+   for( std::size_t i = 0; i < 8; i++ )
+      if( a.Data4[i] != b.Data4[i] )
+	 return false;
+
+   return true;
+}
+
+/*
+ * The GUID as the two 64-bit words it occupies in memory, which is how
+ * IsEqualIID() compares them.
+ */
+
+constexpr std::uint64_t guid_word( const GUID &guid, int i ) noexcept
+{
+   std::uint64_t w = 0;
+
+#if defined( __BYTE_ORDER__ ) && ( __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__ )
+   if( i == 0 )
+      return ( (std::uint64_t)guid.Data1 << 32 ) |
+	     ( (std::uint64_t)guid.Data2 << 16 ) | guid.Data3;
+
+   for( int j = 0; j < 8; j++ )
+      w = ( w << 8 ) | guid.Data4[j];
+#else
+   if( i == 0 )
+      return (std::uint64_t)guid.Data1 |
+	     ( (std::uint64_t)guid.Data2 << 32 ) |
+	     ( (std::uint64_t)guid.Data3 << 48 );
+
+   for( int j = 7; j >= 0; j-- )
+      w = ( w << 8 ) | guid.Data4[j];
+#endif
+
+   return w;
+}
+
+/************************************************************************/
+/* Interface IDs							*/
+/************************************************************************/
+
+/*
+ * uuidof_traits< I >::value is the IID of interface I.  There's no
+ * default; GCOM_DECLARE_UUIDOF() supplies one per interface, at global
+ * scope, in the header declaring the interface.
+ */
+
+template< class I >
+struct uuidof_traits;
+
+#define GCOM_DECLARE_UUIDOF( i, text )				\
+   template<>							\
+   struct gcom::uuidof_traits< i >				\
+   {								\
+      static constexpr GUID value = gcom::make_guid( text );	\
+   };
+
+template< class I >
+constexpr const GUID &uuidof() noexcept
+{
+   return uuidof_traits< I >::value;
+}
+
+/*
+ * A REFIID for I, for passing to the C API.  Like any address, it isn't
+ * one of the runtime's canonical pointers; see gCoInternIID().
+ */
+
+template< class I >
+constexpr REFIID iidof() noexcept
+{
+   return &uuidof_traits< I >::value;
+}
+
+/*
+ * Is riid the IID of I?  The IID is folded into the code, so this is
+ * two loads and two compares against constants.
+ */
+
+template< class I >
+inline bool is_iid( REFIID riid ) noexcept
+{
+   constexpr std::uint64_t lo = guid_word( uuidof< I >(), 0 );
+   constexpr std::uint64_t hi = guid_word( uuidof< I >(), 1 );
+   std::uint64_t w[2];
+
+   std::memcpy( w, riid, sizeof( w ) );
+   return ( ( w[0] ^ lo ) | ( w[1] ^ hi ) ) == 0;
+}
+
+namespace detail
+{
+
+template< class... I >
+constexpr bool DistinctIIDs()
+{
+   const GUID *apguid[] = { &uuidof< I >()... };
+   constexpr std::size_t c = sizeof...( I );
+
+   for( std::size_t i = 0; i < c; i++ )
+      for( std::size_t j = i + 1; j < c; j++ )
+	 if( equal_guids( *apguid[i], *apguid[j] ) )
+	    return false;
+
+   return true;
+}
+
+}
+
+/*
+ * The interfaces a C++ object implements, first to last.  The object
+ * derives from each of them; the first one stands in for IUnknown, and
+ * holds the reference count.  IUnknown is implied, so it isn't listed.
+ */
+
+template< class First, class... Rest >
+struct interfaces
+{
+   static_assert( detail::DistinctIIDs< IUnknown, First, Rest... >(),
+		  "two interfaces of one object share an IID" );
+
+   template< class Object >
+   static HRESULT query( Object *pObject, REFIID riid, void **ppv ) noexcept
+   {
+      First *pFirst = static_cast< First * >( pObject );
+      void *pv = nullptr;
+
+      if( is_iid< IUnknown >( riid ) || is_iid< First >( riid ) )
+	 pv = pFirst;
+      else
+	 ( void )( ( is_iid< Rest >( riid ) &&
+		     ( pv = static_cast< Rest * >( pObject ), true ) ) || ... );
+
+      *ppv = pv;
+      if( pv == nullptr )
+	 return E_NOINTERFACE;
+
+      pFirst -> lpVtbl -> AddRef( pFirst );
+      return S_OK;
+   }
+};
+
+}
+
+/*
+ * The runtime's own interfaces.  These must agree with the IIDs in
+ * libraries/constants.c.
+ */
+
+GCOM_DECLARE_UUIDOF( IUnknown, "{00000000-0000-0000-C000-000000000046}" )
+GCOM_DECLARE_UUIDOF( IClassFactory, "{00000001-0000-0000-C000-000000000046}" )
+GCOM_DECLARE_UUIDOF( IMalloc, "{00000002-0000-0000-C000-000000000046}" )
+GCOM_DECLARE_UUIDOF( IMallocSpy, "{0000001D-0000-0000-C000-000000000046}" )
+GCOM_DECLARE_UUIDOF( IMemoryPressure, "{5B0E7C21-3A4D-4F86-9C1B-2E60D847A315}" )
+
+#endif
@@ -0,0 +1,211 @@
+/*
+
+Copyright (c) 1999, 2000 Samuel A. Falvo II
+
+This software is provided 'as-is', without any implied or express warranty.
+In no event shall the authors be held liable for damages arising from the
+use this software.
+
+Permission is granted for anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software in a
+   product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+3. This notice may not be removed or altered from any source
+   distribution.
+
+*/
+
+#ifndef GCOM_PMR_HPP
+#define GCOM_PMR_HPP
+
+/*
+ * gcom/pmr.hpp
+ * GCOM Release 0.3
+ *
+ * C++17 only.  Exposes any IMalloc -- the task allocator, an arena from
+ * gCoCreateArenaMalloc(), the shared allocator, or one of a component's
+ * own -- as a std::pmr::memory_resource, so standard containers can
+ * allocate from it:
+ *
+ *	gcom::malloc_resource arena( pArena );
+ *	std::pmr::vector<int> v( &arena );
+ *
+ * There is no extra bookkeeping: blocks come straight from the IMalloc,
+ * and go straight back to it.  Blocks from the task allocator don't even
+ * go through its vtable.
+ */
+
+#if !defined( __cplusplus ) || ( __cplusplus < 201703L )
+#error gcom/pmr.hpp requires C++17.
+#endif
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <memory_resource>
+
+extern "C"
+{
+#include <gcom/gcom.h>
+}
+
+namespace gcom
+{
+
+/************************************************************************/
+/* IMalloc as a std::pmr::memory_resource				*/
+/************************************************************************/
+
+class malloc_resource : public std::pmr::memory_resource
+{
+public:
+   /*
+    * Wraps the given allocator, holding a reference to it for the life
+    * of the resource.  A null pointer means the task allocator, as
+    * returned by CoGetMalloc( MEMCTX_TASK ).
+    */
+
+   explicit malloc_resource( IMalloc *pMalloc = nullptr ) noexcept
+   {
+      IMalloc *pTask = nullptr;
+
+      CoGetMalloc( MEMCTX_TASK, &pTask );
+      if( ( pMalloc == nullptr ) || ( pMalloc == pTask ) )
+      {
+	 m_pMalloc = pTask;
+	 m_task = true;
+	 m_aligned = gCoTaskMemIsBuiltin();
+      }
+      else
+      {
+	 pTask -> lpVtbl -> Release( pTask );
+	 pMalloc -> lpVtbl -> AddRef( pMalloc );
+	 m_pMalloc = pMalloc;
+	 m_task = false;
+	 m_aligned = false;
+      }
+   }
+
+   ~malloc_resource() override
+   {
+      m_pMalloc -> lpVtbl -> Release( m_pMalloc );
+   }
+
+   malloc_resource( const malloc_resource & ) = delete;
+   malloc_resource &operator=( const malloc_resource & ) = delete;
+
+   IMalloc *get() const noexcept
+   {
+      return m_pMalloc;
+   }
+
+protected:
+   /*
+    * IMalloc promises blocks aligned for any type, so stricter alignment
+    * is had by over-allocating, and remembering the block's real start
+    * just in front of the aligned pointer.  The built-in task allocator
+    * can align blocks of its own up to a page; one registered with
+    * CoRegisterMalloc() can't.
+    */
+
+   void *do_allocate( std::size_t cBytes, std::size_t alignment ) override
+   {
+      void *pv;
+
+      if( cBytes == 0 )
+	 cBytes = 1;
+
+      if( cBytes > 0xFFFFFFFFUL - alignment )
+	 throw std::bad_alloc();
+
+      if( alignment <= alignof( std::max_align_t ) )
+	 pv = Alloc( cBytes );
+      else if( m_aligned && ( alignment <= 4096 ) )
+	 pv = CoTaskMemAllocAligned( (uint32)cBytes, (uint32)alignment );
+      else
+      {
+	 void *raw = Alloc( cBytes + alignment );
+
+	 pv = nullptr;
+	 if( raw != nullptr )
+	 {
+	    pv = (void *)( ( (std::uintptr_t)raw + alignment )
+			   & ~(std::uintptr_t)( alignment - 1 ) );
+	    ( (void **)pv )[ -1 ] = raw;
+	 }
+      }
+
+      if( pv == nullptr )
+	 throw std::bad_alloc();
+
+      return pv;
+   }
+
+   void do_deallocate(
+		      void *pv,
+		      std::size_t,
+		      std::size_t alignment
+		     ) override
+   {
+      if( ( alignment > alignof( std::max_align_t ) ) &&
+	  !( m_aligned && ( alignment <= 4096 ) ) )
+	 pv = ( (void **)pv )[ -1 ];
+
+      if( m_task )
+	 CoTaskMemFree( pv );
+      else
+	 m_pMalloc -> lpVtbl -> Free( m_pMalloc, pv );
+   }
+
+   bool do_is_equal( const std::pmr::memory_resource &other ) const
+      noexcept override
+   {
+      const malloc_resource *that =
+	 dynamic_cast< const malloc_resource * >( &other );
+
+      return ( that != nullptr ) && ( that -> m_pMalloc == m_pMalloc );
+   }
+
+private:
+   /*
+    * CoTaskMemAlloc() and CoTaskMemFree() call straight into the built-in
+    * task allocator, skipping its vtable; if the application registered
+    * an allocator of its own, they dispatch to that instead.
+    */
+
+   void *Alloc( std::size_t cBytes )
+   {
+      if( m_task )
+	 return CoTaskMemAlloc( (uint32)cBytes );
+
+      return m_pMalloc -> lpVtbl -> Alloc( m_pMalloc, (uint32)cBytes );
+   }
+
+   IMalloc *	m_pMalloc;
+   bool		m_task;
+   bool		m_aligned;	/* Built-in task allocator */
+};
+
+/*
+ * A process-wide resource for the task allocator, handy as the default
+ * for std::pmr::set_default_resource().  GCOM must stay initialized for
+ * as long as it's in use.
+ */
+
+inline malloc_resource *task_resource() noexcept
+{
+   static malloc_resource resource;
+   return &resource;
+}
+
+}
+
+#endif
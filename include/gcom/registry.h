@@ -42,4 +42,8 @@ HRESULT CoTreatAsClass( REFCLSID, REFCLSID );
 HRESULT CoGetTreatAsClass( REFCLSID, CLSID * );
 HRESULT gCoResolveTreatAsClass( REFCLSID, CLSID * );
 
+HRESULT gCoReadRegistryValueUTF8( const char *, const char *, char ** );
+HRESULT gCoWriteRegistryValueUTF8( const char *, const char *, const char * );
+HRESULT gCoDeleteRegistryValueUTF8( const char *, const char * );
+
 #endif
@@ -55,18 +55,34 @@ typedef unsigned short		uint16;
 typedef unsigned int		uint32;
 typedef unsigned long		uint64;
 
-/* Linux using GNU C/C++ */
+/*
+ * Linux using GNU C/C++.  Widths come from <stdint.h>, so they're right on
+ * 32- and 64-bit targets alike.  Through release 0.3, int32 and uint32
+ * were long, which is 64 bits on LP64 systems; sources that depend on
+ * that may define GCOM_LEGACY_TYPES before including any GCOM header to
+ * keep it.  Everything GCOM itself lays out in memory -- GUIDs, HRESULTs,
+ * wchars -- is declared with fixed widths either way, as is every count or
+ * token GCOM hands back through a pointer (as uint32f, below).
+ */
 
 #elif defined( __LINUX__ ) && defined( __GNUC__ )
-typedef char			int8;
-typedef short			int16;
-typedef long			int32;
-typedef long long		int64;
+#include <stdint.h>
 
-typedef unsigned char		uint8;
-typedef unsigned short		uint16;
+typedef int8_t			int8;
+typedef int16_t			int16;
+typedef int64_t			int64;
+
+typedef uint8_t			uint8;
+typedef uint16_t		uint16;
+typedef uint64_t		uint64;
+
+#if defined( GCOM_LEGACY_TYPES )
+typedef long			int32;
 typedef unsigned long		uint32;
-typedef unsigned long long	uint64;
+#else
+typedef int32_t			int32;
+typedef uint32_t		uint32;
+#endif
 
 /* Haven't a clue; define your specific platform here. */
 
@@ -74,6 +90,32 @@ typedef unsigned long long	uint64;
 #error Define a set of datatypes for your particular platform here.
 #endif
 
+/*
+ * uint32f is exactly 32 bits, even with GCOM_LEGACY_TYPES; GCOM's own
+ * structures use it.  uintptr is an unsigned integer the size of a pointer.
+ */
+
+#if defined( __LINUX__ ) && defined( __GNUC__ )
+typedef uint32_t		uint32f;
+typedef uintptr_t		uintptr;
+#else
+typedef uint32			uint32f;
+typedef unsigned long		uintptr;
+#endif
+
+/*
+ * GCOM_INLINE marks the few functions the headers define, spelled so
+ * that C89 compilers accept it as well as C99 and C++ ones.
+ */
+
+#if defined( __cplusplus ) || ( defined( __STDC_VERSION__ ) && ( __STDC_VERSION__ >= 199901L ) )
+#define GCOM_INLINE		inline
+#elif defined( __GNUC__ )
+#define GCOM_INLINE		__inline__
+#else
+#define GCOM_INLINE
+#endif
+
 /************************************************************************/
 /* Unicode Type Support							*/
 /************************************************************************/
@@ -85,7 +127,7 @@ typedef uint16			Rune;
 #include <wchar.h>
 typedef wchar_t			wchar;
 #else	/* Assume UCS-4 encoding */
-typedef uint32			wchar;
+typedef uint32f			wchar;
 #endif
 
 /************************************************************************/
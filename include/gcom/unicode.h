@@ -41,6 +41,16 @@ freely, subject to the following restrictions:
 HRESULT gCoUnicodeStringToAscii    ( wchar *, char *, uint32 );
 HRESULT gCoAsciiStringToUnicode    ( char *, wchar *, uint32 );
 
+HRESULT gCoUTF8ToUCS4              ( const char *, uint32, wchar *, uint32, uint32f * );
+HRESULT gCoUCS4ToUTF8              ( const wchar *, uint32, char *, uint32, uint32f * );
+HRESULT gCoUTF8ToUTF16             ( const char *, uint32, uint16 *, uint32, uint32f * );
+HRESULT gCoUTF16ToUTF8             ( const uint16 *, uint32, char *, uint32, uint32f * );
+
+HRESULT gCoUnicodeStringToUTF8     ( wchar *, char *, uint32 );
+HRESULT gCoUTF8StringToUnicode     ( const char *, wchar *, uint32 );
+HRESULT gCoUnicodeStringDuplicateAsUTF8( wchar *, char ** );
+HRESULT gCoUTF8StringDuplicateAsUnicode( const char *, wchar ** );
+
 uint32  gCoUnicodeStringLength     ( wchar * );
 uint32  gCoUnicodeStringSizeInBytes( wchar * );
 
@@ -49,4 +59,66 @@ HRESULT gCoUnicodeStringDuplicate  ( wchar *, wchar ** );
 int     gCoUnicodeStringCompare    ( wchar *, wchar * );
 void    gCoUnicodeStringConcatenate( wchar *, wchar * );
 
+/************************************************************************/
+/* Counted Strings							*/
+/************************************************************************/
+
+/*
+ * A GSTRING carries its length, so asking for it never scans the text.
+ * The text is UTF-8 or UCS-4, always followed by a NULL unit, so
+ * gCoStringText() can be handed to functions wanting a plain string.
+ *
+ * Short strings (up to 23 bytes of UTF-8, or 5 characters of UCS-4)
+ * live inside the GSTRING itself, and cost no allocation at all.
+ * Longer ones live in a buffer from the task allocator, which
+ * gCoStringDuplicate() shares rather than copies; a shared buffer is
+ * copied only when one of its strings is changed.
+ *
+ * A GSTRING is a value: declare one, give it text with gCoStringInit()
+ * or one of the functions producing one, and gCoStringFree() it when
+ * done.  Those functions overwrite their result without freeing it.
+ */
+
+enum STRINGENCODING
+{
+   STRINGENCODING_UTF8		= 0,
+   STRINGENCODING_UCS4		= 1,
+};
+typedef enum STRINGENCODING STRINGENCODING;
+
+#define GSTRING_INLINE_SIZE	24
+
+typedef struct GSTRINGBUFFER GSTRINGBUFFER;
+
+struct GSTRING
+{
+   uint32f		cch;		/* Length in units, not counting the NULL */
+   uint16		encoding;	/* A STRINGENCODING */
+   uint16		onHeap;		/* Text is in u.pBuffer, not u.text */
+   union
+   {
+      uint8		text[ GSTRING_INLINE_SIZE ];
+      wchar		align;
+      GSTRINGBUFFER *	pBuffer;
+   } u;
+};
+typedef struct GSTRING GSTRING;
+
+typedef char GCOM_GSTRING_SIZE_CHECK[ ( sizeof( struct GSTRING ) == 32 ) ? 1 : -1 ];
+
+#define gCoStringLength( pstr )		( (pstr) -> cch )
+#define gCoStringEncoding( pstr )	( (STRINGENCODING)(pstr) -> encoding )
+#define gCoStringUTF8( pstr )		( (const char *)gCoStringText( pstr ) )
+#define gCoStringUCS4( pstr )		( (const wchar *)gCoStringText( pstr ) )
+
+void    gCoStringInit              ( GSTRING *, STRINGENCODING );
+HRESULT gCoStringFromUTF8          ( const char *, uint32, GSTRING * );
+HRESULT gCoStringFromUCS4          ( const wchar *, uint32, GSTRING * );
+HRESULT gCoStringConvert           ( const GSTRING *, STRINGENCODING, GSTRING * );
+void    gCoStringDuplicate         ( const GSTRING *, GSTRING * );
+HRESULT gCoStringConcatenate       ( GSTRING *, const GSTRING * );
+int     gCoStringCompare           ( const GSTRING *, const GSTRING * );
+const void *gCoStringText          ( const GSTRING * );
+void    gCoStringFree              ( GSTRING * );
+
 #endif
@@ -0,0 +1,78 @@
+#ifndef DOLPHIN_GUIDMAP_H
+#define DOLPHIN_GUIDMAP_H
+
+/*
+ * util/guidmap.h
+ * GCOM Release 0.3
+ *
+ * Copyright (c) 1999, 2000 Samuel A. Falvo II
+ *
+ * This software is provided 'as-is', without any implied or express warranty.
+ * In no event shall the authors be held liable for damages arising from the
+ * use this software.
+ *
+ * Permission is granted for anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software in a
+ *    product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+#include <gcom/types.h>
+#include <gcom/errors.h>
+#include <gcom/guid.h>
+
+/*** GUID-keyed hash maps...
+ *
+ * A GUIDMap maps GUIDs to non-NULL pointers.  It's an open-addressing
+ * table: a byte of control information per slot, probed sixteen slots at
+ * a time, so a lookup usually touches one group of control bytes and one
+ * key.
+ *
+ * Lookups never take a lock, and may run concurrently with each other
+ * and with updates.  Updates are serialized per key by a set of striped
+ * locks, so unrelated keys can be updated in parallel; a map created with
+ * GUIDMAP_SINGLEWRITER skips the locks, and its owner must make sure only
+ * one thread updates it at a time.
+ *
+ * Since a lookup may still be reading a value after another thread has
+ * removed or replaced it, the map never frees anything a value points
+ * to.  Values must remain valid until every lookup that might have seen
+ * them is done.  Tables outgrown by the map are kept for the same
+ * reason, but only until the lookups that might be reading them finish;
+ * a later rehash frees them.
+ */
+
+typedef struct GUIDMap GUIDMap;
+
+#define GUIDMAP_SINGLEWRITER	0x0001	/* Caller serializes all updates */
+
+/* Called by GUIDMapEnumerate() for each entry; return FALSE to stop. */
+
+typedef Bool (*GUIDMAPENUMPROC)( void *, REFGUID, void * );
+
+/*** PROTOTYPES ***/
+
+uint64	GUIDHash( REFGUID );
+
+HRESULT	GUIDMapCreate( uint32, uint32, GUIDMap ** );
+void	GUIDMapDestroy( GUIDMap * );
+
+void *	GUIDMapLookup( GUIDMap *, REFGUID );
+HRESULT	GUIDMapInsert( GUIDMap *, REFGUID, void *, void ** );
+HRESULT	GUIDMapSet( GUIDMap *, REFGUID, void *, void ** );
+void *	GUIDMapRemove( GUIDMap *, REFGUID );
+
+uint32	GUIDMapGetCount( GUIDMap * );
+void	GUIDMapEnumerate( GUIDMap *, GUIDMAPENUMPROC, void * );
+
+#endif
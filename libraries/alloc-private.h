@@ -0,0 +1,170 @@
+/*
+
+Copyright (c) 1999, 2000 Samuel A. Falvo II
+
+This software is provided 'as-is', without any implied or express warranty.
+In no event shall the authors be held liable for damages arising from the
+use this software.
+
+Permission is granted for anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software in a
+   product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+3. This notice may not be removed or altered from any source
+   distribution.
+
+*/
+
+#ifndef GCOM_ALLOC_PRIVATE_H
+#define GCOM_ALLOC_PRIVATE_H
+
+/*
+ * alloc-private.h
+ * GCOM Release 0.3
+ *
+ * Chunk-level interfaces shared between the task allocator (alloc.c) and
+ * the other allocators built on top of it.  Nothing outside of the GCOM
+ * library itself should ever include this file.
+ */
+
+#include <stdint.h>
+#include <gcom/types.h>
+#include <gcom/alloc.h>
+
+/*
+ * All memory handed out by the task allocator lives in chunks: regions
+ * of CHUNK_SIZE bytes (or a multiple thereof), aligned on a CHUNK_SIZE
+ * boundary and obtained straight from mmap().  Every chunk starts with a
+ * ChunkHeader, so masking off the low bits of any pointer we returned
+ * finds the bookkeeping for it in O(1).
+ *
+ * A chunk is either a slab, which is carved into equally sized blocks of
+ * one size class and carries no per-block header at all, a large object,
+ * which holds exactly one allocation right after its header, or a region
+ * belonging to an arena (see arena.c).
+ *
+ * Any block handed out to a client must start within the first chunk of
+ * its mapping, or ChunkOf() won't find its header.
+ */
+
+#define CHUNK_SHIFT		18
+#define CHUNK_SIZE		( 1UL << CHUNK_SHIFT )
+#define CHUNK_MASK		( CHUNK_SIZE - 1 )
+
+#define CHUNK_SLAB		1
+#define CHUNK_LARGE		2
+#define CHUNK_ARENA		3
+
+#define CHUNK_SAMPLED		0x0001	/* Large object tracked by heapprof.c */
+
+/*
+ * This structure heads every chunk.  For a large object, it is the only
+ * bookkeeping there is: the object's size and where it starts, from which
+ * the length of the mapping follows.  Unless the object was allocated
+ * with a larger alignment, it starts at LARGE_OFFSET, which keeps it
+ * 16-byte aligned.
+ */
+
+typedef struct
+{
+   uint16	kind;		/* CHUNK_SLAB, CHUNK_LARGE or CHUNK_ARENA */
+   uint16	sizeClass;	/* Slabs only */
+   uint16	flags;		/* CHUNK_SAMPLED */
+   uint16	node;		/* NUMA node the chunk is bound to */
+   uint16	component;	/* Large objects: owning component, or 0 */
+   uint32	size;		/* Large objects: bytes requested.
+				 * Arena regions: length in chunks. */
+   uint32	offset;		/* Large objects: offset of the payload */
+} ChunkHeader;
+
+#define LARGE_OFFSET		( ( sizeof( ChunkHeader ) + 15 ) & ~15UL )
+
+/*
+ * Mappings of at least this size are aligned on a huge page boundary, and
+ * the kernel is asked to back them with transparent huge pages.
+ */
+
+#define HUGE_PAGE_SIZE		( 1UL << 21 )
+
+/*
+ * Arena blocks are preceded by their size, padded to keep the payload
+ * 16-byte aligned.
+ */
+
+#define ARENA_BLOCK_OFFSET	16
+#define ARENA_BLOCK_SIZE(pv)	( *(uint32 *)( (uint8 *)(pv) - ARENA_BLOCK_OFFSET ) )
+
+static __inline__ ChunkHeader *ChunkOf( void *pv )
+{
+   return (ChunkHeader *)( (uintptr_t)pv & ~(uintptr_t)CHUNK_MASK );
+}
+
+HRESULT		TaskMallocInitialize( void );
+HRESULT		TaskMallocUninitialize( Bool );
+HRESULT		DLLInitialize( void );
+HRESULT		DLLUninitialize( Bool );
+
+ChunkHeader *	TaskChunkAcquire( uint32, uint16 );
+ChunkHeader *	TaskChunkAcquireOnNode( uint32, uint16, uint16 );
+void		TaskChunkRelease( ChunkHeader * );
+ChunkHeader *	TaskPageMapLookup( void * );
+void		TaskHeapLock( void );
+void		TaskHeapUnlock( void );
+
+/*
+ * Allocations picked by the heap profiler are made as large objects, with
+ * the profiler's record of the allocation tucked in between the chunk
+ * header and the payload.  See heapprof.c.
+ */
+
+#define HEAPPROF_MAX_DEPTH	48
+
+typedef struct HeapSample HeapSample;
+struct HeapSample
+{
+   HeapSample *	next;
+   HeapSample *	prev;
+   uint32	size;		/* Bytes requested */
+   uint32	interval;	/* Mean sampling interval at the time */
+   uint32	depth;
+   void *	stack[ HEAPPROF_MAX_DEPTH ];
+};
+
+#define HEAP_SAMPLE_OFFSET	LARGE_OFFSET
+#define HEAP_SAMPLE_SIZE	( ( sizeof( HeapSample ) + 15 ) & ~15UL )
+
+int64		HeapProfileNextSample( void );
+Bool		HeapProfileActive( void );
+void		HeapProfileRecord( HeapSample *, uint32 );
+void		HeapProfileForget( HeapSample * );
+void		HeapProfileResize( HeapSample *, uint32 );
+void		HeapProfileReset( void );
+
+IMalloc *	SharedMallocGet( void );
+void		SharedMallocUninitialize( void );
+
+void		MemoryPressureUninitialize( void );
+
+/*
+ * Components (libraries loaded by dll.c) are known to the task allocator
+ * by a small number, zero meaning none.  Allocations made while a thread
+ * has a component current are charged to it.
+ */
+
+#define MAX_COMPONENTS		256
+
+uint16		TaskComponentAttach( void );
+void		TaskComponentDetach( uint16 );
+uint16		TaskComponentSwitch( uint16 );
+void		TaskComponentGetStats( uint16, TASKMEMCOMPONENTSTATS * );
+void		TaskComponentSetBudget( uint16, uint64, IMemoryPressure * );
+
+#endif
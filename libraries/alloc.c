@@ -25,8 +25,20 @@
  */
 
 #include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <sched.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
 #include <gcom/gcom.h>
 #include <util/lists.h>
+#include "alloc-private.h"
 
 /************************************************************************/
 /* Prototypes								*/
@@ -42,48 +54,1679 @@ static uint32  IMalloc_GetSize       ( IMalloc *, void * );
 static int     IMalloc_DidAlloc      ( IMalloc *, void * );
 static void    IMalloc_HeapMinimize  ( IMalloc * );
 
+static void    TaskFree              ( void * );
+
 /************************************************************************/
 /* Coherency helper functions.						*/
 /************************************************************************/
 
-static void LockAllocList( void )
+static pthread_mutex_t heapLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t initCountLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void LockHeap( void )
+{
+   pthread_mutex_lock( &heapLock );
+}
+
+static void UnlockHeap( void )
+{
+   pthread_mutex_unlock( &heapLock );
+}
+
+/* For arena.c, which reads the page map */
+
+void TaskHeapLock( void )
+{
+   LockHeap();
+}
+
+void TaskHeapUnlock( void )
+{
+   UnlockHeap();
+}
+
+static void LockInitCount( void )
+{
+   pthread_mutex_lock( &initCountLock );
+}
+
+static void UnlockInitCount( void )
+{
+   pthread_mutex_unlock( &initCountLock );
+}
+
+/************************************************************************/
+/* The process' allocator object.  Yes, we're a real COM (singleton)	*/
+/* object.								*/
+/************************************************************************/
+
+/*
+ * Small requests are rounded up to one of the following size classes.
+ * Sizes step by 16 bytes up to 128, and thereafter by a quarter of the
+ * enclosing power of two.  Anything larger than the last class is a
+ * "large" allocation, and gets a chunk all to itself.
+ */
+
+#define NUM_SIZE_CLASSES	36
+#define MAX_SMALL_SIZE		16384
+
+static const uint32 classSizes[ NUM_SIZE_CLASSES ] =
+{
+      16,    32,    48,    64,    80,    96,   112,   128,
+     160,   192,   224,   256,   320,   384,   448,   512,
+     640,   768,   896,  1024,  1280,  1536,  1792,  2048,
+    2560,  3072,  3584,  4096,  5120,  6144,  7168,  8192,
+   10240, 12288, 14336, 16384
+};
+
+/*
+ * We keep track of which chunks we've allocated with a two-level radix
+ * tree over chunk numbers, covering a 48-bit address space.  Each entry
+ * points at the header of the chunk containing that address, so the
+ * IMalloc::DidAlloc() function is a pair of array lookups.  Leaves are
+ * mapped on demand and never released; each one spans 8GB.
+ *
+ * Everything using the map holds the heap lock.  A chunk leaves the map
+ * before it's unmapped, so while the lock is held, any chunk found in the
+ * map stays mapped, and its header can be read safely.
+ */
+
+#define PAGEMAP_BITS		15
+#define PAGEMAP_SIZE		( 1UL << PAGEMAP_BITS )
+#define PAGEMAP_MASK		( PAGEMAP_SIZE - 1 )
+
+static ChunkHeader ** volatile pageMap[ PAGEMAP_SIZE ];
+
+/*
+ * Chunks which have been emptied are removed from the map and parked
+ * here, so that they can be recycled without another mmap().
+ */
+
+#define CHUNK_CACHE_MAX		16
+
+static ChunkHeader *chunkCache[ CHUNK_CACHE_MAX ];
+static Bool chunkCacheDirty[ CHUNK_CACHE_MAX ];
+static uint16 chunkCacheNode[ CHUNK_CACHE_MAX ];
+static uint32 chunkCacheCount = 0;
+
+/*
+ * On NUMA machines, every chunk is bound to a node when it is mapped,
+ * with the MPOL_PREFERRED policy, so its pages come from that node
+ * whenever it has any to spare.  Threads carve their slabs from chunks
+ * on whichever node they're running on when they need a new slab; large
+ * objects likewise.  CoTaskMemAllocOnNode() allocates from a node heap
+ * instead: a ThreadCache belonging to the node rather than to a thread,
+ * which allocating threads take turns at under nodeHeapLock.
+ *
+ * On machines with only one node, none of this costs anything.
+ */
+
+#define MAX_NUMA_NODES		64
+#define NUMA_MPOL_PREFERRED	1
+
+typedef struct
+{
+   uint64	cbMapped;	/* Bytes in chunks bound to the node */
+   uint64	cNodeAllocs;	/* Calls to CoTaskMemAllocOnNode() */
+} NodeStats;
+
+static uint32 numaNodes = 1;
+static pthread_once_t numaOnce = PTHREAD_ONCE_INIT;
+static NodeStats nodeStats[ MAX_NUMA_NODES ];
+
+/*
+ * Pages we no longer need are handed back to the kernel with madvise(),
+ * which keeps the address range mapped for reuse.  An explicit
+ * HeapMinimize() uses MADV_DONTNEED, so the memory leaves our resident
+ * set at once; the background trimmer prefers the cheaper MADV_FREE,
+ * which lets the kernel reclaim the pages only if it needs them.
+ *
+ * Each call to HeapTrim() bumps trimEpoch.  Threads whose caches were
+ * in use at the time notice on their next allocation, and trim their
+ * own caches then, using trimAdvice.
+ */
+
+#define TRIM_ADVICE_NOW		MADV_DONTNEED
+#ifdef MADV_FREE
+#define TRIM_ADVICE_LAZY	MADV_FREE
+#else
+#define TRIM_ADVICE_LAZY	MADV_DONTNEED
+#endif
+
+static volatile uint32 trimEpoch = 0;
+static volatile int trimAdvice = TRIM_ADVICE_NOW;
+
+/*
+ * Free blocks within a slab are threaded through their own first word.
+ */
+
+typedef struct Block Block;
+struct Block
+{
+   Block *	next;
+};
+
+typedef struct ThreadCache ThreadCache;
+typedef struct Slab Slab;
+
+struct Slab
+{
+   ChunkHeader	hdr;
+   Node		link;		/* On owner's partial list, if not full */
+   Bool		linked;
+   ThreadCache *owner;
+   Block *	freeList;	/* Blocks freed back by the owner */
+   uint8 *	data;		/* First block */
+   uint8 *	bump;		/* Next block never yet handed out */
+   uint8 *	limit;		/* End of the last whole block */
+   uint32	inUse;
+};
+
+/*
+ * A slab's first block is aligned on the largest power of two dividing
+ * its class size, up to MAX_SLAB_ALIGN, and never less than a cache line.
+ * Since every block in the slab is a whole number of class sizes further
+ * on, they all share that alignment, which CoTaskMemAllocAligned() relies
+ * on.  That wastes at most a page per slab, and only for classes which
+ * are multiples of a page.
+ */
+
+#define MIN_SLAB_ALIGN		64
+#define MAX_SLAB_ALIGN		4096
+
+/*
+ * Every thread which allocates small blocks gets one of these, and owns
+ * the slabs it carves them from.  Allocating, or freeing a block from its
+ * owning thread, touches only that thread's slabs and takes no lock.
+ * Freeing a block from any other thread pushes it onto the owner's
+ * remoteFree stack with a compare-and-swap; the owner takes the whole
+ * stack in one atomic exchange the next time it runs out of free blocks.
+ *
+ * ThreadCache structures are never released back to the system, as other
+ * threads may still hold blocks from slabs they own.  When a thread
+ * exits, its cache gives up its empty slabs and is parked on tcList for
+ * the next new thread to adopt, along with any slabs still in use.
+ *
+ * A thread also gets a cache of its own for each component it allocates
+ * on behalf of (see below), chained from its main cache through nextHeap
+ * and parked along with it.
+ */
+
+struct ThreadCache
+{
+   Node		node;		/* On tcList */
+   List		partial[ NUM_SIZE_CLASSES ];	/* Slabs with room */
+   Bool		inUse;		/* FALSE while parked for adoption */
+   Bool		pinned;		/* Node heap; never changes node */
+   uint16	homeNode;	/* NUMA node new slabs come from */
+   uint16	component;	/* Component heap; charged for its blocks */
+   uint32	trimEpoch;	/* Value of trimEpoch when last trimmed */
+   ThreadCache *nextHeap;	/* Owner's next component heap */
+   int64 volatile *componentLive;	/* Owner's charges, by component */
+   Block * volatile remoteFree __attribute__(( aligned( 64 ) ));
+};
+
+static List tcList;
+static ThreadCache *nodeHeaps[ MAX_NUMA_NODES ];
+static pthread_mutex_t nodeHeapLock[ MAX_NUMA_NODES ];
+static pthread_key_t tcKey;
+static pthread_once_t tcKeyOnce = PTHREAD_ONCE_INIT;
+static __thread ThreadCache *tcCurrent;
+static __thread ThreadCache *tcComponentHeap;	/* Last component heap used */
+
+/*
+ * Each thread allocates small blocks for a component (see dll.c) from a
+ * cache of its own kept for that component, so that the slab a block came
+ * from says which component to credit when the block is freed.  Large
+ * objects say so in their chunk header.  Live bytes are counted as
+ * GetSize() reports them: whole size classes for small blocks, and bytes
+ * requested for large ones.
+ *
+ * Each thread counts what it charges and credits in its main cache's
+ * componentLive array, which only it writes; a component's live bytes
+ * are the sum over every cache, plus cbStray for threads which had no
+ * cache to count in.  A thread's count for one component can go negative,
+ * when it frees what another thread allocated.
+ *
+ * Summing takes the heap lock, so peak and budget are only checked when
+ * a thread's count crosses a multiple of COMPONENT_CHECK_SIZE, and when
+ * stats are read.  Exceeding a component's budget allocates normally, but
+ * tells the component's budget sink, once; the sink is told again only
+ * after the component has been seen back within budget.
+ */
+
+#define COMPONENT_CHECK_SHIFT	16
+#define COMPONENT_CHECK_SIZE	( 1 << COMPONENT_CHECK_SHIFT )
+
+typedef struct
+{
+   Bool			attached;
+   Bool			overBudget;
+   uint64		cbBudget;	/* Zero = no budget */
+   IMemoryPressure *	budgetSink;
+   int64 volatile	cbStray;
+   uint64		cbPeak;
+} Component;
+
+static Component components[ MAX_COMPONENTS ];	/* [0] is unused */
+static __thread uint16 tcComponent;		/* Current component */
+
+/*
+ * Maps a request size onto its size class.  Requests of 128 bytes or
+ * less are handled directly; beyond that, the top three significant bits
+ * of (cBytes-1) select one of four classes per power of two.
+ */
+
+static uint16 SizeToClass( uint32 cBytes )
+{
+   uint32 n, bit;
+
+   if( cBytes <= 128 )
+      return ( cBytes == 0 ) ? 0 : (uint16)( ( cBytes - 1 ) >> 4 );
+
+   n = cBytes - 1;
+   bit = 31 - __builtin_clz( n );
+
+   return (uint16)( 8 + ( bit - 7 ) * 4 + ( n >> ( bit - 2 ) ) - 4 );
+}
+
+/*
+ * Returns the alignment every block of a size class is guaranteed.
+ */
+
+static uint32 ClassAlignment( uint16 sizeClass )
+{
+   uint32 size = classSizes[ sizeClass ];
+   uint32 alignment = size & -size;
+
+   if( alignment < MIN_SLAB_ALIGN )
+      return MIN_SLAB_ALIGN;
+   if( alignment > MAX_SLAB_ALIGN )
+      return MAX_SLAB_ALIGN;
+   return alignment;
+}
+
+/*
+ * Returns how many chunks a large object of cBytes needs, starting offset
+ * bytes into its first chunk, or zero if that's more than we can map.
+ * The sum is taken in 64 bits, since a request near 4GB overflows 32.
+ */
+
+static uint32 LargeChunkCount( uint32 offset, uint32 cBytes )
+{
+   uint64 length = (uint64)offset + cBytes + CHUNK_MASK;
+
+   if( length > (uint64)(size_t)-1 )
+      return 0;
+
+   return (uint32)( length >> CHUNK_SHIFT );
+}
+
+static uint32 ChunkCount( ChunkHeader *ch )
+{
+   if( ch -> kind == CHUNK_SLAB )
+      return 1;
+
+   if( ch -> kind == CHUNK_ARENA )
+      return ch -> size;
+
+   return LargeChunkCount( ch -> offset, ch -> size );
+}
+
+/*
+ * Page map maintenance.
+ */
+
+/*
+ * Must be called with the heap locked, and the chunk's header read before
+ * the lock is let go.
+ */
+
+ChunkHeader *TaskPageMapLookup( void *pv )
+{
+   uintptr_t n = (uintptr_t)pv >> CHUNK_SHIFT;
+   ChunkHeader **leaf;
+
+   if( n >> ( 2 * PAGEMAP_BITS ) )
+      return NULL;
+
+   leaf = pageMap[ n >> PAGEMAP_BITS ];
+   if( leaf == NULL )
+      return NULL;
+
+   return leaf[ n & PAGEMAP_MASK ];
+}
+
+/*
+ * Points the entries for chunks [first, first+chunks) at value, which may
+ * be NULL to forget them.  Must be called with the heap lock held.
+ */
+
+static Bool PageMapSet( uintptr_t first, uint32 chunks, ChunkHeader *value )
+{
+   uintptr_t n;
+   ChunkHeader **leaf;
+
+   for( n = first; n < first + chunks; n++ )
+   {
+      if( n >> ( 2 * PAGEMAP_BITS ) )
+	 return FALSE;
+
+      leaf = pageMap[ n >> PAGEMAP_BITS ];
+      if( leaf == NULL )
+      {
+	 if( value == NULL )
+	    continue;
+
+	 leaf = mmap( NULL, PAGEMAP_SIZE * sizeof( ChunkHeader * ),
+		      PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+		      -1, 0 );
+	 if( leaf == MAP_FAILED )
+	    return FALSE;
+
+	 __sync_synchronize();
+	 pageMap[ n >> PAGEMAP_BITS ] = leaf;
+      }
+
+      leaf[ n & PAGEMAP_MASK ] = value;
+   }
+
+   return TRUE;
+}
+
+static uintptr_t ChunkNumber( void *pv )
+{
+   return (uintptr_t)pv >> CHUNK_SHIFT;
+}
+
+/*
+ * Chunk management.  TaskChunkAcquire() and TaskChunkRelease() only run once per
+ * slab or large object, never per block.
+ */
+
+/*
+ * Finds out how many NUMA nodes the system has, from the highest node
+ * number listed as online.
+ */
+
+static void NumaDetect( void )
+{
+   char buffer[ 256 ], *p;
+   unsigned long n, highest = 0;
+   FILE *f;
+   uint32 i;
+
+   for( i = 0; i < MAX_NUMA_NODES; i++ )
+      pthread_mutex_init( &nodeHeapLock[ i ], NULL );
+
+   f = fopen( "/sys/devices/system/node/online", "r" );
+   if( f == NULL )
+      return;
+
+   if( fgets( buffer, sizeof( buffer ), f ) != NULL )
+   {
+      for( p = buffer; *p; )
+      {
+	 n = strtoul( p, &p, 10 );
+	 if( n > highest )
+	    highest = n;
+	 if( ( *p != '-' ) && ( *p != ',' ) )
+	    break;
+	 p++;
+      }
+   }
+   fclose( f );
+
+   numaNodes = ( highest < MAX_NUMA_NODES ) ? highest + 1 : MAX_NUMA_NODES;
+}
+
+/*
+ * Returns the node the calling thread is running on right now.
+ */
+
+static uint16 CurrentNode( void )
+{
+   unsigned int cpu, node;
+
+   if( numaNodes <= 1 )
+      return 0;
+
+   if( syscall( SYS_getcpu, &cpu, &node, NULL ) != 0 )
+      return 0;
+
+   return ( node < numaNodes ) ? (uint16)node : 0;
+}
+
+static void ChunkBind( void *pv, size_t length, uint16 node )
+{
+   unsigned long mask[ MAX_NUMA_NODES / ( 8 * sizeof( unsigned long ) ) ];
+
+   if( numaNodes <= 1 )
+      return;
+
+   memset( mask, 0, sizeof( mask ) );
+   mask[ node / ( 8 * sizeof( unsigned long ) ) ] =
+      1UL << ( node % ( 8 * sizeof( unsigned long ) ) );
+
+   syscall( SYS_mbind, pv, length, NUMA_MPOL_PREFERRED, mask,
+	    MAX_NUMA_NODES + 1, 0 );
+}
+
+static ChunkHeader *ChunkMap( uint32 chunks, uint16 node )
+{
+   uint8 *p, *aligned;
+   size_t length = (size_t)chunks << CHUNK_SHIFT;
+   size_t alignment = CHUNK_SIZE;
+
+   /*
+    * mmap() only promises page alignment, so over-allocate by one chunk
+    * (or one huge page, for mappings big enough to use them) and trim off
+    * whatever hangs over either end.
+    */
+
+   if( length >= HUGE_PAGE_SIZE )
+      alignment = HUGE_PAGE_SIZE;
+
+   p = mmap( NULL, length + alignment, PROT_READ | PROT_WRITE,
+	     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+   if( p == MAP_FAILED )
+      return NULL;
+
+   aligned = (uint8 *)( ( (uintptr_t)p + alignment - 1 ) & ~(uintptr_t)( alignment - 1 ) );
+   if( aligned != p )
+      munmap( p, aligned - p );
+   munmap( aligned + length, ( p + alignment ) - aligned );
+
+#ifdef MADV_HUGEPAGE
+   if( alignment == HUGE_PAGE_SIZE )
+      madvise( aligned, length, MADV_HUGEPAGE );
+#endif
+
+   ChunkBind( aligned, length, node );
+
+   return (ChunkHeader *)aligned;
+}
+
+static void ChunkUnmap( ChunkHeader *ch, uint32 chunks )
+{
+   munmap( ch, (size_t)chunks << CHUNK_SHIFT );
+}
+
+ChunkHeader *TaskChunkAcquireOnNode( uint32 chunks, uint16 kind, uint16 node )
+{
+   ChunkHeader *ch = NULL;
+   Bool mapped;
+   uint32 i;
+
+   LockHeap();
+   if( chunks == 1 )
+   {
+      for( i = chunkCacheCount; i > 0; i-- )
+      {
+	 if( chunkCacheNode[ i - 1 ] == node )
+	 {
+	    ch = chunkCache[ i - 1 ];
+	    chunkCacheCount--;
+	    chunkCache[ i - 1 ] = chunkCache[ chunkCacheCount ];
+	    chunkCacheDirty[ i - 1 ] = chunkCacheDirty[ chunkCacheCount ];
+	    chunkCacheNode[ i - 1 ] = chunkCacheNode[ chunkCacheCount ];
+	    break;
+	 }
+      }
+   }
+   UnlockHeap();
+
+   if( ch == NULL )
+   {
+      ch = ChunkMap( chunks, node );
+      if( ch == NULL )
+	 return NULL;
+   }
+
+   ch -> kind = kind;
+   ch -> sizeClass = 0;
+   ch -> size = 0;
+   ch -> offset = 0;
+   ch -> flags = 0;
+   ch -> node = node;
+   ch -> component = 0;
+
+   LockHeap();
+   mapped = PageMapSet( ChunkNumber( ch ), chunks, ch );
+   if( !mapped )
+      PageMapSet( ChunkNumber( ch ), chunks, NULL );
+   else
+      nodeStats[ node ].cbMapped += (uint64)chunks << CHUNK_SHIFT;
+   UnlockHeap();
+
+   if( !mapped )
+   {
+      ChunkUnmap( ch, chunks );
+      return NULL;
+   }
+
+   return ch;
+}
+
+ChunkHeader *TaskChunkAcquire( uint32 chunks, uint16 kind )
+{
+   return TaskChunkAcquireOnNode( chunks, kind, CurrentNode() );
+}
+
+void TaskChunkRelease( ChunkHeader *ch )
+{
+   uint32 chunks = ChunkCount( ch );
+
+   LockHeap();
+   PageMapSet( ChunkNumber( ch ), chunks, NULL );
+   nodeStats[ ch -> node ].cbMapped -= (uint64)chunks << CHUNK_SHIFT;
+   if( ( chunks == 1 ) && ( chunkCacheCount < CHUNK_CACHE_MAX ) )
+   {
+      chunkCacheDirty[ chunkCacheCount ] = TRUE;
+      chunkCacheNode[ chunkCacheCount ] = ch -> node;
+      chunkCache[ chunkCacheCount++ ] = ch;
+      ch = NULL;
+   }
+   UnlockHeap();
+
+   if( ch != NULL )
+      ChunkUnmap( ch, chunks );
+}
+
+/*
+ * Slab management.  All of these run on the owning thread only.
+ */
+
+static Slab *SlabCreate( ThreadCache *tc, uint16 sizeClass )
+{
+   Slab *slab;
+   uint32 blockSize = classSizes[ sizeClass ];
+   uint32 blocks, dataOffset;
+
+   if( !tc -> pinned )
+      tc -> homeNode = CurrentNode();
+
+   slab = (Slab *)TaskChunkAcquireOnNode( 1, CHUNK_SLAB, tc -> homeNode );
+   if( slab == NULL )
+      return NULL;
+
+   dataOffset = ClassAlignment( sizeClass );
+   dataOffset = ( sizeof( Slab ) + dataOffset - 1 ) & ~( dataOffset - 1 );
+   blocks = ( CHUNK_SIZE - dataOffset ) / blockSize;
+
+   slab -> hdr.sizeClass = sizeClass;
+   slab -> owner = tc;
+   slab -> freeList = NULL;
+   slab -> data = (uint8 *)slab + dataOffset;
+   slab -> bump = slab -> data;
+   slab -> limit = slab -> data + blocks * blockSize;
+   slab -> inUse = 0;
+
+   ListAddHead( &tc -> partial[ sizeClass ], &slab -> link );
+   slab -> linked = TRUE;
+
+   return slab;
+}
+
+static Bool SlabIsFull( Slab *slab )
+{
+   return ( slab -> freeList == NULL ) && ( slab -> bump >= slab -> limit );
+}
+
+/*
+ * Returns a block to its slab.  A slab that had filled up goes back on
+ * the partial list; a slab that has emptied out is handed back to the
+ * chunk cache, unless it's the only one of its class we have, in which
+ * case we hang on to it to avoid thrashing at the boundary.
+ */
+
+static void SlabFree( ThreadCache *tc, Slab *slab, Block *b )
+{
+   List *partial = &tc -> partial[ slab -> hdr.sizeClass ];
+
+   b -> next = slab -> freeList;
+   slab -> freeList = b;
+   slab -> inUse--;
+
+   if( !slab -> linked )
+   {
+      ListAddHead( partial, &slab -> link );
+      slab -> linked = TRUE;
+   }
+   else if( ( slab -> inUse == 0 ) &&
+	    ( partial -> head -> next -> next != NULL ) )
+   {
+      NodeRemove( &slab -> link );
+      slab -> linked = FALSE;
+      TaskChunkRelease( &slab -> hdr );
+   }
+}
+
+/*
+ * Moves every block queued by other threads back into our own slabs.
+ */
+
+static void ThreadCacheDrainRemote( ThreadCache *tc )
+{
+   Block *b, *nb;
+
+   if( tc -> remoteFree == NULL )
+      return;
+
+   b = __sync_lock_test_and_set( &tc -> remoteFree, NULL );
+   for( ; b; b = nb )
+   {
+      nb = b -> next;
+      SlabFree( tc, (Slab *)ChunkOf( b ), b );
+   }
+}
+
+static Slab *SlabFromLink( Node *link )
+{
+   return (Slab *)( (uint8 *)link - offsetof( Slab, link ) );
+}
+
+/*
+ * Releases every empty slab in a cache.
+ */
+
+static void ThreadCacheRelease( ThreadCache *tc )
+{
+   Node *n, *nn;
+   Slab *slab;
+   uint16 i;
+
+   ThreadCacheDrainRemote( tc );
+   for( i = 0; i < NUM_SIZE_CLASSES; i++ )
+   {
+      for( n = tc -> partial[ i ].head; n -> next; n = nn )
+      {
+	 nn = n -> next;
+	 slab = SlabFromLink( n );
+	 if( slab -> inUse == 0 )
+	 {
+	    NodeRemove( n );
+	    slab -> linked = FALSE;
+	    TaskChunkRelease( &slab -> hdr );
+	 }
+      }
+   }
+}
+
+/*
+ * Called by pthreads when a thread which owned a cache exits.  Empty
+ * slabs are released; the rest stay with the cache, which is parked, as
+ * are the thread's component heaps.
+ */
+
+static void ThreadCacheExit( void *pv )
+{
+   ThreadCache *tc = (ThreadCache *)pv;
+   ThreadCache *heap, *next;
+
+   for( heap = tc; heap != NULL; heap = heap -> nextHeap )
+      ThreadCacheRelease( heap );
+
+   LockHeap();
+   for( heap = tc; heap != NULL; heap = next )
+   {
+      next = heap -> nextHeap;
+      heap -> nextHeap = NULL;
+      heap -> inUse = FALSE;
+   }
+   UnlockHeap();
+
+   tcCurrent = NULL;
+   tcComponentHeap = NULL;
+}
+
+static void ThreadCacheCreateKey( void )
+{
+   pthread_key_create( &tcKey, &ThreadCacheExit );
+}
+
+static void ThreadCacheReset( ThreadCache *tc )
+{
+   uint16 i;
+
+   for( i = 0; i < NUM_SIZE_CLASSES; i++ )
+      ListInitialize( &tc -> partial[ i ] );
+   tc -> remoteFree = NULL;
+   tc -> trimEpoch = trimEpoch;
+}
+
+/*
+ * Gives the pages in [start, end) back to the kernel, after widening the
+ * range out to page boundaries at the end only; the page containing start
+ * may still hold live data.  Returns the number of bytes given back.
+ */
+
+static uint64 PagesRelease( uint8 *start, uint8 *end, int advice )
+{
+   uintptr_t pageMask = (uintptr_t)sysconf( _SC_PAGESIZE ) - 1;
+   uint8 *first, *last;
+
+   first = (uint8 *)( ( (uintptr_t)start + pageMask ) & ~pageMask );
+   last = (uint8 *)( ( (uintptr_t)end + pageMask ) & ~pageMask );
+   if( last <= first )
+      return 0;
+
+   if( madvise( first, last - first, advice ) != 0 )
+      return 0;
+
+   return last - first;
+}
+
+/*
+ * An empty slab which the thread cache hung on to is rewound, as if
+ * freshly created, and the pages its blocks occupied are released.
+ * Remote frees must have been drained first.
+ */
+
+static uint64 SlabTrim( Slab *slab, int advice )
+{
+   uint64 released;
+
+   if( ( slab -> inUse != 0 ) || ( slab -> bump == slab -> data ) )
+      return 0;
+
+   released = PagesRelease( slab -> data, slab -> bump, advice );
+   slab -> freeList = NULL;
+   slab -> bump = slab -> data;
+
+   return released;
+}
+
+/*
+ * Trims every empty slab in a cache.  Must be called from the owning
+ * thread, or with a parked cache claimed as in HeapTrim().
+ */
+
+static uint64 ThreadCacheTrim( ThreadCache *tc, int advice )
+{
+   uint64 released = 0;
+   Node *n;
+   uint16 i;
+
+   tc -> trimEpoch = trimEpoch;
+   ThreadCacheDrainRemote( tc );
+
+   for( i = 0; i < NUM_SIZE_CLASSES; i++ )
+   {
+      for( n = tc -> partial[ i ].head; n -> next; n = n -> next )
+	 released += SlabTrim( SlabFromLink( n ), advice );
+   }
+
+   return released;
+}
+
+/*
+ * Releases every page the task allocator holds but isn't using: those
+ * of the chunks in the chunk cache, and those of empty slabs belonging to
+ * the calling thread and its component heaps, to parked caches, or to
+ * node heaps.  Caches owned by other live threads are trimmed later, by
+ * their owners.  Returns the number of bytes given back right away.
+ */
+
+static uint64 HeapTrim( int advice )
+{
+   uint64 released = 0;
+   ThreadCache *tc;
+   uint32 epoch, i;
+
+   trimAdvice = advice;
+   epoch = __sync_add_and_fetch( &trimEpoch, 1 );
+
+   for( tc = tcCurrent; tc != NULL; tc = tc -> nextHeap )
+      released += ThreadCacheTrim( tc, advice );
+
+   /*
+    * Node heaps are always in use, by whichever thread holds their
+    * locks, so they're trimmed under those same locks.
+    */
+
+   for( i = 0; i < MAX_NUMA_NODES; i++ )
+   {
+      tc = nodeHeaps[ i ];
+      if( tc == NULL )
+	 continue;
+
+      pthread_mutex_lock( &nodeHeapLock[ i ] );
+      released += ThreadCacheTrim( tc, advice );
+      pthread_mutex_unlock( &nodeHeapLock[ i ] );
+   }
+
+   /*
+    * Parked caches are claimed for the duration of the trim, as though
+    * adopted, since draining their remote frees may need the heap lock.
+    */
+
+   for( ;; )
+   {
+      LockHeap();
+      for(
+	  tc = (ThreadCache *)tcList.head;
+	  tc -> node.next;
+	  tc = (ThreadCache *)tc -> node.next
+	 )
+      {
+	 if( !tc -> inUse && ( tc -> trimEpoch != epoch ) )
+	    break;
+      }
+
+      if( tc -> node.next == NULL )
+	 break;
+
+      tc -> inUse = TRUE;
+      UnlockHeap();
+
+      released += ThreadCacheTrim( tc, advice );
+      tc -> trimEpoch = epoch;
+
+      LockHeap();
+      tc -> inUse = FALSE;
+      UnlockHeap();
+   }
+
+   for( i = 0; i < chunkCacheCount; i++ )
+   {
+      if( chunkCacheDirty[ i ] )
+      {
+	 released += PagesRelease(
+	    (uint8 *)chunkCache[ i ], (uint8 *)chunkCache[ i ] + CHUNK_SIZE,
+	    advice
+	 );
+	 chunkCacheDirty[ i ] = FALSE;
+      }
+   }
+   UnlockHeap();
+
+   return released;
+}
+
+/*
+ * Claims a parked cache for a component (zero for a thread's main cache),
+ * or creates a new one.  Must be called with the heap lock held.
+ */
+
+static ThreadCache *ThreadCacheAdopt( uint16 component )
+{
+   ThreadCache *tc;
+
+   for(
+       tc = (ThreadCache *)tcList.head;
+       tc -> node.next;
+       tc = (ThreadCache *)tc -> node.next
+      )
+   {
+      if( !tc -> inUse && ( tc -> component == component ) )
+	 break;
+   }
+
+   if( tc -> node.next == NULL )
+   {
+      tc = (ThreadCache *)calloc( 1, sizeof( ThreadCache ) );
+      if( tc != NULL )
+      {
+	 ThreadCacheReset( tc );
+	 tc -> component = component;
+	 ListAddTail( &tcList, (Node *)tc );
+      }
+   }
+
+   if( tc != NULL )
+      tc -> inUse = TRUE;
+
+   return tc;
+}
+
+/*
+ * Returns the calling thread's cache, adopting a parked one or creating
+ * a new one on first use.  Returns NULL only if we're out of memory.
+ */
+
+static ThreadCache *GetThreadCache( void )
+{
+   ThreadCache *tc = tcCurrent;
+
+   if( tc != NULL )
+      return tc;
+
+   LockHeap();
+   tc = ThreadCacheAdopt( 0 );
+   UnlockHeap();
+
+   if( tc != NULL )
+   {
+      pthread_setspecific( tcKey, tc );
+      tcCurrent = tc;
+   }
+
+   return tc;
+}
+
+/*
+ * Returns the calling thread's heap for a component, adopting a parked
+ * one or creating a new one on first use.
+ */
+
+static ThreadCache *GetComponentHeap( uint16 id )
+{
+   ThreadCache *owner, *tc;
+
+   owner = GetThreadCache();
+   if( owner == NULL )
+      return NULL;
+
+   for( tc = owner -> nextHeap; tc != NULL; tc = tc -> nextHeap )
+      if( tc -> component == id )
+	 break;
+
+   if( tc == NULL )
+   {
+      LockHeap();
+      tc = ThreadCacheAdopt( id );
+      if( tc != NULL )
+      {
+	 tc -> nextHeap = owner -> nextHeap;
+	 owner -> nextHeap = tc;
+      }
+      UnlockHeap();
+   }
+
+   tcComponentHeap = tc;
+   return tc;
+}
+
+/*
+ * Carves a block out of one of a cache's slabs.  The cache must belong to
+ * the calling thread, or be a node heap whose lock we hold.
+ */
+
+static void *SlabAlloc( ThreadCache *tc, uint16 sizeClass )
+{
+   List *partial;
+   Slab *slab;
+   Block *b;
+
+   if( __builtin_expect( tc -> trimEpoch != trimEpoch, 0 ) )
+      ThreadCacheTrim( tc, trimAdvice );
+
+   partial = &tc -> partial[ sizeClass ];
+   if( partial -> head -> next == NULL )
+      ThreadCacheDrainRemote( tc );
+
+   if( partial -> head -> next != NULL )
+      slab = SlabFromLink( partial -> head );
+   else
+   {
+      slab = SlabCreate( tc, sizeClass );
+      if( slab == NULL )
+	 return NULL;
+   }
+
+   if( slab -> freeList != NULL )
+   {
+      b = slab -> freeList;
+      slab -> freeList = b -> next;
+   }
+   else
+   {
+      b = (Block *)slab -> bump;
+      slab -> bump += classSizes[ sizeClass ];
+   }
+   slab -> inUse++;
+
+   if( SlabIsFull( slab ) )
+   {
+      NodeRemove( &slab -> link );
+      slab -> linked = FALSE;
+   }
+
+   return (void *)b;
+}
+
+/*
+ * Returns a component's live bytes.  Must be called with the heap locked.
+ */
+
+static uint64 ComponentLive( uint16 id )
+{
+   ThreadCache *tc;
+   int64 live = components[ id ].cbStray;
+
+   for(
+       tc = (ThreadCache *)tcList.head;
+       tc -> node.next;
+       tc = (ThreadCache *)tc -> node.next
+      )
+   {
+      if( tc -> componentLive != NULL )
+	 live += tc -> componentLive[ id ];
+   }
+
+   return ( live > 0 ) ? (uint64)live : 0;
+}
+
+/*
+ * Brings a component's peak up to date, and tells its budget sink if
+ * it's gone over budget since the sink was last told.
+ */
+
+static void ComponentCheck( uint16 id )
+{
+   Component *c = &components[ id ];
+   IMemoryPressure *sink = NULL;
+   uint64 live;
+
+   LockHeap();
+   live = ComponentLive( id );
+   if( live > c -> cbPeak )
+      c -> cbPeak = live;
+
+   if( ( c -> cbBudget == 0 ) || ( live <= c -> cbBudget ) )
+      c -> overBudget = FALSE;
+   else if( !c -> overBudget )
+   {
+      c -> overBudget = TRUE;
+      sink = c -> budgetSink;
+      if( sink != NULL )
+	 sink -> lpVtbl -> AddRef( sink );
+   }
+   UnlockHeap();
+
+   if( sink != NULL )
+   {
+      sink -> lpVtbl -> OnMemoryPressure( sink, MEMPRESSURE_MODERATE );
+      sink -> lpVtbl -> Release( sink );
+   }
+}
+
+/*
+ * Charges (or, given a negative delta, credits) a component with live
+ * bytes, in the calling thread's own count.
+ */
+
+static void ComponentAdjust( uint16 id, int64 delta )
+{
+   ThreadCache *tc = GetThreadCache();
+   int64 volatile *counts;
+   int64 before, after;
+
+   if( ( tc != NULL ) && ( tc -> componentLive == NULL ) )
+   {
+      counts = (int64 volatile *)calloc( MAX_COMPONENTS, sizeof( int64 ) );
+      __sync_synchronize();
+      tc -> componentLive = counts;
+   }
+
+   if( ( tc == NULL ) || ( tc -> componentLive == NULL ) )
+   {
+      __sync_add_and_fetch( &components[ id ].cbStray, delta );
+      ComponentCheck( id );
+      return;
+   }
+
+   before = tc -> componentLive[ id ];
+   after = before + delta;
+   tc -> componentLive[ id ] = after;
+
+   if( ( before >> COMPONENT_CHECK_SHIFT ) != ( after >> COMPONENT_CHECK_SHIFT ) )
+      ComponentCheck( id );
+}
+
+static void *ComponentAlloc( uint16 id, uint16 sizeClass )
+{
+   ThreadCache *tc = tcComponentHeap;
+   void *pv;
+
+   if( ( tc == NULL ) || ( tc -> component != id ) )
+   {
+      tc = GetComponentHeap( id );
+      if( tc == NULL )
+	 return NULL;
+   }
+
+   pv = SlabAlloc( tc, sizeClass );
+   if( pv != NULL )
+      ComponentAdjust( id, classSizes[ sizeClass ] );
+
+   return pv;
+}
+
+/*
+ * Large objects allocated on a component's behalf are marked as such.
+ */
+
+static void ComponentChargeLarge( ChunkHeader *ch )
+{
+   if( __builtin_expect( tcComponent != 0, 0 ) )
+   {
+      ch -> component = tcComponent;
+      ComponentAdjust( tcComponent, ch -> size );
+   }
+}
+
+static void *SmallAlloc( uint16 sizeClass )
+{
+   ThreadCache *tc;
+
+   if( __builtin_expect( tcComponent != 0, 0 ) )
+      return ComponentAlloc( tcComponent, sizeClass );
+
+   tc = GetThreadCache();
+   if( tc == NULL )
+      return NULL;
+
+   return SlabAlloc( tc, sizeClass );
+}
+
+/*
+ * Returns a node's heap, creating it on first use.
+ */
+
+static ThreadCache *GetNodeHeap( uint16 node )
 {
-#warning Insert locking code to make thread-safe.
+   ThreadCache *tc = nodeHeaps[ node ];
+
+   if( tc != NULL )
+      return tc;
+
+   LockHeap();
+   tc = nodeHeaps[ node ];
+   if( tc == NULL )
+   {
+      tc = (ThreadCache *)calloc( 1, sizeof( ThreadCache ) );
+      if( tc != NULL )
+      {
+	 ThreadCacheReset( tc );
+	 tc -> inUse = TRUE;
+	 tc -> pinned = TRUE;
+	 tc -> homeNode = node;
+	 ListAddTail( &tcList, (Node *)tc );
+	 nodeHeaps[ node ] = tc;
+      }
+   }
+   UnlockHeap();
+
+   return tc;
 }
 
-static void UnlockAllocList( void )
+/*
+ * Large objects get chunks of their own.  Since chunks are aligned far
+ * more strictly than any alignment we let clients ask for, aligning the
+ * payload is only a matter of where in the chunk it starts.
+ */
+
+static void *LargeAllocOnNode( uint32 cBytes, uint32 alignment, uint16 node )
 {
-#warning Insert unlocking code to make thread-safe.
+   ChunkHeader *ch;
+   uint32 chunks, offset;
+
+   offset = LARGE_OFFSET;
+   if( alignment > offset )
+      offset = alignment;
+
+   chunks = LargeChunkCount( offset, cBytes );
+   if( chunks == 0 )
+      return NULL;
+
+   ch = TaskChunkAcquireOnNode( chunks, CHUNK_LARGE, node );
+   if( ch == NULL )
+      return NULL;
+
+   ch -> size = cBytes;
+   ch -> offset = offset;
+   return (uint8 *)ch + offset;
 }
 
-static void LockInitCount( void )
+/*
+ * Large blocks are charged to the current component here, rather than in
+ * LargeAllocOnNode(), so that blocks from CoTaskMemAllocOnNode() are
+ * charged to nobody whatever their size.
+ */
+
+static void *LargeAlloc( uint32 cBytes, uint32 alignment )
 {
-#warning Insert locking code to make thread-safe.
+   void *pv;
+
+   pv = LargeAllocOnNode( cBytes, alignment, CurrentNode() );
+   if( pv != NULL )
+      ComponentChargeLarge( ChunkOf( pv ) );
+   return pv;
 }
 
-static void UnlockInitCount( void )
+/*
+ * The heap operations proper.  The IMalloc methods below are thin
+ * wrappers around these, which give a registered spy a look in first;
+ * internally, the allocator only ever calls these directly.
+ */
+
+/*
+ * Each thread counts down the bytes it allocates until the heap profiler
+ * wants its next sample (see heapprof.c); only the allocation which takes
+ * the count below zero goes the slow way round.  While the profiler is
+ * off, the count is simply reloaded every so often.
+ */
+
+static __thread int64 sampleCountdown;
+
+static void *SampledAlloc( uint32 cBytes )
+{
+   ChunkHeader *ch;
+   uint32 chunks, offset;
+
+   sampleCountdown = HeapProfileNextSample();
+   if( !HeapProfileActive() )
+   {
+      if( cBytes <= MAX_SMALL_SIZE )
+	 return SmallAlloc( SizeToClass( cBytes ) );
+      else
+	 return LargeAlloc( cBytes, 0 );
+   }
+
+   offset = HEAP_SAMPLE_OFFSET + HEAP_SAMPLE_SIZE;
+   chunks = LargeChunkCount( offset, cBytes );
+   if( chunks == 0 )
+      return NULL;
+
+   ch = TaskChunkAcquire( chunks, CHUNK_LARGE );
+   if( ch == NULL )
+      return NULL;
+
+   ch -> size = cBytes;
+   ch -> offset = offset;
+   ch -> flags = CHUNK_SAMPLED;
+   ComponentChargeLarge( ch );
+   HeapProfileRecord( (HeapSample *)( (uint8 *)ch + HEAP_SAMPLE_OFFSET ), cBytes );
+
+   return (uint8 *)ch + offset;
+}
+
+static
+void *TaskAlloc( uint32 cBytes )
+{
+   /* IMalloc requires us to implement the DidAlloc() function,
+    * which returns non-zero if we allocated a particular chunk
+    * of memory.
+    *
+    * In order to properly implement that functionality, every
+    * chunk of address space we obtain from the system is entered
+    * in the page map.  Small blocks are carved out of per-thread
+    * slabs, so the map (and the heap lock guarding it) is only
+    * touched when a thread needs a whole new slab.
+    */
+
+   sampleCountdown -= cBytes;
+   if( __builtin_expect( sampleCountdown < 0, 0 ) )
+      return SampledAlloc( cBytes );
+
+   if( cBytes <= MAX_SMALL_SIZE )
+      return SmallAlloc( SizeToClass( cBytes ) );
+   else
+      return LargeAlloc( cBytes, 0 );
+}
+
+/*
+ * Every block is 16-byte aligned to begin with.  Beyond that, small
+ * blocks are aligned by picking the smallest size class whose blocks all
+ * fall on the required boundary; failing that, the block is allocated as
+ * a large object.
+ */
+
+static
+void *TaskAllocAligned( uint32 cBytes, uint32 alignment )
+{
+   uint16 sizeClass;
+
+   if( alignment <= 16 )
+      return TaskAlloc( cBytes );
+
+   if( cBytes <= MAX_SMALL_SIZE )
+   {
+      for(
+	  sizeClass = SizeToClass( cBytes );
+	  sizeClass < NUM_SIZE_CLASSES;
+	  sizeClass++
+	 )
+      {
+	 if( ( ( classSizes[ sizeClass ] & ( alignment - 1 ) ) == 0 ) &&
+	     ( ClassAlignment( sizeClass ) >= alignment ) )
+	    return SmallAlloc( sizeClass );
+      }
+   }
+
+   return LargeAlloc( cBytes, alignment );
+}
+
+static
+void *TaskRealloc( void *pv, uint32 cBytes )
+{
+   ChunkHeader *ch = ChunkOf( pv );
+   uint32 oldSize, oldChunks, newChunks;
+   uint64 room;
+   void *pvNew;
+
+   if( pv == NULL )
+      return TaskAlloc( cBytes );
+
+   /*
+    * A block which can already hold cBytes stays right where it is.  For
+    * slab blocks, that's anything up to the size of the class; for large
+    * objects, anything up to the end of the mapping.  Blocks belonging to
+    * an arena always move out into the task heap.
+    */
+
+   if( ch -> kind == CHUNK_ARENA )
+      oldSize = ARENA_BLOCK_SIZE( pv );
+   else if( ch -> kind == CHUNK_SLAB )
+   {
+      oldSize = classSizes[ ch -> sizeClass ];
+      if( cBytes <= oldSize )
+	 return pv;
+   }
+   else if( cBytes > MAX_SMALL_SIZE )
+   {
+      /*
+       * A large object that shrinks gives the chunks it no longer needs
+       * straight back to the system.
+       */
+
+      oldSize = ch -> size;
+      oldChunks = ChunkCount( ch );
+      room = ( (uint64)oldChunks << CHUNK_SHIFT ) - ch -> offset;
+      if( cBytes <= room )
+      {
+	 ch -> size = cBytes;
+	 if( ch -> component != 0 )
+	    ComponentAdjust( ch -> component, (int64)cBytes - (int64)oldSize );
+	 if( ch -> flags & CHUNK_SAMPLED )
+	    HeapProfileResize( (HeapSample *)( (uint8 *)ch + HEAP_SAMPLE_OFFSET ), cBytes );
+
+	 newChunks = ChunkCount( ch );
+	 if( newChunks < oldChunks )
+	 {
+	    LockHeap();
+	    PageMapSet( ChunkNumber( ch ) + newChunks,
+			oldChunks - newChunks, NULL );
+	    nodeStats[ ch -> node ].cbMapped -=
+	       (uint64)( oldChunks - newChunks ) << CHUNK_SHIFT;
+	    UnlockHeap();
+	    munmap( (uint8 *)ch + ( (size_t)newChunks << CHUNK_SHIFT ),
+		    (size_t)( oldChunks - newChunks ) << CHUNK_SHIFT );
+	 }
+	 return pv;
+      }
+   }
+   else
+      oldSize = ch -> size;
+
+   pvNew = TaskAlloc( cBytes );
+   if( pvNew != NULL )
+   {
+      memcpy( pvNew, pv, ( oldSize < cBytes ) ? oldSize : cBytes );
+      TaskFree( pv );
+   }
+
+   return pvNew;
+}
+
+static
+void TaskFree( void *pv )
+{
+   ChunkHeader *ch = ChunkOf( pv );
+   ThreadCache *tc;
+   Block *b = (Block *)pv;
+   Block *head;
+
+   if( pv == NULL )
+      return;
+
+   if( ch -> kind == CHUNK_LARGE )
+   {
+      if( ch -> component != 0 )
+	 ComponentAdjust( ch -> component, -(int64)ch -> size );
+      if( ch -> flags & CHUNK_SAMPLED )
+	 HeapProfileForget( (HeapSample *)( (uint8 *)ch + HEAP_SAMPLE_OFFSET ) );
+      TaskChunkRelease( ch );
+      return;
+   }
+
+   if( ch -> kind == CHUNK_ARENA )
+      return;		/* Released along with the arena itself */
+
+   tc = ( (Slab *)ch ) -> owner;
+   if( __builtin_expect( tc -> component != 0, 0 ) )
+      ComponentAdjust( tc -> component, -(int64)classSizes[ ch -> sizeClass ] );
+
+   if( ( tc == tcCurrent ) || ( tc == tcComponentHeap ) )
+      SlabFree( tc, (Slab *)ch, b );
+   else
+   {
+      do
+      {
+	 head = tc -> remoteFree;
+	 b -> next = head;
+      }
+      while( !__sync_bool_compare_and_swap( &tc -> remoteFree, head, b ) );
+   }
+}
+
+/*
+ * Note that for small blocks, this reports the usable size of the block
+ * (that is, the size of its class), which may exceed what was asked for.
+ */
+
+static
+uint32 TaskGetSize( void *pv )
+{
+   ChunkHeader *ch = ChunkOf( pv );
+
+   if( ch -> kind == CHUNK_SLAB )
+      return classSizes[ ch -> sizeClass ];
+
+   if( ch -> kind == CHUNK_ARENA )
+      return ARENA_BLOCK_SIZE( pv );
+
+   return ch -> size;
+}
+
+/*
+ * Slab blocks carry no state of their own, so a block that has been freed
+ * back into a live slab still counts as one of ours.  The heap lock keeps
+ * another thread from releasing the chunk while we look at its header.
+ */
+
+static
+int TaskDidAlloc( void *pv )
+{
+   ChunkHeader *ch;
+   Slab *slab;
+   int result = FALSE;
+
+   LockHeap();
+   ch = TaskPageMapLookup( pv );
+   if( ( ch != NULL ) && ( ch == ChunkOf( pv ) ) )
+   {
+      if( ch -> kind == CHUNK_LARGE )
+	 result = ( (uint8 *)pv == (uint8 *)ch + ch -> offset );
+      else if( ch -> kind == CHUNK_SLAB )
+      {
+	 slab = (Slab *)ch;
+	 result = ( (uint8 *)pv >= slab -> data )
+	       && ( (uint8 *)pv < slab -> bump )
+	       && ( ( (uint8 *)pv - slab -> data )
+		    % classSizes[ ch -> sizeClass ] == 0 );
+      }
+
+      /* Arena blocks are left for the arena to claim */
+   }
+   UnlockHeap();
+
+   return result;
+}
+
+static
+uint64 TaskHeapMinimize( void )
 {
-#warning Insert unlocking code to make thread-safe.
+   return HeapTrim( TRIM_ADVICE_NOW );
 }
 
 /************************************************************************/
-/* The process' allocator object.  Yes, we're a real COM (singleton)	*/
-/* object.								*/
+/* Malloc Spies								*/
 /************************************************************************/
 
 /*
- * This structure is used to keep track of which memory chunks we've
- * allocated.  With some minor changes to this source code, it can
- * also be used to help detect memory leaks.
+ * A spy, if one is registered, sees every call made on the task
+ * allocator (see CoRegisterMallocSpy()).  When there isn't one, the
+ * only cost is the one well-predicted test of pSpy in each IMalloc
+ * method.
+ *
+ * Calls into the spy are bracketed by SpyEnter() and SpyLeave(), which
+ * keep count of the calls in flight, so CoRevokeMallocSpy() can wait
+ * them out before releasing the spy.  A spy that allocates memory
+ * itself doesn't get to spy on its own allocations.
  */
 
-typedef struct
+#define SPYING()	__builtin_expect( pSpy != NULL, 0 )
+
+static pthread_mutex_t spyLock = PTHREAD_MUTEX_INITIALIZER;
+static IMallocSpy * volatile pSpy = NULL;
+static volatile uint32 spyCalls = 0;
+static __thread Bool inSpy;
+
+static IMallocSpy *SpyEnter( void )
+{
+   IMallocSpy *spy;
+
+   if( inSpy )
+      return NULL;
+
+   __sync_add_and_fetch( &spyCalls, 1 );
+   spy = pSpy;
+   if( spy == NULL )
+   {
+      __sync_sub_and_fetch( &spyCalls, 1 );
+      return NULL;
+   }
+
+   inSpy = TRUE;
+   return spy;
+}
+
+static void SpyLeave( void )
+{
+   inSpy = FALSE;
+   __sync_sub_and_fetch( &spyCalls, 1 );
+}
+
+/*
+ * GCOM doesn't remember which blocks were allocated while a spy was
+ * registered, so the fSpyed argument is always TRUE.
+ */
+
+static void *SpyAlloc( uint32 cBytes, uint32 alignment )
+{
+   IMallocSpy *spy = SpyEnter();
+   void *pv = NULL;
+
+   if( spy == NULL )
+      return TaskAllocAligned( cBytes, alignment );
+
+   cBytes = spy -> lpVtbl -> PreAlloc( spy, cBytes );
+   if( cBytes != 0 )
+      pv = TaskAllocAligned( cBytes, alignment );
+   pv = spy -> lpVtbl -> PostAlloc( spy, pv );
+
+   SpyLeave();
+   return pv;
+}
+
+static void *SpyRealloc( void *pv, uint32 cBytes )
+{
+   IMallocSpy *spy = SpyEnter();
+   void *pvRequest = pv;
+
+   if( spy == NULL )
+      return TaskRealloc( pv, cBytes );
+
+   cBytes = spy -> lpVtbl -> PreRealloc( spy, pv, cBytes, &pvRequest, TRUE );
+   pv = TaskRealloc( pvRequest, cBytes );
+   pv = spy -> lpVtbl -> PostRealloc( spy, pv, TRUE );
+
+   SpyLeave();
+   return pv;
+}
+
+static void SpyFree( void *pv )
+{
+   IMallocSpy *spy = SpyEnter();
+
+   if( spy == NULL )
+   {
+      TaskFree( pv );
+      return;
+   }
+
+   pv = spy -> lpVtbl -> PreFree( spy, pv, TRUE );
+   TaskFree( pv );
+   spy -> lpVtbl -> PostFree( spy, TRUE );
+
+   SpyLeave();
+}
+
+static uint32 SpyGetSize( void *pv )
+{
+   IMallocSpy *spy = SpyEnter();
+   uint32 cBytes;
+
+   if( spy == NULL )
+      return TaskGetSize( pv );
+
+   pv = spy -> lpVtbl -> PreGetSize( spy, pv, TRUE );
+   cBytes = TaskGetSize( pv );
+   cBytes = spy -> lpVtbl -> PostGetSize( spy, cBytes, TRUE );
+
+   SpyLeave();
+   return cBytes;
+}
+
+static int SpyDidAlloc( void *pv )
+{
+   IMallocSpy *spy = SpyEnter();
+   void *pvRequest;
+   int fActual;
+
+   if( spy == NULL )
+      return TaskDidAlloc( pv );
+
+   pvRequest = spy -> lpVtbl -> PreDidAlloc( spy, pv, TRUE );
+   fActual = TaskDidAlloc( pvRequest );
+   fActual = spy -> lpVtbl -> PostDidAlloc( spy, pv, TRUE, fActual );
+
+   SpyLeave();
+   return fActual;
+}
+
+static uint64 SpyHeapMinimize( void )
 {
-   Node		node;
-   uint32	size;
-} AllocNode;
+   IMallocSpy *spy = SpyEnter();
+   uint64 released;
+
+   if( spy == NULL )
+      return TaskHeapMinimize();
+
+   spy -> lpVtbl -> PreHeapMinimize( spy );
+   released = TaskHeapMinimize();
+   spy -> lpVtbl -> PostHeapMinimize( spy );
 
-static List allocList;
+   SpyLeave();
+   return released;
+}
+
+/************************************************************************/
+/* The task allocator's IMalloc interface				*/
+/************************************************************************/
 
 /*
  * The IUnknown methods, which all COM objects must support in one
@@ -94,10 +1737,10 @@ static
 HRESULT IMalloc_QueryInterface( IMalloc *self, REFIID riid, void **ppv )
 {
    HRESULT hr;
-   
+
    *ppv = NULL;
    hr = E_NOINTERFACE;
-   
+
    if( IsEqualIID( riid, IID_IUnknown ) || IsEqualIID( riid, IID_IMalloc ) )
    {
       *ppv = self;
@@ -137,124 +1780,135 @@ uint32 IMalloc_Release( IMalloc *self )
 static
 void *IMalloc_Alloc( IMalloc *self, uint32 cBytes )
 {
-   AllocNode *an;
-
-   /* IMalloc requires us to implement the DidAlloc() function,
-    * which returns non-zero if we allocated a particular chunk
-    * of memory.
-    * 
-    * In order to properly implement that functionality, this
-    * code allocates the requested memory, and adds that memory
-    * to a doubly-linked list, maintained internally as part of
-    * the object's state.  This way, we have a record of which
-    * chunks of memory we did and did not allocate.
-    */
-
-   an = (AllocNode *)malloc( cBytes + sizeof( AllocNode ) );
-   if( an != NULL )
-   {
-      /* Fill in some bookkeeping information. */
-
-      an -> size = cBytes;	/* For the IMalloc::GetSize() function */
-      LockAllocList();
-      ListAddTail( &allocList, (Node *)an );
-      UnlockAllocList();
-      
-      /* Now advance "an" to point to the memory requested by the client */
-      an++;
-   }
+   if( SPYING() )
+      return SpyAlloc( cBytes, 0 );
 
-   return (void *)an;
+   return TaskAlloc( cBytes );
 }
 
 static
 void *IMalloc_Realloc( IMalloc *self, void *pv, uint32 cBytes )
 {
-   AllocNode *an1 = ( (AllocNode *)pv ) - 1;
-   AllocNode *an2;
-
-   /*
-    * Unlike the other memory allocation functions, we must lock the
-    * list for the entire duration of the realloc operation.  This is
-    * because we must, essentially, perform a "read-modify-write"
-    * operation on the list, and it must be atomic.
-    * 
-    * The reason is realloc() *could* relocate a chunk of data, rather
-    * than extending a chunk in-place.  As a result, we must remove the
-    * allocated node from the list, realloc() it, and then place it back
-    * onto the list.
-    */
+   if( SPYING() )
+      return SpyRealloc( pv, cBytes );
 
-   LockAllocList();
-
-   NodeRemove( (Node *)an1 );
-   an2 = (AllocNode *)realloc( an1, cBytes + sizeof( AllocNode ) );
-   
-   if( an2 != NULL )
-   {
-      an2 -> size = cBytes;
-      ListAddTail( &allocList, (Node *)an2 );
-      UnlockAllocList();
-      
-      return (void *)( an2 + 1 );
-   }
-   else
-   {
-      ListAddTail( &allocList, (Node *)an1 );
-      UnlockAllocList();
-
-      return NULL;
-   }
+   return TaskRealloc( pv, cBytes );
 }
 
 static
 void IMalloc_Free( IMalloc *self, void *pv )
 {
-   AllocNode *an = ( (AllocNode *)pv ) - 1;
-   
-   LockAllocList();
-   NodeRemove( (Node *)an );
-   UnlockAllocList();
-   
-   free( an );
+   if( SPYING() )
+      SpyFree( pv );
+   else
+      TaskFree( pv );
 }
 
 static
 uint32 IMalloc_GetSize( IMalloc *self, void *pv )
 {
-   AllocNode *an = ( (AllocNode *)pv ) - 1;
-   
-   return an -> size;
+   if( SPYING() )
+      return SpyGetSize( pv );
+
+   return TaskGetSize( pv );
 }
 
 static
 int IMalloc_DidAlloc( IMalloc *self, void *pv )
 {
-   AllocNode *anGiven = ( (AllocNode *)pv ) - 1;
-   AllocNode *an;
-   int result = FALSE;
+   if( SPYING() )
+      return SpyDidAlloc( pv );
+
+   return TaskDidAlloc( pv );
+}
 
-   LockAllocList();
+static
+void IMalloc_HeapMinimize( IMalloc *self )
+{
+   if( SPYING() )
+      SpyHeapMinimize();
+   else
+      TaskHeapMinimize();
+}
 
-   for(		/* NOTE: THIS IS A BRUTE-FORCE IMPLEMENTATION.  It's slow! */
-       an = (AllocNode *)allocList.head;
-       ( result == FALSE ) && ( an -> node.next );
-       an = (AllocNode *)an -> node.next
-      )
+/************************************************************************/
+/* Background Trimming							*/
+/************************************************************************/
+
+/*
+ * If asked to (see gCoTaskMemSetTrimInterval()), a thread of our own
+ * calls HeapTrim() periodically, so that memory left over from a spike
+ * in demand finds its way back to the system without anybody having to
+ * call HeapMinimize().
+ */
+
+static pthread_mutex_t trimLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t trimCond = PTHREAD_COND_INITIALIZER;
+static pthread_t trimThread;
+static Bool trimRunning = FALSE;
+static uint32 trimInterval = 0;		/* Milliseconds; 0 = stop */
+
+static void *Trimmer( void *pv )
+{
+   struct timespec deadline;
+   int rc;
+
+   pthread_mutex_lock( &trimLock );
+   while( trimInterval != 0 )
    {
-      if( an == anGiven )
-	      result = TRUE;
-   }
+      clock_gettime( CLOCK_REALTIME, &deadline );
+      deadline.tv_sec += trimInterval / 1000;
+      deadline.tv_nsec += ( trimInterval % 1000 ) * 1000000L;
+      if( deadline.tv_nsec >= 1000000000L )
+      {
+	 deadline.tv_sec++;
+	 deadline.tv_nsec -= 1000000000L;
+      }
 
-   UnlockAllocList();
+      rc = pthread_cond_timedwait( &trimCond, &trimLock, &deadline );
+      if( ( rc == ETIMEDOUT ) && ( trimInterval != 0 ) )
+      {
+	 pthread_mutex_unlock( &trimLock );
+	 HeapTrim( TRIM_ADVICE_LAZY );
+	 pthread_mutex_lock( &trimLock );
+      }
+   }
+   pthread_mutex_unlock( &trimLock );
 
-   return result;
+   return NULL;
 }
 
-static
-void IMalloc_HeapMinimize( IMalloc *self )
+/*
+ * Changes the trimmer's interval, starting or stopping the thread as
+ * needed.  Returns FALSE only if the thread couldn't be started.  Callers
+ * hold the init count lock, so only one thread at a time gets here.
+ */
+
+static Bool TrimmerSetInterval( uint32 msInterval )
 {
-   /* Do nothing -- ANSI C provides no counterpart. */
+   Bool joinIt = FALSE;
+   Bool ok = TRUE;
+
+   pthread_mutex_lock( &trimLock );
+   trimInterval = msInterval;
+   if( ( msInterval != 0 ) && !trimRunning )
+   {
+      trimRunning =
+	 ( pthread_create( &trimThread, NULL, &Trimmer, NULL ) == 0 );
+      ok = trimRunning;
+   }
+   else if( ( msInterval == 0 ) && trimRunning )
+   {
+      trimRunning = FALSE;
+      joinIt = TRUE;
+   }
+   pthread_cond_signal( &trimCond );
+   pthread_mutex_unlock( &trimLock );
+
+   if( joinIt )
+      pthread_join( trimThread, NULL );
+
+   return ok;
 }
 
 /************************************************************************/
@@ -279,50 +1933,133 @@ static const IMalloc TaskMalloc =
    &TaskMallocVtbl
 };
 
-static IMalloc *pTaskMalloc = &TaskMalloc;
+/*
+ * The process' allocator is normally TaskMalloc, but the application may
+ * register one of its own before initializing GCOM (see
+ * CoRegisterMalloc()).  The CoTaskMem*() wrappers only dispatch through
+ * the vtable for a registered allocator; for the built-in one, they call
+ * straight into its methods.
+ */
+
+#define BUILTIN_MALLOC()	__builtin_expect( pTaskMalloc == &TaskMalloc, 1 )
+
+static IMalloc *pTaskMalloc = (IMalloc *)&TaskMalloc;
 static uint32 initCount = 0;
 
 /*
  * TaskMallocInitialize() and TaskMallocUninitialize() are called
  * by CoInitialize() and CoUninitialize(), respectively.  Threads should
  * never, ever call these functions directly.
+ *
+ * If the process is exiting (see gCoUninitializeForExit()), the heap is
+ * left exactly as it is: the kernel reclaims it wholesale far faster than
+ * we could, and anything still running on the way out can go on using
+ * and freeing its blocks.  Only our own threads are stopped.
  */
 
 HRESULT TaskMallocInitialize( void )
 {
+   HRESULT hr = S_FALSE;
+
+   pthread_once( &tcKeyOnce, &ThreadCacheCreateKey );
+   pthread_once( &numaOnce, &NumaDetect );
+
+   LockInitCount();
    initCount++;
    if( initCount == 1 )
    {
-      ListInitialize( &allocList );
-      return S_OK;
+      LockHeap();
+      if( tcList.head == NULL )
+	 ListInitialize( &tcList );
+      UnlockHeap();
+
+      hr = S_OK;
    }
-   
-   return S_FALSE;
+   UnlockInitCount();
+
+   return hr;
 }
 
-HRESULT TaskMallocUninitialize( void )
+HRESULT TaskMallocUninitialize( Bool exiting )
 {
-   AllocNode *an, *nan;
+   ChunkHeader **leaf, *ch;
+   ThreadCache *tc;
+   uintptr_t i, j;
 
+   LockInitCount();
    if( initCount != 1 )
    {
-      initCount--;
+      if( initCount != 0 )
+	 initCount--;
+      UnlockInitCount();
       return S_FALSE;
    }
 
-   LockAllocList();
-   an = (AllocNode *)( allocList.head );
-   while( an -> node.next )
+   TrimmerSetInterval( 0 );
+   MemoryPressureUninitialize();
+
+   if( exiting )
+   {
+      initCount--;
+      UnlockInitCount();
+      return S_OK;
+   }
+
+   SharedMallocUninitialize();
+
+   /*
+    * Outstanding blocks are released a chunk at a time, never one by one,
+    * by sweeping the page map for the first chunk of every mapping.  The
+    * thread caches themselves stay put, since threads still refer to them,
+    * but they forget about the slabs they owned.
+    */
+
+   LockHeap();
+   for( i = 0; i < PAGEMAP_SIZE; i++ )
+   {
+      leaf = pageMap[ i ];
+      if( leaf == NULL )
+	 continue;
+
+      for( j = 0; j < PAGEMAP_SIZE; j++ )
+      {
+	 ch = leaf[ j ];
+	 if( ( ch != NULL ) &&
+	     ( ChunkNumber( ch ) == ( ( i << PAGEMAP_BITS ) | j ) ) )
+	    ChunkUnmap( ch, ChunkCount( ch ) );
+
+	 leaf[ j ] = NULL;
+      }
+   }
+
+   HeapProfileReset();
+   while( chunkCacheCount > 0 )
+      ChunkUnmap( chunkCache[ --chunkCacheCount ], 1 );
+
+   for( i = 0; i < MAX_NUMA_NODES; i++ )
+      nodeStats[ i ].cbMapped = 0;
+
+   for( i = 1; i < MAX_COMPONENTS; i++ )
    {
-      nan = (AllocNode *)an -> node.next;
-      NodeRemove( (Node *)an );
-      free( an );
+      components[ i ].cbStray = 0;
+      components[ i ].cbPeak = 0;
+      components[ i ].overBudget = FALSE;
+   }
 
-      an = nan;
+   for(
+       tc = (ThreadCache *)tcList.head;
+       tc -> node.next;
+       tc = (ThreadCache *)tc -> node.next
+      )
+   {
+      ThreadCacheReset( tc );
+      if( tc -> componentLive != NULL )
+	 memset( (void *)tc -> componentLive, 0, MAX_COMPONENTS * sizeof( int64 ) );
    }
-   UnlockAllocList();
+   UnlockHeap();
 
    initCount--;
+   UnlockInitCount();
    return S_OK;
 }
 
@@ -337,12 +2074,11 @@ HRESULT TaskMallocUninitialize( void )
  * For more information on memory allocators, please refer to the Microsoft
  * COM 0.9 specifications document.
  *
- * NOTE FOR AMIGA USERS: Elate operates without memory protection; as a
- * result, the task allocator is simultaneously also the shared memory
- * allocator.  As a result, MEMCTX_SHARED and MEMCTX_TASK both return
- * the same object.  Please note, however, that this can change in future
- * releases of either Elate or Ami environments.  Do not depend on this
- * behavior.
+ * The MEMCTX_SHARED allocator hands out memory which can be shared with
+ * other processes.  Its heap lives in a memfd, which another process can
+ * map by calling gCoSharedMemAttach(); blocks are passed between the two
+ * as handles, using gCoSharedMemToHandle() and gCoSharedMemFromHandle().
+ * The shared allocator is created the first time it's asked for.
  *
  * @param memctx
  * This parameter specifies the memory allocator desired.  There are
@@ -360,9 +2096,8 @@ HRESULT TaskMallocUninitialize( void )
  * E_INVALIDARG if the specified memory context isn't supported.  Currently
  * only MEMCTX_TASK and MEMCTX_SHARED are supported.
  * 
- * E_NOMEMORY if there wasn't enough memory to create the memory allocator
- * object.  This implementation of GCOM never returns this specific error,
- * but do not depend on this behavior.
+ * E_OUTOFMEMORY if there wasn't enough memory to create the memory
+ * allocator object.  Only the MEMCTX_SHARED allocator can fail this way.
  *
  * @see CoTaskMemAlloc
  * @see CoTaskMemRealloc
@@ -373,12 +2108,18 @@ HRESULT CoGetMalloc( MEMCTX memctx, IMalloc **ppMalloc )
 {
    *ppMalloc = NULL;
    
-   if( ( memctx == MEMCTX_TASK ) || ( memctx == MEMCTX_SHARED ) )
+   if( memctx == MEMCTX_TASK )
    {
       *ppMalloc = pTaskMalloc;
-      IMalloc_AddRef( pTaskMalloc );
+      pTaskMalloc -> lpVtbl -> AddRef( pTaskMalloc );
       return S_OK;
    }
+
+   if( memctx == MEMCTX_SHARED )
+   {
+      *ppMalloc = SharedMallocGet();
+      return ( *ppMalloc != NULL ) ? S_OK : E_OUTOFMEMORY;
+   }
    
    return E_INVALIDARG;
 }
@@ -416,13 +2157,18 @@ void *CoTaskMemAlloc( uint32 cBytes )
     * Note that we don't go through the riff-raff specified above.
     * We know that the allocator object is /always/ present in the
     * process, since we never unload it (regardless of its reference
-    * count).  Therefore, there's no point in wasting CPU cycles on it.
+    * count), and a registered allocator can't change while GCOM is
+    * initialized.  Therefore, there's no point in wasting CPU cycles
+    * on it.
     */
 
-   if( initCount != 0 )
+   if( initCount == 0 )
+	   return NULL;
+
+   if( BUILTIN_MALLOC() )
 	   return IMalloc_Alloc( pTaskMalloc, cBytes );
    else
-	   return NULL;
+	   return pTaskMalloc -> lpVtbl -> Alloc( pTaskMalloc, cBytes );
 }
 
 /**
@@ -463,13 +2209,18 @@ void *CoTaskMemRealloc( void *pvMem, uint32 cb )
     * Note that we don't go through the riff-raff specified above.
     * We know that the allocator object is /always/ present in the
     * process, since we never unload it (regardless of its reference
-    * count).  Therefore, there's no point in wasting CPU cycles on it.
+    * count), and a registered allocator can't change while GCOM is
+    * initialized.  Therefore, there's no point in wasting CPU cycles
+    * on it.
     */
 
-   if( initCount != 0 )
+   if( initCount == 0 )
+	   return NULL;
+
+   if( BUILTIN_MALLOC() )
 	   return IMalloc_Realloc( pTaskMalloc, pvMem, cb );
    else
-	   return NULL;
+	   return pTaskMalloc -> lpVtbl -> Realloc( pTaskMalloc, pvMem, cb );
 }
 
 /**
@@ -497,6 +2248,526 @@ void *CoTaskMemRealloc( void *pvMem, uint32 cb )
 
 void CoTaskMemFree( void *pvMem )
 {
-   if( initCount != 0 )
+   if( initCount == 0 )
+	   return;
+
+   if( BUILTIN_MALLOC() )
 	   IMalloc_Free( pTaskMalloc, pvMem );
+   else
+	   pTaskMalloc -> lpVtbl -> Free( pTaskMalloc, pvMem );
+}
+
+/**
+ * This function registers a spy on the task allocator.  From then on,
+ * every call made on the task allocator, whether through its IMalloc
+ * interface or through the CoTaskMem*() wrappers, is bracketed by calls
+ * to the spy's corresponding IMallocSpy::Pre*() and IMallocSpy::Post*()
+ * methods.  The spy may change the arguments on the way in and the
+ * results on the way out; in particular, it may ask for extra room in
+ * each block to keep its own bookkeeping in.
+ *
+ * GCOM does not track which blocks were allocated while the spy was
+ * registered, so the fSpyed argument passed to the spy is always TRUE.
+ * A spy which alters the layout of the blocks it sees must therefore
+ * be registered before any are allocated, and never revoked while any
+ * are still outstanding.  Calls which the spy itself makes on the task
+ * allocator from within its own methods are not spied on.
+ *
+ * While no spy is registered, the task allocator pays only for a single
+ * predicted branch per call.  Spies only ever see the built-in task
+ * allocator, not one registered with CoRegisterMalloc().
+ *
+ * @param pMallocSpy
+ * This parameter points to the spy object.  It must support the
+ * IMallocSpy interface; the task allocator holds a reference to it until
+ * CoRevokeMallocSpy() is called.
+ *
+ * @returns
+ * S_OK if the spy was registered.  CO_E_OBJISREG if a spy is already
+ * registered.  E_INVALIDARG if pMallocSpy doesn't support IMallocSpy.
+ *
+ * @see CoRevokeMallocSpy
+ */
+
+HRESULT CoRegisterMallocSpy( IMallocSpy *pMallocSpy )
+{
+   IMallocSpy *spy;
+   HRESULT hr;
+
+   if( pMallocSpy == NULL )
+      return E_INVALIDARG;
+
+   hr = pMallocSpy -> lpVtbl -> QueryInterface(
+	 pMallocSpy, IID_IMallocSpy, (void **)&spy
+	);
+   if( FAILED( hr ) )
+      return E_INVALIDARG;
+
+   pthread_mutex_lock( &spyLock );
+   if( pSpy != NULL )
+   {
+      pthread_mutex_unlock( &spyLock );
+      spy -> lpVtbl -> Release( spy );
+      return CO_E_OBJISREG;
+   }
+
+   pSpy = spy;
+   pthread_mutex_unlock( &spyLock );
+
+   return S_OK;
+}
+
+/**
+ * This function revokes the spy registered by CoRegisterMallocSpy(),
+ * waits for any calls still running inside of it to finish, and releases
+ * the task allocator's reference to it.
+ *
+ * @returns
+ * S_OK if the spy was revoked.  CO_E_OBJNOTREG if no spy was registered.
+ *
+ * @see CoRegisterMallocSpy
+ */
+
+HRESULT CoRevokeMallocSpy( void )
+{
+   IMallocSpy *spy;
+
+   pthread_mutex_lock( &spyLock );
+   spy = pSpy;
+   if( spy == NULL )
+   {
+      pthread_mutex_unlock( &spyLock );
+      return CO_E_OBJNOTREG;
+   }
+
+   pSpy = NULL;
+   __sync_synchronize();
+   while( spyCalls != 0 )
+      sched_yield();
+   pthread_mutex_unlock( &spyLock );
+
+   spy -> lpVtbl -> Release( spy );
+   return S_OK;
+}
+
+/**
+ * This function releases the memory the task allocator holds on to
+ * but isn't using, handing it back to the operating system.  This is
+ * what the task allocator's IMalloc::HeapMinimize() method does; unlike
+ * that method, this function also reports how much it gave back.
+ *
+ * Memory cached by threads other than the caller is given back later,
+ * the next time each of those threads allocates memory, and isn't
+ * included in the count.  If the application registered an allocator
+ * of its own, its IMalloc::HeapMinimize() method is called instead, and
+ * nothing is counted.
+ *
+ * @returns
+ * The number of bytes returned to the system.
+ *
+ * @see gCoTaskMemSetTrimInterval
+ */
+
+uint64 gCoTaskMemMinimize( void )
+{
+   if( initCount == 0 )
+      return 0;
+
+   if( !BUILTIN_MALLOC() )
+   {
+      pTaskMalloc -> lpVtbl -> HeapMinimize( pTaskMalloc );
+      return 0;
+   }
+
+   if( SPYING() )
+      return SpyHeapMinimize();
+
+   return TaskHeapMinimize();
+}
+
+/**
+ * This function has a background thread minimize the task allocator's
+ * heap at regular intervals.  The background thread uses MADV_FREE where
+ * the system supports it, so pages are only actually taken away from the
+ * process when the system needs them.
+ *
+ * The background thread stops automatically when the last call to
+ * CoUninitialize() is made.
+ *
+ * @param msInterval
+ * The time between trims, in milliseconds.  Zero stops the background
+ * thread.
+ *
+ * @returns
+ * S_OK if successful.  E_UNEXPECTED if GCOM hasn't been initialized.
+ * E_OUTOFMEMORY if the background thread couldn't be created.
+ *
+ * @see gCoTaskMemMinimize
+ */
+
+HRESULT gCoTaskMemSetTrimInterval( uint32 msInterval )
+{
+   HRESULT hr = S_OK;
+
+   LockInitCount();
+   if( initCount == 0 )
+      hr = E_UNEXPECTED;
+   else if( !TrimmerSetInterval( msInterval ) )
+      hr = E_OUTOFMEMORY;
+   UnlockInitCount();
+
+   return hr;
+}
+
+/**
+ * This function allocates a block of memory from the task allocator,
+ * much like CoTaskMemAlloc(), but guarantees the block starts on a
+ * boundary of the given alignment.  The block may be released with
+ * CoTaskMemFree(), and is understood by the task allocator's
+ * IMalloc::GetSize() and IMalloc::DidAlloc() methods.
+ *
+ * Note that CoTaskMemRealloc() only preserves the alignment if the block
+ * can be resized in place.  Also, a malloc spy which moves the pointer
+ * returned to the client (see CoRegisterMallocSpy()) defeats the
+ * alignment guarantee.  If the application registered an allocator of
+ * its own (see CoRegisterMalloc()), this function fails unless that
+ * allocator happens to return a suitably aligned block.
+ *
+ * @param cBytes
+ * This parameter specifies the size of the memory block to allocate.
+ *
+ * @param cbAlignment
+ * This parameter specifies the alignment required.  It must be a power
+ * of two no larger than the system's page size.  Blocks returned by
+ * CoTaskMemAlloc() are always aligned to at least 16 bytes.
+ *
+ * @returns
+ * NULL if the memory couldn't be allocated, or if cbAlignment is not
+ * valid.  Otherwise, a pointer to the memory block is returned.
+ *
+ * @see CoTaskMemAlloc
+ * @see CoTaskMemFree
+ */
+
+void *CoTaskMemAllocAligned( uint32 cBytes, uint32 cbAlignment )
+{
+   void *pv;
+
+   if( ( cbAlignment == 0 ) || ( ( cbAlignment & ( cbAlignment - 1 ) ) != 0 ) )
+      return NULL;
+
+   if( cbAlignment > (uint32)sysconf( _SC_PAGESIZE ) )
+      return NULL;
+
+   if( initCount == 0 )
+      return NULL;
+
+   if( !BUILTIN_MALLOC() )
+   {
+      /*
+       * IMalloc has no way to ask for alignment, and we can't free an
+       * offset pointer through it either, so the best we can do is hope
+       * the registered allocator's natural alignment suffices.
+       */
+
+      pv = pTaskMalloc -> lpVtbl -> Alloc( pTaskMalloc, cBytes );
+      if( ( (uintptr_t)pv & ( cbAlignment - 1 ) ) != 0 )
+      {
+	 pTaskMalloc -> lpVtbl -> Free( pTaskMalloc, pv );
+	 pv = NULL;
+      }
+      return pv;
+   }
+
+   if( SPYING() )
+      return SpyAlloc( cBytes, cbAlignment );
+
+   return TaskAllocAligned( cBytes, cbAlignment );
+}
+
+/**
+ * This function replaces the process' task allocator with one provided
+ * by the application.  From then on, CoGetMalloc( MEMCTX_TASK, ... ) and
+ * the CoTaskMemAlloc(), CoTaskMemRealloc() and CoTaskMemFree() functions,
+ * and therefore GCOM itself and every component using them, go through
+ * the registered allocator.
+ *
+ * Since blocks from one allocator can't be freed by another, the task
+ * allocator may only be changed while GCOM is not initialized; that is,
+ * before the first call to CoInitialize(), or after the last call to
+ * CoUninitialize().
+ *
+ * @param pMalloc
+ * This parameter points to the allocator to use.  GCOM holds a reference
+ * to it until it is replaced.  NULL restores the built-in allocator.
+ *
+ * @returns
+ * S_OK if successful.  E_UNEXPECTED if GCOM is currently initialized.
+ *
+ * @see CoGetMalloc
+ */
+
+HRESULT CoRegisterMalloc( IMalloc *pMalloc )
+{
+   IMalloc *pOld;
+
+   if( pMalloc == NULL )
+      pMalloc = (IMalloc *)&TaskMalloc;
+
+   LockInitCount();
+   if( initCount != 0 )
+   {
+      UnlockInitCount();
+      return E_UNEXPECTED;
+   }
+
+   pOld = pTaskMalloc;
+   pMalloc -> lpVtbl -> AddRef( pMalloc );
+   pTaskMalloc = pMalloc;
+   UnlockInitCount();
+
+   pOld -> lpVtbl -> Release( pOld );
+   return S_OK;
+}
+
+/**
+ * This function tells whether the task allocator is GCOM's own, rather
+ * than one the application registered with CoRegisterMalloc().  Only the
+ * built-in allocator honours CoTaskMemAllocAligned() for any alignment
+ * up to a page.
+ *
+ * @returns
+ * TRUE if the built-in allocator is in use, FALSE otherwise.
+ *
+ * @see CoRegisterMalloc
+ * @see CoTaskMemAllocAligned
+ */
+
+Bool gCoTaskMemIsBuiltin( void )
+{
+   return BUILTIN_MALLOC() ? TRUE : FALSE;
+}
+
+/**
+ * This function allocates a block of memory from the task allocator,
+ * much like CoTaskMemAlloc(), but from memory on the given NUMA node
+ * rather than the node the caller happens to be running on.  Use it for
+ * objects which will mostly be used by threads on another node.  The
+ * block is released with CoTaskMemFree() as usual.
+ *
+ * Allocations made this way are not seen by malloc spies, nor sampled by
+ * the heap profiler.  If the application registered an allocator of its
+ * own (see CoRegisterMalloc()), the node is ignored.
+ *
+ * @param cBytes
+ * This parameter specifies the size of the memory block to allocate.
+ *
+ * @param node
+ * The NUMA node to allocate from, counting from zero.  See
+ * gCoTaskMemGetNodeCount().
+ *
+ * @returns
+ * NULL if the memory couldn't be allocated, or if the node doesn't exist.
+ * Otherwise, a pointer to the memory block is returned.
+ *
+ * @see CoTaskMemAlloc
+ * @see gCoTaskMemGetNodeStats
+ */
+
+void *CoTaskMemAllocOnNode( uint32 cBytes, uint32 node )
+{
+   ThreadCache *tc;
+   void *pv;
+
+   if( ( initCount == 0 ) || ( node >= numaNodes ) )
+      return NULL;
+
+   if( !BUILTIN_MALLOC() )
+      return pTaskMalloc -> lpVtbl -> Alloc( pTaskMalloc, cBytes );
+
+   __sync_add_and_fetch( &nodeStats[ node ].cNodeAllocs, 1 );
+
+   if( cBytes > MAX_SMALL_SIZE )
+      return LargeAllocOnNode( cBytes, 0, (uint16)node );
+
+   tc = GetNodeHeap( (uint16)node );
+   if( tc == NULL )
+      return NULL;
+
+   pthread_mutex_lock( &nodeHeapLock[ node ] );
+   pv = SlabAlloc( tc, SizeToClass( cBytes ) );
+   pthread_mutex_unlock( &nodeHeapLock[ node ] );
+
+   return pv;
+}
+
+/**
+ * This function returns the number of NUMA nodes the task allocator
+ * knows about.  On machines without NUMA, there is exactly one.
+ *
+ * @returns
+ * The number of nodes.
+ *
+ * @see CoTaskMemAllocOnNode
+ */
+
+uint32 gCoTaskMemGetNodeCount( void )
+{
+   pthread_once( &numaOnce, &NumaDetect );
+   return numaNodes;
+}
+
+/**
+ * This function reports how much of the task allocator's memory lives on
+ * a given NUMA node.
+ *
+ * @param node
+ * The node to report on, counting from zero.
+ *
+ * @param pStats
+ * This parameter points to a structure to fill in.  cbMapped receives
+ * the number of bytes in chunks bound to the node which are in use,
+ * cbCached the number of bytes in chunks kept around for reuse, and
+ * cNodeAllocs the number of calls made to CoTaskMemAllocOnNode() for the
+ * node.
+ *
+ * @returns
+ * S_OK if successful.  E_INVALIDARG if the node doesn't exist.
+ *
+ * @see gCoTaskMemGetNodeCount
+ */
+
+HRESULT gCoTaskMemGetNodeStats( uint32 node, TASKMEMNODESTATS *pStats )
+{
+   uint32 i;
+
+   if( node >= gCoTaskMemGetNodeCount() )
+      return E_INVALIDARG;
+
+   LockHeap();
+   pStats -> cbMapped = nodeStats[ node ].cbMapped;
+   pStats -> cbCached = 0;
+   for( i = 0; i < chunkCacheCount; i++ )
+   {
+      if( chunkCacheNode[ i ] == node )
+	 pStats -> cbCached += CHUNK_SIZE;
+   }
+   pStats -> cNodeAllocs = nodeStats[ node ].cNodeAllocs;
+   UnlockHeap();
+
+   return S_OK;
+}
+
+/************************************************************************/
+/* Component accounting, for dll.c					*/
+/************************************************************************/
+
+/*
+ * Hands out a component number for a newly loaded library, reusing that
+ * of a library since unloaded if none of its memory is still live.
+ * Returns zero if we've run out, in which case the library's allocations
+ * simply go unattributed.
+ */
+
+uint16 TaskComponentAttach( void )
+{
+   Component *c = NULL;
+   uint16 id;
+
+   LockHeap();
+   for( id = 1; id < MAX_COMPONENTS; id++ )
+   {
+      c = &components[ id ];
+      if( !c -> attached && ( ComponentLive( id ) == 0 ) )
+	 break;
+   }
+
+   if( id < MAX_COMPONENTS )
+   {
+      c -> attached = TRUE;
+      c -> overBudget = FALSE;
+      c -> cbBudget = 0;
+      c -> cbPeak = 0;
+   }
+   UnlockHeap();
+
+   return ( id < MAX_COMPONENTS ) ? id : 0;
+}
+
+/*
+ * Called when a library is unloaded.  Its heaps stay put, along with any
+ * blocks it still has live; they're credited back as they're freed.
+ */
+
+void TaskComponentDetach( uint16 id )
+{
+   IMemoryPressure *sink;
+
+   if( id == 0 )
+      return;
+
+   LockHeap();
+   sink = components[ id ].budgetSink;
+   components[ id ].budgetSink = NULL;
+   components[ id ].cbBudget = 0;
+   components[ id ].attached = FALSE;
+   UnlockHeap();
+
+   if( sink != NULL )
+      sink -> lpVtbl -> Release( sink );
+}
+
+/*
+ * Makes a component current for the calling thread, returning the one
+ * that was.
+ */
+
+uint16 TaskComponentSwitch( uint16 id )
+{
+   uint16 previous = tcComponent;
+
+   tcComponent = id;
+   return previous;
+}
+
+void TaskComponentGetStats( uint16 id, TASKMEMCOMPONENTSTATS *pStats )
+{
+   uint64 live;
+
+   if( ( id == 0 ) || ( id >= MAX_COMPONENTS ) )
+   {
+      memset( pStats, 0, sizeof( TASKMEMCOMPONENTSTATS ) );
+      return;
+   }
+
+   LockHeap();
+   live = ComponentLive( id );
+   if( live > components[ id ].cbPeak )
+      components[ id ].cbPeak = live;
+
+   pStats -> cbLive = live;
+   pStats -> cbPeak = components[ id ].cbPeak;
+   pStats -> cbBudget = components[ id ].cbBudget;
+   UnlockHeap();
+}
+
+void TaskComponentSetBudget( uint16 id, uint64 cbBudget, IMemoryPressure *sink )
+{
+   IMemoryPressure *old;
+
+   if( ( id == 0 ) || ( id >= MAX_COMPONENTS ) )
+      return;
+
+   if( sink != NULL )
+      sink -> lpVtbl -> AddRef( sink );
+
+   LockHeap();
+   old = components[ id ].budgetSink;
+   components[ id ].budgetSink = sink;
+   components[ id ].cbBudget = cbBudget;
+   components[ id ].overBudget = FALSE;
+   UnlockHeap();
+
+   if( old != NULL )
+      old -> lpVtbl -> Release( old );
 }
@@ -0,0 +1,389 @@
+/*
+ * arena.c
+ * GCOM Release 0.3
+ *
+ * Copyright (c) 1999, 2000 Samuel A. Falvo II
+ *
+ * This software is provided 'as-is', without any implied or express warranty.
+ * In no event shall the authors be held liable for damages arising from the
+ * use this software.
+ *
+ * Permission is granted for anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software in a
+ *    product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+#include <stddef.h>
+#include <string.h>
+#include <pthread.h>
+#include <gcom/gcom.h>
+#include "alloc-private.h"
+
+/************************************************************************/
+/* Prototypes								*/
+/************************************************************************/
+
+static HRESULT Arena_QueryInterface( IMalloc *, REFIID, void ** );
+static uint32  Arena_AddRef        ( IMalloc * );
+static uint32  Arena_Release       ( IMalloc * );
+static void *  Arena_Alloc         ( IMalloc *, uint32 );
+static void *  Arena_Realloc       ( IMalloc *, void *, uint32 );
+static void    Arena_Free          ( IMalloc *, void * );
+static uint32  Arena_GetSize       ( IMalloc *, void * );
+static int     Arena_DidAlloc      ( IMalloc *, void * );
+static void    Arena_HeapMinimize  ( IMalloc * );
+
+/************************************************************************/
+/* Arena allocator objects.  Unlike the task allocator, these are real	*/
+/* reference counted COM objects; there can be any number of them.	*/
+/************************************************************************/
+
+/*
+ * An arena hands out memory by bumping a pointer through regions, which
+ * are chunks obtained from the task allocator.  Nothing is ever freed
+ * individually; when the last reference to the arena goes away, all of
+ * its regions go back to the task allocator at once.
+ *
+ * The arena object itself lives in its first region, right after the
+ * region header, so creating an arena costs exactly one chunk.
+ */
+
+typedef struct Arena Arena;
+typedef struct ArenaRegion ArenaRegion;
+
+struct ArenaRegion
+{
+   ChunkHeader	hdr;
+   Arena *	arena;
+   ArenaRegion *next;
+   uint8 *	bump;		/* Next free byte */
+   uint8 *	limit;		/* End of the region */
+};
+
+struct Arena
+{
+   IMalloc	imalloc;	/* Must be first */
+   uint32	refCount;
+   pthread_mutex_t lock;
+   ArenaRegion *current;	/* Region we're bumping through */
+   ArenaRegion *regions;	/* All regions, including current */
+   uint8 *	last;		/* Most recent block, for in-place Realloc */
+};
+
+/* Rounds in size_t, so a 32-bit size near 4GB doesn't wrap to zero */
+
+#define ROUND16(n)		( ( (size_t)(n) + 15 ) & ~(size_t)15 )
+#define REGION_OFFSET		ROUND16( sizeof( ArenaRegion ) )
+
+static const IMallocVtbl ArenaMallocVtbl =
+{
+   &Arena_QueryInterface,
+   &Arena_AddRef,
+   &Arena_Release,
+   &Arena_Alloc,
+   &Arena_Realloc,
+   &Arena_Free,
+   &Arena_GetSize,
+   &Arena_DidAlloc,
+   &Arena_HeapMinimize
+};
+
+/*
+ * Obtains a new region large enough for cBytes of blocks (headers
+ * included), and links it onto the arena's list of regions.  Returns
+ * NULL if we're out of memory, or the region would be too big to map.
+ */
+
+static ArenaRegion *NewRegion( Arena *self, size_t cBytes )
+{
+   ArenaRegion *region;
+   size_t chunks;
+
+   if( cBytes > (size_t)-1 - REGION_OFFSET - CHUNK_MASK )
+      return NULL;
+
+   chunks = ( REGION_OFFSET + cBytes + CHUNK_MASK ) >> CHUNK_SHIFT;
+   if( chunks > 0xFFFFFFFF )
+      return NULL;
+
+   region = (ArenaRegion *)TaskChunkAcquire( (uint32)chunks, CHUNK_ARENA );
+   if( region == NULL )
+      return NULL;
+
+   region -> hdr.size = (uint32)chunks;
+   region -> arena = self;
+   region -> bump = (uint8 *)region + REGION_OFFSET;
+   region -> limit = (uint8 *)region + ( (size_t)chunks << CHUNK_SHIFT );
+   region -> next = NULL;
+
+   if( self != NULL )
+   {
+      region -> next = self -> regions;
+      self -> regions = region;
+   }
+
+   return region;
+}
+
+/*
+ * Carves a block out of the arena.  Requests too big for an ordinary
+ * region get a region to themselves, so that every block starts within
+ * the first chunk of its region; that leaves the current region alone.
+ * Must be called with the arena locked.
+ */
+
+static void *ArenaCarve( Arena *self, uint32 cBytes )
+{
+   ArenaRegion *region = self -> current;
+   size_t need;
+   uint8 *pv;
+
+   need = ARENA_BLOCK_OFFSET + ROUND16( cBytes );
+   if( region -> bump + need > region -> limit )
+   {
+      if( REGION_OFFSET + need > CHUNK_SIZE )
+      {
+	 region = NewRegion( self, need );
+	 if( region == NULL )
+	    return NULL;
+      }
+      else
+      {
+	 region = NewRegion( self, CHUNK_SIZE - REGION_OFFSET );
+	 if( region == NULL )
+	    return NULL;
+	 self -> current = region;
+      }
+   }
+
+   pv = region -> bump + ARENA_BLOCK_OFFSET;
+   region -> bump += need;
+   ARENA_BLOCK_SIZE( pv ) = cBytes;
+
+   self -> last = pv;
+   return pv;
+}
+
+/*
+ * The IUnknown methods.
+ */
+
+static
+HRESULT Arena_QueryInterface( IMalloc *self, REFIID riid, void **ppv )
+{
+   HRESULT hr;
+
+   *ppv = NULL;
+   hr = E_NOINTERFACE;
+
+   if( IsEqualIID( riid, IID_IUnknown ) || IsEqualIID( riid, IID_IMalloc ) )
+   {
+      *ppv = self;
+      Arena_AddRef( self );
+      hr = S_OK;
+   }
+
+   return hr;
+}
+
+static
+uint32 Arena_AddRef( IMalloc *pMalloc )
+{
+   Arena *self = (Arena *)pMalloc;
+
+   return __sync_add_and_fetch( &self -> refCount, 1 );
+}
+
+static
+uint32 Arena_Release( IMalloc *pMalloc )
+{
+   Arena *self = (Arena *)pMalloc;
+   ArenaRegion *region, *next;
+   uint32 refCount;
+
+   refCount = __sync_sub_and_fetch( &self -> refCount, 1 );
+   if( refCount != 0 )
+      return refCount;
+
+   /*
+    * This is the whole point of an arena: everything it ever handed out
+    * goes away here, a region at a time.  The arena object itself lives
+    * in the oldest region, which is last on the list.
+    */
+
+   pthread_mutex_destroy( &self -> lock );
+   for( region = self -> regions; region; region = next )
+   {
+      next = region -> next;
+      TaskChunkRelease( &region -> hdr );
+   }
+
+   return 0;
+}
+
+/*
+ * The IMalloc methods.
+ */
+
+static
+void *Arena_Alloc( IMalloc *pMalloc, uint32 cBytes )
+{
+   Arena *self = (Arena *)pMalloc;
+   void *pv;
+
+   pthread_mutex_lock( &self -> lock );
+   pv = ArenaCarve( self, cBytes );
+   pthread_mutex_unlock( &self -> lock );
+
+   return pv;
+}
+
+/*
+ * Blocks shrink in place.  The most recently allocated block can also
+ * grow in place, if there's room left in the current region; any other
+ * block is copied, and the old copy simply abandoned.
+ */
+
+static
+void *Arena_Realloc( IMalloc *pMalloc, void *pv, uint32 cBytes )
+{
+   Arena *self = (Arena *)pMalloc;
+   ArenaRegion *region;
+   uint32 oldSize;
+   void *pvNew;
+
+   if( pv == NULL )
+      return Arena_Alloc( pMalloc, cBytes );
+
+   pthread_mutex_lock( &self -> lock );
+
+   oldSize = ARENA_BLOCK_SIZE( pv );
+   region = self -> current;
+
+   if( ROUND16( cBytes ) <= ROUND16( oldSize ) )
+   {
+      ARENA_BLOCK_SIZE( pv ) = cBytes;
+      pvNew = pv;
+   }
+   else if(
+	      ( pv == self -> last )
+	   && ( (uint8 *)pv + ROUND16( oldSize ) == region -> bump )
+	   && ( (uint8 *)pv + ROUND16( cBytes ) <= region -> limit )
+	  )
+   {
+      region -> bump = (uint8 *)pv + ROUND16( cBytes );
+      ARENA_BLOCK_SIZE( pv ) = cBytes;
+      pvNew = pv;
+   }
+   else
+   {
+      pvNew = ArenaCarve( self, cBytes );
+      if( pvNew != NULL )
+	 memcpy( pvNew, pv, oldSize );
+   }
+
+   pthread_mutex_unlock( &self -> lock );
+
+   return pvNew;
+}
+
+static
+void Arena_Free( IMalloc *self, void *pv )
+{
+   /* Do nothing -- memory is reclaimed when the arena is released. */
+}
+
+static
+uint32 Arena_GetSize( IMalloc *self, void *pv )
+{
+   return ARENA_BLOCK_SIZE( pv );
+}
+
+static
+int Arena_DidAlloc( IMalloc *pMalloc, void *pv )
+{
+   Arena *self = (Arena *)pMalloc;
+   ArenaRegion *region;
+   int result = FALSE;
+
+   TaskHeapLock();
+   region = (ArenaRegion *)TaskPageMapLookup( pv );
+   if( ( region != NULL ) && ( region -> hdr.kind == CHUNK_ARENA ) )
+      result = ( region -> arena == self )
+	    && ( (uint8 *)pv < region -> bump );
+   TaskHeapUnlock();
+
+   return result;
+}
+
+static
+void Arena_HeapMinimize( IMalloc *self )
+{
+   /* Do nothing -- there are no free blocks to give back. */
+}
+
+/************************************************************************/
+/* Public Interface							*/
+/************************************************************************/
+
+/**
+ * This function creates a new arena allocator, exposing the IMalloc
+ * interface.  An arena suits allocations which all share one lifetime,
+ * such as everything allocated while servicing a single request.
+ *
+ * Allocation from an arena is a pointer bump.  IMalloc::Free() does
+ * nothing at all; instead, every block allocated from the arena is
+ * released in one go when the arena's last reference is released.
+ * IMalloc::Realloc() and IMalloc::GetSize() behave normally.
+ *
+ * Blocks from an arena may be passed to CoTaskMemFree(), which ignores
+ * them, or to CoTaskMemRealloc(), which moves them out into the task
+ * allocator's heap.
+ *
+ * @param ppMalloc
+ * This parameter points to a variable used to hold the resulting interface
+ * pointer for the new arena.  The caller owns the one reference to it.
+ *
+ * @returns
+ * S_OK if the arena was created.  E_OUTOFMEMORY if there wasn't enough
+ * memory to create it.
+ *
+ * @see CoGetMalloc
+ */
+
+HRESULT gCoCreateArenaMalloc( IMalloc **ppMalloc )
+{
+   ArenaRegion *region;
+   Arena *self;
+
+   *ppMalloc = NULL;
+
+   region = NewRegion( NULL, CHUNK_SIZE - REGION_OFFSET );
+   if( region == NULL )
+      return E_OUTOFMEMORY;
+
+   self = (Arena *)region -> bump;
+   region -> bump += ROUND16( sizeof( Arena ) );
+   region -> arena = self;
+
+   self -> imalloc.lpVtbl = (IMallocVtbl *)&ArenaMallocVtbl;
+   self -> refCount = 1;
+   pthread_mutex_init( &self -> lock, NULL );
+   self -> current = region;
+   self -> regions = region;
+   self -> last = NULL;
+
+   *ppMalloc = &self -> imalloc;
+   return S_OK;
+}
@@ -29,8 +29,209 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <errno.h>
+#include <sys/stat.h>
 #include "gcom-config.h"
 
+/************************************************************************/
+/* Registry Access							*/
+/************************************************************************/
+
+/*
+ * The registry is a directory tree under STR_REGISTRYHOME: each key is
+ * a directory, and each value a file in it, named for the value and
+ * holding its contents as UTF-8.  Paths are built to fit, so there is
+ * no limit on the length of a name or value.
+ */
+
+static HRESULT RegistryPath( const char *pszKey, const char *pszName, char **ppsz )
+{
+   *ppsz = (char *)CoTaskMemAlloc(
+				  strlen( STR_REGISTRYHOME ) + strlen( pszKey ) +
+				  strlen( pszName ) + 1
+				 );
+   if( *ppsz == NULL )
+      return E_OUTOFMEMORY;
+
+   strcpy( *ppsz, STR_REGISTRYHOME );
+   strcat( *ppsz, pszKey );
+   strcat( *ppsz, pszName );
+   return S_OK;
+}
+
+static HRESULT RegistryError( HRESULT hrDefault )
+{
+   switch( errno )
+   {
+      case EACCES:
+      case EPERM:
+	 return E_NOPERMISSION;
+
+      default:
+	 return hrDefault;
+   }
+}
+
+/**
+ * This function reads a value from the registry.
+ *
+ * @param pszKey
+ * The key holding the value, with its slashes; for example,
+ * "/InprocServers/".
+ *
+ * @param pszName
+ * The name of the value, usually a GUID in text form.
+ *
+ * @param ppszValue
+ * Receives the value, NULL-terminated, which the caller frees with
+ * CoTaskMemFree().
+ *
+ * @returns
+ * S_OK if successful.  E_READREGDB if there is no such value, or it
+ * couldn't be read.  E_NOPERMISSION if the caller may not read it.
+ * E_OUTOFMEMORY if there isn't room for the value.
+ *
+ * @see gCoWriteRegistryValueUTF8
+ */
+
+HRESULT gCoReadRegistryValueUTF8(
+				 const char *pszKey,
+				 const char *pszName,
+				 char **ppszValue
+				)
+{
+   HRESULT hr;
+   char *pszPath, *pszValue;
+   struct stat st;
+   ssize_t cbRead;
+   size_t cb = 0;
+   int fh;
+
+   *ppszValue = NULL;
+
+   hr = RegistryPath( pszKey, pszName, &pszPath );
+   if( FAILED( hr ) )
+      return hr;
+
+   fh = open( pszPath, O_RDONLY );
+   hr = ( fh < 0 ) ? RegistryError( E_READREGDB ) : S_OK;
+   CoTaskMemFree( pszPath );
+
+   if( FAILED( hr ) )
+      return hr;
+
+   if( fstat( fh, &st ) < 0 )
+   {
+      close( fh );
+      return E_READREGDB;
+   }
+
+   pszValue = (char *)CoTaskMemAlloc( (uint32)st.st_size + 1 );
+   if( pszValue == NULL )
+   {
+      close( fh );
+      return E_OUTOFMEMORY;
+   }
+
+   while( cb < (size_t)st.st_size )
+   {
+      cbRead = read( fh, &pszValue[ cb ], (size_t)st.st_size - cb );
+      if( cbRead < 0 && errno == EINTR )
+	 continue;
+
+      if( cbRead <= 0 )
+	 break;
+
+      cb += (size_t)cbRead;
+   }
+
+   close( fh );
+
+   pszValue[ cb ] = 0;
+   *ppszValue = pszValue;
+   return S_OK;
+}
+
+/**
+ * This function writes a value to the registry, replacing any value of
+ * the same name.
+ *
+ * @param pszKey
+ * The key to hold the value, with its slashes.
+ *
+ * @param pszName
+ * The name of the value.
+ *
+ * @param pszValue
+ * The value, as a NULL-terminated string.
+ *
+ * @returns
+ * S_OK if successful.  E_WRITEREGDB if the value couldn't be written.
+ * E_NOPERMISSION if the caller may not write it.
+ *
+ * @see gCoReadRegistryValueUTF8
+ * @see gCoDeleteRegistryValueUTF8
+ */
+
+HRESULT gCoWriteRegistryValueUTF8(
+				  const char *pszKey,
+				  const char *pszName,
+				  const char *pszValue
+				 )
+{
+   HRESULT hr;
+   char *pszPath;
+   size_t cb = strlen( pszValue );
+   int fh;
+
+   hr = RegistryPath( pszKey, pszName, &pszPath );
+   if( FAILED( hr ) )
+      return hr;
+
+   fh = open( pszPath, O_WRONLY | O_CREAT | O_TRUNC, 0666 );
+   CoTaskMemFree( pszPath );
+
+   if( fh < 0 )
+      return RegistryError( E_WRITEREGDB );
+
+   if( write( fh, pszValue, cb ) != (ssize_t)cb )
+      hr = RegistryError( E_WRITEREGDB );
+
+   close( fh );
+   return hr;
+}
+
+/**
+ * This function removes a value from the registry.
+ *
+ * @param pszKey
+ * The key holding the value, with its slashes.
+ *
+ * @param pszName
+ * The name of the value.
+ *
+ * @returns
+ * S_OK if successful.  E_WRITEREGDB if the value couldn't be removed,
+ * or didn't exist.  E_NOPERMISSION if the caller may not remove it.
+ *
+ * @see gCoWriteRegistryValueUTF8
+ */
+
+HRESULT gCoDeleteRegistryValueUTF8( const char *pszKey, const char *pszName )
+{
+   HRESULT hr;
+   char *pszPath;
+
+   hr = RegistryPath( pszKey, pszName, &pszPath );
+   if( FAILED( hr ) )
+      return hr;
+
+   if( unlink( pszPath ) < 0 )
+      hr = RegistryError( E_WRITEREGDB );
+
+   CoTaskMemFree( pszPath );
+   return hr;
+}
+
 /************************************************************************/
 /* Library Functions                                                    */
 /************************************************************************/
@@ -78,79 +279,16 @@
 
 HRESULT CoTreatAsClass( REFCLSID rclsidOld, REFCLSID rclsidNew )
 {
-   HRESULT hr = E_WRITEREGDB;
-   char fullFilename[ MAX_PATH_LEN ];
    char achClassID[ MAX_GUIDSTRING_LEN ];
-   wchar awchClassID[ MAX_GUIDSTRING_LEN ];
    char achNewClassID[ MAX_GUIDSTRING_LEN ];
-   wchar awchNewClassID[ MAX_GUIDSTRING_LEN ];
-   int fh;
 
-   if( IsEqualIID( rclsidNew, CLSID_NULL ) )
-   {
-      gCoGUIDToString( rclsidOld, awchClassID );
-      gCoUnicodeStringToAscii( awchClassID, achClassID, MAX_GUIDSTRING_LEN );
-      strcpy( fullFilename, STR_REGISTRYHOME );
-      strcat( fullFilename, STR_TREATAS );
-      strcat( fullFilename, achClassID );
+   gCoGUIDToStringUTF8( rclsidOld, achClassID );
 
-      if( ( unlink( fullFilename ) ) < 0 )
-      {
-         switch( errno )
-         {
-            case EACCES:
-            case EPERM:
-               hr = E_NOPERMISSION;
-               break;
-
-            default:
-               hr = E_WRITEREGDB;
-               break;
-         }
-      }
-      else
-         hr = S_OK;
-   }
-   else
-   {
-      gCoGUIDToString( rclsidOld, awchClassID );
-      gCoUnicodeStringToAscii( awchClassID, achClassID, MAX_GUIDSTRING_LEN );
-      strcpy( fullFilename, STR_REGISTRYHOME );
-      strcat( fullFilename, STR_TREATAS );
-      strcat( fullFilename, achClassID );
-
-      printf( "Writing file %s\n", fullFilename );
-
-      gCoGUIDToString( rclsidNew, awchNewClassID );
-
-      hr = gCoUnicodeStringToAscii( awchNewClassID, achNewClassID, MAX_GUIDSTRING_LEN );
-      if( FAILED(hr) )  return hr;
-
-      fh = open( fullFilename, O_WRONLY | O_CREAT | O_TRUNC, 0666 );
-      if( fh > 0 )
-      {
-         write( fh, achNewClassID, MAX_GUIDSTRING_LEN );
-         close( fh );
+   if( IsEqualIID( rclsidNew, CLSID_NULL ) )
+      return gCoDeleteRegistryValueUTF8( STR_TREATAS, achClassID );
 
-         hr = S_OK;
-      }
-      else
-      {
-         switch( errno )
-         {
-            case EACCES:
-            case EPERM:
-               hr = E_NOPERMISSION;
-               break;
-
-            default:
-               hr = E_WRITEREGDB;
-               break;
-         }
-      }
-   }
-   
-   return hr;
+   gCoGUIDToStringUTF8( rclsidNew, achNewClassID );
+   return gCoWriteRegistryValueUTF8( STR_TREATAS, achClassID, achNewClassID );
 }
 
 /**
@@ -176,58 +314,32 @@ HRESULT CoTreatAsClass( REFCLSID rclsidOld, REFCLSID rclsidNew )
 HRESULT CoGetTreatAsClass( REFCLSID rclsidOld, CLSID *pclsidNew )
 {
    HRESULT hr;
-   wchar awchClassID[ MAX_GUIDSTRING_LEN ];
    char achClassID[ MAX_GUIDSTRING_LEN ];
-   wchar awchReadClassID[ MAX_GUIDSTRING_LEN ];
-   char achReadClassID[ MAX_GUIDSTRING_LEN  ];
-   char datumName[ MAX_PATH_LEN ];
+   char *pszReadClassID;
    CLSID readClassID;
-   int fh;
 
    /*
-    * Convert class ID to string
+    * Convert class ID to string, and read the registry entry by that
+    * name.
     */
 
-   gCoGUIDToString( rclsidOld, awchClassID );
-   hr = gCoUnicodeStringToAscii( awchClassID, achClassID, MAX_GUIDSTRING_LEN );
-   if( FAILED(hr) )
-      return hr;
+   gCoGUIDToStringUTF8( rclsidOld, achClassID );
 
-   /*
-    * From the string form of the class ID, build the registry
-    * entry's filename.
-    */
-
-   strcpy( datumName, STR_REGISTRYHOME );
-   strcat( datumName, STR_TREATAS );
-   strcat( datumName, achClassID );
+   hr = gCoReadRegistryValueUTF8( STR_TREATAS, achClassID, &pszReadClassID );
+   if( FAILED( hr ) )
+      return hr;
 
    /*
-    * Read registry entry's value.
+    * Convert registry entry's textual value into a CLSID.  Anything
+    * after the GUID, such as a newline, is ignored.
     */
 
-   fh = open( datumName, O_RDONLY );
-   if( fh < 0 )
-   {
-      return E_READREGDB;
-   }
-   else
-   {
-      read( fh, &achReadClassID, MAX_GUIDSTRING_LEN );
-      close( fh );
-
-      achReadClassID[ MAX_GUIDSTRING_LEN-1 ] = 0;
-   }
-
-   /*
-    * Convert registry entry's textual value into a CLSID
-    */
+   if( strlen( pszReadClassID ) >= MAX_GUIDSTRING_LEN )
+      pszReadClassID[ MAX_GUIDSTRING_LEN-1 ] = 0;
 
-   hr = gCoAsciiStringToUnicode( achReadClassID, awchReadClassID, MAX_GUIDSTRING_LEN );
-   if( FAILED(hr) )
-        return hr;
+   hr = gCoStringToGUIDUTF8( pszReadClassID, &readClassID );
+   CoTaskMemFree( pszReadClassID );
 
-   hr = gCoStringToGUID( awchReadClassID, &readClassID );
    if( SUCCEEDED( hr ) )
    {
       if( IsEqualIID( &readClassID, rclsidOld ) )
@@ -49,6 +49,20 @@ DECLARE_IID(
 	    0x00, 0x00, 0x00, 0x00, 0x00, 0x46
 	   )
 
+DECLARE_IID(
+	    IMallocSpy,
+	    0x0000001D,
+	    0x0000, 0x0000, 0xC000,
+	    0x00, 0x00, 0x00, 0x00, 0x00, 0x46
+	   )
+
+DECLARE_IID(
+	    IMemoryPressure,
+	    0x5B0E7C21,
+	    0x3A4D, 0x4F86, 0x9C1B,
+	    0x2E, 0x60, 0xD8, 0x47, 0xA3, 0x15
+	   )
+
 DECLARE_IID(
 	    IClassFactory,
 	    0x00000001,
@@ -66,3 +80,35 @@ DECLARE_CLSID(
 	      0x0000, 0x0000, 0x0000,
 	      0x00, 0x00, 0x00, 0x00, 0x00, 0x00
 	     )
+
+/************************************************************************/
+/* Name-based GUID Namespaces						*/
+/************************************************************************/
+
+DECLARE_GUID(
+	     GUID_NAMESPACE_DNS,
+	     0x6BA7B810,
+	     0x9DAD, 0x11D1, 0x80B4,
+	     0x00, 0xC0, 0x4F, 0xD4, 0x30, 0xC8
+	    )
+
+DECLARE_GUID(
+	     GUID_NAMESPACE_URL,
+	     0x6BA7B811,
+	     0x9DAD, 0x11D1, 0x80B4,
+	     0x00, 0xC0, 0x4F, 0xD4, 0x30, 0xC8
+	    )
+
+DECLARE_GUID(
+	     GUID_NAMESPACE_OID,
+	     0x6BA7B812,
+	     0x9DAD, 0x11D1, 0x80B4,
+	     0x00, 0xC0, 0x4F, 0xD4, 0x30, 0xC8
+	    )
+
+DECLARE_GUID(
+	     GUID_NAMESPACE_X500,
+	     0x6BA7B814,
+	     0x9DAD, 0x11D1, 0x80B4,
+	     0x00, 0xC0, 0x4F, 0xD4, 0x30, 0xC8
+	    )
@@ -24,9 +24,13 @@
  *    distribution.
  */
 
+#define _GNU_SOURCE
+
+#include <pthread.h>
 #include <gcom/gcom.h>
 #include <util/lists.h>
 #include "gcom-config.h"
+#include "alloc-private.h"
 
 /************************************************************************/
 /* Internal data structures needed to keep track of which DLLs we've	*/
@@ -40,8 +44,9 @@ typedef struct
 {
    Node		node;
    void *	pDLL;
-   wchar *	name;
+   char *	name;		/* UTF-8 */
    uint32	loadCount;
+   uint16	component;	/* Task allocator's number for us */
 } LibNode;
 
 /**
@@ -52,7 +57,7 @@ typedef struct
  * internal data structures needlessly.
  * 
  * @param name
- * The Unicode path and filename of the library to load.
+ * The UTF-8 path and filename of the library to load.
  * 
  * @param ppln
  * Pointer to the LibNode pointer that will hold the resulting structure.
@@ -61,9 +66,8 @@ typedef struct
  * S_OK if all went well; E_OUTOFMEMORY otherwise.
  */
 
-HRESULT NewLibNodeFromName( wchar *name, LibNode **ppln )
+HRESULT NewLibNodeFromName( const char *name, LibNode **ppln )
 {
-   HRESULT hr;
    LibNode *pln;
 
    *ppln = NULL;
@@ -74,10 +78,12 @@ HRESULT NewLibNodeFromName( wchar *name, LibNode **ppln )
       pln -> pDLL = NULL;
       pln -> name = NULL;
       pln -> loadCount = 0;
+      pln -> component = 0;
       
-      hr = gCoUnicodeStringDuplicate( name, &pln -> name );
-      if( SUCCEEDED( hr ) )
+      pln -> name = CoTaskMemAlloc( strlen( name ) + 1 );
+      if( pln -> name != NULL )
       {
+	 strcpy( pln -> name, name );
 	 *ppln = pln;
 	 return S_OK;
       }
@@ -138,10 +144,192 @@ HRESULT DLLInitialize( void )
    return S_FALSE;
 }
 
-HRESULT DLLUninitialize( void )
+/*
+ * Looks a symbol up in a library without taking the library list lock,
+ * for callers which already hold it, or which mustn't.
+ */
+
+static HRESULT DLLSymbol( LibNode *pln, const char *symbol, void **ppv )
 {
+   *ppv = dlsym( pln -> pDLL, symbol );
+   return ( dlerror() == NULL ) ? S_OK : E_NOINTERFACE;
+}
+
+/*
+ * Runs a library's GCOMDLLExpunge(), already looked up, if it has one.
+ */
+
+static void DLLRunExpunge( LibNode *pln, void (*expunge)( void ) )
+{
+   uint32 cookie;
+
+   if( expunge == NULL )
+      return;
+
+   cookie = gCoDLLEnter( (HDLL)pln );
+   (*expunge)();
+   gCoDLLLeave( cookie );
+}
+
+/*
+ * The same as gCoGCOMDLLExpunge(), for callers holding the library list
+ * lock.
+ */
+
+static void DLLExpunge( LibNode *pln )
+{
+   void (*expunge)( void );
+
+   if( FAILED( DLLSymbol( pln, STR_DLLEXPUNGE, (void **)&expunge ) ) )
+      expunge = NULL;
+
+   DLLRunExpunge( pln, expunge );
+}
+
+/*
+ * When GCOM is going away because the process is exiting, every loaded
+ * library's GCOMDLLExpunge() is run at once, each on a thread of its own
+ * up to MAX_EXPUNGE_THREADS, since there's no telling how long any one of
+ * them takes, or whether it spends that time waiting on I/O rather than
+ * a processor.  The calling thread lends a hand too.
+ *
+ * The expunge functions are all looked up beforehand, and the library
+ * list lock let go before any of them runs, since they may well call
+ * back into GCOM.
+ */
+
+#define MAX_EXPUNGE_THREADS	16
+
+typedef struct
+{
+   LibNode *	pln;
+   void		(*expunge)( void );
+} ExpungeJob;
+
+typedef struct
+{
+   ExpungeJob *	jobs;
+   uint32	count;
+   uint32	next;		/* Next library to expunge; atomic */
+} ExpungeWork;
+
+static void *ExpungeWorker( void *pv )
+{
+   ExpungeWork *work = (ExpungeWork *)pv;
+   uint32 i;
+
+   while( ( i = __sync_fetch_and_add( &work -> next, 1 ) ) < work -> count )
+      DLLRunExpunge( work -> jobs[ i ].pln, work -> jobs[ i ].expunge );
+
+   return NULL;
+}
+
+static void ExpungeAllInParallel( void )
+{
+   pthread_t threads[ MAX_EXPUNGE_THREADS ];
+   ExpungeWork work;
+   LibNode *pln;
+   uint32 i, cThreads = 0;
+
+   work.count = 0;
+   work.next = 0;
+
+   LockLibList();
+   for(
+       pln = (LibNode *)( libraryList.head );
+       pln -> node.next;
+       pln = (LibNode *)( pln -> node.next )
+      )
+      work.count++;
+
+   if( work.count == 0 )
+   {
+      UnlockLibList();
+      return;
+   }
+
+   work.jobs = (ExpungeJob *)CoTaskMemAlloc( work.count * sizeof( ExpungeJob ) );
+   if( work.jobs == NULL )
+   {
+      for(
+	  pln = (LibNode *)( libraryList.head );
+	  pln -> node.next;
+	  pln = (LibNode *)( pln -> node.next )
+	 )
+	 DLLExpunge( pln );
+      UnlockLibList();
+      return;
+   }
+
+   i = 0;
+   for(
+       pln = (LibNode *)( libraryList.head );
+       pln -> node.next;
+       pln = (LibNode *)( pln -> node.next )
+      )
+   {
+      work.jobs[ i ].pln = pln;
+      if( FAILED( DLLSymbol( pln, STR_DLLEXPUNGE,
+			     (void **)&work.jobs[ i ].expunge ) ) )
+	 work.jobs[ i ].expunge = NULL;
+      i++;
+   }
+   UnlockLibList();
+
+   while( ( cThreads + 1 < work.count ) && ( cThreads < MAX_EXPUNGE_THREADS ) )
+   {
+      if( pthread_create( &threads[ cThreads ], NULL,
+			  &ExpungeWorker, &work ) != 0 )
+	 break;
+      cThreads++;
+   }
+
+   ExpungeWorker( &work );
+   for( i = 0; i < cThreads; i++ )
+      pthread_join( threads[ i ], NULL );
+
+   CoTaskMemFree( work.jobs );
+}
+
+/*
+ * The last call unloads every library still loaded, newest first, so a
+ * library loaded by another's GCOMDLLInit() goes before it.  If the
+ * process is exiting, the libraries' expunge functions are all run at
+ * once instead, and the libraries are left mapped: unmapping them, and
+ * freeing our records of them, would only slow the exit down.
+ */
+
+HRESULT DLLUninitialize( Bool exiting )
+{
+   LibNode *pln;
+
+   if( initCount == 0 )
+      return S_OK;
+
+   initCount--;
    if( initCount != 0 )
-	initCount--;
+      return S_OK;
+
+   /* Objects the libraries registered mustn't outlive their code. */
+
+   MemoryPressureUninitialize();
+
+   if( exiting )
+   {
+      ExpungeAllInParallel();
+      return S_OK;
+   }
+
+   LockLibList();
+   while( ( pln = (LibNode *)ListPeekTail( &libraryList ) ) != NULL )
+   {
+      DLLExpunge( pln );
+      NodeRemove( (Node *)pln );
+      TaskComponentDetach( pln -> component );
+      if( pln -> pDLL )	dlclose( pln -> pDLL );
+      DisposeLibNode( pln );
+   }
+   UnlockLibList();
 
    return S_OK;
 }
@@ -162,7 +350,7 @@ HRESULT DLLUninitialize( void )
  * it's case insensitive.  It all depends on the underlying filesystem.
  * 
  * @param libName
- * Unicode string of the library's filename, including path.
+ * UTF-8 string of the library's filename, including path.
  * 
  * @param pln
  * Pointer to a LibNode structure.  See dll.c for more info on that
@@ -172,7 +360,7 @@ HRESULT DLLUninitialize( void )
  * S_OK if we've found a library; S_FALSE if not.
  */
 
-static HRESULT gCoFindDLL( wchar *dllName, LibNode **ppln )
+static HRESULT gCoFindDLL( const char *dllName, LibNode **ppln )
 {
    LibNode *pln;
    HRESULT result = S_FALSE;
@@ -186,7 +374,7 @@ static HRESULT gCoFindDLL( wchar *dllName, LibNode **ppln )
        pln = (LibNode *)( pln -> node.next )
       )
    {
-      if( gCoUnicodeStringCompare( dllName, pln -> name ) == 0 )
+      if( strcmp( dllName, pln -> name ) == 0 )
       {
 	 result = S_OK;
 	 *ppln = pln;
@@ -206,27 +394,26 @@ static HRESULT gCoFindDLL( wchar *dllName, LibNode **ppln )
  * 
  * @param libName
  * The name of the library to load, expressed as a NULL-terminated,
- * Unicode string.  This parameter must not be NULL.
+ * UTF-8 string.  This parameter must not be NULL.
  * 
  * @param phDLL
  * This is a pointer to a variable of type HDLL, which is used to
  * hold the handle to the library.  This parameter must not be NULL.
  * 
  * @returns
- * S_OK if everything worked perfectly.  E_INVALIDARG is returned if
- * there was some kind of problem with converting the Unicode filename
- * into the native OS' representation.  E_DLLNOTFOUND is returned if
+ * S_OK if everything worked perfectly.  E_OUTOFMEMORY if there's no
+ * memory to keep track of the library.  E_DLLNOTFOUND is returned if
  * the library couldn't be loaded for some reason.  Otherwise, it will
  * return anything the GCOMDLLInit() function returns.
  *
+ * @see gCoLoadDLL
  * @see gCoUnloadDLL
- * @see gCoGetDLLSymbol
+ * @see gCoGetDLLSymbolUTF8
  */
 
-HRESULT gCoLoadDLL( wchar *libName, HDLL *phdll )
+HRESULT gCoLoadDLLUTF8( const char *libName, HDLL *phdll )
 {
    HRESULT hr;
-   char asciiLibName[MAX_PATH_LEN];
    LibNode *pln;
 
    *phdll = (HDLL)0;
@@ -240,42 +427,69 @@ HRESULT gCoLoadDLL( wchar *libName, HDLL *phdll )
    }
    else
    {
-      hr = gCoUnicodeStringToAscii( libName, asciiLibName, MAX_PATH_LEN );
+      hr = NewLibNodeFromName( libName, &pln );
       if( SUCCEEDED( hr ) )
       {
-         hr = NewLibNodeFromName( libName, &pln );
-         if( SUCCEEDED( hr ) )
-         {
-	    LockLibList();
-
-	    pln -> pDLL = dlopen( asciiLibName, RTLD_LAZY );
-	    if( dlerror() == NULL )
+	 LockLibList();
+
+	 pln -> pDLL = dlopen( libName, RTLD_LAZY );
+	 if( dlerror() == NULL )
+	 {
+	    ListAddTail( &libraryList, (Node *)pln );
+	    *phdll = (HDLL)pln;
+	    pln -> loadCount = 1;
+	    pln -> component = TaskComponentAttach();
+
+	    hr = gCoGCOMDLLInit( (HDLL)pln );
+	    if( FAILED( hr ) )
 	    {
-	       ListAddTail( &libraryList, (Node *)pln );
-	       *phdll = (HDLL)pln;
-	       pln -> loadCount = 1;
-
-	       hr = gCoGCOMDLLInit( (HDLL)pln );
-	       if( FAILED( hr ) )
-	       {
-		  dlclose( pln -> pDLL );
-		  DisposeLibNode( pln );
-	       }
-	    }
-	    else
-	    {
-	       hr = E_DLLNOTFOUND;
+	       NodeRemove( (Node *)pln );
+	       TaskComponentDetach( pln -> component );
+	       dlclose( pln -> pDLL );
 	       DisposeLibNode( pln );
 	    }
-	       
-	    UnlockLibList();
 	 }
+	 else
+	 {
+	    hr = E_DLLNOTFOUND;
+	    DisposeLibNode( pln );
+	 }
+
+	 UnlockLibList();
       }
    }
 
    return hr;
 }
 
+/**
+ * The same as gCoLoadDLLUTF8(), but with the library's name as a
+ * Unicode string.
+ *
+ * @returns
+ * As for gCoLoadDLLUTF8(), or E_INVALIDARG if the name can't be
+ * expressed in UTF-8.
+ *
+ * @see gCoLoadDLLUTF8
+ */
+
+HRESULT gCoLoadDLL( wchar *libName, HDLL *phdll )
+{
+   HRESULT hr;
+   char *utf8LibName;
+
+   *phdll = (HDLL)0;
+
+   hr = gCoUnicodeStringDuplicateAsUTF8( libName, &utf8LibName );
+   if( SUCCEEDED( hr ) )
+   {
+      hr = gCoLoadDLLUTF8( utf8LibName, phdll );
+      CoTaskMemFree( utf8LibName );
+   }
+
+   return hr;
+}
+
 /**
  * This function forcibly unloads the indicated DLL, *even if it's not
  * ready to be unloaded!*  Use this function with extreme care.
@@ -304,8 +518,9 @@ HRESULT gCoUnloadDLL( HDLL hdll )
 
    if( pln -> loadCount == 0 )
    {
-      gCoGCOMDLLExpunge( hdll );
+      DLLExpunge( pln );
       NodeRemove( (Node *)pln );
+      TaskComponentDetach( pln -> component );
       if( pln -> pDLL )		dlclose( pln -> pDLL );
       DisposeLibNode( pln );
    }
@@ -324,7 +539,7 @@ HRESULT gCoUnloadDLL( HDLL hdll )
  * Handle to the DLL to query.  This is as returned by gCoLoadDLL().
  * 
  * @param symbol
- * The Unicode string containing the symbol name to query for.
+ * The UTF-8 string containing the symbol name to query for.
  * 
  * @param ppv
  * A pointer to a variable which will point to the symbol requested.
@@ -333,26 +548,45 @@ HRESULT gCoUnloadDLL( HDLL hdll )
  * S_OK if the symbol is exported and publicly available.
  * E_NOINTERFACE if the symbol is not supported by the DLL.
  * E_NOTSUPPORTED if the DLL doesn't support this operation.
+ *
+ * @see gCoGetDLLSymbol
  */
 
-HRESULT gCoGetDLLSymbol( HDLL hdll, wchar *symbol, void **ppv )
+HRESULT gCoGetDLLSymbolUTF8( HDLL hdll, const char *symbol, void **ppv )
 {
    HRESULT hr;
    LibNode *pln = (LibNode *)hdll;
-   char asciiSymbol[ MAX_SYMBOL_LEN ];
 
-   hr = gCoUnicodeStringToAscii( symbol, asciiSymbol, MAX_SYMBOL_LEN );
+   LockLibList();	/* Because dlsym() isn't thread safe */
+   hr = DLLSymbol( pln, symbol, ppv );
+   UnlockLibList();
+
+   return hr;
+}
+
+/**
+ * The same as gCoGetDLLSymbolUTF8(), but with the symbol's name as a
+ * Unicode string.
+ *
+ * @returns
+ * As for gCoGetDLLSymbolUTF8(), or E_INVALIDARG if the name can't be
+ * expressed in UTF-8.
+ *
+ * @see gCoGetDLLSymbolUTF8
+ */
+
+HRESULT gCoGetDLLSymbol( HDLL hdll, wchar *symbol, void **ppv )
+{
+   HRESULT hr;
+   char *utf8Symbol;
+
+   hr = gCoUnicodeStringDuplicateAsUTF8( symbol, &utf8Symbol );
    if( SUCCEEDED( hr ) )
    {
-      LockLibList();	/* Because dlsym() isn't thread safe */
-      *ppv = dlsym( pln -> pDLL, asciiSymbol );
-      if( dlerror() == NULL )
-		      hr = S_OK;
-      else
-		      hr = E_NOINTERFACE;
-      UnlockLibList();
+      hr = gCoGetDLLSymbolUTF8( hdll, utf8Symbol, ppv );
+      CoTaskMemFree( utf8Symbol );
    }
-   
+
    return hr;
 }
 
@@ -399,13 +633,16 @@ HRESULT gCoDLLGetClassObject(
 {
    HRESULT hr;
    HRESULT (*getClassObject)( REFCLSID, REFIID, void ** );
+   uint32 cookie;
    
    *ppv = NULL;		/* Just in case... */
 
-   hr = gCoGetDLLSymbol( hdll, L"DllGetClassObject", (void *)&getClassObject );
+   hr = gCoGetDLLSymbolUTF8( hdll, "DllGetClassObject", (void *)&getClassObject );
    if( SUCCEEDED( hr ) )
    {
+      cookie = gCoDLLEnter( hdll );
       hr = (*getClassObject)( rclsid, riid, ppv );
+      gCoDLLLeave( cookie );
    }
    else
    {
@@ -433,11 +670,14 @@ HRESULT gCoDLLCanUnloadNow( HDLL hdll )
 {
    HRESULT hr;
    HRESULT (*canUnloadNow)( void );
+   uint32 cookie;
    
-   hr = gCoGetDLLSymbol( hdll, L"DllCanUnloadNow", (void *)&canUnloadNow );
+   hr = gCoGetDLLSymbolUTF8( hdll, "DllCanUnloadNow", (void *)&canUnloadNow );
    if( SUCCEEDED( hr ) )
    {
+      cookie = gCoDLLEnter( hdll );
       hr = (*canUnloadNow)();
+      gCoDLLLeave( cookie );
    }
    else
    {
@@ -467,11 +707,14 @@ HRESULT gCoGCOMDLLInit( HDLL hdll )
 {
    HRESULT hr;
    HRESULT (*init)( void );
+   uint32 cookie;
 
-   hr = gCoGetDLLSymbol( hdll, WSTR_DLLINIT, (void *)&init );
+   hr = gCoGetDLLSymbolUTF8( hdll, STR_DLLINIT, (void *)&init );
    if( SUCCEEDED( hr ) )
    {
+      cookie = gCoDLLEnter( hdll );
       hr = (*init)();
+      gCoDLLLeave( cookie );
    }
    else
 		   hr = S_OK;
@@ -493,9 +736,9 @@ void gCoGCOMDLLExpunge( HDLL hdll )
    HRESULT hr;
    void (*expunge)( void );
    
-   hr = gCoGetDLLSymbol( hdll, WSTR_DLLEXPUNGE, (void *)&expunge );
+   hr = gCoGetDLLSymbolUTF8( hdll, STR_DLLEXPUNGE, (void *)&expunge );
    if( SUCCEEDED( hr ) )
-		   (*expunge)();
+      DLLRunExpunge( (LibNode *)hdll, expunge );
 }
 
 /**
@@ -524,3 +767,180 @@ void CoFreeUnusedLibraries( void )
    
    UnlockLibList();
 }
+
+/************************************************************************/
+/* Per-component memory accounting					*/
+/************************************************************************/
+
+/**
+ * This function finds the loaded library containing the given address,
+ * which may be that of any function or static data in the library.  A
+ * component can use this to find its own handle, for gCoDLLEnter().
+ *
+ * @param pv
+ * The address to look up.
+ *
+ * @returns
+ * The handle to the library, or zero if the address isn't in a library
+ * loaded by gCoLoadDLL().
+ */
+
+HDLL gCoDLLFromAddress( void *pv )
+{
+   LibNode *pln;
+   Dl_info info;
+   void *handle;
+   HDLL hdll = 0;
+
+   if( ( dladdr( pv, &info ) == 0 ) || ( info.dli_fname == NULL ) )
+      return 0;
+
+   /* Opening a library that's already loaded yields the same handle. */
+
+   handle = dlopen( info.dli_fname, RTLD_LAZY | RTLD_NOLOAD );
+   if( handle == NULL )
+      return 0;
+
+   LockLibList();
+   for(
+       pln = (LibNode *)( libraryList.head );
+       pln -> node.next;
+       pln = (LibNode *)( pln -> node.next )
+      )
+   {
+      if( pln -> pDLL == handle )
+      {
+	 hdll = (HDLL)pln;
+	 break;
+      }
+   }
+   UnlockLibList();
+
+   dlclose( handle );
+   return hdll;
+}
+
+/**
+ * This function makes a library the current component for the calling
+ * thread: until the matching call to gCoDLLLeave(), memory the thread
+ * allocates from the task allocator is charged to that library, no
+ * matter who frees it.  GCOM does this itself around every call it makes
+ * into a library, including IClassFactory::CreateInstance() in
+ * CoCreateInstance(); components should do the same on entry to the
+ * methods of their objects.  Calls nest.
+ *
+ * Memory allocated with CoTaskMemAllocOnNode(), from an arena, or with
+ * no component current is charged to nobody.
+ *
+ * @param hdll
+ * The handle to the library, as returned by gCoLoadDLL() or
+ * gCoDLLFromAddress().  Zero stands for the application itself.
+ *
+ * @returns
+ * A cookie to pass to gCoDLLLeave().
+ *
+ * @see gCoDLLLeave
+ * @see gCoDLLGetMemoryStats
+ */
+
+uint32 gCoDLLEnter( HDLL hdll )
+{
+   LibNode *pln = (LibNode *)hdll;
+
+   return TaskComponentSwitch( pln ? pln -> component : 0 );
+}
+
+/**
+ * This function restores the component which was current before the
+ * matching call to gCoDLLEnter().
+ *
+ * @param cookie
+ * The value returned by gCoDLLEnter().
+ *
+ * @see gCoDLLEnter
+ */
+
+void gCoDLLLeave( uint32 cookie )
+{
+   TaskComponentSwitch( (uint16)cookie );
+}
+
+/**
+ * This function reports how much task allocator memory is charged to a
+ * library (see gCoDLLEnter()).
+ *
+ * @param hdll
+ * The handle to the library.  Zero, standing for the application itself,
+ * isn't charged for anything, and gets E_NOTSUPPORTED.
+ *
+ * @param pStats
+ * This parameter points to a structure to fill in.  cbLive receives the
+ * number of bytes charged to the library and not yet freed, counting
+ * small blocks at the size IMalloc::GetSize() reports for them; cbPeak
+ * the most cbLive has been seen to be since the library was loaded; and
+ * cbBudget the library's budget, or zero if it has none.  Each thread
+ * keeps its own count, so cbPeak is only brought up to date each time a
+ * thread's count moves by another 64K, and when stats are read.
+ *
+ * @returns
+ * S_OK if successful.  E_NOTSUPPORTED if hdll is zero, or if the task
+ * allocator had no room left to keep track of the library when it was
+ * loaded.
+ *
+ * @see gCoDLLSetMemoryBudget
+ */
+
+HRESULT gCoDLLGetMemoryStats( HDLL hdll, TASKMEMCOMPONENTSTATS *pStats )
+{
+   LibNode *pln = (LibNode *)hdll;
+
+   if( ( pln == NULL ) || ( pln -> component == 0 ) )
+      return E_NOTSUPPORTED;
+
+   TaskComponentGetStats( pln -> component, pStats );
+   return S_OK;
+}
+
+/**
+ * This function sets a soft budget on the memory charged to a library.
+ * Allocations which take the library over budget still succeed, but the
+ * given object's IMemoryPressure::OnMemoryPressure() method is called,
+ * with MEMPRESSURE_MODERATE, from within the allocation that did it.  It
+ * isn't called again until the library's usage has dropped back within
+ * budget, and gone over once more.  Usage is checked against the budget
+ * each time a thread's count of it moves by another 64K, so it may run
+ * past the budget by up to that much per thread before the call is made.
+ *
+ * @param hdll
+ * The handle to the library.  Zero, standing for the application itself,
+ * can't be given a budget, and gets E_NOTSUPPORTED.
+ *
+ * @param cbBudget
+ * The budget, in bytes.  Zero removes the budget.
+ *
+ * @param pSink
+ * The object to tell, or NULL for nobody.  GCOM holds a reference to it
+ * until the budget is changed, or the library unloaded.
+ *
+ * @returns
+ * S_OK if successful.  E_NOTSUPPORTED if hdll is zero, or if the task
+ * allocator had no room left to keep track of the library when it was
+ * loaded.
+ *
+ * @see gCoDLLGetMemoryStats
+ */
+
+HRESULT gCoDLLSetMemoryBudget(
+			      HDLL hdll,
+			      uint64 cbBudget,
+			      IMemoryPressure *pSink
+			     )
+{
+   LibNode *pln = (LibNode *)hdll;
+
+   if( ( pln == NULL ) || ( pln -> component == 0 ) )
+      return E_NOTSUPPORTED;
+
+   TaskComponentSetBudget( pln -> component, cbBudget, pSink );
+   return S_OK;
+}
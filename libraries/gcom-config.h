@@ -67,39 +67,26 @@ freely, subject to the following restrictions:
 #define STR_TREATAS		"/TreatAs/"
 #endif
 
-#ifdef REGGUIDTEMPLATE
-#define STR_GUIDSTRING_TEMPLATE	REGGUIDTEMPLATE
-#else
-#warning Compiler did not receive a -DREGGUIDTEMPLATE=\\"...\\" option.
-#if defined( __ELATE__ ) && defined( __GNUC__ )
-#warning Using the default "{%08X-%04X-%04X-%02X%02X-%02X%02X%02X%02X%02X%02X}"
-#define STR_GUIDSTRING_TEMPLATE	"{%08X-%04X-%04X-%02X%02X-%02X%02X%02X%02X%02X%02X}"
-#elif defined( __LINUX__ ) && defined( __GNUC__ )
-#warning Using the default "{%08lX-%04X-%04X-%02X%02X-%02X%02X%02X%02X%02X%02X}"
-#define STR_GUIDSTRING_TEMPLATE	"{%08lX-%04X-%04X-%02X%02X-%02X%02X%02X%02X%02X%02X}"
-#endif
-#endif
-
 #ifdef DLLINITFUNC
-#define WSTR_DLLINIT		DLLINITFUNC
+#define STR_DLLINIT		DLLINITFUNC
 #else
-#warning Compiler did not receive a -DDLLINITFUNC=L\\"...\\" option.
-#warning Using the default of L"__init_com_".
-#define WSTR_DLLINIT		L"__init_com_"
+#warning Compiler did not receive a -DDLLINITFUNC=\\"...\\" option.
+#warning Using the default of "__init_com_".
+#define STR_DLLINIT		"__init_com_"
 #endif
 
 #ifdef DLLEXPUNGEFUNC
-#define WSTR_DLLEXPUNGE		DLLEXPUNGEFUNC
+#define STR_DLLEXPUNGE		DLLEXPUNGEFUNC
 #else
-#warning Compiler did not receive a -DDLLEXPUNGEFUNC=L\\"...\\" option.
-#warning Using the default of L"__expunge_com_".
-#define WSTR_DLLEXPUNGE		L"__expunge_com_"
+#warning Compiler did not receive a -DDLLEXPUNGEFUNC=\\"...\\" option.
+#warning Using the default of "__expunge_com_".
+#define STR_DLLEXPUNGE		"__expunge_com_"
 #endif
 
-#ifdef DLLSYMLEN
-#define MAX_SYMBOL_LEN		DLLSYMLEN
+#ifdef SHAREDHEAPSIZE
+#define SHARED_HEAP_SIZE	SHAREDHEAPSIZE
 #else
-#warning Compiler did not receive a -DDLLSYMLEN=n option.
-#warning Defaulting to 32.
-#define MAX_SYMBOL_LEN		32
+#warning Compiler did not receive a -DSHAREDHEAPSIZE=n option.
+#warning Reserving 1GB for the shared heap.
+#define SHARED_HEAP_SIZE	( 1ULL << 30 )
 #endif
@@ -0,0 +1,476 @@
+/*
+ * gstring.c
+ * GCOM Release 0.4
+ *
+ * Copyright (c) 1999, 2000 Samuel A. Falvo II
+ *
+ * This software is provided 'as-is', without any implied or express warranty.
+ * In no event shall the authors be held liable for damages arising from the
+ * use this software.
+ *
+ * Permission is granted for anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software in a
+ *    product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+#include <string.h>
+#include <gcom/gcom.h>
+
+/************************************************************************/
+/* String Buffers							*/
+/************************************************************************/
+
+/*
+ * A string too long to live inside its GSTRING keeps its text in one of
+ * these, allocated with CoTaskMemAlloc().  The text follows the header
+ * directly; the header is eight bytes, so UCS-4 text stays aligned.  Each
+ * GSTRING sharing the buffer holds a reference, and the only one holding
+ * a reference may change the text in place.
+ */
+
+struct GSTRINGBUFFER
+{
+   uint32f	cRef;
+   uint32f	cbSize;		/* Room for text, in bytes, the NULL included */
+};
+
+#define BufferText( pBuffer )	( (uint8 *)( (pBuffer) + 1 ) )
+
+static uint32 UnitSize( uint32 encoding )
+{
+   return ( encoding == STRINGENCODING_UCS4 ) ? sizeof( wchar ) : 1;
+}
+
+static uint8 *StringText( GSTRING *pstr )
+{
+   return pstr -> onHeap ? BufferText( pstr -> u.pBuffer ) : pstr -> u.text;
+}
+
+static void ReleaseBuffer( GSTRINGBUFFER *pBuffer )
+{
+   if( __sync_sub_and_fetch( &pBuffer -> cRef, 1 ) == 0 )
+      CoTaskMemFree( pBuffer );
+}
+
+/**
+ * Finds the size in bytes of cch units and a NULL.
+ *
+ * @returns
+ * The size, or zero if it doesn't fit in 32 bits.
+ */
+
+static uint32 TextSize( uint32 cch, uint32 cbUnit )
+{
+   if( cch >= ( 0xFFFFFFFF / cbUnit ) - 1 )
+      return 0;
+
+   return ( cch + 1 ) * cbUnit;
+}
+
+/**
+ * Makes room in pstr for cch units of text, inline if they fit, and
+ * NULL-terminates it.  The caller fills in the text.
+ *
+ * @param cbSize
+ * The room wanted, in bytes, if the text doesn't fit inline; at least
+ * enough for cch units and a NULL.
+ *
+ * @returns
+ * S_OK, or E_OUTOFMEMORY, in which case pstr is left empty.
+ */
+
+static HRESULT AllocateString( GSTRING *pstr, STRINGENCODING encoding, uint32 cch, uint32 cbSize )
+{
+   uint32 cbUnit = UnitSize( encoding ), cbText = TextSize( cch, cbUnit );
+   GSTRINGBUFFER *pBuffer;
+
+   gCoStringInit( pstr, encoding );
+
+   if( ( cbText == 0 ) || ( cbText > GSTRING_INLINE_SIZE ) )
+   {
+      if( ( cbText == 0 ) || ( cbSize < cbText ) ||
+	  ( cbSize > 0xFFFFFFFF - sizeof( GSTRINGBUFFER ) ) )
+	 return E_OUTOFMEMORY;
+
+      pBuffer = (GSTRINGBUFFER *)CoTaskMemAlloc( sizeof( GSTRINGBUFFER ) + cbSize );
+      if( pBuffer == NULL )
+	 return E_OUTOFMEMORY;
+
+      pBuffer -> cRef = 1;
+      pBuffer -> cbSize = cbSize;
+      pstr -> u.pBuffer = pBuffer;
+      pstr -> onHeap = TRUE;
+   }
+
+   pstr -> cch = cch;
+   memset( StringText( pstr ) + ( cch * cbUnit ), 0, cbUnit );
+   return S_OK;
+}
+
+/************************************************************************/
+/* Counted Strings							*/
+/************************************************************************/
+
+/**
+ * Makes an empty string.  An empty string needs no freeing, but may be
+ * freed all the same.
+ *
+ * @param pstr
+ * The string to set up.
+ *
+ * @param encoding
+ * The encoding of text it'll later be given, by gCoStringConcatenate().
+ */
+
+void gCoStringInit( GSTRING *pstr, STRINGENCODING encoding )
+{
+   pstr -> cch = 0;
+   pstr -> encoding = (uint16)encoding;
+   pstr -> onHeap = FALSE;
+   memset( pstr -> u.text, 0, sizeof( wchar ) );
+}
+
+/**
+ * Makes a UTF-8 string from counted text.
+ *
+ * @param ps
+ * The text.  It needn't be NULL-terminated, and a NULL in it is taken
+ * like any other character.
+ *
+ * @param cb
+ * Its length in bytes.
+ *
+ * @param pstr
+ * Receives the string.
+ *
+ * @returns
+ * S_OK, E_INVALIDARG if the text isn't well-formed UTF-8, or
+ * E_OUTOFMEMORY.  On failure, *pstr is an empty string.
+ *
+ * @see gCoStringFromUCS4
+ */
+
+HRESULT gCoStringFromUTF8( const char *ps, uint32 cb, GSTRING *pstr )
+{
+   uint32f cch;
+   HRESULT hr;
+
+   if( FAILED( gCoUTF8ToUCS4( ps, cb, NULL, 0, &cch ) ) )
+   {
+      gCoStringInit( pstr, STRINGENCODING_UTF8 );
+      return E_INVALIDARG;
+   }
+
+   hr = AllocateString( pstr, STRINGENCODING_UTF8, cb, TextSize( cb, 1 ) );
+   if( SUCCEEDED( hr ) )
+      memcpy( StringText( pstr ), ps, cb );
+
+   return hr;
+}
+
+/**
+ * Makes a UCS-4 string from counted text.
+ *
+ * @param ps
+ * The text, which needn't be NULL-terminated.
+ *
+ * @param cch
+ * Its length in characters.  For a NULL-terminated string, that's
+ * gCoUnicodeStringLength().
+ *
+ * @param pstr
+ * Receives the string.
+ *
+ * @returns
+ * S_OK, E_INVALIDARG if the text holds something that isn't a
+ * character, or E_OUTOFMEMORY.  On failure, *pstr is an empty string.
+ *
+ * @see gCoStringFromUTF8
+ */
+
+HRESULT gCoStringFromUCS4( const wchar *ps, uint32 cch, GSTRING *pstr )
+{
+   uint32f cb;
+   HRESULT hr;
+
+   if( FAILED( gCoUCS4ToUTF8( ps, cch, NULL, 0, &cb ) ) )
+   {
+      gCoStringInit( pstr, STRINGENCODING_UCS4 );
+      return E_INVALIDARG;
+   }
+
+   hr = AllocateString( pstr, STRINGENCODING_UCS4, cch, TextSize( cch, sizeof( wchar ) ) );
+   if( SUCCEEDED( hr ) )
+      memcpy( StringText( pstr ), ps, cch * sizeof( wchar ) );
+
+   return hr;
+}
+
+/**
+ * Makes a copy of a string in another encoding.  A copy in the same
+ * encoding is made as gCoStringDuplicate() makes it.
+ *
+ * @param ps
+ * The string to convert.
+ *
+ * @param encoding
+ * The encoding wanted.
+ *
+ * @param pd
+ * Receives the copy.  This mustn't be ps.
+ *
+ * @returns
+ * S_OK or E_OUTOFMEMORY.  On failure, *pd is an empty string.
+ */
+
+HRESULT gCoStringConvert( const GSTRING *ps, STRINGENCODING encoding, GSTRING *pd )
+{
+   const void *pText = gCoStringText( ps );
+   uint32f cch;
+   HRESULT hr;
+
+   if( ps -> encoding == encoding )
+   {
+      gCoStringDuplicate( ps, pd );
+      return S_OK;
+   }
+
+   if( encoding == STRINGENCODING_UCS4 )
+   {
+      gCoUTF8ToUCS4( (const char *)pText, ps -> cch, NULL, 0, &cch );
+      hr = AllocateString( pd, encoding, cch, TextSize( cch, sizeof( wchar ) ) );
+      if( SUCCEEDED( hr ) )
+	 gCoUTF8ToUCS4( (const char *)pText, ps -> cch, (wchar *)StringText( pd ), cch, &cch );
+   }
+   else
+   {
+      gCoUCS4ToUTF8( (const wchar *)pText, ps -> cch, NULL, 0, &cch );
+      hr = AllocateString( pd, encoding, cch, TextSize( cch, 1 ) );
+      if( SUCCEEDED( hr ) )
+	 gCoUCS4ToUTF8( (const wchar *)pText, ps -> cch, (char *)StringText( pd ), cch, &cch );
+   }
+
+   return hr;
+}
+
+/**
+ * Makes a copy of a string.  A short string is copied outright; a long
+ * one shares its text with the original until either is changed, so
+ * this never allocates memory, and never fails.
+ *
+ * @param ps
+ * The string to copy.
+ *
+ * @param pd
+ * Receives the copy.  This mustn't be ps.
+ */
+
+void gCoStringDuplicate( const GSTRING *ps, GSTRING *pd )
+{
+   *pd = *ps;
+   if( pd -> onHeap )
+      __sync_add_and_fetch( &pd -> u.pBuffer -> cRef, 1 );
+}
+
+/**
+ * Appends one string to another.  Text in another encoding is converted
+ * first.  If pstr shares its text, it gets a copy of its own; either
+ * way, room is left for the string to keep growing.
+ *
+ * @param pstr
+ * The string to add to.
+ *
+ * @param ps
+ * The string to add.  This may be pstr.
+ *
+ * @returns
+ * S_OK or E_OUTOFMEMORY.  On failure, pstr is unchanged.
+ *
+ * @see gCoUnicodeStringConcatenate
+ */
+
+HRESULT gCoStringConcatenate( GSTRING *pstr, const GSTRING *ps )
+{
+   uint32 cbUnit = UnitSize( pstr -> encoding ), cch, cbSize;
+   GSTRING converted, grown;
+   HRESULT hr;
+
+   if( ps -> encoding != pstr -> encoding )
+   {
+      hr = gCoStringConvert( ps, (STRINGENCODING)pstr -> encoding, &converted );
+      if( SUCCEEDED( hr ) )
+	 hr = gCoStringConcatenate( pstr, &converted );
+
+      gCoStringFree( &converted );
+      return hr;
+   }
+
+   if( ps -> cch > 0xFFFFFFFF - pstr -> cch )
+      return E_OUTOFMEMORY;
+
+   cch = pstr -> cch + ps -> cch;
+   cbSize = TextSize( cch, cbUnit );
+   if( cbSize == 0 )
+      return E_OUTOFMEMORY;
+
+   /*
+    * The text can be added in place if it fits, and pstr is the only
+    * string using it.  When pstr is ps, the two copies don't overlap.
+    */
+
+   if( pstr -> onHeap ?
+       ( ( pstr -> u.pBuffer -> cRef == 1 ) && ( pstr -> u.pBuffer -> cbSize >= cbSize ) ) :
+       ( cbSize <= GSTRING_INLINE_SIZE ) )
+   {
+      memcpy( StringText( pstr ) + ( pstr -> cch * cbUnit ), gCoStringText( ps ), ps -> cch * cbUnit );
+      memset( StringText( pstr ) + ( cch * cbUnit ), 0, cbUnit );
+      pstr -> cch = cch;
+      return S_OK;
+   }
+
+   if( pstr -> onHeap && ( pstr -> u.pBuffer -> cbSize <= 0x7FFFFFFF ) &&
+       ( cbSize < pstr -> u.pBuffer -> cbSize * 2 ) )
+      cbSize = pstr -> u.pBuffer -> cbSize * 2;
+
+   hr = AllocateString( &grown, (STRINGENCODING)pstr -> encoding, cch, cbSize );
+   if( FAILED( hr ) )
+      return hr;
+
+   memcpy( StringText( &grown ), StringText( pstr ), pstr -> cch * cbUnit );
+   memcpy( StringText( &grown ) + ( pstr -> cch * cbUnit ), gCoStringText( ps ), ps -> cch * cbUnit );
+
+   gCoStringFree( pstr );
+   *pstr = grown;
+   return S_OK;
+}
+
+/**
+ * Compares UTF-8 text with UCS-4 text.  The UCS-4 text is encoded a
+ * little at a time, as UTF-8 bytes sort in the order of the characters
+ * they encode.
+ */
+
+static int CompareUTF8WithUCS4( const uint8 *pb, uint32 cb, const wchar *ps, uint32 cch )
+{
+   uint8 chunk[ 64 ];
+   uint32 i, n;
+   uint32f cbChunk;
+   int r;
+
+   for( i = 0; i < cch; i += n )
+   {
+      n = ( cch - i < sizeof( chunk ) / 4 ) ? cch - i : sizeof( chunk ) / 4;
+      gCoUCS4ToUTF8( &ps[i], n, (char *)chunk, sizeof( chunk ), &cbChunk );
+
+      r = memcmp( pb, chunk, ( cb < cbChunk ) ? cb : cbChunk );
+      if( r != 0 )
+	 return ( r < 0 ) ? -1 : 1;
+      if( cb < cbChunk )
+	 return -1;
+
+      pb += cbChunk;
+      cb -= cbChunk;
+   }
+
+   return ( cb > 0 ) ? 1 : 0;
+}
+
+/**
+ * Compares two strings, in the order of the characters' code points,
+ * whatever their encodings.
+ *
+ * @returns
+ * -1 if the first string sorts before the second, 0 if they hold the
+ * same text, or +1 if the first sorts after the second.
+ *
+ * @see gCoUnicodeStringCompare
+ */
+
+int gCoStringCompare( const GSTRING *pstr1, const GSTRING *pstr2 )
+{
+   const uint8 *pb1, *pb2;
+   const wchar *ps1, *ps2;
+   uint32 i, cch;
+   int r;
+
+   if( pstr1 -> onHeap && pstr2 -> onHeap &&
+       ( pstr1 -> u.pBuffer == pstr2 -> u.pBuffer ) && ( pstr1 -> cch == pstr2 -> cch ) )
+      return 0;
+
+   if( pstr1 -> encoding != pstr2 -> encoding )
+   {
+      if( pstr1 -> encoding == STRINGENCODING_UTF8 )
+	 return CompareUTF8WithUCS4( gCoStringText( pstr1 ), pstr1 -> cch,
+				     gCoStringText( pstr2 ), pstr2 -> cch );
+
+      return -CompareUTF8WithUCS4( gCoStringText( pstr2 ), pstr2 -> cch,
+				   gCoStringText( pstr1 ), pstr1 -> cch );
+   }
+
+   cch = ( pstr1 -> cch < pstr2 -> cch ) ? pstr1 -> cch : pstr2 -> cch;
+
+   if( pstr1 -> encoding == STRINGENCODING_UTF8 )
+   {
+      pb1 = gCoStringText( pstr1 );
+      pb2 = gCoStringText( pstr2 );
+      r = memcmp( pb1, pb2, cch );
+      if( r != 0 )
+	 return ( r < 0 ) ? -1 : 1;
+   }
+   else
+   {
+      ps1 = gCoStringText( pstr1 );
+      ps2 = gCoStringText( pstr2 );
+      for( i = 0; i < cch; i++ )
+	 if( ps1[i] != ps2[i] )
+	    return ( ps1[i] < ps2[i] ) ? -1 : 1;
+   }
+
+   if( pstr1 -> cch == pstr2 -> cch )
+      return 0;
+
+   return ( pstr1 -> cch < pstr2 -> cch ) ? -1 : 1;
+}
+
+/**
+ * Finds a string's text, which is followed by a NULL unit: a NULL byte
+ * for UTF-8, or a NULL wchar for UCS-4.  gCoStringUTF8() and
+ * gCoStringUCS4() give it the right type.
+ *
+ * @returns
+ * The text.  It's valid until the string is changed or freed, and
+ * mustn't be changed through this pointer, as other strings may share
+ * it.
+ */
+
+const void *gCoStringText( const GSTRING *pstr )
+{
+   return StringText( (GSTRING *)pstr );
+}
+
+/**
+ * Frees a string's text, leaving it an empty string in the same encoding.
+ * Text shared with other strings is freed with the last of them.
+ *
+ * @param pstr
+ * The string to free.
+ */
+
+void gCoStringFree( GSTRING *pstr )
+{
+   if( pstr -> onHeap )
+      ReleaseBuffer( pstr -> u.pBuffer );
+
+   gCoStringInit( pstr, (STRINGENCODING)pstr -> encoding );
+}
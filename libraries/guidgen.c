@@ -0,0 +1,470 @@
+/*
+ * guidgen.c
+ * GCOM Release 0.4
+ *
+ * Copyright (c) 1999, 2000 Samuel A. Falvo II
+ *
+ * This software is provided 'as-is', without any implied or express warranty.
+ * In no event shall the authors be held liable for damages arising from the
+ * use this software.
+ *
+ * Permission is granted for anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software in a
+ *    product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <gcom/gcom.h>
+
+/************************************************************************/
+/* Per-thread generator state						*/
+/************************************************************************/
+
+/*
+ * Each thread has its own generator, so making GUIDs never takes a lock.
+ * Random bits come from ChaCha20, keyed from the kernel's getrandom().
+ * Every refill of the buffer replaces the key with the first 32 bytes of
+ * the new keystream and throws those bytes away, so a later leak of the
+ * state can't reveal GUIDs already handed out.
+ */
+
+#define RANDOM_BLOCKS		8
+#define RANDOM_BUFFER_SIZE	( RANDOM_BLOCKS * 64 )
+#define RANDOM_KEY_SIZE		32
+
+/* 100ns intervals between 1582-10-15 (the UUID epoch) and 1970-01-01 */
+
+#define UUID_EPOCH_OFFSET	0x01B21DD213814000ULL
+
+/* Bits in a version 7 GUID's per-millisecond counter */
+
+#define V7_COUNTER_BITS		42
+
+typedef struct GuidState
+{
+   uint32	key[8];
+   uint8	buffer[ RANDOM_BUFFER_SIZE ];
+   uint32	cbUsed;			/* Bytes of buffer handed out */
+   uint32	generation;		/* forkGeneration when seeded */
+   Bool		seeded;
+
+   uint64	v1LastTime;		/* 100ns ticks since UUID epoch */
+   uint16	v1ClockSeq;
+   uint8	v1Node[6];
+
+   uint64	v7LastMs;
+   uint64	v7Counter;
+} GuidState;
+
+static __thread GuidState tgs;
+
+/*
+ * A child process inherits its parent's generator state, and would repeat
+ * its GUIDs; forking bumps the generation, which makes every thread in the
+ * child reseed before making any more.
+ */
+
+static volatile uint32 forkGeneration = 0;
+static pthread_once_t atforkOnce = PTHREAD_ONCE_INIT;
+
+static void AtForkChild( void )
+{
+   forkGeneration++;
+}
+
+static void RegisterAtFork( void )
+{
+   pthread_atfork( NULL, NULL, AtForkChild );
+}
+
+/**
+ * Reads seed material from the kernel.
+ *
+ * @returns
+ * TRUE if all cb bytes were read.
+ */
+
+static Bool GetEntropy( void *pv, size_t cb )
+{
+   uint8 *pb = (uint8 *)pv;
+   long n;
+   int fd;
+
+#if defined( SYS_getrandom )
+   while( cb > 0 )
+   {
+      n = syscall( SYS_getrandom, pb, cb, 0 );
+      if( n < 0 )
+      {
+	 if( errno == EINTR )
+	    continue;
+
+	 break;
+      }
+
+      pb += n;
+      cb -= n;
+   }
+
+   if( cb == 0 )
+      return TRUE;
+#endif
+
+   /* Kernels older than 3.17 have no getrandom() */
+
+   fd = open( "/dev/urandom", O_RDONLY | O_CLOEXEC );
+   if( fd < 0 )
+      return FALSE;
+
+   while( cb > 0 )
+   {
+      n = read( fd, pb, cb );
+      if( n <= 0 )
+      {
+	 if( ( n < 0 ) && ( errno == EINTR ) )
+	    continue;
+
+	 break;
+      }
+
+      pb += n;
+      cb -= n;
+   }
+
+   close( fd );
+   return cb == 0;
+}
+
+/************************************************************************/
+/* ChaCha20								*/
+/************************************************************************/
+
+#define ROTL32(v,n)	( ( (v) << (n) ) | ( (v) >> ( 32 - (n) ) ) )
+
+#define QUARTERROUND(a,b,c,d)					\
+   a += b; d ^= a; d = ROTL32( d, 16 );				\
+   c += d; b ^= c; b = ROTL32( b, 12 );				\
+   a += b; d ^= a; d = ROTL32( d, 8 );				\
+   c += d; b ^= c; b = ROTL32( b, 7 );
+
+/**
+ * Produces one 64-byte block of ChaCha20 keystream, with a zero nonce.
+ */
+
+static void ChaChaBlock( const uint32 *key, uint32 counter, uint8 *out )
+{
+   uint32 in[16], x[16];
+   int i;
+
+   in[0] = 0x61707865;		/* "expand 32-byte k" */
+   in[1] = 0x3320646E;
+   in[2] = 0x79622D32;
+   in[3] = 0x6B206574;
+   memcpy( &in[4], key, RANDOM_KEY_SIZE );
+   in[12] = counter;
+   in[13] = in[14] = in[15] = 0;
+
+   memcpy( x, in, sizeof( x ) );
+
+   for( i = 0; i < 10; i++ )
+   {
+      QUARTERROUND( x[0], x[4], x[8],  x[12] )
+      QUARTERROUND( x[1], x[5], x[9],  x[13] )
+      QUARTERROUND( x[2], x[6], x[10], x[14] )
+      QUARTERROUND( x[3], x[7], x[11], x[15] )
+      QUARTERROUND( x[0], x[5], x[10], x[15] )
+      QUARTERROUND( x[1], x[6], x[11], x[12] )
+      QUARTERROUND( x[2], x[7], x[8],  x[13] )
+      QUARTERROUND( x[3], x[4], x[9],  x[14] )
+   }
+
+   for( i = 0; i < 16; i++ )
+      x[i] += in[i];
+
+   memcpy( out, x, 64 );
+}
+
+/**
+ * Refills a generator's buffer, and rekeys it.
+ */
+
+static void Refill( GuidState *s )
+{
+   uint32 i;
+
+   for( i = 0; i < RANDOM_BLOCKS; i++ )
+      ChaChaBlock( s -> key, i, &s -> buffer[ i * 64 ] );
+
+   memcpy( s -> key, s -> buffer, RANDOM_KEY_SIZE );
+   memset( s -> buffer, 0, RANDOM_KEY_SIZE );
+   s -> cbUsed = RANDOM_KEY_SIZE;
+}
+
+/**
+ * Copies random bytes out of a generator.
+ */
+
+static void RandomBytes( GuidState *s, void *pv, size_t cb )
+{
+   uint8 *pb = (uint8 *)pv;
+   size_t n;
+
+   while( cb > 0 )
+   {
+      if( s -> cbUsed == RANDOM_BUFFER_SIZE )
+	 Refill( s );
+
+      n = RANDOM_BUFFER_SIZE - s -> cbUsed;
+      if( n > cb )
+	 n = cb;
+
+      memcpy( pb, &s -> buffer[ s -> cbUsed ], n );
+      memset( &s -> buffer[ s -> cbUsed ], 0, n );
+
+      s -> cbUsed += n;
+      pb += n;
+      cb -= n;
+   }
+}
+
+static uint64 RandomBits( GuidState *s, int cBits )
+{
+   uint64 v;
+
+   RandomBytes( s, &v, sizeof( v ) );
+   return v >> ( 64 - cBits );
+}
+
+/**
+ * Returns the calling thread's generator, seeding it first if it's new,
+ * or if the process has forked since it was seeded.
+ *
+ * @returns
+ * The generator, or NULL if no entropy could be had.
+ */
+
+static GuidState *GetState( void )
+{
+   GuidState *s = &tgs;
+
+   if( s -> seeded && ( s -> generation == forkGeneration ) )
+      return s;
+
+   pthread_once( &atforkOnce, RegisterAtFork );
+
+   if( !GetEntropy( s -> key, RANDOM_KEY_SIZE ) )
+      return NULL;
+
+   s -> generation = forkGeneration;
+   s -> cbUsed = RANDOM_BUFFER_SIZE;
+   s -> seeded = TRUE;
+
+   /*
+    * Version 1 GUIDs get a random node ID with the multicast bit set, as
+    * the UUID specs allow, instead of a MAC address.  It's per thread, so
+    * threads reading the same clock tick can't collide.
+    */
+
+   s -> v1LastTime = 0;
+   s -> v1ClockSeq = (uint16)RandomBits( s, 14 );
+   RandomBytes( s, s -> v1Node, sizeof( s -> v1Node ) );
+   s -> v1Node[0] |= 0x01;
+
+   s -> v7LastMs = 0;
+   s -> v7Counter = 0;
+
+   return s;
+}
+
+/************************************************************************/
+/* The three versions							*/
+/************************************************************************/
+
+/**
+ * Returns the time since the Unix epoch in 100ns ticks.
+ */
+
+static uint64 Now( void )
+{
+   struct timespec ts;
+
+   clock_gettime( CLOCK_REALTIME, &ts );
+   return ( (uint64)ts.tv_sec * 10000000 ) + ( ts.tv_nsec / 100 );
+}
+
+static void SetVariant( GUID *pguid, uint16 version )
+{
+   pguid -> Data3 = ( pguid -> Data3 & 0x0FFF ) | ( version << 12 );
+   pguid -> Data4[0] = ( pguid -> Data4[0] & 0x3F ) | 0x80;
+}
+
+/**
+ * Version 1: the time in 100ns ticks, a clock sequence and a node ID.
+ * Within a thread, no two share a timestamp; when GUIDs are made faster
+ * than the clock ticks, the timestamp runs ahead of it a little.
+ */
+
+static void MakeTimeGUID( GuidState *s, uint64 now, GUID *pguid )
+{
+   uint64 t = now + UUID_EPOCH_OFFSET;
+
+   if( t <= s -> v1LastTime )
+      t = s -> v1LastTime + 1;
+
+   s -> v1LastTime = t;
+
+   pguid -> Data1 = (uint32f)t;
+   pguid -> Data2 = (uint16)( t >> 32 );
+   pguid -> Data3 = (uint16)( t >> 48 );
+   pguid -> Data4[0] = (uint8)( s -> v1ClockSeq >> 8 );
+   pguid -> Data4[1] = (uint8)s -> v1ClockSeq;
+   memcpy( &pguid -> Data4[2], s -> v1Node, 6 );
+
+   SetVariant( pguid, 1 );
+}
+
+/**
+ * Version 7: milliseconds since 1970 in the top 48 bits, so the text and
+ * binary forms sort by creation time.  The next 42 bits, less the version
+ * and variant, hold a counter that starts at a random value each
+ * millisecond and counts up, so a thread's GUIDs always sort in the order
+ * they were made.  Should the counter overflow, the timestamp borrows a
+ * millisecond from the future.  The last 32 bits are random.
+ */
+
+static void MakeSortableGUID( GuidState *s, uint64 now, GUID *pguid )
+{
+   uint64 ms = now / 10000;
+   uint64 c;
+   uint32f r;
+
+   if( ms > s -> v7LastMs )
+   {
+      s -> v7LastMs = ms;
+      s -> v7Counter = RandomBits( s, V7_COUNTER_BITS - 1 );
+   }
+   else if( ++s -> v7Counter >= ( 1ULL << V7_COUNTER_BITS ) )
+   {
+      s -> v7LastMs++;
+      s -> v7Counter = RandomBits( s, V7_COUNTER_BITS - 1 );
+   }
+
+   ms = s -> v7LastMs;
+   c = s -> v7Counter;
+   RandomBytes( s, &r, sizeof( r ) );
+
+   pguid -> Data1 = (uint32f)( ms >> 16 );
+   pguid -> Data2 = (uint16)ms;
+   pguid -> Data3 = (uint16)( c >> 30 );
+   pguid -> Data4[0] = (uint8)( c >> 24 );
+   pguid -> Data4[1] = (uint8)( c >> 16 );
+   pguid -> Data4[2] = (uint8)( c >> 8 );
+   pguid -> Data4[3] = (uint8)c;
+   memcpy( &pguid -> Data4[4], &r, 4 );
+
+   SetVariant( pguid, 7 );
+}
+
+/************************************************************************/
+/* Public interface							*/
+/************************************************************************/
+
+/**
+ * Makes a batch of GUIDs.
+ *
+ * @param version
+ * GUIDVERSION_TIME (1), GUIDVERSION_RANDOM (4) or GUIDVERSION_SORTABLE
+ * (7).  Random GUIDs are the safe default; version 1 GUIDs reveal when
+ * they were made, and version 7 GUIDs sort by when they were made, which
+ * keeps B-tree indexes compact.
+ *
+ * @param pguids
+ * Array to fill.
+ *
+ * @param cGuids
+ * How many GUIDs to make.
+ *
+ * @returns
+ * S_OK if successful.  E_INVALIDARG for an unknown version.  E_UNEXPECTED
+ * if the kernel couldn't supply a seed.
+ *
+ * @see gCoCreateGuid
+ */
+
+HRESULT gCoCreateGuids( GUIDVERSION version, GUID *pguids, uint32 cGuids )
+{
+   GuidState *s;
+   uint64 now = 0;
+   uint32 i;
+
+   if( ( version != GUIDVERSION_TIME ) &&
+       ( version != GUIDVERSION_RANDOM ) &&
+       ( version != GUIDVERSION_SORTABLE ) )
+      return E_INVALIDARG;
+
+   s = GetState();
+   if( s == NULL )
+      return E_UNEXPECTED;
+
+   if( version == GUIDVERSION_RANDOM )
+   {
+      RandomBytes( s, pguids, (size_t)cGuids * sizeof( GUID ) );
+      for( i = 0; i < cGuids; i++ )
+	 SetVariant( &pguids[i], 4 );
+
+      return S_OK;
+   }
+
+   /* The clock is read once every 256 GUIDs; the counters do the rest */
+
+   for( i = 0; i < cGuids; i++ )
+   {
+      if( ( i & 255 ) == 0 )
+	 now = Now();
+
+      if( version == GUIDVERSION_TIME )
+	 MakeTimeGUID( s, now, &pguids[i] );
+      else
+	 MakeSortableGUID( s, now, &pguids[i] );
+   }
+
+   return S_OK;
+}
+
+/**
+ * Makes a random (version 4) GUID, good for identifying anything: new
+ * classes, interfaces, objects or requests.
+ *
+ * @param pguid
+ * Receives the new GUID.
+ *
+ * @returns
+ * S_OK if successful.  E_UNEXPECTED if the kernel couldn't supply a seed.
+ *
+ * @see gCoCreateGuids
+ */
+
+HRESULT gCoCreateGuid( GUID *pguid )
+{
+   return gCoCreateGuids( GUIDVERSION_RANDOM, pguid, 1 );
+}
@@ -0,0 +1,942 @@
+/*
+ * guidmap.c
+ * GCOM Release 0.3
+ *
+ * Copyright (c) 1999, 2000 Samuel A. Falvo II
+ *
+ * This software is provided 'as-is', without any implied or express warranty.
+ * In no event shall the authors be held liable for damages arising from the
+ * use this software.
+ *
+ * Permission is granted for anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software in a
+ *    product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <gcom/types.h>
+#include <gcom/errors.h>
+#include <gcom/guid.h>
+#include <util/guidmap.h>
+
+#if defined( __SSE2__ )
+#include <emmintrin.h>
+#endif
+
+/************************************************************************/
+/* Table layout								*/
+/************************************************************************/
+
+/*
+ * A table is one block: the header, then a control byte per slot, then
+ * the slots themselves.  A control byte is either one of the values
+ * below, or, for a slot holding an entry, the low seven bits of its key's
+ * hash.  Slots are probed a group at a time, starting at the group picked
+ * by the hash and moving on in triangular steps until a group with an
+ * empty slot turns up.
+ *
+ * Slots only ever go from empty to busy to full, and from full to
+ * deleted.  None ever becomes empty again, so a lookup racing an update
+ * can't stop early, and a key it compares against can't change under it.
+ * Deleted slots are recovered when the map is next rehashed.
+ */
+
+#define GROUP_SIZE	16
+#define MIN_CAPACITY	64
+#define LOCK_STRIPES	16
+#define READER_STRIPES	16
+
+#define CTRL_EMPTY	0x80
+#define CTRL_DELETED	0xFE
+#define CTRL_BUSY	0xFF	/* Claimed; key being written */
+
+#define LOAD_ACQUIRE(p)		__atomic_load_n( (p), __ATOMIC_ACQUIRE )
+#define STORE_RELEASE(p,v)	__atomic_store_n( (p), (v), __ATOMIC_RELEASE )
+
+typedef struct Entry
+{
+   GUID			key;
+   void *		value;
+} Entry;
+
+typedef struct Table
+{
+   struct Table *	retired;	/* Next on the map's retired list */
+   uint64		retiredAt;	/* Map's phase when it was replaced */
+   uint64		mask;		/* Number of slots - 1 */
+   uint64		limit;		/* Slots usable before rehashing */
+   uint64 volatile	cUsed;		/* Slots claimed, deleted ones too */
+   uint8 *		ctrl;
+   Entry *		entries;
+} Table;
+
+#define TABLE_HEADER_SIZE	( ( sizeof( Table ) + 63 ) & ~(size_t)63 )
+
+/*
+ * Lookups run without locks, so a table the map has outgrown can only be
+ * freed once every lookup that might still be reading it is done.  Each
+ * lookup counts itself in one of two counters, picked by the low bit of
+ * the map's phase, spread over a few cache lines by thread.
+ *
+ * Only a rehash moves the phase on, and only once the counter it moves
+ * new lookups onto has drained, meaning every lookup begun two phases
+ * earlier is done.  A table replaced in one phase is therefore free to
+ * go two phases later.  Nothing ever waits for lookups: a rehash frees
+ * whatever it can, and leaves the rest for the next one.
+ */
+
+typedef struct
+{
+   uint64 volatile	count[ 2 ];
+} __attribute__(( aligned( 64 ) )) ReaderStripe;
+
+struct GUIDMap
+{
+   ReaderStripe		readers[ READER_STRIPES ];
+   Table *		table;
+   Table *		retired;	/* Tables outgrown, newest first */
+   uint64 volatile	phase;
+   uint32		flags;
+   uint32 volatile	cLive;
+   pthread_rwlock_t	resizeLock;	/* Held exclusively to rehash */
+   pthread_mutex_t	stripes[ LOCK_STRIPES ];
+};
+
+static uint32 volatile nextReaderStripe;
+static __thread uint32 readerStripe;	/* Plus one; zero until assigned */
+
+/**
+ * Allocates an empty table.
+ *
+ * @param cSlots
+ * Number of slots; a power of two, at least MIN_CAPACITY.
+ *
+ * @returns
+ * The new table, or NULL if memory ran out.
+ */
+
+static Table *TableCreate( uint64 cSlots )
+{
+   Table *t;
+   void *pv;
+
+   if( posix_memalign(
+		      &pv, 64,
+		      TABLE_HEADER_SIZE + cSlots + ( cSlots * sizeof( Entry ) )
+		     ) != 0 )
+      return NULL;
+
+   t = (Table *)pv;
+   t -> retired = NULL;
+   t -> retiredAt = 0;
+   t -> mask = cSlots - 1;
+   t -> limit = cSlots - ( cSlots / 8 );
+   t -> cUsed = 0;
+   t -> ctrl = (uint8 *)pv + TABLE_HEADER_SIZE;
+   t -> entries = (Entry *)( t -> ctrl + cSlots );
+
+   memset( t -> ctrl, CTRL_EMPTY, cSlots );
+   return t;
+}
+
+/**
+ * Returns a bit mask of the control bytes in a group equal to ctrl.
+ */
+
+static inline uint32 GroupMatch( const uint8 *group, uint8 ctrl )
+{
+#if defined( __SSE2__ )
+   return (uint32)_mm_movemask_epi8(
+				    _mm_cmpeq_epi8(
+						   _mm_load_si128( (const __m128i *)group ),
+						   _mm_set1_epi8( (char)ctrl )
+						  )
+				   );
+#else
+   uint32 mask = 0;
+   int i;
+
+   for( i = 0; i < GROUP_SIZE; i++ )
+      if( ( (const uint8 volatile *)group )[i] == ctrl )
+	 mask |= 1 << i;
+
+   return mask;
+#endif
+}
+
+/**
+ * Looks for a key in a table.
+ *
+ * @returns
+ * The slot holding the key, or -1 if it isn't there.
+ */
+
+static int64 TableFind( Table *t, REFGUID rguid, uint64 hash )
+{
+   uint64 groupMask = t -> mask / GROUP_SIZE;
+   uint64 group = ( hash >> 7 ) & groupMask;
+   uint64 step = 0, slot;
+   uint32 match, empty;
+
+   for( ;; )
+   {
+      match = GroupMatch( &t -> ctrl[ group * GROUP_SIZE ], hash & 0x7F );
+      empty = GroupMatch( &t -> ctrl[ group * GROUP_SIZE ], CTRL_EMPTY );
+
+      /* Keys must be read after the control bytes that published them */
+
+      __atomic_thread_fence( __ATOMIC_ACQUIRE );
+
+      while( match != 0 )
+      {
+	 slot = ( group * GROUP_SIZE ) + __builtin_ctz( match );
+	 if( IsEqualIID( &t -> entries[ slot ].key, rguid ) )
+	    return (int64)slot;
+
+	 match &= match - 1;
+      }
+
+      if( empty != 0 )
+	 return -1;
+
+      group = ( group + ++step ) & groupMask;
+   }
+}
+
+/**
+ * Adds a key known not to be in the table.  Other writers may be adding
+ * other keys at the same time; slots are claimed with a compare-and-swap,
+ * and published once the entry is written.
+ *
+ * @returns
+ * The slot used, or -1 if the table is too full and must be rehashed.
+ */
+
+static int64 TableClaim( Table *t, REFGUID rguid, uint64 hash, void *value )
+{
+   uint64 groupMask = t -> mask / GROUP_SIZE;
+   uint64 group = ( hash >> 7 ) & groupMask;
+   uint64 step = 0, slot;
+   uint32 empty;
+
+   /*
+    * Reserving a slot up front guarantees there's one to be had below,
+    * however many other writers are racing for them.
+    */
+
+   if( __sync_add_and_fetch( &t -> cUsed, 1 ) > t -> limit )
+   {
+      __sync_sub_and_fetch( &t -> cUsed, 1 );
+      return -1;
+   }
+
+   for( ;; )
+   {
+      empty = GroupMatch( &t -> ctrl[ group * GROUP_SIZE ], CTRL_EMPTY );
+
+      while( empty != 0 )
+      {
+	 slot = ( group * GROUP_SIZE ) + __builtin_ctz( empty );
+	 if( __sync_bool_compare_and_swap( &t -> ctrl[ slot ], CTRL_EMPTY, CTRL_BUSY ) )
+	 {
+	    t -> entries[ slot ].key = *rguid;
+	    t -> entries[ slot ].value = value;
+	    STORE_RELEASE( &t -> ctrl[ slot ], (uint8)( hash & 0x7F ) );
+	    return (int64)slot;
+	 }
+
+	 empty &= empty - 1;
+      }
+
+      group = ( group + ++step ) & groupMask;
+   }
+}
+
+/************************************************************************/
+/* Reclaiming outgrown tables						*/
+/************************************************************************/
+
+/**
+ * Starts a lookup, returning the counter to pass to EndRead().  The
+ * map's current table may be read until then.
+ */
+
+static uint64 volatile *BeginRead( GUIDMap *map )
+{
+   uint64 volatile *counter;
+
+   if( readerStripe == 0 )
+      readerStripe = ( __sync_fetch_and_add( &nextReaderStripe, 1 ) % READER_STRIPES ) + 1;
+
+   counter = &map -> readers[ readerStripe - 1 ].count[ LOAD_ACQUIRE( &map -> phase ) & 1 ];
+   __sync_add_and_fetch( counter, 1 );
+   return counter;
+}
+
+static void EndRead( uint64 volatile *counter )
+{
+   __sync_sub_and_fetch( counter, 1 );
+}
+
+/**
+ * Moves the map's phase on, if lookups allow, and frees every retired
+ * table no lookup can still be reading.  Must be called by the thread
+ * rehashing the map.
+ */
+
+static void Reclaim( GUIDMap *map )
+{
+   Table **pt, *t;
+   uint64 phase, busy;
+   int i, step;
+
+   for( step = 0; step < 2; step++ )
+   {
+      phase = map -> phase;
+      __sync_synchronize();
+
+      busy = 0;
+      for( i = 0; i < READER_STRIPES; i++ )
+	 busy += map -> readers[i].count[ ( phase + 1 ) & 1 ];
+
+      if( busy != 0 )
+	 break;
+
+      __sync_add_and_fetch( &map -> phase, 1 );
+   }
+
+   phase = map -> phase;
+   for( pt = &map -> retired; ( t = *pt ) != NULL; )
+   {
+      if( t -> retiredAt + 2 <= phase )
+      {
+	 *pt = t -> retired;
+	 free( t );
+      }
+      else
+	 pt = &t -> retired;
+   }
+}
+
+/************************************************************************/
+/* Locking								*/
+/************************************************************************/
+
+/**
+ * Takes the locks needed to update a key: the resize lock, shared, so the
+ * table can't be replaced underneath, and the key's stripe lock.
+ *
+ * @returns
+ * The stripe lock taken, for UnlockForUpdate(); NULL for maps with a
+ * single writer.
+ */
+
+static pthread_mutex_t *LockForUpdate( GUIDMap *map, uint64 hash )
+{
+   pthread_mutex_t *stripe;
+
+   if( map -> flags & GUIDMAP_SINGLEWRITER )
+      return NULL;
+
+   pthread_rwlock_rdlock( &map -> resizeLock );
+
+   stripe = &map -> stripes[ ( hash >> 32 ) % LOCK_STRIPES ];
+   pthread_mutex_lock( stripe );
+   return stripe;
+}
+
+static void UnlockForUpdate( GUIDMap *map, pthread_mutex_t *stripe )
+{
+   if( stripe == NULL )
+      return;
+
+   pthread_mutex_unlock( stripe );
+   pthread_rwlock_unlock( &map -> resizeLock );
+}
+
+/**
+ * Replaces a full table.  The new one is twice the size if the old one
+ * was mostly live entries, or the same size if it was mostly deleted
+ * ones.  Lookups already under way carry on in the old table, which is
+ * retired, and freed by a later rehash once they're done.
+ *
+ * @param told
+ * The table the caller found full.  If some other writer has already
+ * replaced it, there's nothing to do.
+ *
+ * @returns
+ * S_OK, or E_OUTOFMEMORY.
+ */
+
+static HRESULT Rehash( GUIDMap *map, Table *told )
+{
+   Table *tnew;
+   uint64 cSlots, slot;
+   HRESULT hr = S_OK;
+
+   if( !( map -> flags & GUIDMAP_SINGLEWRITER ) )
+      pthread_rwlock_wrlock( &map -> resizeLock );
+
+   if( map -> table == told )
+   {
+      cSlots = told -> mask + 1;
+      if( (uint64)map -> cLive >= ( told -> limit / 2 ) )
+	 cSlots *= 2;
+
+      tnew = TableCreate( cSlots );
+      if( tnew == NULL )
+	 hr = E_OUTOFMEMORY;
+      else
+      {
+	 for( slot = 0; slot <= told -> mask; slot++ )
+	 {
+	    if( told -> ctrl[ slot ] < CTRL_EMPTY )
+	       TableClaim(
+			  tnew,
+			  &told -> entries[ slot ].key,
+			  GUIDHash( &told -> entries[ slot ].key ),
+			  told -> entries[ slot ].value
+			 );
+	 }
+
+	 STORE_RELEASE( &map -> table, tnew );
+
+	 told -> retiredAt = map -> phase;
+	 told -> retired = map -> retired;
+	 map -> retired = told;
+      }
+
+      Reclaim( map );
+   }
+
+   if( !( map -> flags & GUIDMAP_SINGLEWRITER ) )
+      pthread_rwlock_unlock( &map -> resizeLock );
+
+   return hr;
+}
+
+/****** GUIDHash *********************************************************
+ *
+ * NAME
+ * 	GUIDHash
+ *
+ * SYNOPSIS
+ * 	#include <util/guidmap.h>
+ *
+ * 	hash = GUIDHash( rguid );
+ *
+ * 	uint64	hash;
+ * 	REFGUID	rguid;
+ *
+ * FUNCTION
+ * 	Hashes a GUID down to 64 bits.  Random GUIDs hash well enough
+ * 	on their own, but the well-known interface IDs differ only in a
+ * 	few bits of Data1, so everything is mixed into every bit.
+ *
+ * INPUTS
+ * 	rguid		The GUID to hash.
+ *
+ * RESULT
+ * 	The hash.
+ *
+ * BUGS
+ *
+ * SEE ALSO
+ *
+ ************************************************************************/
+
+uint64 GUIDHash( REFGUID rguid )
+{
+   uint64 lo, hi, h;
+
+   memcpy( &lo, rguid, 8 );
+   memcpy( &hi, (const uint8 *)rguid + 8, 8 );
+
+   h = ( lo * 0x9E3779B97F4A7C15ULL ) ^ hi;
+   h = ( h ^ ( h >> 32 ) ) * 0xD6E8FEB86659FD93ULL;
+   h ^= h >> 29;
+
+   return h;
+}
+
+/****** GUIDMapCreate ****************************************************
+ *
+ * NAME
+ * 	GUIDMapCreate
+ *
+ * SYNOPSIS
+ * 	#include <util/guidmap.h>
+ *
+ * 	hr = GUIDMapCreate( cInitial, flags, ppMap );
+ *
+ * 	HRESULT	hr;
+ * 	uint32	cInitial;
+ * 	uint32	flags;
+ * 	GUIDMap	**ppMap;
+ *
+ * FUNCTION
+ * 	Creates an empty map.
+ *
+ * INPUTS
+ * 	cInitial	How many entries to make room for up front.  The
+ * 			map grows as needed regardless.
+ *
+ * 	flags		GUIDMAP_SINGLEWRITER if the caller will make sure
+ * 			updates never overlap; otherwise 0.
+ *
+ * 	ppMap		Receives the new map.
+ *
+ * RESULT
+ * 	S_OK, or E_OUTOFMEMORY.
+ *
+ * BUGS
+ *
+ * SEE ALSO
+ * 	GUIDMapDestroy
+ *
+ ************************************************************************/
+
+HRESULT GUIDMapCreate( uint32 cInitial, uint32 flags, GUIDMap **ppMap )
+{
+   GUIDMap *map;
+   uint64 cSlots = MIN_CAPACITY;
+   int i;
+
+   *ppMap = NULL;
+
+   while( ( cSlots - ( cSlots / 8 ) ) < (uint64)cInitial )
+      cSlots *= 2;
+
+   if( posix_memalign( (void **)&map, 64, sizeof( GUIDMap ) ) != 0 )
+      return E_OUTOFMEMORY;
+
+   memset( map -> readers, 0, sizeof( map -> readers ) );
+   map -> retired = NULL;
+   map -> phase = 0;
+
+   map -> table = TableCreate( cSlots );
+   if( map -> table == NULL )
+   {
+      free( map );
+      return E_OUTOFMEMORY;
+   }
+
+   map -> flags = flags;
+   map -> cLive = 0;
+
+   pthread_rwlock_init( &map -> resizeLock, NULL );
+   for( i = 0; i < LOCK_STRIPES; i++ )
+      pthread_mutex_init( &map -> stripes[i], NULL );
+
+   *ppMap = map;
+   return S_OK;
+}
+
+/****** GUIDMapDestroy ***************************************************
+ *
+ * NAME
+ * 	GUIDMapDestroy
+ *
+ * SYNOPSIS
+ * 	#include <util/guidmap.h>
+ *
+ * 	GUIDMapDestroy( map );
+ *
+ * 	GUIDMap	*map;
+ *
+ * FUNCTION
+ * 	Frees a map, along with every table it has outgrown.  The
+ * 	values it held are left alone.  Nobody else may be using the map.
+ *
+ * INPUTS
+ * 	map		The map to destroy.  NULL is ignored.
+ *
+ * RESULT
+ *
+ * BUGS
+ *
+ * SEE ALSO
+ * 	GUIDMapCreate
+ *
+ ************************************************************************/
+
+void GUIDMapDestroy( GUIDMap *map )
+{
+   Table *t, *next;
+   int i;
+
+   if( map == NULL )
+      return;
+
+   free( map -> table );
+   for( t = map -> retired; t != NULL; t = next )
+   {
+      next = t -> retired;
+      free( t );
+   }
+
+   pthread_rwlock_destroy( &map -> resizeLock );
+   for( i = 0; i < LOCK_STRIPES; i++ )
+      pthread_mutex_destroy( &map -> stripes[i] );
+
+   free( map );
+}
+
+/****** GUIDMapLookup ****************************************************
+ *
+ * NAME
+ * 	GUIDMapLookup
+ *
+ * SYNOPSIS
+ * 	#include <util/guidmap.h>
+ *
+ * 	value = GUIDMapLookup( map, rguid );
+ *
+ * 	void	*value;
+ * 	GUIDMap	*map;
+ * 	REFGUID	rguid;
+ *
+ * FUNCTION
+ * 	Finds the value stored under a key.  Never blocks, even while
+ * 	the map is being updated or rehashed.
+ *
+ * INPUTS
+ * 	map		The map to search.
+ *
+ * 	rguid		The key.
+ *
+ * RESULT
+ * 	The value, or NULL if the key isn't in the map.
+ *
+ * BUGS
+ *
+ * SEE ALSO
+ * 	GUIDMapInsert, GUIDMapSet
+ *
+ ************************************************************************/
+
+void *GUIDMapLookup( GUIDMap *map, REFGUID rguid )
+{
+   uint64 volatile *counter = BeginRead( map );
+   Table *t = LOAD_ACQUIRE( &map -> table );
+   void *value = NULL;
+   int64 slot;
+
+   slot = TableFind( t, rguid, GUIDHash( rguid ) );
+   if( slot >= 0 )
+      value = LOAD_ACQUIRE( &t -> entries[ slot ].value );
+
+   EndRead( counter );
+   return value;
+}
+
+/**
+ * Does the work of GUIDMapInsert() and GUIDMapSet().
+ */
+
+static HRESULT Update( GUIDMap *map, REFGUID rguid, void *value, void **ppOld, Bool replace )
+{
+   pthread_mutex_t *stripe;
+   uint64 hash;
+   Table *t;
+   int64 slot;
+   void *old;
+   HRESULT hr;
+
+   if( ppOld != NULL )
+      *ppOld = NULL;
+
+   if( value == NULL )
+      return E_INVALIDARG;
+
+   hash = GUIDHash( rguid );
+
+   for( ;; )
+   {
+      stripe = LockForUpdate( map, hash );
+      t = map -> table;
+
+      slot = TableFind( t, rguid, hash );
+      if( slot >= 0 )
+      {
+	 old = t -> entries[ slot ].value;
+	 if( replace )
+	    STORE_RELEASE( &t -> entries[ slot ].value, value );
+
+	 UnlockForUpdate( map, stripe );
+
+	 if( ppOld != NULL )
+	    *ppOld = old;
+
+	 return S_FALSE;
+      }
+
+      slot = TableClaim( t, rguid, hash, value );
+      if( slot >= 0 )
+	 __sync_add_and_fetch( &map -> cLive, 1 );
+
+      UnlockForUpdate( map, stripe );
+
+      if( slot >= 0 )
+	 return S_OK;
+
+      hr = Rehash( map, t );
+      if( FAILED( hr ) )
+	 return hr;
+   }
+}
+
+/****** GUIDMapInsert ****************************************************
+ *
+ * NAME
+ * 	GUIDMapInsert
+ *
+ * SYNOPSIS
+ * 	#include <util/guidmap.h>
+ *
+ * 	hr = GUIDMapInsert( map, rguid, value, ppExisting );
+ *
+ * 	HRESULT	hr;
+ * 	GUIDMap	*map;
+ * 	REFGUID	rguid;
+ * 	void	*value;
+ * 	void	**ppExisting;
+ *
+ * FUNCTION
+ * 	Adds an entry, unless the key is already in the map, in which
+ * 	case the map is left as it was.  Either way, the caller learns
+ * 	which value ended up stored under the key.
+ *
+ * INPUTS
+ * 	map		The map to add to.
+ *
+ * 	rguid		The key.
+ *
+ * 	value		The value; must not be NULL.
+ *
+ * 	ppExisting	If not NULL, receives the value already stored
+ * 			under the key, or NULL if there wasn't one.
+ *
+ * RESULT
+ * 	S_OK if the entry was added.  S_FALSE if the key was already
+ * 	present.  E_INVALIDARG if value is NULL.  E_OUTOFMEMORY if the
+ * 	map needed to grow, but couldn't.
+ *
+ * BUGS
+ *
+ * SEE ALSO
+ * 	GUIDMapSet, GUIDMapRemove
+ *
+ ************************************************************************/
+
+HRESULT GUIDMapInsert( GUIDMap *map, REFGUID rguid, void *value, void **ppExisting )
+{
+   return Update( map, rguid, value, ppExisting, FALSE );
+}
+
+/****** GUIDMapSet *******************************************************
+ *
+ * NAME
+ * 	GUIDMapSet
+ *
+ * SYNOPSIS
+ * 	#include <util/guidmap.h>
+ *
+ * 	hr = GUIDMapSet( map, rguid, value, ppOld );
+ *
+ * 	HRESULT	hr;
+ * 	GUIDMap	*map;
+ * 	REFGUID	rguid;
+ * 	void	*value;
+ * 	void	**ppOld;
+ *
+ * FUNCTION
+ * 	Stores a value under a key, replacing whatever was there.
+ *
+ * INPUTS
+ * 	map		The map to update.
+ *
+ * 	rguid		The key.
+ *
+ * 	value		The value; must not be NULL.
+ *
+ * 	ppOld		If not NULL, receives the value replaced, or NULL
+ * 			if the key is new.
+ *
+ * RESULT
+ * 	S_OK if the key was added.  S_FALSE if an existing entry was
+ * 	replaced.  E_INVALIDARG if value is NULL.  E_OUTOFMEMORY if the
+ * 	map needed to grow, but couldn't.
+ *
+ * BUGS
+ *
+ * SEE ALSO
+ * 	GUIDMapInsert, GUIDMapRemove
+ *
+ ************************************************************************/
+
+HRESULT GUIDMapSet( GUIDMap *map, REFGUID rguid, void *value, void **ppOld )
+{
+   return Update( map, rguid, value, ppOld, TRUE );
+}
+
+/****** GUIDMapRemove ****************************************************
+ *
+ * NAME
+ * 	GUIDMapRemove
+ *
+ * SYNOPSIS
+ * 	#include <util/guidmap.h>
+ *
+ * 	value = GUIDMapRemove( map, rguid );
+ *
+ * 	void	*value;
+ * 	GUIDMap	*map;
+ * 	REFGUID	rguid;
+ *
+ * FUNCTION
+ * 	Removes a key from the map.  Lookups already under way may still
+ * 	return the value removed.
+ *
+ * INPUTS
+ * 	map		The map to remove from.
+ *
+ * 	rguid		The key.
+ *
+ * RESULT
+ * 	The value that was stored under the key, or NULL if there was
+ * 	none.
+ *
+ * BUGS
+ *
+ * SEE ALSO
+ * 	GUIDMapInsert, GUIDMapSet
+ *
+ ************************************************************************/
+
+void *GUIDMapRemove( GUIDMap *map, REFGUID rguid )
+{
+   pthread_mutex_t *stripe;
+   uint64 hash = GUIDHash( rguid );
+   Table *t;
+   int64 slot;
+   void *old = NULL;
+
+   stripe = LockForUpdate( map, hash );
+   t = map -> table;
+
+   slot = TableFind( t, rguid, hash );
+   if( slot >= 0 )
+   {
+      old = t -> entries[ slot ].value;
+      STORE_RELEASE( &t -> ctrl[ slot ], CTRL_DELETED );
+      __sync_sub_and_fetch( &map -> cLive, 1 );
+   }
+
+   UnlockForUpdate( map, stripe );
+   return old;
+}
+
+/****** GUIDMapGetCount **************************************************
+ *
+ * NAME
+ * 	GUIDMapGetCount
+ *
+ * SYNOPSIS
+ * 	#include <util/guidmap.h>
+ *
+ * 	count = GUIDMapGetCount( map );
+ *
+ * 	uint32	count;
+ * 	GUIDMap	*map;
+ *
+ * FUNCTION
+ * 	Tells how many entries the map holds.  With updates under way,
+ * 	the answer may be out of date by the time it's returned.
+ *
+ * INPUTS
+ * 	map		The map to count.
+ *
+ * RESULT
+ * 	The number of entries.
+ *
+ * BUGS
+ *
+ * SEE ALSO
+ *
+ ************************************************************************/
+
+uint32 GUIDMapGetCount( GUIDMap *map )
+{
+   return map -> cLive;
+}
+
+/****** GUIDMapEnumerate *************************************************
+ *
+ * NAME
+ * 	GUIDMapEnumerate
+ *
+ * SYNOPSIS
+ * 	#include <util/guidmap.h>
+ *
+ * 	GUIDMapEnumerate( map, proc, context );
+ *
+ * 	GUIDMap		*map;
+ * 	GUIDMAPENUMPROC	proc;
+ * 	void		*context;
+ *
+ * FUNCTION
+ * 	Calls proc( context, key, value ) for each entry in the map, in
+ * 	no particular order, until it returns FALSE.  Like a lookup, this
+ * 	takes no locks; entries added or removed meanwhile may or may not
+ * 	be seen.  proc may update the map.
+ *
+ * INPUTS
+ * 	map		The map to walk.
+ *
+ * 	proc		The function to call.
+ *
+ * 	context		Passed to proc as is.
+ *
+ * RESULT
+ *
+ * BUGS
+ *
+ * SEE ALSO
+ *
+ ************************************************************************/
+
+void GUIDMapEnumerate( GUIDMap *map, GUIDMAPENUMPROC proc, void *context )
+{
+   uint64 volatile *counter = BeginRead( map );
+   Table *t = LOAD_ACQUIRE( &map -> table );
+   uint64 slot;
+
+   for( slot = 0; slot <= t -> mask; slot++ )
+   {
+      if( LOAD_ACQUIRE( &t -> ctrl[ slot ] ) >= CTRL_EMPTY )
+	 continue;
+
+      if( !proc(
+		context,
+		&t -> entries[ slot ].key,
+		LOAD_ACQUIRE( &t -> entries[ slot ].value )
+	       ) )
+	 break;
+   }
+
+   EndRead( counter );
+}
@@ -0,0 +1,583 @@
+/*
+ * guidname.c
+ * GCOM Release 0.4
+ *
+ * Copyright (c) 1999, 2000 Samuel A. Falvo II
+ *
+ * This software is provided 'as-is', without any implied or express warranty.
+ * In no event shall the authors be held liable for damages arising from the
+ * use this software.
+ *
+ * Permission is granted for anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software in a
+ *    product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+#include <string.h>
+#include <gcom/gcom.h>
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+#include <cpuid.h>
+#include <immintrin.h>
+#define HAVE_SHANI_CODE
+#endif
+
+/************************************************************************/
+/* Name-based GUIDs							*/
+/************************************************************************/
+
+/*
+ * A name-based GUID is a hash of a namespace GUID followed by a name,
+ * truncated to 128 bits and stamped with a version: MD5 for version 3,
+ * SHA-1 for version 5.  The same namespace and name always give the
+ * same GUID, so generated classes can be given stable CLSIDs, and
+ * registries built from the same inputs come out identical.
+ */
+
+/************************************************************************/
+/* SHA-1								*/
+/************************************************************************/
+
+typedef struct HashContext
+{
+   uint32f	h[5];
+   uint64	cb;
+   uint8	block[64];
+   void		(*compress)( uint32f *, const uint8 *, size_t );
+} HashContext;
+
+#define ROTL32(v,n)	( ( (v) << (n) ) | ( (v) >> ( 32 - (n) ) ) )
+
+static uint32f LoadBE32( const uint8 *pb )
+{
+   return ( (uint32f)pb[0] << 24 ) | ( (uint32f)pb[1] << 16 ) |
+	  ( (uint32f)pb[2] << 8 ) | pb[3];
+}
+
+static uint32f LoadLE32( const uint8 *pb )
+{
+   return ( (uint32f)pb[3] << 24 ) | ( (uint32f)pb[2] << 16 ) |
+	  ( (uint32f)pb[1] << 8 ) | pb[0];
+}
+
+static void Sha1Compress( uint32f *h, const uint8 *pb, size_t cBlocks )
+{
+   uint32f w[80], a, b, c, d, e, f, k, t;
+   int i;
+
+   for( ; cBlocks > 0; cBlocks--, pb += 64 )
+   {
+      for( i = 0; i < 16; i++ )
+	 w[i] = LoadBE32( &pb[ i * 4 ] );
+
+      for( i = 16; i < 80; i++ )
+	 w[i] = ROTL32( w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1 );
+
+      a = h[0];  b = h[1];  c = h[2];  d = h[3];  e = h[4];
+
+      for( i = 0; i < 80; i++ )
+      {
+	 if( i < 20 )
+	 {
+	    f = ( b & c ) | ( ~b & d );
+	    k = 0x5A827999;
+	 }
+	 else if( i < 40 )
+	 {
+	    f = b ^ c ^ d;
+	    k = 0x6ED9EBA1;
+	 }
+	 else if( i < 60 )
+	 {
+	    f = ( b & c ) | ( b & d ) | ( c & d );
+	    k = 0x8F1BBCDC;
+	 }
+	 else
+	 {
+	    f = b ^ c ^ d;
+	    k = 0xCA62C1D6;
+	 }
+
+	 t = ROTL32( a, 5 ) + f + e + k + w[i];
+	 e = d;
+	 d = c;
+	 c = ROTL32( b, 30 );
+	 b = a;
+	 a = t;
+      }
+
+      h[0] += a;  h[1] += b;  h[2] += c;  h[3] += d;  h[4] += e;
+   }
+}
+
+#if defined( HAVE_SHANI_CODE )
+
+/*
+ * The same, using the SHA extensions found in recent x86 processors.
+ * Each group below does four rounds while the message schedule for
+ * later groups is worked out alongside.
+ */
+
+#define SHANI_ROUNDS( eThis, eNext, msg, f )			\
+   eThis = _mm_sha1nexte_epu32( eThis, msg );			\
+   eNext = abcd;						\
+   abcd = _mm_sha1rnds4_epu32( abcd, eThis, f );
+
+__attribute__(( target( "sha,sse4.1" ) ))
+static void Sha1CompressNI( uint32f *h, const uint8 *pb, size_t cBlocks )
+{
+   const __m128i bswap = _mm_set_epi64x( 0x0001020304050607LL, 0x08090A0B0C0D0E0FLL );
+   __m128i abcd, abcdSave, e0, e0Save, e1;
+   __m128i m0, m1, m2, m3;
+
+   abcd = _mm_shuffle_epi32( _mm_loadu_si128( (const __m128i *)h ), 0x1B );
+   e0 = _mm_set_epi32( h[4], 0, 0, 0 );
+
+   for( ; cBlocks > 0; cBlocks--, pb += 64 )
+   {
+      abcdSave = abcd;
+      e0Save = e0;
+
+      /* Rounds 0-15: the message words straight from the block */
+
+      m0 = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i *)&pb[0] ), bswap );
+      e0 = _mm_add_epi32( e0, m0 );
+      e1 = abcd;
+      abcd = _mm_sha1rnds4_epu32( abcd, e0, 0 );
+
+      m1 = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i *)&pb[16] ), bswap );
+      SHANI_ROUNDS( e1, e0, m1, 0 )
+      m0 = _mm_sha1msg1_epu32( m0, m1 );
+
+      m2 = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i *)&pb[32] ), bswap );
+      SHANI_ROUNDS( e0, e1, m2, 0 )
+      m1 = _mm_sha1msg1_epu32( m1, m2 );
+      m0 = _mm_xor_si128( m0, m2 );
+
+      m3 = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i *)&pb[48] ), bswap );
+      m0 = _mm_sha1msg2_epu32( m0, m3 );
+      SHANI_ROUNDS( e1, e0, m3, 0 )
+      m2 = _mm_sha1msg1_epu32( m2, m3 );
+      m1 = _mm_xor_si128( m1, m3 );
+
+      /* Rounds 16-79: the message schedule, four words at a time */
+
+      m1 = _mm_sha1msg2_epu32( m1, m0 );
+      SHANI_ROUNDS( e0, e1, m0, 0 )		/* 16-19 */
+      m3 = _mm_sha1msg1_epu32( m3, m0 );
+      m2 = _mm_xor_si128( m2, m0 );
+
+      m2 = _mm_sha1msg2_epu32( m2, m1 );
+      SHANI_ROUNDS( e1, e0, m1, 1 )		/* 20-23 */
+      m0 = _mm_sha1msg1_epu32( m0, m1 );
+      m3 = _mm_xor_si128( m3, m1 );
+
+      m3 = _mm_sha1msg2_epu32( m3, m2 );
+      SHANI_ROUNDS( e0, e1, m2, 1 )		/* 24-27 */
+      m1 = _mm_sha1msg1_epu32( m1, m2 );
+      m0 = _mm_xor_si128( m0, m2 );
+
+      m0 = _mm_sha1msg2_epu32( m0, m3 );
+      SHANI_ROUNDS( e1, e0, m3, 1 )		/* 28-31 */
+      m2 = _mm_sha1msg1_epu32( m2, m3 );
+      m1 = _mm_xor_si128( m1, m3 );
+
+      m1 = _mm_sha1msg2_epu32( m1, m0 );
+      SHANI_ROUNDS( e0, e1, m0, 1 )		/* 32-35 */
+      m3 = _mm_sha1msg1_epu32( m3, m0 );
+      m2 = _mm_xor_si128( m2, m0 );
+
+      m2 = _mm_sha1msg2_epu32( m2, m1 );
+      SHANI_ROUNDS( e1, e0, m1, 1 )		/* 36-39 */
+      m0 = _mm_sha1msg1_epu32( m0, m1 );
+      m3 = _mm_xor_si128( m3, m1 );
+
+      m3 = _mm_sha1msg2_epu32( m3, m2 );
+      SHANI_ROUNDS( e0, e1, m2, 2 )		/* 40-43 */
+      m1 = _mm_sha1msg1_epu32( m1, m2 );
+      m0 = _mm_xor_si128( m0, m2 );
+
+      m0 = _mm_sha1msg2_epu32( m0, m3 );
+      SHANI_ROUNDS( e1, e0, m3, 2 )		/* 44-47 */
+      m2 = _mm_sha1msg1_epu32( m2, m3 );
+      m1 = _mm_xor_si128( m1, m3 );
+
+      m1 = _mm_sha1msg2_epu32( m1, m0 );
+      SHANI_ROUNDS( e0, e1, m0, 2 )		/* 48-51 */
+      m3 = _mm_sha1msg1_epu32( m3, m0 );
+      m2 = _mm_xor_si128( m2, m0 );
+
+      m2 = _mm_sha1msg2_epu32( m2, m1 );
+      SHANI_ROUNDS( e1, e0, m1, 2 )		/* 52-55 */
+      m0 = _mm_sha1msg1_epu32( m0, m1 );
+      m3 = _mm_xor_si128( m3, m1 );
+
+      m3 = _mm_sha1msg2_epu32( m3, m2 );
+      SHANI_ROUNDS( e0, e1, m2, 2 )		/* 56-59 */
+      m1 = _mm_sha1msg1_epu32( m1, m2 );
+      m0 = _mm_xor_si128( m0, m2 );
+
+      m0 = _mm_sha1msg2_epu32( m0, m3 );
+      SHANI_ROUNDS( e1, e0, m3, 3 )		/* 60-63 */
+      m2 = _mm_sha1msg1_epu32( m2, m3 );
+      m1 = _mm_xor_si128( m1, m3 );
+
+      m1 = _mm_sha1msg2_epu32( m1, m0 );
+      SHANI_ROUNDS( e0, e1, m0, 3 )		/* 64-67 */
+      m3 = _mm_sha1msg1_epu32( m3, m0 );
+      m2 = _mm_xor_si128( m2, m0 );
+
+      m2 = _mm_sha1msg2_epu32( m2, m1 );
+      SHANI_ROUNDS( e1, e0, m1, 3 )		/* 68-71 */
+      m3 = _mm_xor_si128( m3, m1 );
+
+      m3 = _mm_sha1msg2_epu32( m3, m2 );
+      SHANI_ROUNDS( e0, e1, m2, 3 )		/* 72-75 */
+
+      SHANI_ROUNDS( e1, e0, m3, 3 )		/* 76-79 */
+
+      e0 = _mm_sha1nexte_epu32( e0, e0Save );
+      abcd = _mm_add_epi32( abcd, abcdSave );
+   }
+
+   _mm_storeu_si128( (__m128i *)h, _mm_shuffle_epi32( abcd, 0x1B ) );
+   h[4] = (uint32f)_mm_extract_epi32( e0, 3 );
+}
+
+#endif
+
+/**
+ * Picks the fastest SHA-1 block function this processor can run.
+ */
+
+static void (*ChooseSha1Compress( void ))( uint32f *, const uint8 *, size_t )
+{
+#if defined( HAVE_SHANI_CODE )
+   unsigned int eax, ebx, ecx, edx;
+
+   if( __get_cpuid_count( 7, 0, &eax, &ebx, &ecx, &edx ) &&
+       ( ebx & ( 1 << 29 ) ) &&				/* SHA */
+       __get_cpuid( 1, &eax, &ebx, &ecx, &edx ) &&
+       ( ecx & ( 1 << 19 ) ) )				/* SSE4.1 */
+      return Sha1CompressNI;
+#endif
+
+   return Sha1Compress;
+}
+
+static void (*sha1Compress)( uint32f *, const uint8 *, size_t ) = NULL;
+
+static void Sha1Init( HashContext *ctx )
+{
+   if( sha1Compress == NULL )
+      sha1Compress = ChooseSha1Compress();
+
+   ctx -> h[0] = 0x67452301;
+   ctx -> h[1] = 0xEFCDAB89;
+   ctx -> h[2] = 0x98BADCFE;
+   ctx -> h[3] = 0x10325476;
+   ctx -> h[4] = 0xC3D2E1F0;
+   ctx -> cb = 0;
+   ctx -> compress = sha1Compress;
+}
+
+/************************************************************************/
+/* MD5									*/
+/************************************************************************/
+
+static const uint32f md5K[64] =
+{
+   0xD76AA478, 0xE8C7B756, 0x242070DB, 0xC1BDCEEE,
+   0xF57C0FAF, 0x4787C62A, 0xA8304613, 0xFD469501,
+   0x698098D8, 0x8B44F7AF, 0xFFFF5BB1, 0x895CD7BE,
+   0x6B901122, 0xFD987193, 0xA679438E, 0x49B40821,
+   0xF61E2562, 0xC040B340, 0x265E5A51, 0xE9B6C7AA,
+   0xD62F105D, 0x02441453, 0xD8A1E681, 0xE7D3FBC8,
+   0x21E1CDE6, 0xC33707D6, 0xF4D50D87, 0x455A14ED,
+   0xA9E3E905, 0xFCEFA3F8, 0x676F02D9, 0x8D2A4C8A,
+   0xFFFA3942, 0x8771F681, 0x6D9D6122, 0xFDE5380C,
+   0xA4BEEA44, 0x4BDECFA9, 0xF6BB4B60, 0xBEBFBC70,
+   0x289B7EC6, 0xEAA127FA, 0xD4EF3085, 0x04881D05,
+   0xD9D4D039, 0xE6DB99E5, 0x1FA27CF8, 0xC4AC5665,
+   0xF4292244, 0x432AFF97, 0xAB9423A7, 0xFC93A039,
+   0x655B59C3, 0x8F0CCC92, 0xFFEFF47D, 0x85845DD1,
+   0x6FA87E4F, 0xFE2CE6E0, 0xA3014314, 0x4E0811A1,
+   0xF7537E82, 0xBD3AF235, 0x2AD7D2BB, 0xEB86D391
+};
+
+static const uint8 md5Shift[16] =
+{
+   7, 12, 17, 22,  5, 9, 14, 20,  4, 11, 16, 23,  6, 10, 15, 21
+};
+
+static void Md5Compress( uint32f *h, const uint8 *pb, size_t cBlocks )
+{
+   uint32f m[16], a, b, c, d, f, t;
+   int i, g;
+
+   for( ; cBlocks > 0; cBlocks--, pb += 64 )
+   {
+      for( i = 0; i < 16; i++ )
+	 m[i] = LoadLE32( &pb[ i * 4 ] );
+
+      a = h[0];  b = h[1];  c = h[2];  d = h[3];
+
+      for( i = 0; i < 64; i++ )
+      {
+	 if( i < 16 )
+	 {
+	    f = ( b & c ) | ( ~b & d );
+	    g = i;
+	 }
+	 else if( i < 32 )
+	 {
+	    f = ( d & b ) | ( ~d & c );
+	    g = ( ( 5 * i ) + 1 ) & 15;
+	 }
+	 else if( i < 48 )
+	 {
+	    f = b ^ c ^ d;
+	    g = ( ( 3 * i ) + 5 ) & 15;
+	 }
+	 else
+	 {
+	    f = c ^ ( b | ~d );
+	    g = ( 7 * i ) & 15;
+	 }
+
+	 t = d;
+	 d = c;
+	 c = b;
+	 b += ROTL32( a + f + md5K[i] + m[g], md5Shift[ ( ( i >> 4 ) << 2 ) | ( i & 3 ) ] );
+	 a = t;
+      }
+
+      h[0] += a;  h[1] += b;  h[2] += c;  h[3] += d;
+   }
+}
+
+static void Md5Init( HashContext *ctx )
+{
+   ctx -> h[0] = 0x67452301;
+   ctx -> h[1] = 0xEFCDAB89;
+   ctx -> h[2] = 0x98BADCFE;
+   ctx -> h[3] = 0x10325476;
+   ctx -> cb = 0;
+   ctx -> compress = Md5Compress;
+}
+
+/************************************************************************/
+/* Common hashing							*/
+/************************************************************************/
+
+static void HashUpdate( HashContext *ctx, const void *pv, size_t cb )
+{
+   const uint8 *pb = (const uint8 *)pv;
+   size_t used = (size_t)( ctx -> cb & 63 ), n;
+
+   ctx -> cb += cb;
+
+   if( used > 0 )
+   {
+      n = 64 - used;
+      if( n > cb )
+	 n = cb;
+
+      memcpy( &ctx -> block[ used ], pb, n );
+      pb += n;
+      cb -= n;
+
+      if( used + n < 64 )
+	 return;
+
+      ctx -> compress( ctx -> h, ctx -> block, 1 );
+   }
+
+   if( cb >= 64 )
+   {
+      ctx -> compress( ctx -> h, pb, cb / 64 );
+      pb += cb & ~(size_t)63;
+      cb &= 63;
+   }
+
+   memcpy( ctx -> block, pb, cb );
+}
+
+/**
+ * Pads the message and produces the first 16 bytes of the digest.  SHA-1
+ * is big-endian throughout; MD5 is little-endian.
+ */
+
+static void HashFinal( HashContext *ctx, Bool bigEndian, uint8 *digest )
+{
+   uint64 cBits = ctx -> cb * 8;
+   uint8 pad[72];
+   size_t cbPad;
+   int i;
+
+   cbPad = ( ( ctx -> cb & 63 ) < 56 ) ? 56 - ( ctx -> cb & 63 )
+				      : 120 - ( ctx -> cb & 63 );
+
+   memset( pad, 0, sizeof( pad ) );
+   pad[0] = 0x80;
+
+   for( i = 0; i < 8; i++ )
+      pad[ cbPad + i ] = (uint8)( cBits >> ( bigEndian ? ( 56 - ( i * 8 ) ) : ( i * 8 ) ) );
+
+   HashUpdate( ctx, pad, cbPad + 8 );
+
+   for( i = 0; i < 4; i++ )
+   {
+      if( bigEndian )
+      {
+	 digest[ i*4 ] = (uint8)( ctx -> h[i] >> 24 );
+	 digest[ i*4+1 ] = (uint8)( ctx -> h[i] >> 16 );
+	 digest[ i*4+2 ] = (uint8)( ctx -> h[i] >> 8 );
+	 digest[ i*4+3 ] = (uint8)ctx -> h[i];
+      }
+      else
+      {
+	 digest[ i*4 ] = (uint8)ctx -> h[i];
+	 digest[ i*4+1 ] = (uint8)( ctx -> h[i] >> 8 );
+	 digest[ i*4+2 ] = (uint8)( ctx -> h[i] >> 16 );
+	 digest[ i*4+3 ] = (uint8)( ctx -> h[i] >> 24 );
+      }
+   }
+}
+
+/************************************************************************/
+/* Public interface							*/
+/************************************************************************/
+
+/**
+ * Makes a name-based GUID.
+ *
+ * @param version
+ * GUIDVERSION_SHA1 (5), or GUIDVERSION_MD5 (3) where compatibility with
+ * existing version 3 GUIDs calls for it.
+ *
+ * @param rnamespace
+ * The namespace the name belongs to: one of GUID_NAMESPACE_DNS, _URL,
+ * _OID or _X500, or any GUID of the application's choosing.
+ *
+ * @param pvName
+ * The name.  Any bytes will do, but names meant to be shared should be
+ * in UTF-8.
+ *
+ * @param cbName
+ * Length of the name in bytes.
+ *
+ * @param pguid
+ * Receives the GUID.
+ *
+ * @returns
+ * S_OK if successful.  E_INVALIDARG for a version other than 3 or 5.
+ *
+ * @see gCoCreateNameGuids
+ */
+
+HRESULT gCoCreateNameGuid(
+			  GUIDVERSION version,
+			  REFGUID rnamespace,
+			  const void *pvName,
+			  uint32 cbName,
+			  GUID *pguid
+			 )
+{
+   HashContext ctx;
+   uint8 ns[16], digest[16];
+
+   if( version == GUIDVERSION_SHA1 )
+      Sha1Init( &ctx );
+   else if( version == GUIDVERSION_MD5 )
+      Md5Init( &ctx );
+   else
+      return E_INVALIDARG;
+
+   /* The namespace is hashed in network byte order, like the text form */
+
+   ns[0] = (uint8)( rnamespace -> Data1 >> 24 );
+   ns[1] = (uint8)( rnamespace -> Data1 >> 16 );
+   ns[2] = (uint8)( rnamespace -> Data1 >> 8 );
+   ns[3] = (uint8)rnamespace -> Data1;
+   ns[4] = (uint8)( rnamespace -> Data2 >> 8 );
+   ns[5] = (uint8)rnamespace -> Data2;
+   ns[6] = (uint8)( rnamespace -> Data3 >> 8 );
+   ns[7] = (uint8)rnamespace -> Data3;
+   memcpy( &ns[8], rnamespace -> Data4, 8 );
+
+   HashUpdate( &ctx, ns, sizeof( ns ) );
+   HashUpdate( &ctx, pvName, cbName );
+   HashFinal( &ctx, version == GUIDVERSION_SHA1, digest );
+
+   pguid -> Data1 = LoadBE32( &digest[0] );
+   pguid -> Data2 = (uint16)( ( digest[4] << 8 ) | digest[5] );
+   pguid -> Data3 = (uint16)( ( digest[6] << 8 ) | digest[7] );
+   memcpy( pguid -> Data4, &digest[8], 8 );
+
+   pguid -> Data3 = ( pguid -> Data3 & 0x0FFF ) | ( version << 12 );
+   pguid -> Data4[0] = ( pguid -> Data4[0] & 0x3F ) | 0x80;
+
+   return S_OK;
+}
+
+/**
+ * Makes name-based GUIDs for a list of NULL-terminated names, all in
+ * the same namespace.
+ *
+ * @param version
+ * GUIDVERSION_SHA1 or GUIDVERSION_MD5.
+ *
+ * @param rnamespace
+ * The namespace the names belong to.
+ *
+ * @param apszNames
+ * The names.
+ *
+ * @param cNames
+ * How many there are.
+ *
+ * @param pguids
+ * Array of cNames GUIDs to receive the results, in the same order.
+ *
+ * @returns
+ * S_OK if successful.  E_INVALIDARG for a version other than 3 or 5.
+ *
+ * @see gCoCreateNameGuid
+ */
+
+HRESULT gCoCreateNameGuids(
+			   GUIDVERSION version,
+			   REFGUID rnamespace,
+			   const char **apszNames,
+			   uint32 cNames,
+			   GUID *pguids
+			  )
+{
+   HRESULT hr;
+   uint32 i;
+
+   for( i = 0; i < cNames; i++ )
+   {
+      hr = gCoCreateNameGuid(
+			     version, rnamespace,
+			     apszNames[i], (uint32)strlen( apszNames[i] ),
+			     &pguids[i]
+			    );
+      if( FAILED( hr ) )
+	 return hr;
+   }
+
+   return S_OK;
+}
@@ -0,0 +1,637 @@
+/*
+ * heapprof.c
+ * GCOM Release 0.3
+ *
+ * Copyright (c) 1999, 2000 Samuel A. Falvo II
+ *
+ * This software is provided 'as-is', without any implied or express warranty.
+ * In no event shall the authors be held liable for damages arising from the
+ * use this software.
+ *
+ * Permission is granted for anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software in a
+ *    product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <gcom/gcom.h>
+#include "alloc-private.h"
+
+/************************************************************************/
+/* Sampling								*/
+/************************************************************************/
+
+/*
+ * The heap profiler samples the task allocator's allocations as a Poisson
+ * process over bytes allocated: the gaps between samples are drawn from
+ * an exponential distribution whose mean is the sampling interval.  Each
+ * sampled allocation carries a HeapSample, recording the stack which
+ * allocated it, until it is freed.  Scaling each sample by the inverse of
+ * the probability of its having been picked gives an unbiased estimate
+ * of everything the process has in use, by allocation site.
+ *
+ * alloc.c does the counting down; we only get called once a thread's
+ * count runs out.  While the profiler is stopped, threads still come
+ * back every PROFILE_IDLE_CHECK bytes, to find out if it's been started.
+ */
+
+#define PROFILE_IDLE_CHECK	( 1L << 20 )
+
+static pthread_mutex_t profileLock = PTHREAD_MUTEX_INITIALIZER;
+static volatile uint32 sampleInterval = 0;	/* 0 = stopped */
+static HeapSample *samples = NULL;
+static __thread uint64 rngState;
+
+static uint64 NextRandom( void )
+{
+   uint64 x = rngState;
+
+   if( x == 0 )
+      x = (uint64)(uintptr_t)&rngState ^ (uint64)time( NULL ) ^ 0x9E3779B97F4A7C15ULL;
+
+   x ^= x << 13;
+   x ^= x >> 7;
+   x ^= x << 17;
+   rngState = x;
+
+   return x;
+}
+
+int64 HeapProfileNextSample( void )
+{
+   uint32 interval = sampleInterval;
+   double u;
+
+   if( interval == 0 )
+      return PROFILE_IDLE_CHECK;
+
+   /* u is uniform over (0,1], so -log( u ) is never infinite. */
+
+   u = (double)( ( NextRandom() >> 11 ) + 1 ) * ( 1.0 / 9007199254740992.0 );
+   return (int64)( -log( u ) * interval );
+}
+
+Bool HeapProfileActive( void )
+{
+   return sampleInterval != 0;
+}
+
+/*
+ * Fills in the record for a freshly sampled allocation, and adds it to
+ * the set of live samples.  Frames belonging to GCOM itself are left off
+ * the top of the stack.
+ */
+
+void HeapProfileRecord( HeapSample *hs, uint32 cBytes )
+{
+   void *stack[ HEAPPROF_MAX_DEPTH + 8 ];
+   Dl_info self, info;
+   int depth, skip;
+
+   hs -> size = cBytes;
+   hs -> interval = sampleInterval;
+
+   depth = backtrace( stack, HEAPPROF_MAX_DEPTH + 8 );
+   skip = 0;
+   if( dladdr( (void *)&HeapProfileRecord, &self ) != 0 )
+   {
+      while(
+	       ( skip < depth - 1 )
+	    && ( dladdr( stack[ skip ], &info ) != 0 )
+	    && ( info.dli_fbase == self.dli_fbase )
+	   )
+	 skip++;
+   }
+
+   depth -= skip;
+   if( depth > HEAPPROF_MAX_DEPTH )
+      depth = HEAPPROF_MAX_DEPTH;
+   memcpy( hs -> stack, stack + skip, depth * sizeof( void * ) );
+   hs -> depth = depth;
+
+   pthread_mutex_lock( &profileLock );
+   hs -> prev = NULL;
+   hs -> next = samples;
+   if( samples != NULL )
+      samples -> prev = hs;
+   samples = hs;
+   pthread_mutex_unlock( &profileLock );
+}
+
+void HeapProfileForget( HeapSample *hs )
+{
+   pthread_mutex_lock( &profileLock );
+   if( hs -> prev != NULL )
+      hs -> prev -> next = hs -> next;
+   else
+      samples = hs -> next;
+   if( hs -> next != NULL )
+      hs -> next -> prev = hs -> prev;
+   pthread_mutex_unlock( &profileLock );
+}
+
+/*
+ * Called when a sampled allocation is resized in place, so profiles
+ * report the size it has now.
+ */
+
+void HeapProfileResize( HeapSample *hs, uint32 cBytes )
+{
+   pthread_mutex_lock( &profileLock );
+   hs -> size = cBytes;
+   pthread_mutex_unlock( &profileLock );
+}
+
+/*
+ * Called when the task allocator throws its whole heap away, samples and
+ * all.
+ */
+
+void HeapProfileReset( void )
+{
+   pthread_mutex_lock( &profileLock );
+   samples = NULL;
+   pthread_mutex_unlock( &profileLock );
+}
+
+/************************************************************************/
+/* Protocol buffer encoding						*/
+/************************************************************************/
+
+/*
+ * Just enough of the protocol buffer wire format to write a profile.proto
+ * message, as read by pprof.  Buffers come from the C library, not the
+ * task allocator, so that dumping a profile doesn't perturb it.
+ */
+
+#define WIRE_VARINT		0
+#define WIRE_BYTES		2
+
+typedef struct
+{
+   uint8 *	data;
+   size_t	length;
+   size_t	capacity;
+   Bool		failed;
+} PBuf;
+
+static void PBufInit( PBuf *pb )
+{
+   pb -> data = NULL;
+   pb -> length = pb -> capacity = 0;
+   pb -> failed = FALSE;
+}
+
+static void PBufFree( PBuf *pb )
+{
+   free( pb -> data );
+   PBufInit( pb );
+}
+
+static void PBufAppend( PBuf *pb, const void *pv, size_t length )
+{
+   size_t capacity;
+   uint8 *data;
+
+   if( pb -> failed )
+      return;
+
+   if( pb -> length + length > pb -> capacity )
+   {
+      capacity = pb -> capacity ? pb -> capacity * 2 : 256;
+      while( capacity < pb -> length + length )
+	 capacity *= 2;
+
+      data = (uint8 *)realloc( pb -> data, capacity );
+      if( data == NULL )
+      {
+	 pb -> failed = TRUE;
+	 return;
+      }
+      pb -> data = data;
+      pb -> capacity = capacity;
+   }
+
+   memcpy( pb -> data + pb -> length, pv, length );
+   pb -> length += length;
+}
+
+static void PBufVarint( PBuf *pb, uint64 n )
+{
+   uint8 bytes[ 10 ];
+   int i = 0;
+
+   do
+   {
+      bytes[ i ] = (uint8)( n & 0x7F );
+      n >>= 7;
+      if( n != 0 )
+	 bytes[ i ] |= 0x80;
+      i++;
+   }
+   while( n != 0 );
+
+   PBufAppend( pb, bytes, i );
+}
+
+static void PBufUint( PBuf *pb, uint32 field, uint64 n )
+{
+   PBufVarint( pb, ( field << 3 ) | WIRE_VARINT );
+   PBufVarint( pb, n );
+}
+
+static void PBufBytes( PBuf *pb, uint32 field, const void *pv, size_t length )
+{
+   PBufVarint( pb, ( field << 3 ) | WIRE_BYTES );
+   PBufVarint( pb, length );
+   PBufAppend( pb, pv, length );
+}
+
+/*
+ * Appends a finished sub-message, and empties its buffer for reuse.
+ */
+
+static void PBufMessage( PBuf *pb, uint32 field, PBuf *msg )
+{
+   if( msg -> failed )
+      pb -> failed = TRUE;
+
+   PBufBytes( pb, field, msg -> data, msg -> length );
+   msg -> length = 0;
+}
+
+/************************************************************************/
+/* Profile construction							*/
+/************************************************************************/
+
+/* profile.proto field numbers */
+
+#define PROFILE_SAMPLE_TYPE	1
+#define PROFILE_SAMPLE		2
+#define PROFILE_MAPPING		3
+#define PROFILE_LOCATION	4
+#define PROFILE_STRING_TABLE	6
+#define PROFILE_TIME_NANOS	9
+#define PROFILE_PERIOD_TYPE	11
+#define PROFILE_PERIOD		12
+
+#define VALUETYPE_TYPE		1
+#define VALUETYPE_UNIT		2
+
+#define SAMPLE_LOCATION_ID	1
+#define SAMPLE_VALUE		2
+
+#define MAPPING_ID		1
+#define MAPPING_MEMORY_START	2
+#define MAPPING_MEMORY_LIMIT	3
+#define MAPPING_FILE_OFFSET	4
+#define MAPPING_FILENAME	5
+
+#define LOCATION_ID		1
+#define LOCATION_MAPPING_ID	2
+#define LOCATION_ADDRESS	3
+
+/* Fixed entries at the start of the string table */
+
+enum
+{
+   STR_EMPTY,
+   STR_INUSE_OBJECTS,
+   STR_COUNT,
+   STR_INUSE_SPACE,
+   STR_BYTES,
+   STR_SPACE,
+   STR_FIXED
+};
+
+static const char *fixedStrings[ STR_FIXED ] =
+{
+   "", "inuse_objects", "count", "inuse_space", "bytes", "space"
+};
+
+typedef struct
+{
+   uint64	start;
+   uint64	limit;
+   uint64	offset;
+   char		path[ 256 ];
+} Mapping;
+
+/*
+ * Reads the process' executable mappings, so that pprof can symbolize
+ * the addresses we give it.
+ */
+
+static Mapping *ReadMappings( uint32 *pCount )
+{
+   Mapping *maps = NULL, *m;
+   uint32 count = 0, capacity = 0;
+   char line[ 512 ], perms[ 8 ], path[ 256 ];
+   unsigned long long start, limit, offset;
+   FILE *f;
+
+   *pCount = 0;
+   f = fopen( "/proc/self/maps", "r" );
+   if( f == NULL )
+      return NULL;
+
+   while( fgets( line, sizeof( line ), f ) != NULL )
+   {
+      path[ 0 ] = 0;
+      if( sscanf( line, "%llx-%llx %7s %llx %*s %*s %255s",
+		  &start, &limit, perms, &offset, path ) < 4 )
+	 continue;
+
+      if( perms[ 2 ] != 'x' )
+	 continue;
+
+      if( count == capacity )
+      {
+	 capacity = capacity ? capacity * 2 : 32;
+	 m = (Mapping *)realloc( maps, capacity * sizeof( Mapping ) );
+	 if( m == NULL )
+	    break;
+	 maps = m;
+      }
+
+      m = &maps[ count++ ];
+      m -> start = start;
+      m -> limit = limit;
+      m -> offset = offset;
+      strcpy( m -> path, path );
+   }
+
+   fclose( f );
+   *pCount = count;
+   return maps;
+}
+
+static uint32 FindMapping( Mapping *maps, uint32 count, uint64 address )
+{
+   uint32 i;
+
+   for( i = 0; i < count; i++ )
+   {
+      if( ( address >= maps[ i ].start ) && ( address < maps[ i ].limit ) )
+	 return i + 1;
+   }
+
+   return 0;
+}
+
+/*
+ * Assigns location IDs to addresses, with an open-addressed hash table.
+ * Returns 0 if the address is new, or its existing ID.
+ */
+
+static uint64 LocationFind( uint64 *table, uint64 *ids, uint32 mask,
+			    uint64 address, uint64 newID )
+{
+   uint32 i = (uint32)( ( address * 0x9E3779B97F4A7C15ULL ) >> 32 ) & mask;
+
+   while( ids[ i ] != 0 )
+   {
+      if( table[ i ] == address )
+	 return ids[ i ];
+      i = ( i + 1 ) & mask;
+   }
+
+   table[ i ] = address;
+   ids[ i ] = newID;
+   return 0;
+}
+
+static Bool WriteAll( int fd, const uint8 *data, size_t length )
+{
+   ssize_t n;
+
+   while( length > 0 )
+   {
+      n = write( fd, data, length );
+      if( n <= 0 )
+	 return FALSE;
+      data += n;
+      length -= n;
+   }
+
+   return TRUE;
+}
+
+/************************************************************************/
+/* Public Interface							*/
+/************************************************************************/
+
+/**
+ * This function starts the heap profiler, which samples allocations
+ * made through the task allocator.  About once every cbInterval bytes
+ * allocated, chosen at random, an allocation is sampled: the stack which
+ * made it is recorded, and kept until the block is freed.  Dump the
+ * samples with gCoHeapProfileDump().
+ *
+ * Allocations which aren't sampled cost one subtraction and one test.
+ * Sampled allocations are somewhat expensive, so keep the interval large;
+ * half a megabyte is a reasonable choice.  The profiler covers blocks
+ * allocated with CoTaskMemAlloc(), CoTaskMemRealloc() and the task
+ * allocator's IMalloc interface, but not with CoTaskMemAllocAligned().
+ *
+ * @param cbInterval
+ * The mean number of bytes allocated between samples.  Zero stops the
+ * profiler, as gCoHeapProfileStop() does.
+ *
+ * @returns
+ * S_OK.
+ *
+ * @see gCoHeapProfileStop
+ * @see gCoHeapProfileDump
+ */
+
+HRESULT gCoHeapProfileStart( uint32 cbInterval )
+{
+   sampleInterval = cbInterval;
+   return S_OK;
+}
+
+/**
+ * This function stops the heap profiler from taking any more samples.
+ * Allocations already sampled remain in the profile until they are freed.
+ *
+ * @see gCoHeapProfileStart
+ */
+
+void gCoHeapProfileStop( void )
+{
+   sampleInterval = 0;
+}
+
+/**
+ * This function writes the allocations sampled by the heap profiler which
+ * are still live to a file, as a pprof profile (an uncompressed
+ * profile.proto protocol buffer).  The profile has two sample types,
+ * inuse_objects and inuse_space, both estimated from the samples taken.
+ *
+ * @param fd
+ * The file descriptor to write to.
+ *
+ * @returns
+ * S_OK if successful.  E_OUTOFMEMORY if the profile couldn't be built.
+ * E_UNEXPECTED if it couldn't be written.
+ *
+ * @see gCoHeapProfileStart
+ */
+
+HRESULT gCoHeapProfileDump( int fd )
+{
+   PBuf out, msg, packed;
+   HeapSample *hs, *snapshot = NULL;
+   Mapping *maps;
+   uint32 nMaps, nSamples = 0, nFrames = 0, i, j, mask;
+   uint64 *table = NULL, *ids = NULL, id, nextID = 1, address;
+   double scale;
+   struct timespec now;
+   HRESULT hr = S_OK;
+
+   /*
+    * Take a copy of the live samples, so we don't hold the lock (and
+    * stall every free of a sampled block) while we work.
+    */
+
+   pthread_mutex_lock( &profileLock );
+   for( hs = samples; hs; hs = hs -> next )
+      nSamples++;
+
+   if( nSamples > 0 )
+   {
+      snapshot = (HeapSample *)malloc( nSamples * sizeof( HeapSample ) );
+      if( snapshot != NULL )
+      {
+	 for( i = 0, hs = samples; hs; hs = hs -> next, i++ )
+	 {
+	    snapshot[ i ] = *hs;
+	    nFrames += hs -> depth;
+	 }
+      }
+   }
+   pthread_mutex_unlock( &profileLock );
+
+   if( ( nSamples > 0 ) && ( snapshot == NULL ) )
+      return E_OUTOFMEMORY;
+
+   for( mask = 1; mask < nFrames * 2; mask <<= 1 )
+      ;
+   table = (uint64 *)calloc( mask, sizeof( uint64 ) );
+   ids = (uint64 *)calloc( mask, sizeof( uint64 ) );
+   mask--;
+
+   maps = ReadMappings( &nMaps );
+
+   PBufInit( &out );
+   PBufInit( &msg );
+   PBufInit( &packed );
+
+   if( ( table == NULL ) || ( ids == NULL ) )
+      out.failed = TRUE;
+
+   PBufUint( &msg, VALUETYPE_TYPE, STR_INUSE_OBJECTS );
+   PBufUint( &msg, VALUETYPE_UNIT, STR_COUNT );
+   PBufMessage( &out, PROFILE_SAMPLE_TYPE, &msg );
+   PBufUint( &msg, VALUETYPE_TYPE, STR_INUSE_SPACE );
+   PBufUint( &msg, VALUETYPE_UNIT, STR_BYTES );
+   PBufMessage( &out, PROFILE_SAMPLE_TYPE, &msg );
+
+   /*
+    * Samples, and the locations they refer to.  Return addresses are
+    * backed up by one byte, so they fall within the calling instruction.
+    */
+
+   for( i = 0; ( i < nSamples ) && !out.failed; i++ )
+   {
+      hs = &snapshot[ i ];
+
+      for( j = 0; j < hs -> depth; j++ )
+      {
+	 address = (uint64)(uintptr_t)hs -> stack[ j ] - ( ( j > 0 ) ? 1 : 0 );
+	 id = LocationFind( table, ids, mask, address, nextID );
+	 if( id == 0 )
+	 {
+	    id = nextID++;
+	    PBufUint( &msg, LOCATION_ID, id );
+	    PBufUint( &msg, LOCATION_MAPPING_ID,
+		      FindMapping( maps, nMaps, address ) );
+	    PBufUint( &msg, LOCATION_ADDRESS, address );
+	    PBufMessage( &out, PROFILE_LOCATION, &msg );
+	 }
+	 PBufVarint( &packed, id );
+      }
+      PBufMessage( &msg, SAMPLE_LOCATION_ID, &packed );
+
+      scale = 1.0 / ( 1.0 - exp( -(double)hs -> size / hs -> interval ) );
+      PBufVarint( &packed, (uint64)( scale + 0.5 ) );
+      PBufVarint( &packed, (uint64)( scale * hs -> size + 0.5 ) );
+      PBufMessage( &msg, SAMPLE_VALUE, &packed );
+
+      PBufMessage( &out, PROFILE_SAMPLE, &msg );
+   }
+
+   for( i = 0; i < nMaps; i++ )
+   {
+      PBufUint( &msg, MAPPING_ID, i + 1 );
+      PBufUint( &msg, MAPPING_MEMORY_START, maps[ i ].start );
+      PBufUint( &msg, MAPPING_MEMORY_LIMIT, maps[ i ].limit );
+      PBufUint( &msg, MAPPING_FILE_OFFSET, maps[ i ].offset );
+      PBufUint( &msg, MAPPING_FILENAME, STR_FIXED + i );
+      PBufMessage( &out, PROFILE_MAPPING, &msg );
+   }
+
+   for( i = 0; i < STR_FIXED; i++ )
+      PBufBytes( &out, PROFILE_STRING_TABLE,
+		 fixedStrings[ i ], strlen( fixedStrings[ i ] ) );
+   for( i = 0; i < nMaps; i++ )
+      PBufBytes( &out, PROFILE_STRING_TABLE,
+		 maps[ i ].path, strlen( maps[ i ].path ) );
+
+   clock_gettime( CLOCK_REALTIME, &now );
+   PBufUint( &out, PROFILE_TIME_NANOS,
+	     (uint64)now.tv_sec * 1000000000ULL + now.tv_nsec );
+
+   PBufUint( &msg, VALUETYPE_TYPE, STR_SPACE );
+   PBufUint( &msg, VALUETYPE_UNIT, STR_BYTES );
+   PBufMessage( &out, PROFILE_PERIOD_TYPE, &msg );
+   PBufUint( &out, PROFILE_PERIOD, sampleInterval );
+
+   if( out.failed || msg.failed || packed.failed )
+      hr = E_OUTOFMEMORY;
+   else if( !WriteAll( fd, out.data, out.length ) )
+      hr = E_UNEXPECTED;
+
+   PBufFree( &out );
+   PBufFree( &msg );
+   PBufFree( &packed );
+   free( maps );
+   free( table );
+   free( ids );
+   free( snapshot );
+
+   return hr;
+}
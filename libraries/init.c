@@ -29,6 +29,7 @@
 #include <fcntl.h>
 #include <ctype.h>
 #include "gcom-config.h"
+#include "alloc-private.h"
 
 /************************************************************************/
 /* Library Private Data							*/
@@ -81,8 +82,30 @@ HRESULT CoInitialize( void *___unused )
 
 void CoUninitialize( void )
 {
-   DLLUninitialize();
-   TaskMallocUninitialize();
+   DLLUninitialize( FALSE );
+   TaskMallocUninitialize( FALSE );
+}
+
+/**
+ * This function is a faster CoUninitialize(), for use when the process
+ * is about to exit.  When it's the last call, it doesn't bother giving
+ * memory back to the system, or unloading libraries; the kernel does all
+ * that in one go when the process exits.  Every library's GCOMDLLExpunge()
+ * function still runs, but they all run at once, on separate threads, so
+ * they must not depend on one another.
+ *
+ * Memory from the task allocator stays valid, so code which runs after
+ * this function (atexit() handlers, say) may still free it.
+ *
+ * @returns Nothing.
+ *
+ * @see CoUninitialize
+ */
+
+void gCoUninitializeForExit( void )
+{
+   DLLUninitialize( TRUE );
+   TaskMallocUninitialize( TRUE );
 }
 
 /**
@@ -125,6 +148,9 @@ uint32 CoBuildVersion( void )
  * @param ppv
  * Where to store the queried interface.
  * 
+ * @param phdll
+ * Where to store the handle to the library the class object came from.
+ * 
  * @returns
  * S_OK if everything was successful.
  *
@@ -135,17 +161,14 @@ static HRESULT gCoGetInprocClassObject(
 				       GCOMIT inprocType,
 				       REFCLSID rclsid,
 				       REFIID riid,
-				       void **ppv
+				       void **ppv,
+				       HDLL *phdll
 				      )
 {
    HRESULT hr;
-   char asciiFilename[ MAX_PATH_LEN ], *pch;
-   wchar wFilename[ MAX_PATH_LEN ];
-   wchar awchClassID[ MAX_GUIDSTRING_LEN ];
+   char *pszFilename, *pch;
    char achClassID[ MAX_GUIDSTRING_LEN ];
-   char datumPath[ MAX_PATH_LEN ];
    HDLL hdll;
-   int fh;
    CLSID actualCLSID;
 
    *ppv = NULL;
@@ -164,51 +187,31 @@ static HRESULT gCoGetInprocClassObject(
     * implementation we're looking for.
     */
 
-   gCoGUIDToString( &actualCLSID, awchClassID );
-   gCoUnicodeStringToAscii( awchClassID, achClassID, MAX_GUIDSTRING_LEN );
+   gCoGUIDToStringUTF8( &actualCLSID, achClassID );
 
-#warning There needs to be a better way of doing this.  This chunk of code
-#warning can be abused, deliberately or inadvertently, by putting oversized
-#warning strings into the registry entries.  For now, however, I am just
-#warning doing this to get things to work.  --saf2
-   
-   strcpy( datumPath, STR_REGISTRYHOME );
-   strcat(
-	  datumPath,
-	  (inprocType == GCOMIT_SERVER) ? STR_INPROCSERVERS
-					: STR_INPROCHANDLERS
-	 );
-   strcat( datumPath, achClassID );
-
-   fh = open( datumPath, O_RDONLY );
-   if( fh < 0 )
-   {
+   hr = gCoReadRegistryValueUTF8(
+				 (inprocType == GCOMIT_SERVER) ? STR_INPROCSERVERS
+							       : STR_INPROCHANDLERS,
+				 achClassID,
+				 &pszFilename
+				);
+   if( FAILED( hr ) )
       return E_READREGDB;
-   }
-   else
-   {
-      int sz;
-
-      sz = read( fh, asciiFilename, MAX_PATH_LEN-1 );
-      asciiFilename[ sz ] = 0;
-
-      close( fh );
-   }
 
    /*
-    * Strip the ASCII name of all whitespace.  Note that if there is
+    * Strip the name of all whitespace.  Note that if there is
     * any white space in front of the filename, then unpredictable
     * results can occur.  On my computer, dlopen() just chokes and returns
     * an error value.  (as it should.)
     */
 
    for(
-	pch = &asciiFilename[0];
+	pch = pszFilename;
 	*pch != 0;
 	pch++
       )
    {
-      if( isspace( *pch ) )    *pch = 0;
+      if( isspace( (unsigned char)*pch ) )    *pch = 0;
    }
 
    /*
@@ -218,11 +221,8 @@ static HRESULT gCoGetInprocClassObject(
     * load the DLL from backing storage.
     */
 
-   hr = gCoAsciiStringToUnicode( asciiFilename, wFilename, MAX_PATH_LEN );
-   if( FAILED(hr) )
-	return hr;
-
-   hr = gCoLoadDLL( wFilename, &hdll );
+   hr = gCoLoadDLLUTF8( pszFilename, &hdll );
+   CoTaskMemFree( pszFilename );
    if( SUCCEEDED( hr ) )
    {
       hr = gCoDLLGetClassObject(
@@ -232,7 +232,9 @@ static HRESULT gCoGetInprocClassObject(
 				ppv
 			       );
 
-      if( FAILED( hr ) )
+      if( SUCCEEDED( hr ) )
+	 *phdll = hdll;
+      else
       {
 	 HRESULT temphr;
 
@@ -250,6 +252,48 @@ static HRESULT gCoGetInprocClassObject(
    return hr;
 }
 
+/*
+ * Does the work of CoGetClassObject(), also returning the handle to the
+ * library the class object came from, so CoCreateInstance() can charge
+ * the new object's memory to it without looking the library up again.
+ */
+
+static HRESULT gCoGetClassObject(
+				 REFCLSID rclsid,
+				 CLSCTX ctx,
+				 COMSERVERINFO *serverInfo,
+				 REFIID riid,
+				 void **ppv,
+				 HDLL *phdll
+				)
+{
+   HRESULT hr;
+   
+   *ppv = NULL;		/* Just in case ctx == 0 */
+   *phdll = 0;
+
+   if( ctx & CLSCTX_INPROC_SERVER )
+   {
+      hr = gCoGetInprocClassObject( GCOMIT_SERVER, rclsid, riid, ppv, phdll );
+      if( SUCCEEDED( hr ) )
+	      return hr;
+   }
+
+   if( ctx & CLSCTX_INPROC_HANDLER )
+   {
+      hr = gCoGetInprocClassObject( GCOMIT_HANDLER, rclsid, riid, ppv, phdll );
+      if( SUCCEEDED( hr ) )
+	      return hr;
+   }
+
+   /*
+    * We do not currently support local and remote servers,
+    * but you get the idea as to how to implement them.
+    */
+
+   return E_CLASSNOTREG;
+}
+
 /**
  * This function is called to obtain the class object associated with a
  * given class ID.
@@ -341,30 +385,9 @@ HRESULT CoGetClassObject(
 			 void **ppv
 			)
 {
-   HRESULT hr;
-   
-   *ppv = NULL;		/* Just in case ctx == 0 */
-
-   if( ctx & CLSCTX_INPROC_SERVER )
-   {
-      hr = gCoGetInprocClassObject( GCOMIT_SERVER, rclsid, riid, ppv );
-      if( SUCCEEDED( hr ) )
-	      return hr;
-   }
-
-   if( ctx & CLSCTX_INPROC_HANDLER )
-   {
-      hr = gCoGetInprocClassObject( GCOMIT_HANDLER, rclsid, riid, ppv );
-      if( SUCCEEDED( hr ) )
-	      return hr;
-   }
-
-   /*
-    * We do not currently support local and remote servers,
-    * but you get the idea as to how to implement them.
-    */
+   HDLL hdll;
 
-   return E_CLASSNOTREG;
+   return gCoGetClassObject( rclsid, ctx, serverInfo, riid, ppv, &hdll );
 }
 
 /**
@@ -412,11 +435,22 @@ HRESULT CoCreateInstance(
 {
    HRESULT hr;
    IClassFactory *pcf;
+   HDLL hdll;
+   uint32 cookie;
    
-   hr = CoGetClassObject( rclsid, ctx, NULL, IID_IClassFactory, (void **)&pcf );
+   hr = gCoGetClassObject(
+			  rclsid,
+			  ctx,
+			  NULL,
+			  IID_IClassFactory,
+			  (void **)&pcf,
+			  &hdll
+			 );
    if( SUCCEEDED( hr ) )
    {
+      cookie = gCoDLLEnter( hdll );
       hr = pcf -> lpVtbl -> CreateInstance( pcf, punkOuter, riid, ppv );
+      gCoDLLLeave( cookie );
       pcf -> lpVtbl -> Release( pcf );
    }
    
@@ -472,23 +506,27 @@ HRESULT CoCreateInstanceEx(
    HRESULT hr;
    IClassFactory *pcf;
    IUnknown *punk;
-   uint32 i, successfulQueries;
-
-   hr = CoGetClassObject(
-			 rclsid,
-			 ctx,
-			 serverInfo,
-			 IID_IClassFactory,
-			 (void **)&pcf
-			);
+   HDLL hdll;
+   uint32 i, successfulQueries, cookie;
+
+   hr = gCoGetClassObject(
+			  rclsid,
+			  ctx,
+			  serverInfo,
+			  IID_IClassFactory,
+			  (void **)&pcf,
+			  &hdll
+			 );
    if( SUCCEEDED( hr ) )
    {
+      cookie = gCoDLLEnter( hdll );
       hr = pcf -> lpVtbl -> CreateInstance(
 					   pcf,
 					   punkOuter,
 					   IID_IUnknown,
 					   (void **)&punk
 					  );
+      gCoDLLLeave( cookie );
       if( SUCCEEDED( hr ) )
       {
 	 for( i = 0; i < count; i++ )
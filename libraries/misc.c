@@ -25,11 +25,28 @@
  */
 
 #include <stdlib.h>
-#include <ctype.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+/*
+ * gcom/guid.h defines IsEqualIID() inline; move that one aside so the
+ * out-of-line version below can still be exported, for binaries built
+ * against older headers.
+ */
+
+#define IsEqualIID	InlineIsEqualIID
 #include <gcom/gcom.h>
+#undef IsEqualIID
+
+#include <util/guidmap.h>
 #include "gcom-config.h"
 
+#if defined( __SSE2__ )
+#include <emmintrin.h>
+#endif
+
 /**
  * Compare two UUIDs for equality.  Note that the name of this function
  * was chosen for two reasons:
@@ -46,11 +63,446 @@
  *
  * @returns
  * TRUE if they are both bit-wise identical.  FALSE otherwise.
+ *
+ * @see gCoInternIID
  */
 
 Bool IsEqualIID( REFIID riid1, REFIID riid2 )
 {
-   return memcmp( riid1, riid2, sizeof( GUID ) ) == 0;
+   return InlineIsEqualIID( riid1, riid2 );
+}
+
+/************************************************************************/
+/* IID interning							*/
+/************************************************************************/
+
+static GUIDMap *internedIIDs = NULL;
+static pthread_once_t internOnce = PTHREAD_ONCE_INIT;
+
+/* The runtime's own IIDs, which are canonical from the start */
+
+static REFIID *wellKnownIIDs[] =
+{
+   &IID_IUnknown,
+   &IID_IClassFactory,
+   &IID_IMalloc,
+   &IID_IMallocSpy,
+   &IID_IMemoryPressure,
+};
+
+static void InternInitialize( void )
+{
+   uint32 i;
+
+   if( FAILED( GUIDMapCreate( 64, 0, &internedIIDs ) ) )
+      return;
+
+   for( i = 0; i < sizeof( wellKnownIIDs ) / sizeof( wellKnownIIDs[0] ); i++ )
+      GUIDMapInsert(
+		    internedIIDs,
+		    *wellKnownIIDs[i],
+		    (void *)*wellKnownIIDs[i],
+		    NULL
+		   );
+}
+
+/**
+ * Maps an IID to its canonical pointer: the same pointer for every
+ * caller passing an equal IID, for the life of the process.  Comparing
+ * canonical pointers with IsEqualIID() takes a single compare.
+ *
+ * The first time an IID is seen, a private copy of it becomes its
+ * canonical form, so the IID passed in needn't outlive the call --
+ * it may live in a library that's later unloaded.
+ *
+ * @param riid
+ * The IID to intern.
+ *
+ * @returns
+ * The canonical pointer.  If memory runs out, riid itself is returned;
+ * IsEqualIID() still works, just without the shortcut.
+ *
+ * @see IsEqualIID
+ */
+
+REFIID gCoInternIID( REFIID riid )
+{
+   IID *piid;
+   void *pvExisting;
+
+   pthread_once( &internOnce, InternInitialize );
+   if( internedIIDs == NULL )
+      return riid;
+
+   pvExisting = GUIDMapLookup( internedIIDs, riid );
+   if( pvExisting != NULL )
+      return (REFIID)pvExisting;
+
+   piid = (IID *)malloc( sizeof( IID ) );
+   if( piid == NULL )
+      return riid;
+
+   memcpy( piid, riid, sizeof( IID ) );
+
+   switch( GUIDMapInsert( internedIIDs, piid, piid, &pvExisting ) )
+   {
+      case S_OK:
+	 return piid;
+
+      case S_FALSE:		/* Another thread got there first */
+	 free( piid );
+	 return (REFIID)pvExisting;
+
+      default:
+	 free( piid );
+	 return riid;
+   }
+}
+
+
+/************************************************************************/
+/* GUID <-> text conversion						*/
+/************************************************************************/
+
+/*
+ * Every GUID's text form is exactly GUID_TEXT_LEN characters long:
+ *
+ *	{01234567-89AB-CDEF-FEDC-BA9876543210}
+ *
+ * The 32 hex digits spell out the GUID's 16 bytes in "text order" --
+ * Data1, Data2 and Data3 most significant byte first, then Data4 as is.
+ * Since the layout never changes, both directions are done with tables
+ * and, where available, SSE2, rather than with sprintf() and strtoul().
+ */
+
+#define GUID_TEXT_LEN		38
+
+/* Offset of the first digit of each text-order byte within the text form */
+
+static const uint8 hexOffsets[16] =
+{
+   1, 3, 5, 7,  10, 12,  15, 17,  20, 22,  25, 27, 29, 31, 33, 35
+};
+
+/**
+ * Lays a GUID's bytes out in text order.
+ */
+
+static void GUIDToBytes( REFGUID rguid, uint8 *pb )
+{
+   uint32 d1 = rguid -> Data1;
+
+   pb[0] = (uint8)( d1 >> 24 );
+   pb[1] = (uint8)( d1 >> 16 );
+   pb[2] = (uint8)( d1 >> 8 );
+   pb[3] = (uint8)d1;
+   pb[4] = (uint8)( rguid -> Data2 >> 8 );
+   pb[5] = (uint8)rguid -> Data2;
+   pb[6] = (uint8)( rguid -> Data3 >> 8 );
+   pb[7] = (uint8)rguid -> Data3;
+   memcpy( &pb[8], rguid -> Data4, 8 );
+}
+
+/**
+ * The inverse of GUIDToBytes().
+ */
+
+static void BytesToGUID( const uint8 *pb, GUID *pguid )
+{
+   pguid -> Data1 = ( (uint32)pb[0] << 24 ) | ( (uint32)pb[1] << 16 ) |
+		    ( (uint32)pb[2] << 8 ) | pb[3];
+   pguid -> Data2 = (uint16)( ( pb[4] << 8 ) | pb[5] );
+   pguid -> Data3 = (uint16)( ( pb[6] << 8 ) | pb[7] );
+   memcpy( pguid -> Data4, &pb[8], 8 );
+}
+
+/**
+ * Writes the GUID_TEXT_LEN characters of a GUID's text form, using
+ * uppercase hex digits.  No terminator is written.
+ */
+
+static void FormatGUID( REFGUID rguid, char *pch )
+{
+   uint8 bytes[16];
+   char hex[32];
+
+   GUIDToBytes( rguid, bytes );
+
+#if defined( __SSE2__ )
+   {
+      __m128i v, hi, lo, nine, fifteen;
+
+      /*
+       * Split every byte into its two nibbles, turn each nibble into a
+       * digit ('0' + n, plus 7 more to reach 'A' when n > 9), then
+       * interleave them back into high-then-low order.
+       */
+
+      v = _mm_loadu_si128( (const __m128i *)bytes );
+      fifteen = _mm_set1_epi8( 0x0F );
+      nine = _mm_set1_epi8( 9 );
+
+      hi = _mm_and_si128( _mm_srli_epi16( v, 4 ), fifteen );
+      lo = _mm_and_si128( v, fifteen );
+
+      hi = _mm_add_epi8(
+			_mm_add_epi8( hi, _mm_set1_epi8( '0' ) ),
+			_mm_and_si128(
+				      _mm_cmpgt_epi8( hi, nine ),
+				      _mm_set1_epi8( 7 )
+				     )
+		       );
+      lo = _mm_add_epi8(
+			_mm_add_epi8( lo, _mm_set1_epi8( '0' ) ),
+			_mm_and_si128(
+				      _mm_cmpgt_epi8( lo, nine ),
+				      _mm_set1_epi8( 7 )
+				     )
+		       );
+
+      _mm_storeu_si128( (__m128i *)&hex[0], _mm_unpacklo_epi8( hi, lo ) );
+      _mm_storeu_si128( (__m128i *)&hex[16], _mm_unpackhi_epi8( hi, lo ) );
+   }
+#else
+   {
+      static const char hexDigits[] = "0123456789ABCDEF";
+      int i;
+
+      for( i = 0; i < 16; i++ )
+      {
+	 hex[ i*2 ] = hexDigits[ bytes[i] >> 4 ];
+	 hex[ i*2+1 ] = hexDigits[ bytes[i] & 0x0F ];
+      }
+   }
+#endif
+
+   pch[0] = '{';
+   memcpy( &pch[1], &hex[0], 8 );
+   pch[9] = '-';
+   memcpy( &pch[10], &hex[8], 4 );
+   pch[14] = '-';
+   memcpy( &pch[15], &hex[12], 4 );
+   pch[19] = '-';
+   memcpy( &pch[20], &hex[16], 4 );
+   pch[24] = '-';
+   memcpy( &pch[25], &hex[20], 12 );
+   pch[37] = '}';
+}
+
+/**
+ * Returns the value of a single hex digit, either case, or -1 if the
+ * character isn't one.
+ */
+
+static int HexValue( uint8 ch )
+{
+   if( (uint8)( ch - '0' ) < 10 )
+      return ch - '0';
+
+   ch |= 0x20;
+   if( (uint8)( ch - 'a' ) < 6 )
+      return ch - 'a' + 10;
+
+   return -1;
+}
+
+/**
+ * Parses a GUID's text form one character at a time, giving up at the
+ * first character out of place.  Since a NUL is always out of place,
+ * this never reads past the end of a short string.
+ */
+
+static Bool ParseGUIDSlowly( const char *pch, uint8 *pb )
+{
+   int i, hi, lo;
+
+   if( pch[0] != '{' )
+      return FALSE;
+
+   for( i = 0; i < 16; i++ )
+   {
+      hi = HexValue( (uint8)pch[ hexOffsets[i] ] );
+      if( hi < 0 )
+	 return FALSE;
+
+      lo = HexValue( (uint8)pch[ hexOffsets[i] + 1 ] );
+      if( lo < 0 )
+	 return FALSE;
+
+      pb[i] = (uint8)( ( hi << 4 ) | lo );
+
+      if( ( ( i == 3 ) || ( i == 5 ) || ( i == 7 ) || ( i == 9 ) ) &&
+	  ( pch[ hexOffsets[i] + 2 ] != '-' ) )
+	 return FALSE;
+   }
+
+   return pch[37] == '}';
+}
+
+#if defined( __SSE2__ )
+
+/**
+ * Decodes sixteen characters at once.  Each byte of the result holds the
+ * value of the corresponding hex digit; bit n of *pmaskHex is set if the
+ * n-th character was a hex digit at all.
+ */
+
+static __m128i DecodeHex16( __m128i v, int *pmaskHex )
+{
+   __m128i isDigit, isAlpha, lower;
+
+   /*
+    * The comparisons are signed, so anything with its top bit set falls
+    * outside both ranges.
+    */
+
+   isDigit = _mm_and_si128(
+			   _mm_cmpgt_epi8( v, _mm_set1_epi8( '0' - 1 ) ),
+			   _mm_cmplt_epi8( v, _mm_set1_epi8( '9' + 1 ) )
+			  );
+
+   lower = _mm_or_si128( v, _mm_set1_epi8( 0x20 ) );
+   isAlpha = _mm_and_si128(
+			   _mm_cmpgt_epi8( lower, _mm_set1_epi8( 'a' - 1 ) ),
+			   _mm_cmplt_epi8( lower, _mm_set1_epi8( 'f' + 1 ) )
+			  );
+
+   *pmaskHex = _mm_movemask_epi8( _mm_or_si128( isDigit, isAlpha ) );
+
+   return _mm_or_si128(
+		       _mm_and_si128(
+				     isDigit,
+				     _mm_sub_epi8( v, _mm_set1_epi8( '0' ) )
+				    ),
+		       _mm_and_si128(
+				     isAlpha,
+				     _mm_sub_epi8(
+						  lower,
+						  _mm_set1_epi8( 'a' - 10 )
+						 )
+				    )
+		      );
+}
+
+#endif
+
+/**
+ * Parses a GUID's text form into its bytes, in text order.  Digits may
+ * be in either case.  Only the GUID_TEXT_LEN characters of the text form
+ * are examined; whatever follows them doesn't matter.
+ *
+ * @returns
+ * TRUE if the text was well formed.  FALSE otherwise.
+ */
+
+static Bool ParseGUID( const char *pch, uint8 *pb )
+{
+#if defined( __SSE2__ )
+   __m128i v0, v1, v2;
+   uint8 nybbles[ GUID_TEXT_LEN ];
+   int hex0, hex1, hex2, punct0, punct1, punct2;
+   int i;
+
+   /*
+    * The vector loads read all GUID_TEXT_LEN characters without looking
+    * for a terminator first.  That's harmless unless a short string sits
+    * right at the end of a page, where the loads could fault; those few
+    * take the slow path, which stops at the first bad character.
+    */
+
+   if( ( (uintptr_t)pch & 4095 ) > ( 4096 - GUID_TEXT_LEN ) )
+      return ParseGUIDSlowly( pch, pb );
+
+   /*
+    * Three loads cover characters 0-15, 16-31 and 22-37.  In each, the
+    * punctuation has to match exactly, and everything else has to be a
+    * hex digit.  The masks below mark the punctuation's positions:
+    *
+    *	v0: '{' at 0, '-' at 9 and 14		0x4201
+    *	v1: '-' at 19 and 24			0x0108
+    *	v2: '-' at 24, '}' at 37		0x8004
+    */
+
+   v0 = _mm_loadu_si128( (const __m128i *)&pch[0] );
+   v1 = _mm_loadu_si128( (const __m128i *)&pch[16] );
+   v2 = _mm_loadu_si128( (const __m128i *)&pch[22] );
+
+   punct0 = _mm_movemask_epi8(
+			      _mm_cmpeq_epi8(
+					     v0,
+					     _mm_setr_epi8(
+							   '{', 0, 0, 0, 0, 0, 0, 0,
+							   0, '-', 0, 0, 0, 0, '-', 0
+							  )
+					    )
+			     );
+   punct1 = _mm_movemask_epi8(
+			      _mm_cmpeq_epi8(
+					     v1,
+					     _mm_setr_epi8(
+							   0, 0, 0, '-', 0, 0, 0, 0,
+							   '-', 0, 0, 0, 0, 0, 0, 0
+							  )
+					    )
+			     );
+   punct2 = _mm_movemask_epi8(
+			      _mm_cmpeq_epi8(
+					     v2,
+					     _mm_setr_epi8(
+							   0, 0, '-', 0, 0, 0, 0, 0,
+							   0, 0, 0, 0, 0, 0, 0, '}'
+							  )
+					    )
+			     );
+
+   v0 = DecodeHex16( v0, &hex0 );
+   v1 = DecodeHex16( v1, &hex1 );
+   v2 = DecodeHex16( v2, &hex2 );
+
+   if( ( ( punct0 & 0x4201 ) != 0x4201 ) ||
+       ( ( punct1 & 0x0108 ) != 0x0108 ) ||
+       ( ( punct2 & 0x8004 ) != 0x8004 ) ||
+       ( ( hex0 & 0xBDFE ) != 0xBDFE ) ||
+       ( ( hex1 & 0xFEF7 ) != 0xFEF7 ) ||
+       ( ( hex2 & 0x7FFB ) != 0x7FFB ) )
+      return FALSE;
+
+   _mm_storeu_si128( (__m128i *)&nybbles[0], v0 );
+   _mm_storeu_si128( (__m128i *)&nybbles[16], v1 );
+   _mm_storeu_si128( (__m128i *)&nybbles[22], v2 );
+
+   for( i = 0; i < 16; i++ )
+      pb[i] = (uint8)( ( nybbles[ hexOffsets[i] ] << 4 ) |
+		       nybbles[ hexOffsets[i] + 1 ] );
+
+   return TRUE;
+#else
+   return ParseGUIDSlowly( pch, pb );
+#endif
+}
+
+/**
+ * Narrows a wide GUID string into a buffer of GUID_TEXT_LEN characters
+ * for ParseGUID().  Anything outside ASCII becomes a NUL, which no part
+ * of a GUID's text form will match.
+ *
+ * @returns
+ * TRUE if the string was at least GUID_TEXT_LEN characters long.
+ */
+
+static Bool NarrowGUIDString( const wchar *pwch, char *pch )
+{
+   int i;
+
+   for( i = 0; i < GUID_TEXT_LEN; i++ )
+   {
+      if( pwch[i] == 0 )
+	 return FALSE;
+
+      pch[i] = ( pwch[i] < 0x80 ) ? (char)pwch[i] : 0;
+   }
+
+   return TRUE;
 }
 
 /**
@@ -58,163 +510,225 @@ Bool IsEqualIID( REFIID riid1, REFIID riid2 )
  * The resulting string is NULL-terminated.  The textual representation
  * of a class ID is {01234567-89AB-CDEF-FEDC-BA9876543210}, including
  * the opening and closing braces.
- * 
+ *
  * @param rclsid
  * The class ID to express as a string.
- * 
+ *
  * @param buffer
  * Pointer to a buffer which is at least MAX_GUIDSTRING_LEN characters in
  * length (long enough to handle the string itself, plus the terminating
- * NULL).  MAX_GUIDSTRING_LEN is currently defined to 40.
- * 
+ * NULL).  MAX_GUIDSTRING_LEN is currently defined to 39.
+ *
  * @returns Nothing.
  *
  * @see gCoStringToGUID
+ * @see gCoGUIDToAsciiString
  */
 
 void gCoGUIDToString( REFCLSID rclsid, wchar *buffer )
 {
-   char asciiBuffer[ MAX_GUIDSTRING_LEN ];
-
-   sprintf(
-	   asciiBuffer,
-	   STR_GUIDSTRING_TEMPLATE,
-	   rclsid -> Data1,
-	   rclsid -> Data2, rclsid -> Data3,
-	   rclsid -> Data4[0], rclsid -> Data4[1],
-	   rclsid -> Data4[2], rclsid -> Data4[3],
-	   rclsid -> Data4[4], rclsid -> Data4[5],
-	   rclsid -> Data4[6], rclsid -> Data4[7]
-	  );
+   char asciiBuffer[ GUID_TEXT_LEN ];
+   int i;
 
-   gCoAsciiStringToUnicode( asciiBuffer, buffer, MAX_GUIDSTRING_LEN );
-}
+   FormatGUID( rclsid, asciiBuffer );
 
-/**
- * Converts a single hexadecimal character into its equivalent 4-bit
- * quantity.
- * 
- * @param pstr
- * Pointer to the character to convert.
- * 
- * @returns
- * The equivalent numeric value.
- */
+   for( i = 0; i < GUID_TEXT_LEN; i++ )
+      buffer[i] = (uint8)asciiBuffer[i];
 
-static uint8 ConvertNybble( char *pstr )
-{
-   uint8 v = (uint8)( toupper( *pstr ) ) - '0';
-   
-   if( v > 9 )
-	   v -= 7;
-   
-   return v;
+   buffer[ GUID_TEXT_LEN ] = 0;
 }
 
 /**
- * Converts two characters of a string into a byte value in binary.
- * 
- * @param pstr
- * Pointer to the string of two characters to convert.  The string need
- * NOT be NULL-terminated.
- * 
- * @returns
- * The byte represented by the string.
- * 
- * @see gCoStringToGUID
+ * Like gCoGUIDToString(), but produces a plain ASCII string, as used
+ * for registry paths.
+ *
+ * @param rguid
+ * The GUID to express as a string.
+ *
+ * @param buffer
+ * Pointer to a buffer at least MAX_GUIDSTRING_LEN characters long.
+ *
+ * @returns Nothing.
+ *
+ * @see gCoAsciiStringToGUID
  */
 
-static uint8 ConvertByte( char *pstr )
+void gCoGUIDToAsciiString( REFGUID rguid, char *buffer )
 {
-   uint8 v = 0;
-   
-   v = ConvertNybble( pstr++ );
-   v = ( v << 4 ) + ConvertNybble( pstr );
-   
-   return v;
+   FormatGUID( rguid, buffer );
+   buffer[ GUID_TEXT_LEN ] = 0;
 }
 
 /**
  * This function converts a string representation of a GUID into
  * a real GUID.  The textual representation of a class ID is
  * {01234567-89AB-CDEF-FEDC-BA9876543210}, including the opening and
- * closing braces.
- * 
+ * closing braces.  Hex digits may be in either case.
+ *
  * @param buffer
  * Pointer to the start of a Unicode string buffer containing the
  * GUID in string form.
- * 
+ *
  * @param pclsid
  * Pointer to a CLSID which is to contain the resulting GUID in binary
  * form.
- * 
+ *
  * @returns
  * S_OK if successful.  E_INVALIDARG if the supplied textual form of the
  * GUID is not valid (e.g., contains characters other than {, }, -, and
- * the hexadecimal digits).
+ * the hexadecimal digits).  In that case, *pclsid is set to all zeros.
  *
  * @see gCoGUIDToString
+ * @see gCoAsciiStringToGUID
  */
 
 HRESULT gCoStringToGUID( wchar *buffer, CLSID *pclsid )
 {
-   char asciiGUID[ MAX_GUIDSTRING_LEN ];
-   int i;
-   
-   gCoUnicodeStringToAscii( buffer, asciiGUID, MAX_GUIDSTRING_LEN );
-   asciiGUID[ MAX_GUIDSTRING_LEN-1 ] = 0;	/* Ensure NULL termination */
-  
-   memset( pclsid, 0, sizeof( GUID ) );
-
-   /* Sanity checks */
-   
-   if( asciiGUID[0] != '{' )		return E_INVALIDARG;
-   if( asciiGUID[9] != '-' )		return E_INVALIDARG;
-   if( asciiGUID[14] != '-' )		return E_INVALIDARG;
-   if( asciiGUID[19] != '-' )		return E_INVALIDARG;
-   if( asciiGUID[24] != '-' )		return E_INVALIDARG;
-   if( asciiGUID[37] != '}' )		return E_INVALIDARG;
-   
-   for( i = 1; i < 9; i++ )
-	   if( !( isxdigit( asciiGUID[i] ) ) )
-		   return E_INVALIDARG;
-   
-   for( i = 10; i < 14; i++ )
-	   if( !( isxdigit( asciiGUID[i] ) ) )
-		   return E_INVALIDARG;
-   
-   for( i = 15; i < 19; i++ )
-	   if( !( isxdigit( asciiGUID[i] ) ) )
-		   return E_INVALIDARG;
-   
-   for( i = 20; i < 24; i++ )
-	   if( !( isxdigit( asciiGUID[i] ) ) )
-		   return E_INVALIDARG;
-   
-   for( i = 25; i < 37; i++ )
-	   if( !( isxdigit( asciiGUID[i] ) ) )
-		   return E_INVALIDARG;
-   
-   /* Now let's delimit the strings so that we can convert them to
-    * binary.
-    */
-   
-   asciiGUID[9] =
-   asciiGUID[14] =
-   asciiGUID[19] =
-   asciiGUID[24] =
-   asciiGUID[37] = 0;
-   
-   /* Now we actually begin the conversion process. */
-   
-   pclsid -> Data1 = strtoul( &asciiGUID[1], NULL, 16 );
-   pclsid -> Data2 = strtoul( &asciiGUID[10], NULL, 16 );
-   pclsid -> Data3 = strtoul( &asciiGUID[15], NULL, 16 );
-   pclsid -> Data4[0] = ConvertByte( &asciiGUID[20] );
-   pclsid -> Data4[1] = ConvertByte( &asciiGUID[22] );
-   
-   for( i = 0; i < 6; i++ )
-	   pclsid -> Data4[i+2] = ConvertByte( &asciiGUID[ 25 + ( i * 2 ) ] );
+   char asciiGUID[ GUID_TEXT_LEN ];
+   uint8 bytes[16];
+
+   if( !NarrowGUIDString( buffer, asciiGUID ) ||
+       !ParseGUID( asciiGUID, bytes ) )
+   {
+      memset( pclsid, 0, sizeof( GUID ) );
+      return E_INVALIDARG;
+   }
+
+   BytesToGUID( bytes, pclsid );
+   return S_OK;
+}
+
+/**
+ * Like gCoStringToGUID(), but takes a plain ASCII string.  Only the
+ * first 38 characters are examined, so the string need not be
+ * terminated right after the closing brace.
+ *
+ * @param buffer
+ * Pointer to the GUID in string form.
+ *
+ * @param pguid
+ * Pointer to a GUID which is to contain the result.
+ *
+ * @returns
+ * S_OK if successful.  E_INVALIDARG if the string isn't a well formed
+ * GUID, in which case *pguid is set to all zeros.
+ *
+ * @see gCoGUIDToAsciiString
+ */
+
+HRESULT gCoAsciiStringToGUID( const char *buffer, GUID *pguid )
+{
+   uint8 bytes[16];
+
+   if( !ParseGUID( buffer, bytes ) )
+   {
+      memset( pguid, 0, sizeof( GUID ) );
+      return E_INVALIDARG;
+   }
+
+   BytesToGUID( bytes, pguid );
+   return S_OK;
+}
+
+/**
+ * Converts an array of GUIDs to Unicode strings in one call.
+ *
+ * @param pguids
+ * The GUIDs to convert.
+ *
+ * @param cGUIDs
+ * How many there are.
+ *
+ * @param buffer
+ * Pointer to cGUIDs * MAX_GUIDSTRING_LEN characters.  The i-th string,
+ * NULL-terminated, starts at buffer[ i * MAX_GUIDSTRING_LEN ].
+ *
+ * @returns Nothing.
+ *
+ * @see gCoGUIDToString
+ * @see gCoStringsToGUIDs
+ */
+
+void gCoGUIDsToStrings( const GUID *pguids, uint32 cGUIDs, wchar *buffer )
+{
+   uint32 i;
+
+   for( i = 0; i < cGUIDs; i++ )
+      gCoGUIDToString( &pguids[i], &buffer[ i * MAX_GUIDSTRING_LEN ] );
+}
+
+/**
+ * Converts an array of GUIDs to ASCII strings in one call, laid out as
+ * for gCoGUIDsToStrings().
+ *
+ * @see gCoGUIDToAsciiString
+ * @see gCoAsciiStringsToGUIDs
+ */
+
+void gCoGUIDsToAsciiStrings( const GUID *pguids, uint32 cGUIDs, char *buffer )
+{
+   uint32 i;
+
+   for( i = 0; i < cGUIDs; i++ )
+      gCoGUIDToAsciiString( &pguids[i], &buffer[ i * MAX_GUIDSTRING_LEN ] );
+}
+
+/**
+ * Converts an array of Unicode GUID strings, laid out as produced by
+ * gCoGUIDsToStrings(), back into GUIDs.
+ *
+ * @param buffer
+ * Pointer to the strings; the i-th starts at
+ * buffer[ i * MAX_GUIDSTRING_LEN ].
+ *
+ * @param cGUIDs
+ * How many strings there are.
+ *
+ * @param pguids
+ * Pointer to an array of cGUIDs GUIDs to receive the results.
+ *
+ * @returns
+ * S_OK if every string was converted.  E_INVALIDARG if one wasn't well
+ * formed; conversion stops there, and that entry is set to all zeros.
+ * Entries before it hold their results; those after it are untouched.
+ *
+ * @see gCoStringToGUID
+ */
+
+HRESULT gCoStringsToGUIDs( wchar *buffer, uint32 cGUIDs, GUID *pguids )
+{
+   HRESULT hr;
+   uint32 i;
+
+   for( i = 0; i < cGUIDs; i++ )
+   {
+      hr = gCoStringToGUID( &buffer[ i * MAX_GUIDSTRING_LEN ], &pguids[i] );
+      if( FAILED( hr ) )
+	 return hr;
+   }
+
+   return S_OK;
+}
+
+/**
+ * Converts an array of ASCII GUID strings, laid out as produced by
+ * gCoGUIDsToAsciiStrings(), back into GUIDs.  Errors are handled as
+ * for gCoStringsToGUIDs().
+ *
+ * @see gCoAsciiStringToGUID
+ */
+
+HRESULT gCoAsciiStringsToGUIDs( const char *buffer, uint32 cGUIDs, GUID *pguids )
+{
+   HRESULT hr;
+   uint32 i;
+
+   for( i = 0; i < cGUIDs; i++ )
+   {
+      hr = gCoAsciiStringToGUID( &buffer[ i * MAX_GUIDSTRING_LEN ], &pguids[i] );
+      if( FAILED( hr ) )
+	 return hr;
+   }
 
    return S_OK;
 }
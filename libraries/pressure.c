@@ -0,0 +1,629 @@
+/*
+ * pressure.c
+ * GCOM Release 0.3
+ *
+ * Copyright (c) 1999, 2000 Samuel A. Falvo II
+ *
+ * This software is provided 'as-is', without any implied or express warranty.
+ * In no event shall the authors be held liable for damages arising from the
+ * use this software.
+ *
+ * Permission is granted for anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software in a
+ *    product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+#define _GNU_SOURCE
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <gcom/gcom.h>
+#include "alloc-private.h"
+
+/************************************************************************/
+/* Registered IMemoryPressure sinks					*/
+/************************************************************************/
+
+/*
+ * Sinks live in a table which only ever grows; a registration token is
+ * a slot number plus one, so that zero is never a valid token.  Revoked
+ * slots are left NULL, and reused by later registrations.
+ */
+
+static pthread_mutex_t sinkLock = PTHREAD_MUTEX_INITIALIZER;
+static IMemoryPressure **sinks = NULL;
+static uint32 cSinkSlots = 0;
+
+/*
+ * Calls every registered sink with the given level.  The sinks are
+ * called with the lock dropped, so a sink may register or revoke sinks
+ * (itself included) from within its callback; each sink is held by a
+ * reference of our own for the duration.
+ */
+
+static void SinksNotify( MEMPRESSURE level )
+{
+   IMemoryPressure *stack[ 16 ], **snapshot = stack;
+   uint32 i, n = 0;
+
+   pthread_mutex_lock( &sinkLock );
+   if( cSinkSlots > 16 )
+   {
+      snapshot = malloc( cSinkSlots * sizeof( IMemoryPressure * ) );
+      if( snapshot == NULL )
+      {
+	 pthread_mutex_unlock( &sinkLock );
+	 return;
+      }
+   }
+
+   for( i = 0; i < cSinkSlots; i++ )
+   {
+      if( sinks[ i ] != NULL )
+      {
+	 snapshot[ n ] = sinks[ i ];
+	 snapshot[ n ] -> lpVtbl -> AddRef( snapshot[ n ] );
+	 n++;
+      }
+   }
+   pthread_mutex_unlock( &sinkLock );
+
+   for( i = 0; i < n; i++ )
+   {
+      snapshot[ i ] -> lpVtbl -> OnMemoryPressure( snapshot[ i ], level );
+      snapshot[ i ] -> lpVtbl -> Release( snapshot[ i ] );
+   }
+
+   if( snapshot != stack )
+      free( snapshot );
+}
+
+/*
+ * Every notification ends with the task allocator giving back what it
+ * can, including whatever the sinks just freed.
+ */
+
+static uint64 Dispatch( MEMPRESSURE level )
+{
+   SinksNotify( level );
+   return gCoTaskMemMinimize();
+}
+
+/************************************************************************/
+/* The pressure monitor							*/
+/************************************************************************/
+
+/*
+ * The monitor is a thread of our own, which sleeps in poll() on one or
+ * more pressure sources:
+ *
+ * PSI triggers, on the process' cgroup's memory.pressure file, or failing
+ * that the system-wide /proc/pressure/memory.  One trigger is armed per
+ * pressure level; the kernel wakes us when tasks spend more than the
+ * given time stalled on memory within the given window.  Unprivileged
+ * processes may only use windows which are a multiple of two seconds.
+ *
+ * The cgroup's memory.events file, whose counters go up when the cgroup
+ * is throttled at its high limit, hits its hard limit, or runs out of
+ * memory altogether.  Readers are woken whenever a counter changes.
+ */
+
+#define CGROUP_ROOT		"/sys/fs/cgroup"
+#define PSI_SYSTEM		"/proc/pressure/memory"
+#define MAX_SOURCES		4
+
+typedef enum
+{
+   SOURCE_PSI,
+   SOURCE_EVENTS
+} SOURCEKIND;
+
+typedef struct
+{
+   SOURCEKIND	kind;
+   MEMPRESSURE	level;		/* For PSI triggers */
+   uint64	high, max, oom;	/* For memory.events */
+} PressureSource;
+
+static const struct
+{
+   const char *	trigger;
+   MEMPRESSURE	level;
+} psiTriggers[] =
+{
+   { "some 100000 2000000",	MEMPRESSURE_LOW },
+   { "some 300000 2000000",	MEMPRESSURE_MODERATE },
+   { "full 200000 2000000",	MEMPRESSURE_CRITICAL },
+};
+
+#define NUM_PSI_TRIGGERS	( sizeof( psiTriggers ) / sizeof( psiTriggers[ 0 ] ) )
+
+static pthread_mutex_t monitorLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t monitorThread;
+static Bool monitorRunning = FALSE;
+static int monitorWake[ 2 ] = { -1, -1 };	/* Pipe; closing it stops us */
+
+static struct pollfd pollFDs[ MAX_SOURCES + 1 ];
+static PressureSource sources[ MAX_SOURCES ];
+static int cSources = 0;
+
+/*
+ * Finds this process' cgroup (v2) directory.  Returns FALSE if the
+ * process isn't in the unified hierarchy.
+ */
+
+static Bool CGroupPath( char *path, size_t cbPath )
+{
+   char line[ 512 ];
+   size_t len;
+   Bool found = FALSE;
+   FILE *fp;
+
+   fp = fopen( "/proc/self/cgroup", "r" );
+   if( fp == NULL )
+      return FALSE;
+
+   while( !found && fgets( line, sizeof( line ), fp ) )
+   {
+      if( strncmp( line, "0::", 3 ) != 0 )
+	 continue;
+
+      len = strlen( line );
+      if( ( len > 0 ) && ( line[ len - 1 ] == '\n' ) )
+	 line[ len - 1 ] = 0;
+
+      found = ( snprintf( path, cbPath, "%s%s", CGROUP_ROOT, line + 3 )
+		< (int)cbPath );
+   }
+
+   fclose( fp );
+   return found;
+}
+
+/*
+ * Reads the counters we care about out of a memory.events file.
+ */
+
+static void EventsRead( int fd, PressureSource *src )
+{
+   char buf[ 512 ], *line, *save;
+   ssize_t cb;
+
+   cb = pread( fd, buf, sizeof( buf ) - 1, 0 );
+   if( cb <= 0 )
+      return;
+   buf[ cb ] = 0;
+
+   for( line = strtok_r( buf, "\n", &save ); line;
+	line = strtok_r( NULL, "\n", &save ) )
+   {
+      if( strncmp( line, "high ", 5 ) == 0 )
+	 src -> high = strtoull( line + 5, NULL, 10 );
+      else if( strncmp( line, "max ", 4 ) == 0 )
+	 src -> max = strtoull( line + 4, NULL, 10 );
+      else if( strncmp( line, "oom ", 4 ) == 0 )
+	 src -> oom = strtoull( line + 4, NULL, 10 );
+   }
+}
+
+/*
+ * Re-reads a memory.events file after a wakeup, and grades whatever
+ * changed since last time.  Returns zero if nothing we care about did.
+ */
+
+static MEMPRESSURE EventsGrade( int fd, PressureSource *src )
+{
+   PressureSource before = *src;
+
+   EventsRead( fd, src );
+
+   if( ( src -> oom != before.oom ) || ( src -> max != before.max ) )
+      return MEMPRESSURE_CRITICAL;
+   if( src -> high != before.high )
+      return MEMPRESSURE_MODERATE;
+
+   return (MEMPRESSURE)0;
+}
+
+static void SourceAdd( int fd, short events, SOURCEKIND kind, MEMPRESSURE level )
+{
+   pollFDs[ cSources + 1 ].fd = fd;
+   pollFDs[ cSources + 1 ].events = events;
+   sources[ cSources ].kind = kind;
+   sources[ cSources ].level = level;
+   sources[ cSources ].high = 0;
+   sources[ cSources ].max = 0;
+   sources[ cSources ].oom = 0;
+   cSources++;
+}
+
+/*
+ * Arms one PSI trigger per pressure level on the given file.  Returns
+ * FALSE, arming nothing, if the file doesn't exist or doesn't accept
+ * triggers.
+ */
+
+static Bool PSIOpen( const char *path )
+{
+   int fds[ NUM_PSI_TRIGGERS ];
+   uint32 i, j;
+
+   for( i = 0; i < NUM_PSI_TRIGGERS; i++ )
+   {
+      fds[ i ] = open( path, O_RDWR | O_NONBLOCK | O_CLOEXEC );
+      if( ( fds[ i ] < 0 ) ||
+	  ( write( fds[ i ], psiTriggers[ i ].trigger,
+		   strlen( psiTriggers[ i ].trigger ) + 1 ) < 0 ) )
+      {
+	 for( j = 0; j <= i; j++ )
+	    if( fds[ j ] >= 0 )
+	       close( fds[ j ] );
+	 return FALSE;
+      }
+   }
+
+   for( i = 0; i < NUM_PSI_TRIGGERS; i++ )
+      SourceAdd( fds[ i ], POLLPRI, SOURCE_PSI, psiTriggers[ i ].level );
+
+   return TRUE;
+}
+
+static void SourcesOpen( void )
+{
+   char cgroup[ 256 ], path[ 320 ];
+   Bool haveCGroup;
+   int fd;
+
+   cSources = 0;
+   haveCGroup = CGroupPath( cgroup, sizeof( cgroup ) );
+
+   snprintf( path, sizeof( path ), "%s/memory.pressure", cgroup );
+   if( !haveCGroup || !PSIOpen( path ) )
+      PSIOpen( PSI_SYSTEM );
+
+   if( haveCGroup )
+   {
+      snprintf( path, sizeof( path ), "%s/memory.events", cgroup );
+      fd = open( path, O_RDONLY | O_CLOEXEC );
+      if( fd >= 0 )
+      {
+	 SourceAdd( fd, POLLPRI, SOURCE_EVENTS, (MEMPRESSURE)0 );
+	 EventsRead( fd, &sources[ cSources - 1 ] );
+      }
+   }
+}
+
+static void SourcesClose( void )
+{
+   int i;
+
+   for( i = 0; i < cSources; i++ )
+      if( pollFDs[ i + 1 ].fd >= 0 )
+	 close( pollFDs[ i + 1 ].fd );
+
+   cSources = 0;
+}
+
+/*
+ * The monitor proper.  Each wakeup is graded by the most severe source
+ * which fired, and dispatched once.  The wake pipe becomes readable (at
+ * end of file) when the monitor is asked to stop.
+ */
+
+static void *Monitor( void *pv )
+{
+   MEMPRESSURE level, graded;
+   short revents;
+   int i;
+
+   for( ;; )
+   {
+      if( poll( pollFDs, cSources + 1, -1 ) < 0 )
+      {
+	 if( errno == EINTR )
+	    continue;
+	 break;
+      }
+
+      if( pollFDs[ 0 ].revents != 0 )
+	 break;
+
+      level = (MEMPRESSURE)0;
+      for( i = 0; i < cSources; i++ )
+      {
+	 revents = pollFDs[ i + 1 ].revents;
+	 if( revents == 0 )
+	    continue;
+
+	 if( sources[ i ].kind == SOURCE_EVENTS )
+	 {
+	    graded = EventsGrade( pollFDs[ i + 1 ].fd, &sources[ i ] );
+	    if( graded > level )
+	       level = graded;
+	 }
+	 else if( revents & POLLERR )
+	 {
+	    /* The trigger's cgroup went away; stop polling it. */
+	    close( pollFDs[ i + 1 ].fd );
+	    pollFDs[ i + 1 ].fd = -1;
+	 }
+	 else if( ( revents & POLLPRI ) && ( sources[ i ].level > level ) )
+	    level = sources[ i ].level;
+      }
+
+      if( level != 0 )
+	 Dispatch( level );
+   }
+
+   return NULL;
+}
+
+/************************************************************************/
+/* Component Uninitialization						*/
+/************************************************************************/
+
+/*
+ * Called by TaskMallocUninitialize() when GCOM goes away: the monitor is
+ * stopped, and every sink still registered is released.
+ */
+
+void MemoryPressureUninitialize( void )
+{
+   uint32 i;
+
+   gCoMemoryPressureStop();
+
+   pthread_mutex_lock( &sinkLock );
+   for( i = 0; i < cSinkSlots; i++ )
+      if( sinks[ i ] != NULL )
+	 sinks[ i ] -> lpVtbl -> Release( sinks[ i ] );
+
+   free( sinks );
+   sinks = NULL;
+   cSinkSlots = 0;
+   pthread_mutex_unlock( &sinkLock );
+}
+
+/************************************************************************/
+/* Public Interface							*/
+/************************************************************************/
+
+/**
+ * This function registers an object to be told when the system is
+ * running short of memory.  Whenever the pressure monitor (see
+ * gCoMemoryPressureStart()) sees memory pressure, or the application
+ * reports some with gCoMemoryPressureNotify(), every registered object's
+ * IMemoryPressure::OnMemoryPressure() method is called with the level
+ * of pressure; when they have all returned, the task allocator's heap
+ * is minimized, so memory the objects freed goes back to the system.
+ *
+ * The object is queried for IMemoryPressure, so a component can simply
+ * register its class object, provided the class object supports that
+ * interface.  Callbacks arrive on the monitor's own thread, and may
+ * arrive while other threads are using the component.
+ *
+ * @param punk
+ * The object to register.  GCOM holds a reference to it until it is
+ * revoked, or until GCOM is uninitialized.
+ *
+ * @param pToken
+ * Pointer to a variable which receives a token identifying the
+ * registration, for gCoRevokeMemoryPressure().
+ *
+ * @returns
+ * S_OK if successful.  E_NOINTERFACE if the object doesn't support
+ * IMemoryPressure.  E_OUTOFMEMORY if the registration couldn't be
+ * recorded.
+ *
+ * @see gCoRevokeMemoryPressure
+ */
+
+HRESULT gCoRegisterMemoryPressure( IUnknown *punk, uint32f *pToken )
+{
+   IMemoryPressure *sink, **newSinks;
+   uint32 i, cSlots;
+   HRESULT hr;
+
+   *pToken = 0;
+
+   hr = punk -> lpVtbl -> QueryInterface(
+					  punk,
+					  IID_IMemoryPressure,
+					  (void **)&sink
+					 );
+   if( FAILED( hr ) )
+      return E_NOINTERFACE;
+
+   pthread_mutex_lock( &sinkLock );
+   for( i = 0; ( i < cSinkSlots ) && ( sinks[ i ] != NULL ); i++ )
+      ;
+
+   if( i == cSinkSlots )
+   {
+      cSlots = cSinkSlots ? cSinkSlots * 2 : 8;
+      newSinks = realloc( sinks, cSlots * sizeof( IMemoryPressure * ) );
+      if( newSinks == NULL )
+      {
+	 pthread_mutex_unlock( &sinkLock );
+	 sink -> lpVtbl -> Release( sink );
+	 return E_OUTOFMEMORY;
+      }
+
+      memset( newSinks + cSinkSlots, 0,
+	      ( cSlots - cSinkSlots ) * sizeof( IMemoryPressure * ) );
+      sinks = newSinks;
+      cSinkSlots = cSlots;
+   }
+
+   sinks[ i ] = sink;
+   *pToken = i + 1;
+   pthread_mutex_unlock( &sinkLock );
+
+   return S_OK;
+}
+
+/**
+ * This function revokes an object's registration for memory pressure
+ * notifications, and releases GCOM's reference to it.  A notification
+ * already in progress on another thread may still reach the object.
+ *
+ * @param token
+ * The token returned by gCoRegisterMemoryPressure().
+ *
+ * @returns
+ * S_OK if successful.  E_OBJNOTREG if the token doesn't identify a
+ * registration.
+ *
+ * @see gCoRegisterMemoryPressure
+ */
+
+HRESULT gCoRevokeMemoryPressure( uint32 token )
+{
+   IMemoryPressure *sink = NULL;
+
+   pthread_mutex_lock( &sinkLock );
+   if( ( token != 0 ) && ( token <= cSinkSlots ) )
+   {
+      sink = sinks[ token - 1 ];
+      sinks[ token - 1 ] = NULL;
+   }
+   pthread_mutex_unlock( &sinkLock );
+
+   if( sink == NULL )
+      return E_OBJNOTREG;
+
+   sink -> lpVtbl -> Release( sink );
+   return S_OK;
+}
+
+/**
+ * This function starts the memory pressure monitor, a background thread
+ * which watches the kernel's pressure stall information (PSI) for the
+ * process' cgroup, or the whole system if the cgroup has none, along
+ * with the cgroup's memory.events counters.  When pressure builds, the
+ * monitor notifies the registered IMemoryPressure objects, then
+ * minimizes the task allocator's heap.
+ *
+ * Pressure is graded as follows:
+ *
+ * MEMPRESSURE_LOW		Some tasks stalled on memory for 5% of
+ *				the last two seconds.
+ * MEMPRESSURE_MODERATE		Some tasks stalled for 15% of the last two
+ *				seconds, or the cgroup is being throttled
+ *				at its memory.high limit.
+ * MEMPRESSURE_CRITICAL		All tasks stalled for 10% of the last two
+ *				seconds, or the cgroup hit its memory.max
+ *				limit or ran out of memory.
+ *
+ * The monitor stops automatically when the last call to CoUninitialize()
+ * is made.
+ *
+ * @returns
+ * S_OK if the monitor was started.  S_FALSE if it was already running.
+ * E_NOTSUPPORTED if the kernel provides no pressure information to
+ * watch.  E_OUTOFMEMORY if the thread couldn't be created.
+ *
+ * @see gCoMemoryPressureStop
+ * @see gCoRegisterMemoryPressure
+ */
+
+HRESULT gCoMemoryPressureStart( void )
+{
+   HRESULT hr = S_OK;
+
+   pthread_mutex_lock( &monitorLock );
+   if( monitorRunning )
+      hr = S_FALSE;
+   else
+   {
+      SourcesOpen();
+      if( cSources == 0 )
+	 hr = E_NOTSUPPORTED;
+      else if( pipe2( monitorWake, O_CLOEXEC ) < 0 )
+	 hr = E_OUTOFMEMORY;
+      else
+      {
+	 pollFDs[ 0 ].fd = monitorWake[ 0 ];
+	 pollFDs[ 0 ].events = POLLIN;
+
+	 monitorRunning =
+	    ( pthread_create( &monitorThread, NULL, &Monitor, NULL ) == 0 );
+	 if( !monitorRunning )
+	 {
+	    close( monitorWake[ 0 ] );
+	    close( monitorWake[ 1 ] );
+	    hr = E_OUTOFMEMORY;
+	 }
+      }
+
+      if( FAILED( hr ) )
+	 SourcesClose();
+   }
+   pthread_mutex_unlock( &monitorLock );
+
+   return hr;
+}
+
+/**
+ * This function stops the memory pressure monitor, if it's running.
+ * It waits for a notification in progress to finish, so it must not be
+ * called from within IMemoryPressure::OnMemoryPressure().
+ *
+ * @see gCoMemoryPressureStart
+ */
+
+void gCoMemoryPressureStop( void )
+{
+   pthread_mutex_lock( &monitorLock );
+   if( monitorRunning )
+   {
+      close( monitorWake[ 1 ] );
+      pthread_join( monitorThread, NULL );
+      close( monitorWake[ 0 ] );
+      SourcesClose();
+      monitorRunning = FALSE;
+   }
+   pthread_mutex_unlock( &monitorLock );
+}
+
+/**
+ * This function reports memory pressure on the application's behalf,
+ * exactly as if the monitor had seen it: every registered
+ * IMemoryPressure object is notified, on the calling thread, and then
+ * the task allocator's heap is minimized.  Applications with pressure
+ * signals of their own (a container orchestrator's, say) use this; it
+ * works whether or not the monitor is running.
+ *
+ * @param level
+ * How severe the pressure is.
+ *
+ * @returns
+ * The number of bytes the task allocator returned to the system.
+ *
+ * @see gCoRegisterMemoryPressure
+ * @see gCoTaskMemMinimize
+ */
+
+uint64 gCoMemoryPressureNotify( MEMPRESSURE level )
+{
+   return Dispatch( level );
+}
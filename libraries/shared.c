@@ -0,0 +1,599 @@
+/*
+ * shared.c
+ * GCOM Release 0.3
+ *
+ * Copyright (c) 1999, 2000 Samuel A. Falvo II
+ *
+ * This software is provided 'as-is', without any implied or express warranty.
+ * In no event shall the authors be held liable for damages arising from the
+ * use this software.
+ *
+ * Permission is granted for anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software in a
+ *    product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source
+ *    distribution.
+ */
+
+#define _GNU_SOURCE
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <gcom/gcom.h>
+#include "gcom-config.h"
+#include "alloc-private.h"
+
+/************************************************************************/
+/* Prototypes								*/
+/************************************************************************/
+
+static HRESULT Shared_QueryInterface( IMalloc *, REFIID, void ** );
+static uint32  Shared_AddRef        ( IMalloc * );
+static uint32  Shared_Release       ( IMalloc * );
+static void *  Shared_Alloc         ( IMalloc *, uint32 );
+static void *  Shared_Realloc       ( IMalloc *, void *, uint32 );
+static void    Shared_Free          ( IMalloc *, void * );
+static uint32  Shared_GetSize       ( IMalloc *, void * );
+static int     Shared_DidAlloc      ( IMalloc *, void * );
+static void    Shared_HeapMinimize  ( IMalloc * );
+
+/************************************************************************/
+/* The shared heap							*/
+/************************************************************************/
+
+/*
+ * The MEMCTX_SHARED allocator carves its blocks out of a memfd, mapped
+ * MAP_SHARED.  Any process holding a descriptor for the memfd can map the
+ * same heap, allocate from it and free into it; since each process maps
+ * it at its own address, the heap's own bookkeeping, and the handles we
+ * give clients, are all offsets from the start of the mapping.
+ *
+ * The whole heap is reserved up front.  The memfd is sparse, so pages
+ * only cost memory once they're touched, and the pages inside large free
+ * blocks are punched back out of it.
+ *
+ * Blocks are binned by size class, four classes per power of two, and
+ * are never split or coalesced.  Free blocks of each class are threaded
+ * through their headers onto a list per class.  An allocated block's
+ * header holds its own offset, inverted, where the list link would be;
+ * free list offsets never have their top bits set, so the two can't be
+ * confused, and a stray offset into some block's payload is unlikely to
+ * pass for a header.
+ */
+
+#define SHARED_MAGIC		0x47534850UL	/* 'GSHP' */
+#define SHARED_INUSE(off)	( ~(uint64)(off) )
+#define SHARED_BINS		140
+#define SHARED_MAX_SHIFT	40
+
+typedef struct
+{
+   uint64	size;		/* Size of the payload */
+   uint64	next;		/* Next free block, or SHARED_INUSE( offset ) */
+} SharedBlock;
+
+typedef struct
+{
+   uint32	magic;
+   pthread_mutex_t lock;	/* Process-shared and robust */
+   uint64	size;		/* Bytes reserved for the heap */
+   uint64	top;		/* Offset of space never yet used */
+   uint64	freeList[ SHARED_BINS ];
+} SharedHeap;
+
+#define SHARED_HEAP_OFFSET	( ( sizeof( SharedHeap ) + 63 ) & ~63UL )
+#define SHARED_BLOCK(h,off)	( (SharedBlock *)( (uint8 *)(h) + (off) ) )
+
+static pthread_mutex_t sharedInitLock = PTHREAD_MUTEX_INITIALIZER;
+static SharedHeap * volatile sharedHeap = NULL;
+static int sharedFD = -1;
+
+static const IMallocVtbl SharedMallocVtbl =
+{
+   &Shared_QueryInterface,
+   &Shared_AddRef,
+   &Shared_Release,
+   &Shared_Alloc,
+   &Shared_Realloc,
+   &Shared_Free,
+   &Shared_GetSize,
+   &Shared_DidAlloc,
+   &Shared_HeapMinimize
+};
+
+static const IMalloc SharedMalloc =
+{
+   (IMallocVtbl *)&SharedMallocVtbl
+};
+
+/*
+ * Maps a request size onto its bin, and the size of blocks in that bin.
+ * Requests of 128 bytes or less are rounded to 16 bytes; beyond that,
+ * each power of two is split into four classes.
+ */
+
+static uint32 SharedBin( uint64 cBytes, uint64 *pSize )
+{
+   uint64 step;
+   uint32 shift;
+
+   if( cBytes <= 128 )
+   {
+      if( cBytes == 0 )
+	 cBytes = 1;
+      *pSize = ( cBytes + 15 ) & ~(uint64)15;
+      return (uint32)( ( cBytes - 1 ) >> 4 );
+   }
+
+   shift = 63 - __builtin_clzll( cBytes - 1 );
+   step = (uint64)1 << ( shift - 2 );
+   *pSize = ( cBytes + step - 1 ) & ~( step - 1 );
+
+   return 8 + ( shift - 7 ) * 4 + (uint32)( *pSize / step ) - 5;
+}
+
+/*
+ * A process that died holding the heap lock can't have left more than
+ * one free list half-updated, and every update we make is a single store
+ * once the block is ready, so the heap is fine to carry on with.
+ */
+
+static void SharedLock( SharedHeap *heap )
+{
+   if( pthread_mutex_lock( &heap -> lock ) == EOWNERDEAD )
+      pthread_mutex_consistent( &heap -> lock );
+}
+
+static void SharedUnlock( SharedHeap *heap )
+{
+   pthread_mutex_unlock( &heap -> lock );
+}
+
+static SharedHeap *SharedMap( int fd, uint64 size )
+{
+   void *p;
+
+   p = mmap( NULL, size, PROT_READ | PROT_WRITE,
+	     MAP_SHARED | MAP_NORESERVE, fd, 0 );
+   if( p == MAP_FAILED )
+      return NULL;
+
+   return (SharedHeap *)p;
+}
+
+/*
+ * Creates a brand new shared heap.  Must be called with sharedInitLock
+ * held.
+ */
+
+static SharedHeap *SharedCreate( void )
+{
+   pthread_mutexattr_t attr;
+   SharedHeap *heap;
+   int fd;
+
+   fd = memfd_create( "gcom-shared", MFD_CLOEXEC );
+   if( fd < 0 )
+      return NULL;
+
+   if( ftruncate( fd, SHARED_HEAP_SIZE ) != 0 )
+   {
+      close( fd );
+      return NULL;
+   }
+
+   heap = SharedMap( fd, SHARED_HEAP_SIZE );
+   if( heap == NULL )
+   {
+      close( fd );
+      return NULL;
+   }
+
+   pthread_mutexattr_init( &attr );
+   pthread_mutexattr_setpshared( &attr, PTHREAD_PROCESS_SHARED );
+   pthread_mutexattr_setrobust( &attr, PTHREAD_MUTEX_ROBUST );
+   pthread_mutex_init( &heap -> lock, &attr );
+   pthread_mutexattr_destroy( &attr );
+
+   heap -> size = SHARED_HEAP_SIZE;
+   heap -> top = SHARED_HEAP_OFFSET;
+   memset( heap -> freeList, 0, sizeof( heap -> freeList ) );
+   heap -> magic = SHARED_MAGIC;
+
+   sharedFD = fd;
+   return heap;
+}
+
+/*
+ * Returns this process' shared heap, creating it on first use.
+ */
+
+static SharedHeap *GetSharedHeap( void )
+{
+   SharedHeap *heap = sharedHeap;
+
+   if( heap != NULL )
+      return heap;
+
+   pthread_mutex_lock( &sharedInitLock );
+   heap = sharedHeap;
+   if( heap == NULL )
+   {
+      heap = SharedCreate();
+      sharedHeap = heap;
+   }
+   pthread_mutex_unlock( &sharedInitLock );
+
+   return heap;
+}
+
+/*
+ * Returns the header of a block we handed out, or NULL if pv isn't one.
+ * Besides the in-use tag, the block's size must be that of a bin, and
+ * the block must end within the space carved so far.
+ */
+
+static SharedBlock *SharedBlockOf( SharedHeap *heap, void *pv )
+{
+   uint64 offset, top, size;
+   SharedBlock *b;
+
+   if( ( heap == NULL ) || ( (uint8 *)pv < (uint8 *)heap ) )
+      return NULL;
+
+   offset = (uint8 *)pv - (uint8 *)heap;
+   top = heap -> top;
+   if(
+	 ( offset < SHARED_HEAP_OFFSET + sizeof( SharedBlock ) )
+      || ( offset >= top )
+      || ( ( offset & 15 ) != 0 )
+     )
+      return NULL;
+
+   b = SHARED_BLOCK( heap, offset - sizeof( SharedBlock ) );
+   if(
+	 ( b -> next != SHARED_INUSE( offset - sizeof( SharedBlock ) ) )
+      || ( b -> size == 0 )
+      || ( b -> size > top - offset )
+     )
+      return NULL;
+
+   SharedBin( b -> size, &size );
+   if( size != b -> size )
+      return NULL;
+
+   return b;
+}
+
+/*
+ * The IUnknown methods.  Like the task allocator, the shared allocator
+ * lives as long as the process does, and doesn't count references.
+ */
+
+static
+HRESULT Shared_QueryInterface( IMalloc *self, REFIID riid, void **ppv )
+{
+   HRESULT hr;
+
+   *ppv = NULL;
+   hr = E_NOINTERFACE;
+
+   if( IsEqualIID( riid, IID_IUnknown ) || IsEqualIID( riid, IID_IMalloc ) )
+   {
+      *ppv = self;
+      Shared_AddRef( self );
+      hr = S_OK;
+   }
+
+   return hr;
+}
+
+static
+uint32 Shared_AddRef( IMalloc *self )
+{
+   return 1;
+}
+
+static
+uint32 Shared_Release( IMalloc *self )
+{
+   return 0;
+}
+
+/*
+ * The IMalloc methods.
+ */
+
+static
+void *Shared_Alloc( IMalloc *self, uint32 cBytes )
+{
+   SharedHeap *heap = GetSharedHeap();
+   SharedBlock *b = NULL;
+   uint64 size, offset;
+   uint32 bin;
+
+   if( heap == NULL )
+      return NULL;
+
+   bin = SharedBin( cBytes, &size );
+
+   SharedLock( heap );
+   offset = heap -> freeList[ bin ];
+   if( offset != 0 )
+   {
+      b = SHARED_BLOCK( heap, offset );
+      heap -> freeList[ bin ] = b -> next;
+   }
+   else if( heap -> top + sizeof( SharedBlock ) + size <= heap -> size )
+   {
+      b = SHARED_BLOCK( heap, heap -> top );
+      b -> size = size;
+      heap -> top += sizeof( SharedBlock ) + size;
+   }
+
+   if( b != NULL )
+      b -> next = SHARED_INUSE( (uint8 *)b - (uint8 *)heap );
+   SharedUnlock( heap );
+
+   return ( b != NULL ) ? (void *)( b + 1 ) : NULL;
+}
+
+static
+void *Shared_Realloc( IMalloc *self, void *pv, uint32 cBytes )
+{
+   SharedBlock *b;
+   void *pvNew;
+
+   if( pv == NULL )
+      return Shared_Alloc( self, cBytes );
+
+   b = (SharedBlock *)pv - 1;
+   if( cBytes <= b -> size )
+      return pv;
+
+   pvNew = Shared_Alloc( self, cBytes );
+   if( pvNew != NULL )
+   {
+      memcpy( pvNew, pv, b -> size );
+      Shared_Free( self, pv );
+   }
+
+   return pvNew;
+}
+
+/*
+ * The pages wholly inside a large free block are punched out of the
+ * memfd, so they stop costing memory in every process mapping the heap.
+ * The first page holds the block header, and stays.
+ */
+
+static
+void Shared_Free( IMalloc *self, void *pv )
+{
+   SharedHeap *heap = sharedHeap;
+   uintptr_t pageMask = (uintptr_t)sysconf( _SC_PAGESIZE ) - 1;
+   SharedBlock *b;
+   uint8 *first, *last;
+   uint64 size;
+   uint32 bin;
+
+   if( ( pv == NULL ) || ( heap == NULL ) )
+      return;
+
+   b = (SharedBlock *)pv - 1;
+   bin = SharedBin( b -> size, &size );
+
+   first = (uint8 *)( ( (uintptr_t)pv + pageMask ) & ~pageMask );
+   last = (uint8 *)( ( (uintptr_t)pv + b -> size ) & ~pageMask );
+   if( last > first )
+      madvise( first, last - first, MADV_REMOVE );
+
+   SharedLock( heap );
+   b -> next = heap -> freeList[ bin ];
+   heap -> freeList[ bin ] = (uint8 *)b - (uint8 *)heap;
+   SharedUnlock( heap );
+}
+
+static
+uint32 Shared_GetSize( IMalloc *self, void *pv )
+{
+   return (uint32)( (SharedBlock *)pv - 1 ) -> size;
+}
+
+static
+int Shared_DidAlloc( IMalloc *self, void *pv )
+{
+   return SharedBlockOf( sharedHeap, pv ) != NULL;
+}
+
+static
+void Shared_HeapMinimize( IMalloc *self )
+{
+   /* Do nothing -- large blocks are punched out as they're freed. */
+}
+
+/************************************************************************/
+/* Internal interface, used by alloc.c					*/
+/************************************************************************/
+
+IMalloc *SharedMallocGet( void )
+{
+   if( GetSharedHeap() == NULL )
+      return NULL;
+
+   return (IMalloc *)&SharedMalloc;
+}
+
+/*
+ * Called on the last CoUninitialize().  Blocks other processes still
+ * hold stay valid; only our mapping of the heap goes away.
+ */
+
+void SharedMallocUninitialize( void )
+{
+   pthread_mutex_lock( &sharedInitLock );
+   if( sharedHeap != NULL )
+   {
+      munmap( sharedHeap, sharedHeap -> size );
+      close( sharedFD );
+      sharedHeap = NULL;
+      sharedFD = -1;
+   }
+   pthread_mutex_unlock( &sharedInitLock );
+}
+
+/************************************************************************/
+/* Public Interface							*/
+/************************************************************************/
+
+/**
+ * This function returns a file descriptor for the memfd backing this
+ * process' shared heap (see CoGetMalloc()), creating the heap if needed.
+ * Hand the descriptor to a cooperating process, for example over a UNIX
+ * domain socket, and have it call gCoSharedMemAttach() with it; from
+ * then on, both processes allocate from the same heap.
+ *
+ * The descriptor is closed on exec().  It remains owned by GCOM; do not
+ * close it.
+ *
+ * @returns
+ * The file descriptor, or -1 if the shared heap couldn't be created.
+ *
+ * @see gCoSharedMemAttach
+ */
+
+int gCoSharedMemGetFD( void )
+{
+   if( GetSharedHeap() == NULL )
+      return -1;
+
+   return sharedFD;
+}
+
+/**
+ * This function makes the shared heap in the given memfd, as returned by
+ * gCoSharedMemGetFD() in another process, this process' shared heap.  It
+ * must be called before this process first uses its shared allocator.
+ *
+ * @param fd
+ * A file descriptor for the other process' shared heap.  On success, GCOM
+ * takes ownership of it.
+ *
+ * @returns
+ * S_OK if successful.  E_INVALIDARG if fd doesn't refer to a GCOM shared
+ * heap.  E_UNEXPECTED if this process already has a shared heap.
+ * E_OUTOFMEMORY if the heap couldn't be mapped.
+ *
+ * @see gCoSharedMemGetFD
+ */
+
+HRESULT gCoSharedMemAttach( int fd )
+{
+   SharedHeap *heap;
+   struct stat st;
+   HRESULT hr = S_OK;
+
+   if(
+	 ( fstat( fd, &st ) != 0 )
+      || ( st.st_size < 0 )
+      || ( (uint64)st.st_size < SHARED_HEAP_OFFSET )
+     )
+      return E_INVALIDARG;
+
+   pthread_mutex_lock( &sharedInitLock );
+   if( sharedHeap != NULL )
+      hr = E_UNEXPECTED;
+   else
+   {
+      heap = SharedMap( fd, st.st_size );
+      if( heap == NULL )
+	 hr = E_OUTOFMEMORY;
+      else if(
+		( heap -> magic != SHARED_MAGIC )
+	     || ( heap -> size != (uint64)st.st_size )
+	     )
+      {
+	 munmap( heap, st.st_size );
+	 hr = E_INVALIDARG;
+      }
+      else
+      {
+	 sharedFD = fd;
+	 sharedHeap = heap;
+      }
+   }
+   pthread_mutex_unlock( &sharedInitLock );
+
+   return hr;
+}
+
+/**
+ * This function converts a block allocated from the shared heap into a
+ * handle, which any process sharing the heap can turn back into a pointer
+ * to the very same memory with gCoSharedMemFromHandle().  Handles are
+ * plain integers, so they can be passed across process boundaries by any
+ * means at all.
+ *
+ * @param pv
+ * A block allocated by the MEMCTX_SHARED allocator.
+ *
+ * @returns
+ * The handle for the block, or 0 if pv isn't a block from the shared
+ * heap.
+ *
+ * @see gCoSharedMemFromHandle
+ */
+
+HSHAREDMEM gCoSharedMemToHandle( void *pv )
+{
+   SharedHeap *heap = sharedHeap;
+
+   if( SharedBlockOf( heap, pv ) == NULL )
+      return 0;
+
+   return (uint8 *)pv - (uint8 *)heap;
+}
+
+/**
+ * This function converts a handle made by gCoSharedMemToHandle(), in this
+ * process or another one sharing the heap, back into a pointer.
+ *
+ * @param hMem
+ * The handle to convert.
+ *
+ * @returns
+ * A pointer to the block, or NULL if the handle doesn't refer to a block
+ * currently allocated from the shared heap.
+ *
+ * @see gCoSharedMemToHandle
+ */
+
+void *gCoSharedMemFromHandle( HSHAREDMEM hMem )
+{
+   SharedHeap *heap = GetSharedHeap();
+   void *pv;
+
+   if( ( heap == NULL ) || ( hMem >= heap -> size ) )
+      return NULL;
+
+   pv = (uint8 *)heap + hMem;
+   if( SharedBlockOf( heap, pv ) == NULL )
+      return NULL;
+
+   return pv;
+}
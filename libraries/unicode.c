@@ -26,8 +26,13 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <gcom/gcom.h>
 
+#if defined( __SSE2__ )
+#include <immintrin.h>
+#endif
+
 /**
  * This function converts a Unicode string into an ASCII/UTF-8 string.
  * 
@@ -43,20 +48,31 @@
  * This is the maximum number of bytes in the output buffer pointed to by
  * pstr2.  This function converts up to (bufSize-1) bytes of textual data,
  * thus guaranteeing at least one NULL byte at the very end of the buffer.
+ * A string too long for the buffer is cut short between characters.
  * 
  * @returns
  * S_OK if the string converted correctly.  Otherwise, E_INVALIDARG is
  * returned if an illegal character is returned.
  * 
  * @see gCoAsciiStringToUnicode
+ * @see gCoUnicodeStringToUTF8
  */
 
 HRESULT gCoUnicodeStringToAscii( wchar *pstr1, char *pstr2, uint32 bufSize )
 {
-   memset( pstr2, 0, bufSize );
-   if( wcstombs( pstr2, pstr1, bufSize ) == -1 )
-	   return E_INVALIDARG;
-   
+   uint32f cb;
+
+   if( bufSize == 0 )
+      return E_INVALIDARG;
+
+   if( FAILED( gCoUCS4ToUTF8( pstr1, gCoUnicodeStringLength( pstr1 ),
+			      pstr2, bufSize - 1, &cb ) ) )
+   {
+      pstr2[0] = 0;
+      return E_INVALIDARG;
+   }
+
+   pstr2[ cb ] = 0;
    return S_OK;
 }
 
@@ -81,14 +97,24 @@ HRESULT gCoUnicodeStringToAscii( wchar *pstr1, char *pstr2, uint32 bufSize )
  * returned if an illegal character is returned.
  * 
  * @see gCoUnicodeStringToAscii
+ * @see gCoUTF8StringToUnicode
  */
 
 HRESULT gCoAsciiStringToUnicode( char *pstr1, wchar *pstr2, uint32 chars )
 {
-   memset( pstr2, 0, chars * sizeof( wchar ) );
-   if( mbstowcs( pstr2, pstr1, chars ) == -1 )
-	   return E_INVALIDARG;
-   
+   uint32f cch;
+
+   if( chars == 0 )
+      return E_INVALIDARG;
+
+   if( FAILED( gCoUTF8ToUCS4( pstr1, (uint32)strlen( pstr1 ),
+			      pstr2, chars - 1, &cch ) ) )
+   {
+      pstr2[0] = 0;
+      return E_INVALIDARG;
+   }
+
+   pstr2[ cch ] = 0;
    return S_OK;
 }
 
@@ -220,3 +246,997 @@ void gCoUnicodeStringConcatenate( wchar *s1, wchar *s2 )
 {
    wcscat( s1, s2 );
 }
+
+/************************************************************************/
+/* UTF-8, UCS-4 and UTF-16						*/
+/************************************************************************/
+
+/*
+ * Unlike the C library's conversions, these always speak UTF-8, whatever
+ * the locale.  Surrogates and values beyond U+10FFFF are rejected, as
+ * are malformed and overlong UTF-8 sequences and unpaired UTF-16
+ * surrogates.
+ *
+ * Most text passing through GCOM is ASCII, so each conversion hands runs
+ * of ASCII to a vector kernel, which converts them sixteen or thirty-two
+ * units at a time, and handles everything else a character at a time.
+ * When a kernel finds only a short run, as with the odd space or digit
+ * amid other text, the next few units are done without it; see
+ * NextKernelTry().  The kernels take a NULL output buffer to mean that
+ * only the length is wanted.
+ */
+
+#define ASCII_BACKOFF		16
+#define MAX_ASCII_BACKOFF	1024
+
+typedef struct AsciiKernels
+{
+   uint32	(*utf8ToUCS4)( const uint8 *, uint32, wchar * );
+   uint32	(*ucs4ToUTF8)( const wchar *, uint32, uint8 * );
+   uint32	(*utf8ToUTF16)( const uint8 *, uint32, uint16 * );
+   uint32	(*utf16ToUTF8)( const uint16 *, uint32, uint8 * );
+} AsciiKernels;
+
+#if defined( __SSE2__ )
+
+/*
+ * Each kernel converts up to n units of input, stopping at the first
+ * vector holding anything but ASCII, and returns how many it converted.
+ * The caller sees that there's room for n units of output.
+ */
+
+static uint32 UTF8ToUCS4SSE2( const uint8 *ps, uint32 n, wchar *pd )
+{
+   const __m128i zero = _mm_setzero_si128();
+   __m128i v, lo, hi;
+   uint32 i = 0, mask;
+
+   for( ; i + 16 <= n; i += 16 )
+   {
+      v = _mm_loadu_si128( (const __m128i *)&ps[i] );
+      mask = (uint32)_mm_movemask_epi8( v );
+
+      if( pd != NULL )
+      {
+	 lo = _mm_unpacklo_epi8( v, zero );
+	 hi = _mm_unpackhi_epi8( v, zero );
+	 _mm_storeu_si128( (__m128i *)&pd[ i ], _mm_unpacklo_epi16( lo, zero ) );
+	 _mm_storeu_si128( (__m128i *)&pd[ i + 4 ], _mm_unpackhi_epi16( lo, zero ) );
+	 _mm_storeu_si128( (__m128i *)&pd[ i + 8 ], _mm_unpacklo_epi16( hi, zero ) );
+	 _mm_storeu_si128( (__m128i *)&pd[ i + 12 ], _mm_unpackhi_epi16( hi, zero ) );
+      }
+
+      /* The characters after the first non-ASCII byte get redone */
+
+      if( mask != 0 )
+	 return i + (uint32)__builtin_ctz( mask );
+   }
+
+   return i;
+}
+
+static uint32 UCS4ToUTF8SSE2( const wchar *ps, uint32 n, uint8 *pd )
+{
+   const __m128i high = _mm_set1_epi32( ~0x7F );
+   __m128i a, b, c, d;
+   uint32 i = 0;
+
+   for( ; i + 16 <= n; i += 16 )
+   {
+      a = _mm_loadu_si128( (const __m128i *)&ps[ i ] );
+      b = _mm_loadu_si128( (const __m128i *)&ps[ i + 4 ] );
+      c = _mm_loadu_si128( (const __m128i *)&ps[ i + 8 ] );
+      d = _mm_loadu_si128( (const __m128i *)&ps[ i + 12 ] );
+
+      if( _mm_movemask_epi8( _mm_cmpeq_epi32(
+	     _mm_and_si128( _mm_or_si128( _mm_or_si128( a, b ), _mm_or_si128( c, d ) ), high ),
+	     _mm_setzero_si128() ) ) != 0xFFFF )
+	 break;
+
+      if( pd != NULL )
+	 _mm_storeu_si128( (__m128i *)&pd[i],
+			   _mm_packus_epi16( _mm_packs_epi32( a, b ), _mm_packs_epi32( c, d ) ) );
+   }
+
+   return i;
+}
+
+static uint32 UTF8ToUTF16SSE2( const uint8 *ps, uint32 n, uint16 *pd )
+{
+   const __m128i zero = _mm_setzero_si128();
+   __m128i v;
+   uint32 i = 0, mask;
+
+   for( ; i + 16 <= n; i += 16 )
+   {
+      v = _mm_loadu_si128( (const __m128i *)&ps[i] );
+      mask = (uint32)_mm_movemask_epi8( v );
+
+      if( pd != NULL )
+      {
+	 _mm_storeu_si128( (__m128i *)&pd[ i ], _mm_unpacklo_epi8( v, zero ) );
+	 _mm_storeu_si128( (__m128i *)&pd[ i + 8 ], _mm_unpackhi_epi8( v, zero ) );
+      }
+
+      if( mask != 0 )
+	 return i + (uint32)__builtin_ctz( mask );
+   }
+
+   return i;
+}
+
+static uint32 UTF16ToUTF8SSE2( const uint16 *ps, uint32 n, uint8 *pd )
+{
+   const __m128i high = _mm_set1_epi16( (short)0xFF80 );
+   __m128i a, b;
+   uint32 i = 0;
+
+   for( ; i + 16 <= n; i += 16 )
+   {
+      a = _mm_loadu_si128( (const __m128i *)&ps[ i ] );
+      b = _mm_loadu_si128( (const __m128i *)&ps[ i + 8 ] );
+
+      if( _mm_movemask_epi8( _mm_cmpeq_epi16(
+	     _mm_and_si128( _mm_or_si128( a, b ), high ),
+	     _mm_setzero_si128() ) ) != 0xFFFF )
+	 break;
+
+      if( pd != NULL )
+	 _mm_storeu_si128( (__m128i *)&pd[i], _mm_packus_epi16( a, b ) );
+   }
+
+   return i;
+}
+
+static const AsciiKernels sse2Kernels =
+{
+   UTF8ToUCS4SSE2, UCS4ToUTF8SSE2, UTF8ToUTF16SSE2, UTF16ToUTF8SSE2
+};
+
+/*
+ * The same, thirty-two units at a time, for processors with AVX2.  The
+ * 256-bit pack instructions work within 128-bit lanes, so their results
+ * are put back in order with a permute.  Shorter runs are left to the
+ * caller rather than the SSE2 kernels, since mixing the two costs more
+ * than it saves.
+ */
+
+__attribute__(( target( "avx2" ) ))
+static uint32 UTF8ToUCS4AVX2( const uint8 *ps, uint32 n, wchar *pd )
+{
+   __m256i v;
+   uint32 i = 0, mask, j;
+
+   for( ; i + 32 <= n; i += 32 )
+   {
+      v = _mm256_loadu_si256( (const __m256i *)&ps[i] );
+      mask = (uint32)_mm256_movemask_epi8( v );
+
+      if( pd != NULL )
+	 for( j = 0; j < 32; j += 8 )
+	    _mm256_storeu_si256( (__m256i *)&pd[ i + j ],
+				 _mm256_cvtepu8_epi32( _mm_loadl_epi64( (const __m128i *)&ps[ i + j ] ) ) );
+
+      if( mask != 0 )
+	 return i + (uint32)__builtin_ctz( mask );
+   }
+
+   return i;
+}
+
+__attribute__(( target( "avx2" ) ))
+static uint32 UCS4ToUTF8AVX2( const wchar *ps, uint32 n, uint8 *pd )
+{
+   const __m256i high = _mm256_set1_epi32( ~0x7F );
+   const __m256i order = _mm256_setr_epi32( 0, 4, 1, 5, 2, 6, 3, 7 );
+   __m256i a, b, c, d;
+   uint32 i = 0;
+
+   for( ; i + 32 <= n; i += 32 )
+   {
+      a = _mm256_loadu_si256( (const __m256i *)&ps[ i ] );
+      b = _mm256_loadu_si256( (const __m256i *)&ps[ i + 8 ] );
+      c = _mm256_loadu_si256( (const __m256i *)&ps[ i + 16 ] );
+      d = _mm256_loadu_si256( (const __m256i *)&ps[ i + 24 ] );
+
+      if( !_mm256_testz_si256( _mm256_or_si256( _mm256_or_si256( a, b ),
+						_mm256_or_si256( c, d ) ), high ) )
+	 break;
+
+      if( pd != NULL )
+	 _mm256_storeu_si256( (__m256i *)&pd[i],
+			      _mm256_permutevar8x32_epi32(
+				 _mm256_packus_epi16( _mm256_packs_epi32( a, b ),
+						      _mm256_packs_epi32( c, d ) ),
+				 order ) );
+   }
+
+   return i;
+}
+
+__attribute__(( target( "avx2" ) ))
+static uint32 UTF8ToUTF16AVX2( const uint8 *ps, uint32 n, uint16 *pd )
+{
+   __m256i v;
+   uint32 i = 0, mask;
+
+   for( ; i + 32 <= n; i += 32 )
+   {
+      v = _mm256_loadu_si256( (const __m256i *)&ps[i] );
+      mask = (uint32)_mm256_movemask_epi8( v );
+
+      if( pd != NULL )
+      {
+	 _mm256_storeu_si256( (__m256i *)&pd[ i ],
+			      _mm256_cvtepu8_epi16( _mm256_castsi256_si128( v ) ) );
+	 _mm256_storeu_si256( (__m256i *)&pd[ i + 16 ],
+			      _mm256_cvtepu8_epi16( _mm256_extracti128_si256( v, 1 ) ) );
+      }
+
+      if( mask != 0 )
+	 return i + (uint32)__builtin_ctz( mask );
+   }
+
+   return i;
+}
+
+__attribute__(( target( "avx2" ) ))
+static uint32 UTF16ToUTF8AVX2( const uint16 *ps, uint32 n, uint8 *pd )
+{
+   const __m256i high = _mm256_set1_epi16( (short)0xFF80 );
+   __m256i a, b;
+   uint32 i = 0;
+
+   for( ; i + 32 <= n; i += 32 )
+   {
+      a = _mm256_loadu_si256( (const __m256i *)&ps[ i ] );
+      b = _mm256_loadu_si256( (const __m256i *)&ps[ i + 16 ] );
+
+      if( !_mm256_testz_si256( _mm256_or_si256( a, b ), high ) )
+	 break;
+
+      if( pd != NULL )
+	 _mm256_storeu_si256( (__m256i *)&pd[i],
+			      _mm256_permute4x64_epi64( _mm256_packus_epi16( a, b ), 0xD8 ) );
+   }
+
+   return i;
+}
+
+static const AsciiKernels avx2Kernels =
+{
+   UTF8ToUCS4AVX2, UCS4ToUTF8AVX2, UTF8ToUTF16AVX2, UTF16ToUTF8AVX2
+};
+
+#else
+
+/* Without SIMD, ASCII gets no special treatment. */
+
+static uint32 NoAsciiRun( const void *ps, uint32 n, void *pd )
+{
+   return 0;
+}
+
+static const AsciiKernels scalarKernels =
+{
+   (void *)NoAsciiRun, (void *)NoAsciiRun, (void *)NoAsciiRun, (void *)NoAsciiRun
+};
+
+#endif
+
+static const AsciiKernels *kernels = NULL;
+
+static const AsciiKernels *GetKernels( void )
+{
+   if( kernels == NULL )
+   {
+#if defined( __SSE2__ )
+      __builtin_cpu_init();
+      kernels = __builtin_cpu_supports( "avx2" ) ? &avx2Kernels : &sse2Kernels;
+#else
+      kernels = &scalarKernels;
+#endif
+   }
+
+   return kernels;
+}
+
+/**
+ * Decides where to try a kernel again, after it converted n units and
+ * left off at unit i.  A long run means the text is mostly ASCII, so the
+ * next ASCII unit will do.  Each short run in a row doubles the wait,
+ * since in text that merely has some ASCII in it, a kernel costs more
+ * than it saves.
+ */
+
+static inline uint32 NextKernelTry( uint32 i, uint32 n, uint32 *pBackoff )
+{
+   if( n >= ASCII_BACKOFF )
+   {
+      *pBackoff = ASCII_BACKOFF;
+      return i;
+   }
+
+   i += *pBackoff;
+   if( *pBackoff < MAX_ASCII_BACKOFF )
+      *pBackoff *= 2;
+
+   return i;
+}
+
+/**
+ * Decodes one character from UTF-8.
+ *
+ * @returns
+ * The number of bytes it took, with the character in *pc, or zero if
+ * the cb bytes at pb don't start with a well-formed character.
+ */
+
+static inline uint32 DecodeUTF8( const uint8 *pb, uint32 cb, wchar *pc )
+{
+   wchar c;
+
+   if( pb[0] < 0x80 )
+   {
+      *pc = pb[0];
+      return 1;
+   }
+
+   if( ( pb[0] >= 0xC2 ) && ( pb[0] <= 0xDF ) )
+   {
+      if( ( cb < 2 ) || ( ( pb[1] & 0xC0 ) != 0x80 ) )
+	 return 0;
+
+      *pc = ( ( pb[0] & 0x1F ) << 6 ) | ( pb[1] & 0x3F );
+      return 2;
+   }
+
+   if( ( pb[0] & 0xF0 ) == 0xE0 )
+   {
+      if( ( cb < 3 ) ||
+	  ( ( pb[1] & 0xC0 ) != 0x80 ) || ( ( pb[2] & 0xC0 ) != 0x80 ) )
+	 return 0;
+
+      c = ( ( pb[0] & 0x0F ) << 12 ) | ( ( pb[1] & 0x3F ) << 6 ) | ( pb[2] & 0x3F );
+      if( ( c < 0x800 ) || ( ( c >= 0xD800 ) && ( c <= 0xDFFF ) ) )
+	 return 0;
+
+      *pc = c;
+      return 3;
+   }
+
+   if( ( pb[0] >= 0xF0 ) && ( pb[0] <= 0xF4 ) )
+   {
+      if( ( cb < 4 ) ||
+	  ( ( pb[1] & 0xC0 ) != 0x80 ) || ( ( pb[2] & 0xC0 ) != 0x80 ) ||
+	  ( ( pb[3] & 0xC0 ) != 0x80 ) )
+	 return 0;
+
+      c = ( ( pb[0] & 0x07 ) << 18 ) | ( ( pb[1] & 0x3F ) << 12 ) |
+	  ( ( pb[2] & 0x3F ) << 6 ) | ( pb[3] & 0x3F );
+      if( ( c < 0x10000 ) || ( c > 0x10FFFF ) )
+	 return 0;
+
+      *pc = c;
+      return 4;
+   }
+
+   return 0;
+}
+
+/**
+ * Encodes one character as UTF-8.  Characters below U+0800, which make
+ * up nearly all text in European languages, are done without branches,
+ * so mixing them with ASCII doesn't cost mispredictions.
+ *
+ * @returns
+ * The bytes of the encoding, the first in the low eight bits, with the
+ * length in *pcb; or zero in *pcb if c isn't a Unicode character.
+ */
+
+static inline uint32 EncodeUTF8( wchar c, uint32 *pcb )
+{
+   uint32 multi;
+
+   if( c < 0x800 )
+   {
+      multi = 0 - (uint32)( c >= 0x80 );
+      *pcb = 1 - multi;
+      return ( c & ~multi ) |
+	     ( ( 0x80C0 | ( c >> 6 ) | ( ( c & 0x3F ) << 8 ) ) & multi );
+   }
+
+   if( c < 0x10000 )
+   {
+      *pcb = ( ( c >= 0xD800 ) && ( c <= 0xDFFF ) ) ? 0 : 3;
+      return 0x8080E0 | ( c >> 12 ) | ( ( ( c >> 6 ) & 0x3F ) << 8 ) |
+	     ( ( c & 0x3F ) << 16 );
+   }
+
+   *pcb = ( c <= 0x10FFFF ) ? 4 : 0;
+   return 0x808080F0 | ( c >> 18 ) | ( ( ( c >> 12 ) & 0x3F ) << 8 ) |
+	  ( ( ( c >> 6 ) & 0x3F ) << 16 ) | ( ( c & 0x3F ) << 24 );
+}
+
+/**
+ * Stores an encoding from EncodeUTF8(), cb bytes long, where there are
+ * cbRoom bytes of room.  Given the room, all four bytes are stored, as
+ * that's quicker than storing just the ones needed.
+ */
+
+static inline void StoreUTF8( uint8 *pb, uint32 bytes, uint32 cb, uint32 cbRoom )
+{
+   uint32 i;
+
+   if( cbRoom >= 4 )
+   {
+      pb[0] = (uint8)bytes;
+      pb[1] = (uint8)( bytes >> 8 );
+      pb[2] = (uint8)( bytes >> 16 );
+      pb[3] = (uint8)( bytes >> 24 );
+      return;
+   }
+
+   for( i = 0; i < cb; i++, bytes >>= 8 )
+      pb[i] = (uint8)bytes;
+}
+
+/**
+ * This function converts UTF-8 to UCS-4, the form of Unicode held in a
+ * wchar.  Neither string need be NULL-terminated; a NULL in the input
+ * is converted like any other character.
+ *
+ * @param ps
+ * The UTF-8 text to convert.
+ *
+ * @param cb
+ * Its length in bytes.
+ *
+ * @param pd
+ * The buffer for the converted text, or NULL to just find its length.
+ *
+ * @param cchMax
+ * The size of the buffer, in characters.  Ignored if pd is NULL.
+ *
+ * @param pcch
+ * Receives the number of characters converted.
+ *
+ * @returns
+ * S_OK if all the text was converted.  S_FALSE if the buffer filled
+ * up first; as many whole characters as fit are converted.  E_INVALIDARG
+ * if the text isn't well-formed UTF-8, in which case *pcch tells how
+ * many characters were good.
+ *
+ * @see gCoUCS4ToUTF8
+ */
+
+HRESULT gCoUTF8ToUCS4(
+		      const char *ps,
+		      uint32 cb,
+		      wchar *pd,
+		      uint32 cchMax,
+		      uint32f *pcch
+		     )
+{
+   const AsciiKernels *k = GetKernels();
+   const uint8 *pb = (const uint8 *)ps;
+   uint32 i = 0, o = 0, n, cbChar, iRetry = 0, backoff = ASCII_BACKOFF;
+   wchar c;
+
+   if( pd == NULL )
+      cchMax = 0xFFFFFFFF;
+
+   while( i < cb )
+   {
+      if( o == cchMax )
+      {
+	 *pcch = o;
+	 return S_FALSE;
+      }
+
+      if( ( i >= iRetry ) && ( pb[i] < 0x80 ) )
+      {
+	 n = ( cb - i < cchMax - o ) ? cb - i : cchMax - o;
+	 n = k -> utf8ToUCS4( &pb[i], n, pd ? &pd[o] : NULL );
+	 i += n;
+	 o += n;
+	 iRetry = NextKernelTry( i, n, &backoff );
+	 if( ( i == cb ) || ( o == cchMax ) )
+	    continue;
+      }
+
+      cbChar = DecodeUTF8( &pb[i], cb - i, &c );
+      if( cbChar == 0 )
+      {
+	 *pcch = o;
+	 return E_INVALIDARG;
+      }
+
+      if( pd != NULL )
+	 pd[o] = c;
+
+      i += cbChar;
+      o++;
+   }
+
+   *pcch = o;
+   return S_OK;
+}
+
+/**
+ * This function converts UCS-4 to UTF-8.  Neither string need be
+ * NULL-terminated.
+ *
+ * @param ps
+ * The text to convert.
+ *
+ * @param cch
+ * Its length in characters.
+ *
+ * @param pd
+ * The buffer for the converted text, or NULL to just find its length.
+ *
+ * @param cbMax
+ * The size of the buffer, in bytes.  Ignored if pd is NULL.
+ *
+ * @param pcb
+ * Receives the number of bytes produced.
+ *
+ * @returns
+ * S_OK if all the text was converted.  S_FALSE if the buffer filled
+ * up first; as many whole characters as fit are converted.  E_INVALIDARG
+ * if the text holds something that isn't a Unicode character.
+ *
+ * @see gCoUTF8ToUCS4
+ */
+
+HRESULT gCoUCS4ToUTF8(
+		      const wchar *ps,
+		      uint32 cch,
+		      char *pd,
+		      uint32 cbMax,
+		      uint32f *pcb
+		     )
+{
+   const AsciiKernels *k = GetKernels();
+   uint8 *pb = (uint8 *)pd;
+   uint32 i = 0, o = 0, n, cbChar, bytes, iRetry = 0, backoff = ASCII_BACKOFF;
+
+   if( pd == NULL )
+      cbMax = 0xFFFFFFFF;
+
+   while( i < cch )
+   {
+      if( ( i >= iRetry ) && ( ps[i] < 0x80 ) )
+      {
+	 n = ( cch - i < cbMax - o ) ? cch - i : cbMax - o;
+	 n = k -> ucs4ToUTF8( &ps[i], n, pb ? &pb[o] : NULL );
+	 i += n;
+	 o += n;
+	 iRetry = NextKernelTry( i, n, &backoff );
+	 if( i == cch )
+	    break;
+      }
+
+      /*
+       * With room for four bytes a character, the buffer can't fill, so
+       * the characters are taken a run at a time without checking.
+       */
+
+      if( pb != NULL )
+      {
+	 n = ( cbMax - o ) / 4;
+	 if( n > cch - i )
+	    n = cch - i;
+
+	 for( ; n > 0; n--, i++ )
+	 {
+	    if( ps[i] < 0x80 )
+	    {
+	       if( i >= iRetry )
+		  break;
+
+	       pb[o++] = (uint8)ps[i];
+	       continue;
+	    }
+
+	    bytes = EncodeUTF8( ps[i], &cbChar );
+	    if( cbChar == 0 )
+	    {
+	       *pcb = o;
+	       return E_INVALIDARG;
+	    }
+
+	    StoreUTF8( &pb[o], bytes, cbChar, 4 );
+	    o += cbChar;
+	 }
+
+	 if( ( n > 0 ) || ( i == cch ) )
+	    continue;
+      }
+
+      bytes = EncodeUTF8( ps[i], &cbChar );
+      if( cbChar == 0 )
+      {
+	 *pcb = o;
+	 return E_INVALIDARG;
+      }
+
+      if( cbMax - o < cbChar )
+      {
+	 *pcb = o;
+	 return S_FALSE;
+      }
+
+      if( pb != NULL )
+	 StoreUTF8( &pb[o], bytes, cbChar, cbMax - o );
+
+      i++;
+      o += cbChar;
+   }
+
+   *pcb = o;
+   return S_OK;
+}
+
+/**
+ * This function converts UTF-8 to UTF-16.  Neither string need be
+ * NULL-terminated.  Characters beyond U+FFFF take two units each, as a
+ * surrogate pair.
+ *
+ * @param ps
+ * The UTF-8 text to convert.
+ *
+ * @param cb
+ * Its length in bytes.
+ *
+ * @param pd
+ * The buffer for the converted text, or NULL to just find its length.
+ *
+ * @param cchMax
+ * The size of the buffer, in 16-bit units.  Ignored if pd is NULL.
+ *
+ * @param pcch
+ * Receives the number of units produced.
+ *
+ * @returns
+ * As for gCoUTF8ToUCS4().
+ *
+ * @see gCoUTF16ToUTF8
+ */
+
+HRESULT gCoUTF8ToUTF16(
+		       const char *ps,
+		       uint32 cb,
+		       uint16 *pd,
+		       uint32 cchMax,
+		       uint32f *pcch
+		      )
+{
+   const AsciiKernels *k = GetKernels();
+   const uint8 *pb = (const uint8 *)ps;
+   uint32 i = 0, o = 0, n, cbChar, iRetry = 0, backoff = ASCII_BACKOFF;
+   wchar c;
+
+   if( pd == NULL )
+      cchMax = 0xFFFFFFFF;
+
+   while( i < cb )
+   {
+      if( ( i >= iRetry ) && ( pb[i] < 0x80 ) )
+      {
+	 n = ( cb - i < cchMax - o ) ? cb - i : cchMax - o;
+	 n = k -> utf8ToUTF16( &pb[i], n, pd ? &pd[o] : NULL );
+	 i += n;
+	 o += n;
+	 iRetry = NextKernelTry( i, n, &backoff );
+	 if( i == cb )
+	    break;
+      }
+
+      cbChar = DecodeUTF8( &pb[i], cb - i, &c );
+      if( cbChar == 0 )
+      {
+	 *pcch = o;
+	 return E_INVALIDARG;
+      }
+
+      if( cchMax - o < ( ( c < 0x10000 ) ? 1 : 2 ) )
+      {
+	 *pcch = o;
+	 return S_FALSE;
+      }
+
+      if( c < 0x10000 )
+      {
+	 if( pd != NULL )
+	    pd[o] = (uint16)c;
+	 o++;
+      }
+      else
+      {
+	 if( pd != NULL )
+	 {
+	    pd[o] = (uint16)( 0xD800 | ( ( c - 0x10000 ) >> 10 ) );
+	    pd[o+1] = (uint16)( 0xDC00 | ( c & 0x3FF ) );
+	 }
+	 o += 2;
+      }
+
+      i += cbChar;
+   }
+
+   *pcch = o;
+   return S_OK;
+}
+
+/**
+ * This function converts UTF-16 to UTF-8.  Neither string need be
+ * NULL-terminated.
+ *
+ * @param ps
+ * The UTF-16 text to convert.
+ *
+ * @param cch
+ * Its length in 16-bit units.
+ *
+ * @param pd
+ * The buffer for the converted text, or NULL to just find its length.
+ *
+ * @param cbMax
+ * The size of the buffer, in bytes.  Ignored if pd is NULL.
+ *
+ * @param pcb
+ * Receives the number of bytes produced.
+ *
+ * @returns
+ * As for gCoUCS4ToUTF8().  A surrogate without its partner counts as
+ * something that isn't a character.
+ *
+ * @see gCoUTF8ToUTF16
+ */
+
+HRESULT gCoUTF16ToUTF8(
+		       const uint16 *ps,
+		       uint32 cch,
+		       char *pd,
+		       uint32 cbMax,
+		       uint32f *pcb
+		      )
+{
+   const AsciiKernels *k = GetKernels();
+   uint8 *pb = (uint8 *)pd;
+   uint32 i = 0, o = 0, n, cbChar, cchChar, bytes, iRetry = 0, backoff = ASCII_BACKOFF;
+   wchar c;
+
+   if( pd == NULL )
+      cbMax = 0xFFFFFFFF;
+
+   while( i < cch )
+   {
+      if( ( i >= iRetry ) && ( ps[i] < 0x80 ) )
+      {
+	 n = ( cch - i < cbMax - o ) ? cch - i : cbMax - o;
+	 n = k -> utf16ToUTF8( &ps[i], n, pb ? &pb[o] : NULL );
+	 i += n;
+	 o += n;
+	 iRetry = NextKernelTry( i, n, &backoff );
+	 if( i == cch )
+	    break;
+      }
+
+      /*
+       * A unit that isn't a surrogate makes at most three bytes.  Given
+       * room for three bytes a unit, and one over for StoreUTF8(), the
+       * units up to the next surrogate are taken without checking.
+       */
+
+      if( ( pb != NULL ) && ( cbMax - o >= 4 ) )
+      {
+	 n = ( cbMax - o - 1 ) / 3;
+	 if( n > cch - i )
+	    n = cch - i;
+
+	 for( ; n > 0; n--, i++ )
+	 {
+	    if( ps[i] < 0x80 )
+	    {
+	       if( i >= iRetry )
+		  break;
+
+	       pb[o++] = (uint8)ps[i];
+	       continue;
+	    }
+
+	    if( ( ps[i] >= 0xD800 ) && ( ps[i] <= 0xDFFF ) )
+	       break;
+
+	    bytes = EncodeUTF8( ps[i], &cbChar );
+	    StoreUTF8( &pb[o], bytes, cbChar, 4 );
+	    o += cbChar;
+	 }
+
+	 if( ( i == cch ) || ( ( n > 0 ) && ( ps[i] < 0x80 ) ) )
+	    continue;
+      }
+
+      c = ps[i];
+      cchChar = 1;
+      if( ( c >= 0xD800 ) && ( c <= 0xDBFF ) &&
+	  ( i + 1 < cch ) && ( ps[i+1] >= 0xDC00 ) && ( ps[i+1] <= 0xDFFF ) )
+      {
+	 c = 0x10000 + ( ( c - 0xD800 ) << 10 ) + ( ps[i+1] - 0xDC00 );
+	 cchChar = 2;
+      }
+
+      bytes = EncodeUTF8( c, &cbChar );
+      if( cbChar == 0 )
+      {
+	 *pcb = o;
+	 return E_INVALIDARG;
+      }
+
+      if( cbMax - o < cbChar )
+      {
+	 *pcb = o;
+	 return S_FALSE;
+      }
+
+      if( pb != NULL )
+	 StoreUTF8( &pb[o], bytes, cbChar, cbMax - o );
+
+      i += cchChar;
+      o += cbChar;
+   }
+
+   *pcb = o;
+   return S_OK;
+}
+
+/**
+ * This function converts a Unicode string into UTF-8.
+ *
+ * @param pstr1
+ * The NULL-terminated Unicode string to convert.
+ *
+ * @param pstr2
+ * The buffer to store the UTF-8 string into.
+ *
+ * @param bufSize
+ * The size of the buffer, in bytes, including room for the terminator.
+ *
+ * @returns
+ * S_OK if the string converted correctly.  E_INVALIDARG if it holds
+ * something that isn't a Unicode character, or won't fit in the buffer;
+ * the buffer's contents are undefined in that case.
+ *
+ * @see gCoUTF8StringToUnicode
+ * @see gCoUnicodeStringDuplicateAsUTF8
+ */
+
+HRESULT gCoUnicodeStringToUTF8( wchar *pstr1, char *pstr2, uint32 bufSize )
+{
+   uint32f cb;
+
+   if( ( bufSize == 0 ) ||
+       ( gCoUCS4ToUTF8( pstr1, gCoUnicodeStringLength( pstr1 ),
+			pstr2, bufSize - 1, &cb ) != S_OK ) )
+      return E_INVALIDARG;
+
+   pstr2[ cb ] = 0;
+   return S_OK;
+}
+
+/**
+ * This function converts a UTF-8 string into a Unicode string.
+ *
+ * @param pstr1
+ * The NULL-terminated UTF-8 string to convert.
+ *
+ * @param pstr2
+ * The buffer to store the Unicode string into.
+ *
+ * @param chars
+ * The size of the buffer, in characters, including room for the
+ * terminator.
+ *
+ * @returns
+ * S_OK if the string converted correctly.  E_INVALIDARG if it isn't
+ * well-formed UTF-8, or won't fit in the buffer; the buffer's contents
+ * are undefined in that case.
+ *
+ * @see gCoUnicodeStringToUTF8
+ * @see gCoUTF8StringDuplicateAsUnicode
+ */
+
+HRESULT gCoUTF8StringToUnicode( const char *pstr1, wchar *pstr2, uint32 chars )
+{
+   uint32f cch;
+
+   if( ( chars == 0 ) ||
+       ( gCoUTF8ToUCS4( pstr1, (uint32)strlen( pstr1 ),
+			pstr2, chars - 1, &cch ) != S_OK ) )
+      return E_INVALIDARG;
+
+   pstr2[ cch ] = 0;
+   return S_OK;
+}
+
+/**
+ * This function makes a UTF-8 copy of a Unicode string.  The caller
+ * frees it with CoTaskMemFree().
+ *
+ * @param ps
+ * The NULL-terminated Unicode string to convert.
+ *
+ * @param ppd
+ * Receives the UTF-8 string.
+ *
+ * @returns
+ * S_OK if successful.  E_INVALIDARG if the string holds something that
+ * isn't a Unicode character.  E_OUTOFMEMORY if there isn't room for the
+ * copy.
+ *
+ * @see gCoUnicodeStringToUTF8
+ */
+
+HRESULT gCoUnicodeStringDuplicateAsUTF8( wchar *ps, char **ppd )
+{
+   HRESULT hr;
+   uint32 cch;
+   uint32f cb;
+
+   *ppd = NULL;
+
+   cch = gCoUnicodeStringLength( ps );
+   hr = gCoUCS4ToUTF8( ps, cch, NULL, 0, &cb );
+   if( FAILED( hr ) )
+      return hr;
+
+   *ppd = (char *)CoTaskMemAlloc( cb + 1 );
+   if( *ppd == NULL )
+      return E_OUTOFMEMORY;
+
+   gCoUCS4ToUTF8( ps, cch, *ppd, cb, &cb );
+   ( *ppd )[ cb ] = 0;
+   return S_OK;
+}
+
+/**
+ * This function makes a Unicode copy of a UTF-8 string.  The caller
+ * frees it with CoTaskMemFree().
+ *
+ * @param ps
+ * The NULL-terminated UTF-8 string to convert.
+ *
+ * @param ppd
+ * Receives the Unicode string.
+ *
+ * @returns
+ * S_OK if successful.  E_INVALIDARG if the string isn't well-formed
+ * UTF-8.  E_OUTOFMEMORY if there isn't room for the copy.
+ *
+ * @see gCoUTF8StringToUnicode
+ */
+
+HRESULT gCoUTF8StringDuplicateAsUnicode( const char *ps, wchar **ppd )
+{
+   HRESULT hr;
+   uint32 chars;
+
+   /* A UTF-8 string never has more characters than bytes */
+
+   chars = (uint32)strlen( ps ) + 1;
+   *ppd = (wchar *)CoTaskMemAlloc( chars * sizeof( wchar ) );
+   if( *ppd == NULL )
+      return E_OUTOFMEMORY;
+
+   hr = gCoUTF8StringToUnicode( ps, *ppd, chars );
+   if( FAILED( hr ) )
+   {
+      CoTaskMemFree( *ppd );
+      *ppd = NULL;
+   }
+
+   return hr;
+}
@@ -1,76 +1,179 @@
 /*
  * genuuid.c
  * Dolphin Release 0.5.0
- * 
+ *
  * Copyright (c) 1999 Samuel A. Falvo II
  * All Rights Reserved.
  *
  * This program generates UUIDs according to the method documented in the
  * IETF draft-standard on UUIDs.  Please refer to
  * draft-leach-uuids-guids-01.txt.
+ *
+ * Usage: genuuid [-1 | -4 | -7] [-n count]
+ *        genuuid -3 | -5 [-N namespace] [name ...]
+ *
+ *	-1	Time-based UUIDs (the default)
+ *	-4	Random UUIDs
+ *	-7	Time-ordered UUIDs, which sort by creation time
+ *	-n	How many to print, one per line
+ *	-3	Name-based UUIDs, using MD5
+ *	-5	Name-based UUIDs, using SHA-1
+ *	-N	Namespace for names: dns (the default), url, oid, x500, or
+ *		a UUID in braces
+ *
+ * Name-based UUIDs are made for each name on the command line, or for
+ * each line of standard input if there are none.  The same name in the
+ * same namespace always gives the same UUID.
+ *
+ * The UUIDs themselves come from gCoCreateGuids() in the GCOM library,
+ * which makes them in bulk without any locking; printing them is by far
+ * the slower part.
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
-#include <sys/time.h>
+#include <gcom/gcom.h>
 
-/* This is the offset from the time reference between gettimeofday()
- * (Jan 1 1970 UTC), and that required for UUIDs (Jan 1, 1582 UTC).
- */
+/* GUIDs made and formatted per pass */
 
-const unsigned long long time_offset = 122443488000000000LL;
+#define BATCH_SIZE	4096
 
-/* For now, we hardcode the developers Ethernet address into this node
- * structure.	In the future, we will need to fetch this either automatically
- * or via a configuration file.
- */
+static GUID guids[ BATCH_SIZE ];
+static char text[ BATCH_SIZE * MAX_GUIDSTRING_LEN ];
 
-static char node[6] = { 0x00, 0x00, 0x01, 0x13, 0x56, 0x27 };
+static void Usage( void )
+{
+	fprintf( stderr, "usage: genuuid [-1 | -4 | -7] [-n count]\n" );
+	fprintf( stderr, "       genuuid -3 | -5 [-N namespace] [name ...]\n" );
+	exit( 1 );
+}
 
-typedef struct
+/* Prints the batch of n UUIDs in guids[], one per line. */
+
+static int PrintBatch( uint32 n )
 {
-	unsigned long	time_lo;
-	unsigned short	time_mid;
-	unsigned short	time_hi;	/* and version */
-	unsigned char	clockseq_hi;	/* I'd SURE like to know why... */
-	unsigned char	clockseq_lo;	/* this is big-endian. */
-	unsigned char	node[6];
-} UUID;
+	uint32 i;
+
+	/*
+	 * Each string is followed by its terminator; turning those into
+	 * newlines lets the whole batch go out in one write.
+	 */
 
-UUID id;
+	gCoGUIDsToAsciiStrings( guids, n, text );
+	for( i = 0; i < n; i++ )
+		text[ ( i * MAX_GUIDSTRING_LEN ) + MAX_GUIDSTRING_LEN - 1 ] = '\n';
+
+	return fwrite( text, MAX_GUIDSTRING_LEN, n, stdout ) == n;
+}
 
-void main( void )
+static REFGUID ParseNamespace( const char *psz, GUID *pguid )
 {
-	int i;
-	struct timeval tv;
-	unsigned long long hugeTime;
-
-	/* Get all the required information. */
-
-	gettimeofday( &tv, NULL );
-	hugeTime = ( tv.tv_sec * 1000000LL + tv.tv_usec ) * 10LL;
-	hugeTime += time_offset;
-
-	/* Start filling out the UUID */
-	
-	id.time_lo  = (unsigned long)( hugeTime & 0x00000000FFFFFFFF );
-	id.time_mid = (unsigned short)( ( hugeTime >> 32 ) & 0x0000FFFF );
-	id.time_hi  = (unsigned short)( ( hugeTime >> 48 ) & 0x0000FFFF );
-	id.time_hi  = ( id.time_hi & 0x0FFF ) | 0x1000;	/* Sets version */
-
-	id.clockseq_hi &= 0x1F;
-	id.clockseq_hi |= 0x80;	/* Sets UUID variant */
-	
-	memcpy( &id.node[0], node, 6 );
-	
-	/* Print out the resulting UUID */
-	
-	printf
-	(
-		"{%08X-%04X-%04X-%02X%02X-%02X%02X%02X%02X%02X%02X}\n",
-		id.time_lo, id.time_mid, id.time_hi,
-		id.clockseq_hi, id.clockseq_lo,
-		id.node[0], id.node[1], id.node[2],
-		id.node[3], id.node[4], id.node[5]
-	);
+	if( strcmp( psz, "dns" ) == 0 )		return GUID_NAMESPACE_DNS;
+	if( strcmp( psz, "url" ) == 0 )		return GUID_NAMESPACE_URL;
+	if( strcmp( psz, "oid" ) == 0 )		return GUID_NAMESPACE_OID;
+	if( strcmp( psz, "x500" ) == 0 )	return GUID_NAMESPACE_X500;
+
+	if( FAILED( gCoAsciiStringToGUID( psz, pguid ) ) )
+	{
+		fprintf( stderr, "genuuid: bad namespace %s\n", psz );
+		exit( 1 );
+	}
+
+	return pguid;
+}
+
+/* Makes name-based UUIDs for the arguments, or for lines of stdin. */
+
+static int NameGuids( GUIDVERSION version, REFGUID rns, char **names, int cNames )
+{
+	char *line = NULL;
+	size_t cbLine = 0;
+	ssize_t cb;
+	uint32 n = 0;
+
+	if( cNames > 0 )
+	{
+		for( ; cNames > 0; cNames--, names++ )
+		{
+			gCoCreateNameGuid( version, rns, *names, (uint32)strlen( *names ), &guids[ n++ ] );
+			if( n == BATCH_SIZE )
+			{
+				if( !PrintBatch( n ) )
+					return 1;
+				n = 0;
+			}
+		}
+	}
+	else
+	{
+		while( ( cb = getline( &line, &cbLine, stdin ) ) >= 0 )
+		{
+			if( cb > 0 && line[ cb - 1 ] == '\n' )
+				cb--;
+
+			gCoCreateNameGuid( version, rns, line, (uint32)cb, &guids[ n++ ] );
+			if( n == BATCH_SIZE )
+			{
+				if( !PrintBatch( n ) )
+					return 1;
+				n = 0;
+			}
+		}
+		free( line );
+	}
+
+	return ( n > 0 && !PrintBatch( n ) ) ? 1 : 0;
+}
+
+int main( int argc, char *argv[] )
+{
+	GUIDVERSION version = GUIDVERSION_TIME;
+	unsigned long long count = 1, n;
+	const char *pszNamespace = "dns";
+	GUID ns;
+	HRESULT hr;
+	int opt;
+
+	while( ( opt = getopt( argc, argv, "13457n:N:" ) ) != -1 )
+	{
+		switch( opt )
+		{
+			case '1':	version = GUIDVERSION_TIME;	break;
+			case '3':	version = GUIDVERSION_MD5;	break;
+			case '4':	version = GUIDVERSION_RANDOM;	break;
+			case '5':	version = GUIDVERSION_SHA1;	break;
+			case '7':	version = GUIDVERSION_SORTABLE;	break;
+			case 'n':	count = strtoull( optarg, NULL, 0 );	break;
+			case 'N':	pszNamespace = optarg;		break;
+			default:	Usage();
+		}
+	}
+
+	if( version == GUIDVERSION_MD5 || version == GUIDVERSION_SHA1 )
+		return NameGuids( version, ParseNamespace( pszNamespace, &ns ),
+				  &argv[ optind ], argc - optind );
+
+	if( optind != argc )
+		Usage();
+
+	while( count > 0 )
+	{
+		n = ( count < BATCH_SIZE ) ? count : BATCH_SIZE;
+
+		hr = gCoCreateGuids( version, guids, (uint32)n );
+		if( FAILED( hr ) )
+		{
+			fprintf( stderr, "genuuid: can't make UUIDs (%08X)\n", hr );
+			return 1;
+		}
+
+		if( !PrintBatch( (uint32)n ) )
+			return 1;
+
+		count -= n;
+	}
+
+	return 0;
 }
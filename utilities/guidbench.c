@@ -0,0 +1,253 @@
+/*
+ * guidbench.c
+ * GCOM Release 0.4
+ *
+ * Copyright (c) 1999, 2000 Samuel A. Falvo II
+ * All Rights Reserved.
+ *
+ * This program times GCOM's GUID text conversions against the way
+ * gCoGUIDToString() and gCoStringToGUID() worked up to GCOM 0.3:
+ * sprintf() into a char buffer, then mbstowcs() to Unicode; and back
+ * again through wcstombs(), an isxdigit() check of every digit, and
+ * strtoul().
+ *
+ * Usage: guidbench [-n count] [-r rounds]
+ *
+ *	-n	How many GUIDs to convert per round (default 10000)
+ *	-r	How many rounds to time (default 100)
+ *
+ * The results are in millions of GUIDs per second.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <wchar.h>
+#include <unistd.h>
+#include <gcom/gcom.h>
+
+static double Now( void )
+{
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec + ( ts.tv_nsec / 1e9 );
+}
+
+static void MakeGUIDs( GUID *pg, uint32 count )
+{
+	uint8 *pb = (uint8 *)pg;
+	uint32 i;
+
+	for( i = 0; i < count * sizeof( GUID ); i++ )
+		pb[i] = rand() & 0xFF;
+}
+
+/* The GCOM 0.3 conversions, for comparison */
+
+static void OldToAsciiString( const GUID *pg, char *pd )
+{
+	sprintf( pd, "{%08X-%04X-%04X-%02X%02X-%02X%02X%02X%02X%02X%02X}",
+		 (unsigned)pg -> Data1, pg -> Data2, pg -> Data3,
+		 pg -> Data4[0], pg -> Data4[1], pg -> Data4[2],
+		 pg -> Data4[3], pg -> Data4[4], pg -> Data4[5],
+		 pg -> Data4[6], pg -> Data4[7] );
+}
+
+static void OldToString( const GUID *pg, wchar *pd )
+{
+	char ascii[ MAX_GUIDSTRING_LEN ];
+
+	OldToAsciiString( pg, ascii );
+	memset( pd, 0, MAX_GUIDSTRING_LEN * sizeof( wchar ) );
+	mbstowcs( (wchar_t *)pd, ascii, MAX_GUIDSTRING_LEN );
+}
+
+static uint8 OldByte( const char *ps )
+{
+	char digits[3];
+
+	digits[0] = ps[0];
+	digits[1] = ps[1];
+	digits[2] = 0;
+	return (uint8)strtoul( digits, NULL, 16 );
+}
+
+static int OldFromAsciiString( const char *ps, GUID *pg )
+{
+	char ascii[ MAX_GUIDSTRING_LEN ];
+	int i;
+
+	strncpy( ascii, ps, MAX_GUIDSTRING_LEN - 1 );
+	ascii[ MAX_GUIDSTRING_LEN - 1 ] = 0;
+	memset( pg, 0, sizeof( GUID ) );
+
+	if( ascii[0] != '{' || ascii[9] != '-' || ascii[14] != '-' ||
+	    ascii[19] != '-' || ascii[24] != '-' || ascii[37] != '}' )
+		return 0;
+
+	for( i = 1; i < 37; i++ )
+		if( i != 9 && i != 14 && i != 19 && i != 24 &&
+		    !isxdigit( (unsigned char)ascii[i] ) )
+			return 0;
+
+	ascii[9] = ascii[14] = ascii[19] = ascii[24] = ascii[37] = 0;
+
+	pg -> Data1 = strtoul( &ascii[1], NULL, 16 );
+	pg -> Data2 = strtoul( &ascii[10], NULL, 16 );
+	pg -> Data3 = strtoul( &ascii[15], NULL, 16 );
+	pg -> Data4[0] = OldByte( &ascii[20] );
+	pg -> Data4[1] = OldByte( &ascii[22] );
+	for( i = 0; i < 6; i++ )
+		pg -> Data4[i+2] = OldByte( &ascii[ 25 + ( i * 2 ) ] );
+
+	return 1;
+}
+
+static int OldFromString( wchar *ps, GUID *pg )
+{
+	char ascii[ MAX_GUIDSTRING_LEN ];
+
+	memset( ascii, 0, MAX_GUIDSTRING_LEN );
+	wcstombs( ascii, (wchar_t *)ps, MAX_GUIDSTRING_LEN );
+	return OldFromAsciiString( ascii, pg );
+}
+
+static void Report( const char *what, double seconds, double guids )
+{
+	printf( "  %-28s %9.2f M/s\n", what, guids / seconds / 1e6 );
+}
+
+static int Check( const char *what, const GUID *pa, const GUID *pb, uint32 count )
+{
+	if( memcmp( pa, pb, count * sizeof( GUID ) ) == 0 )
+		return 1;
+
+	fprintf( stderr, "guidbench: %s round trip failed\n", what );
+	return 0;
+}
+
+int main( int argc, char *argv[] )
+{
+	uint32 count = 10000, rounds = 100, i, r;
+	GUID *pg, *pr;
+	wchar *pw;
+	char *pc;
+	double start, guids;
+	int opt;
+
+	while( ( opt = getopt( argc, argv, "n:r:" ) ) != -1 )
+	{
+		switch( opt )
+		{
+			case 'n':	count = strtoul( optarg, NULL, 0 );	break;
+			case 'r':	rounds = strtoul( optarg, NULL, 0 );	break;
+			default:
+				fprintf( stderr, "usage: guidbench [-n count] [-r rounds]\n" );
+				return 1;
+		}
+	}
+
+	pg = malloc( count * sizeof( GUID ) );
+	pr = malloc( count * sizeof( GUID ) );
+	pw = malloc( count * MAX_GUIDSTRING_LEN * sizeof( wchar ) );
+	pc = malloc( count * MAX_GUIDSTRING_LEN );
+	if( !pg || !pr || !pw || !pc )
+		return 1;
+
+	MakeGUIDs( pg, count );
+	guids = (double)count * rounds;
+
+	printf( "Formatting (%u GUIDs, %u rounds)\n", (unsigned)count, (unsigned)rounds );
+
+	start = Now();
+	for( r = 0; r < rounds; r++ )
+		for( i = 0; i < count; i++ )
+			OldToString( &pg[i], pw + i * MAX_GUIDSTRING_LEN );
+	Report( "sprintf+mbstowcs (0.3)", Now() - start, guids );
+
+	start = Now();
+	for( r = 0; r < rounds; r++ )
+		for( i = 0; i < count; i++ )
+			gCoGUIDToString( &pg[i], pw + i * MAX_GUIDSTRING_LEN );
+	Report( "gCoGUIDToString", Now() - start, guids );
+
+	start = Now();
+	for( r = 0; r < rounds; r++ )
+		gCoGUIDsToStrings( pg, count, pw );
+	Report( "gCoGUIDsToStrings", Now() - start, guids );
+
+	start = Now();
+	for( r = 0; r < rounds; r++ )
+		for( i = 0; i < count; i++ )
+			OldToAsciiString( &pg[i], pc + i * MAX_GUIDSTRING_LEN );
+	Report( "sprintf (0.3)", Now() - start, guids );
+
+	start = Now();
+	for( r = 0; r < rounds; r++ )
+		for( i = 0; i < count; i++ )
+			gCoGUIDToAsciiString( &pg[i], pc + i * MAX_GUIDSTRING_LEN );
+	Report( "gCoGUIDToAsciiString", Now() - start, guids );
+
+	start = Now();
+	for( r = 0; r < rounds; r++ )
+		gCoGUIDsToAsciiStrings( pg, count, pc );
+	Report( "gCoGUIDsToAsciiStrings", Now() - start, guids );
+
+	printf( "Parsing (%u GUIDs, %u rounds)\n", (unsigned)count, (unsigned)rounds );
+
+	start = Now();
+	for( r = 0; r < rounds; r++ )
+		for( i = 0; i < count; i++ )
+			OldFromString( pw + i * MAX_GUIDSTRING_LEN, &pr[i] );
+	Report( "wcstombs+strtoul (0.3)", Now() - start, guids );
+	if( !Check( "wcstombs+strtoul", pg, pr, count ) )
+		return 1;
+
+	memset( pr, 0, count * sizeof( GUID ) );
+	start = Now();
+	for( r = 0; r < rounds; r++ )
+		for( i = 0; i < count; i++ )
+			gCoStringToGUID( pw + i * MAX_GUIDSTRING_LEN, &pr[i] );
+	Report( "gCoStringToGUID", Now() - start, guids );
+	if( !Check( "gCoStringToGUID", pg, pr, count ) )
+		return 1;
+
+	memset( pr, 0, count * sizeof( GUID ) );
+	start = Now();
+	for( r = 0; r < rounds; r++ )
+		gCoStringsToGUIDs( pw, count, pr );
+	Report( "gCoStringsToGUIDs", Now() - start, guids );
+	if( !Check( "gCoStringsToGUIDs", pg, pr, count ) )
+		return 1;
+
+	memset( pr, 0, count * sizeof( GUID ) );
+	start = Now();
+	for( r = 0; r < rounds; r++ )
+		for( i = 0; i < count; i++ )
+			OldFromAsciiString( pc + i * MAX_GUIDSTRING_LEN, &pr[i] );
+	Report( "strtoul (0.3)", Now() - start, guids );
+	if( !Check( "strtoul", pg, pr, count ) )
+		return 1;
+
+	memset( pr, 0, count * sizeof( GUID ) );
+	start = Now();
+	for( r = 0; r < rounds; r++ )
+		for( i = 0; i < count; i++ )
+			gCoAsciiStringToGUID( pc + i * MAX_GUIDSTRING_LEN, &pr[i] );
+	Report( "gCoAsciiStringToGUID", Now() - start, guids );
+	if( !Check( "gCoAsciiStringToGUID", pg, pr, count ) )
+		return 1;
+
+	memset( pr, 0, count * sizeof( GUID ) );
+	start = Now();
+	for( r = 0; r < rounds; r++ )
+		gCoAsciiStringsToGUIDs( pc, count, pr );
+	Report( "gCoAsciiStringsToGUIDs", Now() - start, guids );
+	if( !Check( "gCoAsciiStringsToGUIDs", pg, pr, count ) )
+		return 1;
+
+	return 0;
+}
@@ -0,0 +1,173 @@
+/*
+ * unibench.c
+ * GCOM Release 0.4
+ *
+ * Copyright (c) 1999, 2000 Samuel A. Falvo II
+ * All Rights Reserved.
+ *
+ * This program times GCOM's string conversions against the C library's
+ * wcstombs() and mbstowcs(), which is how gCoUnicodeStringToAscii() and
+ * gCoAsciiStringToUnicode() worked up to GCOM 0.3: clear the whole
+ * output buffer, then convert according to the locale.
+ *
+ * Usage: unibench [-n iterations] [-s length]
+ *
+ *	-n	How many times to convert each string (default 2000)
+ *	-s	Length of each string in characters (default 4096)
+ *
+ * Each string is converted from Unicode to UTF-8 and back; the results
+ * are in megabytes of UTF-8 per second.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <locale.h>
+#include <time.h>
+#include <wchar.h>
+#include <unistd.h>
+#include <gcom/gcom.h>
+
+typedef struct
+{
+	const char *	name;
+	wchar		first;		/* Characters are taken from here... */
+	wchar		count;		/* ...and the next count-1 */
+	int		asciiPercent;	/* Chance of plain ASCII instead */
+} TEXT;
+
+static const TEXT texts[] =
+{
+	{ "ASCII",	0x20,	0x5F,	100 },
+	{ "Latin-1",	0xA0,	0x60,	80 },
+	{ "Cyrillic",	0x410,	0x40,	15 },
+	{ "CJK",	0x4E00,	0x5000,	5 },
+	{ "Emoji",	0x1F600, 0x50,	50 },
+};
+
+static double Now( void )
+{
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec + ( ts.tv_nsec / 1e9 );
+}
+
+static void MakeText( const TEXT *pt, wchar *ps, uint32 cch )
+{
+	uint32 i;
+
+	for( i = 0; i < cch; i++ )
+	{
+		if( ( rand() % 100 ) < pt -> asciiPercent )
+			ps[i] = 0x20 + ( rand() % 0x5F );
+		else
+			ps[i] = pt -> first + ( rand() % pt -> count );
+	}
+
+	ps[ cch ] = 0;
+}
+
+/* The GCOM 0.3 conversions, for comparison */
+
+static void OldToAscii( wchar *ps, char *pd, uint32 bufSize )
+{
+	memset( pd, 0, bufSize );
+	wcstombs( pd, (wchar_t *)ps, bufSize );
+}
+
+static void OldToUnicode( char *ps, wchar *pd, uint32 chars )
+{
+	memset( pd, 0, chars * sizeof( wchar ) );
+	mbstowcs( (wchar_t *)pd, ps, chars );
+}
+
+static void Report( const char *what, double seconds, double bytes )
+{
+	printf( "  %-28s %9.1f MB/s\n", what, bytes / seconds / 1e6 );
+}
+
+int main( int argc, char *argv[] )
+{
+	uint32 cch = 4096, iterations = 2000, i, t;
+	uint32f cbUTF8, cb;
+	wchar *ps, *pw;
+	char *pb;
+	double start, bytes;
+	int opt;
+
+	while( ( opt = getopt( argc, argv, "n:s:" ) ) != -1 )
+	{
+		switch( opt )
+		{
+			case 'n':	iterations = strtoul( optarg, NULL, 0 );	break;
+			case 's':	cch = strtoul( optarg, NULL, 0 );	break;
+			default:
+				fprintf( stderr, "usage: unibench [-n iterations] [-s length]\n" );
+				return 1;
+		}
+	}
+
+	if( setlocale( LC_CTYPE, "C.UTF-8" ) == NULL &&
+	    setlocale( LC_CTYPE, "en_US.UTF-8" ) == NULL )
+	{
+		fprintf( stderr, "unibench: no UTF-8 locale for the C library\n" );
+		return 1;
+	}
+
+	ps = malloc( ( cch + 1 ) * sizeof( wchar ) );
+	pw = malloc( ( cch + 1 ) * sizeof( wchar ) );
+	pb = malloc( ( cch * 4 ) + 1 );
+	if( !ps || !pw || !pb )
+		return 1;
+
+	for( t = 0; t < sizeof( texts ) / sizeof( texts[0] ); t++ )
+	{
+		MakeText( &texts[t], ps, cch );
+		gCoUCS4ToUTF8( ps, cch, NULL, 0, &cbUTF8 );
+		bytes = (double)cbUTF8 * iterations;
+
+		printf( "%s (%u characters, %u bytes of UTF-8)\n",
+			texts[t].name, (unsigned)cch, (unsigned)cbUTF8 );
+
+		start = Now();
+		for( i = 0; i < iterations; i++ )
+			OldToAscii( ps, pb, ( cch * 4 ) + 1 );
+		Report( "wcstombs (0.3)", Now() - start, bytes );
+
+		start = Now();
+		for( i = 0; i < iterations; i++ )
+			gCoUnicodeStringToAscii( ps, pb, ( cch * 4 ) + 1 );
+		Report( "gCoUnicodeStringToAscii", Now() - start, bytes );
+
+		start = Now();
+		for( i = 0; i < iterations; i++ )
+			gCoUCS4ToUTF8( ps, cch, pb, cch * 4, &cb );
+		Report( "gCoUCS4ToUTF8", Now() - start, bytes );
+
+		pb[ cbUTF8 ] = 0;
+
+		start = Now();
+		for( i = 0; i < iterations; i++ )
+			OldToUnicode( pb, pw, cch + 1 );
+		Report( "mbstowcs (0.3)", Now() - start, bytes );
+
+		start = Now();
+		for( i = 0; i < iterations; i++ )
+			gCoAsciiStringToUnicode( pb, pw, cch + 1 );
+		Report( "gCoAsciiStringToUnicode", Now() - start, bytes );
+
+		start = Now();
+		for( i = 0; i < iterations; i++ )
+			gCoUTF8ToUCS4( pb, cbUTF8, pw, cch, &cb );
+		Report( "gCoUTF8ToUCS4", Now() - start, bytes );
+
+		if( memcmp( ps, pw, cch * sizeof( wchar ) ) != 0 )
+		{
+			fprintf( stderr, "unibench: round trip failed\n" );
+			return 1;
+		}
+	}
+
+	return 0;
+}